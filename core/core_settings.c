@@ -18,6 +18,7 @@
 #define DEFAULT_DNS_LOG_FILE           "dns.json"
 #define DEFAULT_DNS_ENABLE_CONSOLE     true
 #define DEFAULT_RAM_PROFILE            kRamProfileServer
+#define DEFAULT_BUFFER_SLAB_LIMIT_MB   64
 
 enum settings_ram_profiles
 {
@@ -177,6 +178,22 @@ static void parseMiscPartOfJson(cJSON *misc_obj)
             settings->workers_count = get_ncpu();
         }
 
+        getIntFromJsonObjectOrDefault(&(settings->memory_soft_limit_mb), misc_obj, "memory-soft-limit", 0);
+        getIntFromJsonObjectOrDefault(&(settings->memory_hard_limit_mb), misc_obj, "memory-hard-limit", 0);
+        if (settings->memory_soft_limit_mb < 0 || settings->memory_hard_limit_mb < 0)
+        {
+            fprintf(stderr, "CoreSettings: memory-soft-limit and memory-hard-limit are megabytes, 0 disables them\n");
+            exit(1);
+        }
+
+        getIntFromJsonObjectOrDefault(&(settings->buffer_slab_limit_mb), misc_obj, "buffer-slab-limit",
+                                      DEFAULT_BUFFER_SLAB_LIMIT_MB);
+        if (settings->buffer_slab_limit_mb < 0)
+        {
+            fprintf(stderr, "CoreSettings: buffer-slab-limit is megabytes, 0 disables the buffer slab\n");
+            exit(1);
+        }
+
         const cJSON *json_ram_profile = cJSON_GetObjectItemCaseSensitive(misc_obj, "ram-profile");
         if (cJSON_IsNumber(json_ram_profile))
         {
@@ -250,6 +267,7 @@ static void parseMiscPartOfJson(cJSON *misc_obj)
     {
         settings->libs_path = strdup(DEFAULT_LIBS_PATH);
         settings->workers_count = get_ncpu();
+        settings->buffer_slab_limit_mb = DEFAULT_BUFFER_SLAB_LIMIT_MB;
         printf("misc block unspecified in json, using defaults. cpu cores: %d\n", settings->workers_count);
     }
 }
@@ -26,6 +26,9 @@ struct core_settings_s
 
     int   workers_count;
     int   ram_profile;
+    int   memory_soft_limit_mb;
+    int   memory_hard_limit_mb;
+    int   buffer_slab_limit_mb;
     char *libs_path;
 
     vec_config_path_t config_paths;
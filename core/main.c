@@ -1,4 +1,5 @@
 #include "config_file.h"
+#include "config_image.h"
 #include "core_settings.h"
 #include "hbase.h"
 #include "loggers/core_logger.h"
@@ -10,7 +11,53 @@
 #include "utils/stringutils.h"
 #include "ww.h"
 
-int main(void)
+// Waterwall --compile <config.json> [output]
+static int compileMain(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s --compile <config.json> [output]\n", argv[0]);
+        return 1;
+    }
+
+    hv_mkdir_p("log");
+    createCoreLogger("log/compile.log", true);
+    setCoreLoggerLevelByStr("INFO");
+    loadStaticTunnelsIntoCore();
+
+    const char *in_path  = argv[2];
+    const char *out_path = argv[3];
+    char       *derived  = NULL;
+
+    if (argc < 4)
+    {
+        // config.json -> config.wwc
+        const char *ext  = strrchr(in_path, '.');
+        size_t      base = (ext != NULL && strcmp(ext, ".json") == 0) ? (size_t) (ext - in_path) : strlen(in_path);
+        derived          = globalMalloc(base + sizeof(".wwc"));
+        memcpy(derived, in_path, base);
+        strcpy(derived + base, ".wwc");
+        out_path = derived;
+    }
+
+    // both exit on errors, the same node and graph checks as a normal startup
+    config_file_t *cfile = parseConfigFile(in_path);
+    checkConfigFile(cfile);
+
+    bool result = compileConfigFile(cfile, out_path);
+    if (result)
+    {
+        LOGI("Core: config \"%s\" compiled into \"%s\"", in_path, out_path);
+    }
+    destroyConfigFile(cfile);
+    if (derived != NULL)
+    {
+        globalFree(derived);
+    }
+    return result ? 0 : 1;
+}
+
+int main(int argc, char **argv)
 {
     // check address sanitizer works properly
     // int test[3] = {0};
@@ -18,6 +65,11 @@ int main(void)
 
     initHeap();
 
+    if (argc > 1 && strcmp(argv[1], "--compile") == 0)
+    {
+        return compileMain(argc, argv);
+    }
+
     static const char *core_file_name    = "core.json";
     char              *core_file_content = readFile(core_file_name);
 
@@ -38,6 +90,9 @@ int main(void)
     ww_construction_data_t runtime_data = {
         .workers_count       = getCoreSettings()->workers_count,
         .ram_profile         = getCoreSettings()->ram_profile,
+        .memory_soft_limit   = (size_t) getCoreSettings()->memory_soft_limit_mb << 20,
+        .memory_hard_limit   = (size_t) getCoreSettings()->memory_hard_limit_mb << 20,
+        .buffer_slab_limit   = (size_t) getCoreSettings()->buffer_slab_limit_mb << 20,
         .core_logger_data    = (logger_construction_data_t) {.log_file_path = getCoreSettings()->core_log_file_fullpath,
                                                              .log_level     = getCoreSettings()->core_log_level,
                                                              .log_console   = getCoreSettings()->core_log_console},
@@ -62,7 +117,8 @@ int main(void)
         c_foreach(k, vec_config_path_t, getCoreSettings()->config_paths)
         {
             LOGD("Core: begin parsing config file \"%s\"", *k.ref);
-            config_file_t *cfile = parseConfigFile(*k.ref);
+            config_file_t *cfile =
+                isConfigImageFile(*k.ref) ? loadConfigImage(*k.ref) : parseConfigFile(*k.ref);
 
             /*
                 in case of error in config file, the details is already printed out and the
@@ -17,6 +17,22 @@
         LOGD("Imported static tunnel lib%-20s  hash:%lx", #x, h);                                                      \
     } while (0);
 
+// same as USING for libraries that pre-parse their settings into a config image, see compileHandle
+#define USING_COMPILED(x)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        hash_t h = CALC_HASH_BYTES(#x, strlen(#x));                                                                    \
+        registerStaticLib((tunnel_lib_t) {                                                                             \
+            .hash_name         = h,                                                                                    \
+            .createHandle      = new##x,                                                                               \
+            .destroyHandle     = destroy##x,                                                                           \
+            .apiHandle         = api##x,                                                                               \
+            .getMetadataHandle = getMetadata##x,                                                                       \
+            .compileHandle     = compile##x,                                                                           \
+        });                                                                                                            \
+        LOGD("Imported static tunnel lib%-20s  hash:%lx", #x, h);                                                      \
+    } while (0);
+
 #ifdef INCLUDE_TUNDEVICE
 #include "tunnels/adapters/device/tun/tun_device.h"
 #endif
@@ -29,6 +45,10 @@
 #include "tunnels/adapters/device/capture/caputre_device.h"
 #endif
 
+#ifdef INCLUDE_XDPDEVICE
+#include "tunnels/adapters/device/xdp/xdp_device.h"
+#endif
+
 #ifdef INCLUDE_LAYER3_RECEIVER
 #include "tunnels/layer3/receiver/receiver.h"
 #endif
@@ -54,6 +74,10 @@
 #include "tunnels/layer3/tcp/manipulator/tcp_manipulator.h"
 #endif
 
+#ifdef INCLUDE_LAYER3_TERMINATOR
+#include "tunnels/layer3/terminator/terminator.h"
+#endif
+
 #ifdef INCLUDE_TCP_LISTENER
 #include "tunnels/adapters/listener/tcp/tcp_listener.h"
 #endif
@@ -186,6 +210,14 @@
 #include "tunnels/client/mux/mux_client.h"
 #endif
 
+#ifdef INCLUDE_RATE_LIMITER
+#include "tunnels/ratelimiter/rate_limiter.h"
+#endif
+
+#ifdef INCLUDE_WIREGUARD
+#include "tunnels/client/wireguard/wireguard_client.h"
+#endif
+
 void loadStaticTunnelsIntoCore(void)
 {
 
@@ -201,6 +233,10 @@ void loadStaticTunnelsIntoCore(void)
     USING(CaptureDevice);
 #endif
 
+#ifdef INCLUDE_XDPDEVICE
+    USING(XdpDevice);
+#endif
+
 #ifdef INCLUDE_LAYER3_RECEIVER
     USING(Layer3Receiver);
 #endif
@@ -225,12 +261,16 @@ void loadStaticTunnelsIntoCore(void)
     USING(Layer3TcpManipulator);
 #endif
 
+#ifdef INCLUDE_LAYER3_TERMINATOR
+    USING(Layer3Terminator);
+#endif
+
 #ifdef INCLUDE_TCP_LISTENER
-    USING(TcpListener);
+    USING_COMPILED(TcpListener);
 #endif
 
 #ifdef INCLUDE_UDP_LISTENER
-    USING(UdpListener);
+    USING_COMPILED(UdpListener);
 #endif
 
 #ifdef INCLUDE_LISTENER
@@ -250,7 +290,7 @@ void loadStaticTunnelsIntoCore(void)
 #endif
 
 #ifdef INCLUDE_TROJAN_AUTH_SERVER
-    USING(TrojanAuthServer);
+    USING_COMPILED(TrojanAuthServer);
 #endif
 
 #ifdef INCLUDE_TROJAN_SOCKS_SERVER
@@ -356,4 +396,12 @@ void loadStaticTunnelsIntoCore(void)
 #ifdef INCLUDE_MUX_CLIENT
     USING(MuxServer);
 #endif
+
+#ifdef INCLUDE_RATE_LIMITER
+    USING(RateLimiter);
+#endif
+
+#ifdef INCLUDE_WIREGUARD
+    USING(WireGuard);
+#endif
 }
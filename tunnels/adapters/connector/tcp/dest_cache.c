@@ -0,0 +1,78 @@
+#include "dest_cache.h"
+#include "utils/hashutils.h"
+#include "utils/mathutils.h"
+#include "utils/sockutils.h"
+
+enum
+{
+    kDestCacheSize     = 256, // power of 2
+    kDestCacheTtlMs    = 10 * 60 * 1000,
+    kMinAttemptDelayMs = 100,
+    kMaxAttemptDelayMs = 2000
+};
+
+typedef struct dest_cache_entry_s
+{
+    hash_t     hash;
+    sockaddr_u addr;
+    uint64_t   last_ms;
+    uint32_t   rtt_ms;
+
+} dest_cache_entry_t;
+
+struct dest_cache_s
+{
+    dest_cache_entry_t entries[kDestCacheSize];
+};
+
+static hash_t destHash(const socket_context_t *dest)
+{
+    const hash_t hash = CALC_HASH_BYTES(dest->domain, dest->domain_len);
+    return hash ^ sockaddr_port((sockaddr_u *) &(dest->address));
+}
+
+dest_cache_t *newDestCache(void)
+{
+    dest_cache_t *cache = globalMalloc(sizeof(dest_cache_t));
+    memset(cache, 0, sizeof(dest_cache_t));
+    return cache;
+}
+
+void destroyDestCache(dest_cache_t *cache)
+{
+    globalFree(cache);
+}
+
+uint32_t orderByDestCache(dest_cache_t *cache, const socket_context_t *dest, sockaddr_u *addrs, unsigned int len,
+                          uint64_t now_ms)
+{
+    const hash_t        hash  = destHash(dest);
+    dest_cache_entry_t *entry = &(cache->entries[hash & (kDestCacheSize - 1)]);
+
+    if (entry->hash != hash || entry->last_ms == 0 || entry->last_ms + kDestCacheTtlMs < now_ms)
+    {
+        return kConnectAttemptDelayMs;
+    }
+
+    // the dns answer may have changed, the remembered address is only used while it is still in it
+    for (unsigned int i = 0; i < len; i++)
+    {
+        if (sockAddrCmpIP(&addrs[i], &(entry->addr)))
+        {
+            const sockaddr_u winner = addrs[i];
+            memmove(&addrs[1], &addrs[0], sizeof(sockaddr_u) * i);
+            addrs[0] = winner;
+            return max(kMinAttemptDelayMs, min(kMaxAttemptDelayMs, entry->rtt_ms * 2));
+        }
+    }
+    return kConnectAttemptDelayMs;
+}
+
+void rememberDest(dest_cache_t *cache, const socket_context_t *dest, const sockaddr_u *addr, uint32_t rtt_ms,
+                  uint64_t now_ms)
+{
+    const hash_t        hash  = destHash(dest);
+    dest_cache_entry_t *entry = &(cache->entries[hash & (kDestCacheSize - 1)]);
+
+    *entry = (dest_cache_entry_t) {.hash = hash, .addr = *addr, .last_ms = now_ms, .rtt_ms = rtt_ms};
+}
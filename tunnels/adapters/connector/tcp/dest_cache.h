@@ -0,0 +1,20 @@
+#pragma once
+#include "api.h"
+#include "types.h"
+
+/*
+    remembers which address of a domain connected first and how long it took, one small table per worker
+
+    later lines to the same domain and port try that address first and wait about 2 of its round trips
+    before racing the next one, so a dead route is skipped right away and a healthy one is not raced
+*/
+
+dest_cache_t *newDestCache(void);
+void          destroyDestCache(dest_cache_t *cache);
+
+// moves the remembered address to the front, returns the delay before the next address is tried
+uint32_t orderByDestCache(dest_cache_t *cache, const socket_context_t *dest, sockaddr_u *addrs, unsigned int len,
+                          uint64_t now_ms);
+
+void rememberDest(dest_cache_t *cache, const socket_context_t *dest, const sockaddr_u *addr, uint32_t rtt_ms,
+                  uint64_t now_ms);
@@ -1,6 +1,7 @@
 
 #include "tcp_connector.h"
 #include "basic_types.h"
+#include "dest_cache.h"
 #include "frand.h"
 #include "freebind.h"
 #include "hsocket.h"
@@ -12,8 +13,34 @@
 #include "utils/mathutils.h"
 #include "utils/sockutils.h"
 
+// closes the racing connects except keep (all of them when keep is NULL)
+static void stopAttempts(tcp_connector_con_state_t *cstate, hio_t *keep)
+{
+    if (cstate->attempt_timer)
+    {
+        htimer_del(cstate->attempt_timer);
+        cstate->attempt_timer = NULL;
+    }
+    for (unsigned int i = 0; i < cstate->addresses_len; i++)
+    {
+        if (cstate->attempts[i] != NULL && cstate->attempts[i] != keep)
+        {
+            hevent_set_userdata(cstate->attempts[i], NULL);
+            hio_close(cstate->attempts[i]);
+        }
+        cstate->attempts[i] = NULL;
+    }
+    cstate->attempts_inflight = 0;
+}
+
 static void cleanup(tcp_connector_con_state_t *cstate, bool flush_queue)
 {
+    stopAttempts(cstate, NULL);
+    if (cstate->fast_open_timer)
+    {
+        htimer_del(cstate->fast_open_timer);
+        cstate->fast_open_timer = NULL;
+    }
     if (cstate->io)
     {
         hevent_set_userdata(cstate->io, NULL);
@@ -51,11 +78,24 @@ static bool resumeWriteQueue(tcp_connector_con_state_t *cstate)
     hio_t           *io         = cstate->io;
     while (contextQueueLen(data_queue) > 0)
     {
-        context_t *cw     = contextQueuePop(data_queue);
-        int        bytes  = (int) bufLen(cw->payload);
-        int        nwrite = hio_write(io, cw->payload);
+        context_t      *cw  = contextQueuePop(data_queue);
+        shift_buffer_t *buf = cw->payload;
         dropContexPayload(cw);
         destroyContext(cw);
+
+        // small payloads that piled up (mostly while connecting) go out in one write, copying big ones costs more
+        // than the extra write
+        while (contextQueueLen(data_queue) > 0 && bufLen(buf) < kCoalesceThreshold &&
+               bufLen(contextQueuePeek(data_queue)->payload) < kCoalesceThreshold)
+        {
+            cw  = contextQueuePop(data_queue);
+            buf = appendBufferMerge(cstate->buffer_pool, buf, cw->payload);
+            dropContexPayload(cw);
+            destroyContext(cw);
+        }
+
+        int bytes  = (int) bufLen(buf);
+        int nwrite = hio_write(io, buf);
         if (nwrite >= 0 && nwrite < bytes)
         {
             return false; // write pending
@@ -105,10 +145,126 @@ static void onRecv(hio_t *io, shift_buffer_t *buf)
     self->downStream(self, context);
 }
 
+static void onOutBoundConnected(hio_t *upstream_io);
+static void onClose(hio_t *io);
+static void onAttemptDelay(htimer_t *timer);
+
+// a socket with the options of this node, not connected yet
+static hio_t *newConnectIo(tcp_connector_con_state_t *cstate, sockaddr_u *addr)
+{
+    tcp_connector_state_t *state  = TSTATE(cstate->tunnel);
+    hloop_t               *loop   = getWorkerLoop(cstate->line->tid);
+    int                    sockfd = socket(addr->sa.sa_family, SOCK_STREAM, 0);
+
+    if (sockfd < 0)
+    {
+        LOGE("TcpConnector: socket fd < 0");
+        return NULL;
+    }
+
+    if (state->tcp_no_delay)
+    {
+        tcp_nodelay(sockfd, 1);
+    }
+
+#ifdef OS_LINUX
+    if (state->fwmark != kFwMarkInvalid)
+    {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_MARK, &state->fwmark, sizeof(state->fwmark)) < 0)
+        {
+            LOGE("TcpConnector: setsockopt SO_MARK error");
+            closesocket(sockfd);
+            return NULL;
+        }
+    }
+#endif
+
+    hio_t *io = hio_get(loop, sockfd);
+    assert(io != NULL);
+
+    hio_set_peeraddr(io, &(addr->sa), (int) sockaddr_len(addr));
+    hevent_set_userdata(io, cstate);
+    hio_setcb_connect(io, onOutBoundConnected);
+    hio_setcb_close(io, onClose);
+    return io;
+}
+
+// starts a connect to the next address, returns false when every address has been started
+static bool startNextAttempt(tcp_connector_con_state_t *cstate)
+{
+    hloop_t *loop = getWorkerLoop(cstate->line->tid);
+
+    while (cstate->next_address < cstate->addresses_len)
+    {
+        const unsigned int index = cstate->next_address++;
+        hio_t             *io    = newConnectIo(cstate, &(cstate->addresses[index]));
+        if (io == NULL)
+        {
+            continue;
+        }
+        cstate->attempts[index]          = io;
+        cstate->attempts_start_ms[index] = hloop_now_ms(loop);
+        cstate->attempts_inflight += 1;
+
+        if (cstate->next_address < cstate->addresses_len)
+        {
+            cstate->attempt_timer = htimer_add(loop, onAttemptDelay, cstate->attempt_delay_ms, 1);
+            hevent_set_userdata(cstate->attempt_timer, cstate);
+        }
+        hio_connect(io);
+        return true;
+    }
+    return false;
+}
+
+static void onAttemptDelay(htimer_t *timer)
+{
+    tcp_connector_con_state_t *cstate = hevent_userdata(timer);
+
+    // the previous address did not answer in time, race the next one, the one shot timer frees itself
+    cstate->attempt_timer = NULL;
+    startNextAttempt(cstate);
+}
+
+// one of the racing connects failed before any of them connected
+static void onAttemptFailed(tcp_connector_con_state_t *cstate, hio_t *io)
+{
+    for (unsigned int i = 0; i < cstate->addresses_len; i++)
+    {
+        if (cstate->attempts[i] == io)
+        {
+            cstate->attempts[i] = NULL;
+            cstate->attempts_inflight -= 1;
+        }
+    }
+    LOGD("TcpConnector: connect attempt failed FD:%x, %d still connecting", hio_fd(io), cstate->attempts_inflight);
+
+    // a failure does not wait for the delay, the next address starts now
+    if (cstate->attempt_timer)
+    {
+        htimer_del(cstate->attempt_timer);
+        cstate->attempt_timer = NULL;
+    }
+    if (startNextAttempt(cstate) || cstate->attempts_inflight > 0)
+    {
+        return;
+    }
+
+    LOGD("TcpConnector: could not connect to any address of the domain");
+    tunnel_t  *self    = (cstate)->tunnel;
+    line_t    *line    = (cstate)->line;
+    context_t *context = newFinContext(line);
+    self->downStream(self, context);
+}
+
 static void onClose(hio_t *io)
 {
     tcp_connector_con_state_t *cstate = (tcp_connector_con_state_t *) (hevent_userdata(io));
-    if (cstate != NULL)
+    if (cstate != NULL && cstate->io != io)
+    {
+        onAttemptFailed(cstate, io);
+    }
+    else if (cstate != NULL)
     {
         LOGD("TcpConnector: received close for FD:%x ", hio_fd(io));
         tunnel_t  *self    = (cstate)->tunnel;
@@ -122,6 +278,7 @@ static void onClose(hio_t *io)
     }
 }
 
+// while the connect attempts race there is no io yet, the flag is applied when the winner is adopted
 static void onLinePaused(void *userdata)
 {
     tcp_connector_con_state_t *cstate = (tcp_connector_con_state_t *) (userdata);
@@ -129,7 +286,10 @@ static void onLinePaused(void *userdata)
     if (! cstate->read_paused)
     {
         cstate->read_paused = true;
-        hio_read_stop(cstate->io);
+        if (cstate->io != NULL)
+        {
+            hio_read_stop(cstate->io);
+        }
     }
 }
 
@@ -140,7 +300,10 @@ static void onLineResumed(void *userdata)
     if (cstate->read_paused)
     {
         cstate->read_paused = false;
-        hio_read(cstate->io);
+        if (cstate->io != NULL && cstate->established)
+        {
+            hio_read(cstate->io);
+        }
     }
 }
 
@@ -162,6 +325,28 @@ static void onOutBoundConnected(hio_t *upstream_io)
 
     tunnel_t *self = cstate->tunnel;
     line_t   *line = cstate->line;
+
+    if (cstate->io == NULL)
+    {
+        // won the race, remember the address for the next lines to this domain
+        tcp_connector_state_t *state = TSTATE(self);
+        const uint64_t         now   = hloop_now_ms(hevent_loop(upstream_io));
+
+        for (unsigned int i = 0; i < cstate->addresses_len; i++)
+        {
+            if (cstate->attempts[i] == upstream_io)
+            {
+                rememberDest(state->dest_caches[line->tid], &(line->dest_ctx), &(cstate->addresses[i]),
+                             (uint32_t) (now - cstate->attempts_start_ms[i]), now);
+            }
+        }
+        stopAttempts(cstate, upstream_io);
+        cstate->io = upstream_io;
+        if (cstate->read_paused)
+        {
+            hio_read_stop(upstream_io);
+        }
+    }
     hio_setcb_read(upstream_io, onRecv);
 
     if (logger_will_write_level(getNetworkLogger(), LOG_LEVEL_DEBUG))
@@ -178,13 +363,57 @@ static void onOutBoundConnected(hio_t *upstream_io)
     self->downStream(self, newEstContext(line));
 }
 
+static void onFastOpenTimeout(htimer_t *timer)
+{
+    tcp_connector_con_state_t *cstate = hevent_userdata(timer);
+
+    // nothing to send yet (the peer may speak first), connect without data, the one shot timer frees itself
+    cstate->fast_open_timer   = NULL;
+    cstate->fast_open_pending = false;
+    hio_connect(cstate->io);
+}
+
+// the first payload starts the connection and rides in the SYN, whatever did not fit waits for the connect
+static void connectWithPayload(tcp_connector_con_state_t *cstate, context_t *c)
+{
+    htimer_del(cstate->fast_open_timer);
+    cstate->fast_open_timer   = NULL;
+    cstate->fast_open_pending = false;
+
+    int nwrite = hio_connect_fastopen(cstate->io, c->payload);
+    if (nwrite < 0)
+    {
+        // the io closes, onClose finishes the line
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+    if (nwrite > 0)
+    {
+        LOGD("TcpConnector: %d bytes sent with SYN FD:%x", nwrite, hio_fd(cstate->io));
+        shiftr(c->payload, nwrite);
+    }
+    if (bufLen(c->payload) == 0)
+    {
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+    pauseLineDownSide(c->line);
+    contextQueuePush(cstate->data_queue, c);
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     tcp_connector_con_state_t *cstate = CSTATE(c);
 
     if (c->payload != NULL)
     {
-        if (cstate->write_paused)
+        if (cstate->fast_open_pending)
+        {
+            connectWithPayload(cstate, c);
+        }
+        else if (cstate->write_paused)
         {
             pauseLineDownSide(c->line);
             contextQueuePush(cstate->data_queue, c);
@@ -253,7 +482,10 @@ static void upStream(tunnel_t *self, context_t *c)
             {
                 if (! dest_ctx->domain_resolved)
                 {
-                    if (! resolveContextSync(dest_ctx))
+                    cstate->addresses_len =
+                        (uint8_t) resolveContextSyncAll(dest_ctx, (enum domain_strategy) state->domain_strategy,
+                                                        cstate->addresses, kMaxConnectAddresses);
+                    if (cstate->addresses_len == 0)
                     {
                         CSTATE_DROP(c);
                         cleanup(cstate, false);
@@ -274,50 +506,50 @@ static void upStream(tunnel_t *self, context_t *c)
 
             // sockaddr_set_ipport(&(dest_ctx.addr), "127.0.0.1", 443);
 
-            hloop_t *loop   = getWorkerLoop(c->line->tid);
-            int      sockfd = socket(dest_ctx->address.sa.sa_family, SOCK_STREAM, 0);
+            hloop_t *loop = getWorkerLoop(c->line->tid);
 
-            if (sockfd < 0)
+            if (cstate->addresses_len > 1)
             {
-                LOGE("TcpConnector: socket fd < 0");
-                CSTATE_DROP(c);
-                cleanup(cstate, false);
-                goto fail;
+                cstate->attempt_delay_ms = orderByDestCache(state->dest_caches[c->line->tid], dest_ctx,
+                                                            cstate->addresses, cstate->addresses_len,
+                                                            hloop_now_ms(loop));
+
+                // fast open needs a single connection to put the payload in its SYN, it takes the best address
+                if (! state->tcp_fast_open)
+                {
+                    if (! startNextAttempt(cstate))
+                    {
+                        CSTATE_DROP(c);
+                        cleanup(cstate, false);
+                        goto fail;
+                    }
+                    destroyContext(c);
+                    return;
+                }
+                dest_ctx->address     = cstate->addresses[0];
+                cstate->addresses_len = 0;
             }
 
-            if (state->tcp_no_delay)
+            hio_t *upstream_io = newConnectIo(cstate, &(dest_ctx->address));
+            if (upstream_io == NULL)
             {
-                tcp_nodelay(sockfd, 1);
+                CSTATE_DROP(c);
+                cleanup(cstate, false);
+                goto fail;
             }
+            cstate->io = upstream_io;
 
             if (state->tcp_fast_open)
             {
-                const int yes = 1;
-                setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, (const char *) &yes, sizeof(yes));
+                // connect is deferred, so the first payload can go out with the SYN
+                cstate->fast_open_pending = true;
+                cstate->fast_open_timer   = htimer_add(loop, onFastOpenTimeout, kFastOpenWaitMs, 1);
+                hevent_set_userdata(cstate->fast_open_timer, cstate);
             }
-
-#ifdef OS_LINUX
-            if (state->fwmark != kFwMarkInvalid)
+            else
             {
-                if (setsockopt(sockfd, SOL_SOCKET, SO_MARK, &state->fwmark, sizeof(state->fwmark)) < 0)
-                {
-                    LOGE("TcpConnector: setsockopt SO_MARK error");
-                    CSTATE_DROP(c);
-                    cleanup(cstate, false);
-                    goto fail;
-                }
+                hio_connect(upstream_io);
             }
-#endif
-
-            hio_t *upstream_io = hio_get(loop, sockfd);
-            assert(upstream_io != NULL);
-
-            hio_set_peeraddr(upstream_io, &(dest_ctx->address.sa), (int) sockaddr_len(&(dest_ctx->address)));
-            cstate->io = upstream_io;
-            hevent_set_userdata(upstream_io, cstate);
-            hio_setcb_connect(upstream_io, onOutBoundConnected);
-            hio_setcb_close(upstream_io, onClose);
-            hio_connect(upstream_io);
             destroyContext(c);
         }
         else if (c->fin)
@@ -359,7 +591,10 @@ static void downStream(tunnel_t *self, context_t *c)
         if (c->est)
         {
             cstate->established = true;
-            hio_read(cstate->io);
+            if (! cstate->read_paused)
+            {
+                hio_read(cstate->io);
+            }
             if (resumeWriteQueue(cstate))
             {
                 cstate->write_paused = false;
@@ -508,6 +743,12 @@ tunnel_t *newTcpConnector(node_instance_context_t *instance_info)
 
     getIntFromJsonObjectOrDefault(&(state->fwmark), settings, "fwmark", kFwMarkInvalid);
 
+    state->dest_caches = globalMalloc(sizeof(dest_cache_t *) * getWorkersCount());
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        state->dest_caches[i] = newDestCache();
+    }
+
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
@@ -525,7 +766,17 @@ api_result_t apiTcpConnector(tunnel_t *self, const char *msg)
 
 tunnel_t *destroyTcpConnector(tunnel_t *self)
 {
-    (void) (self);
+    tcp_connector_state_t *state = TSTATE(self);
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        destroyDestCache(state->dest_caches[i]);
+    }
+    globalFree(state->dest_caches);
+    destroyDynamicValue(state->dest_addr_selected);
+    destroyDynamicValue(state->dest_port_selected);
+    globalFree(state);
+    globalFree(self);
     return NULL;
 }
 
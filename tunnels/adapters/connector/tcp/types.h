@@ -17,6 +17,19 @@ enum
     kFwMarkInvalid = -1
 };
 
+enum
+{
+    // with fast open the connect waits this long for the first payload, then it connects without data
+    kFastOpenWaitMs = 30,
+    // queued payloads are merged only while both are below this (an ethernet mss), bigger ones are written as they are
+    kCoalesceThreshold = 1460,
+    // a domain with several addresses races them (happy eyeballs), the next one starts after this delay
+    kConnectAttemptDelayMs = 250,
+    kMaxConnectAddresses   = 8
+};
+
+typedef struct dest_cache_s dest_cache_t;
+
 typedef struct tcp_connector_state_s
 {
     // settings
@@ -29,6 +42,7 @@ typedef struct tcp_connector_state_s
     socket_context_t constant_dest_addr;
     uint64_t         outbound_ip_range;
     int              fwmark;
+    dest_cache_t   **dest_caches; // one per worker
 
 } tcp_connector_state_t;
 
@@ -43,6 +57,16 @@ typedef struct tcp_connector_con_state_s
     hio_t           *io;
     buffer_pool_t   *buffer_pool;
     context_queue_t *data_queue;
+    htimer_t        *fast_open_timer;
+    htimer_t        *attempt_timer;
+    hio_t           *attempts[kMaxConnectAddresses]; // racing connects, the first one that connects becomes io
+    uint64_t         attempts_start_ms[kMaxConnectAddresses];
+    sockaddr_u       addresses[kMaxConnectAddresses];
+    uint32_t         attempt_delay_ms;
+    uint8_t          addresses_len;
+    uint8_t          next_address;
+    uint8_t          attempts_inflight;
+    bool             fast_open_pending;
     bool             write_paused;
     bool             established;
     bool             read_paused;
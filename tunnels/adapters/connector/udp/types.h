@@ -20,9 +20,28 @@ typedef struct udp_connector_state_s
     dynamic_value_t  dest_addr_selected;
     dynamic_value_t  dest_port_selected;
     socket_context_t constant_dest_addr;
+    bool             dest_per_packet; // both address and port come from dest_context
 
 } udp_connector_state_t;
 
+enum
+{
+    kUdpResolveCacheTime  = 60 * 1000,
+    kUdpResolvedLineLimit = 256,
+    kUdpResolvedInitCap   = 4
+};
+
+// address of a domain destination, so a line does not resolve it again for every datagram
+typedef struct udp_connector_resolved_s
+{
+    sockaddr_u addr;
+    uint64_t   resolved_at_ms;
+
+} udp_connector_resolved_t;
+
+#define i_TYPE hmap_udp_resolved_t, hash_t, udp_connector_resolved_t // NOLINT
+#include "stc/hmap.h"
+
 typedef struct udp_connector_con_state_s
 {
 #ifdef PROFILE
@@ -31,8 +50,11 @@ typedef struct udp_connector_con_state_s
 
     tunnel_t *     tunnel;
     line_t *       line;
-    hio_t *        io;
     buffer_pool_t *buffer_pool;
+    hio_t *        io; // the one socket of the line, every destination is reached with sendto
+
+    sockaddr_u          fixed_peer; // used for every packet when the destination is not per packet
+    hmap_udp_resolved_t resolved;
 
     bool established;
 } udp_connector_con_state_t;
@@ -6,10 +6,47 @@
 #include "utils/jsonutils.h"
 #include "utils/sockutils.h"
 
+/*
+    a line of UdpConnector can carry datagrams to many destinations (udp associate of socks5 / trojan sets
+    dest_context of the line before every datagram), the line has one unconnected socket and each datagram is
+    sent to its own destination with sendto
+
+    replies are taken from any source address (full cone) and report that source in dest_context, so the server
+    side can tell the client who answered, a peer sees the same source port whatever destination it talks to
+
+    the socket is dual stack (bound to "::" with IPV6_V6ONLY off), ipv4 peers are sent to and received from as
+    v4 mapped ipv6 addresses and converted back to plain ipv4 at the edges of this node
+*/
+
 static void cleanup(udp_connector_con_state_t *cstate)
 {
+    if (cstate->io)
+    {
+        hevent_set_userdata(cstate->io, NULL);
+        hio_close(cstate->io);
+    }
+    hmap_udp_resolved_t_drop(&(cstate->resolved));
     globalFree(cstate);
 }
+
+static void mapToIPV6(sockaddr_u *dest, const sockaddr_u *source)
+{
+    memset(dest, 0, sizeof(sockaddr_u));
+    dest->sin6.sin6_family           = AF_INET6;
+    dest->sin6.sin6_port             = source->sin.sin_port;
+    dest->sin6.sin6_addr.s6_addr[10] = 0xFF;
+    dest->sin6.sin6_addr.s6_addr[11] = 0xFF;
+    memcpy(&(dest->sin6.sin6_addr.s6_addr[12]), &(source->sin.sin_addr), sizeof(struct in_addr));
+}
+
+static void unmapFromIPV6(sockaddr_u *dest, const sockaddr_u *source)
+{
+    memset(dest, 0, sizeof(sockaddr_u));
+    dest->sin.sin_family = AF_INET;
+    dest->sin.sin_port   = source->sin6.sin6_port;
+    memcpy(&(dest->sin.sin_addr), &(source->sin6.sin6_addr.s6_addr[12]), sizeof(struct in_addr));
+}
+
 static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
 {
     udp_connector_con_state_t *cstate = (udp_connector_con_state_t *) (hevent_userdata(io));
@@ -30,21 +67,128 @@ static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
         self->downStream(self, est_context);
         if (hevent_userdata(io) == NULL)
         {
+            reuseBuffer(hloop_bufferpool(hevent_loop(io)), buf);
             return;
         }
     }
 
+    // the socket is not connected, the reply may come from any address (full cone)
+    sockaddr_u *source = (sockaddr_u *) hio_peeraddr(io);
+    if (source->sa.sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&(source->sin6.sin6_addr)))
+    {
+        unmapFromIPV6(&(line->dest_ctx.address), source);
+        line->dest_ctx.address_type = kSatIPV4;
+    }
+    else
+    {
+        sockAddrCopy(&(line->dest_ctx.address), source);
+        line->dest_ctx.address_type = source->sa.sa_family == AF_INET6 ? kSatIPV6 : kSatIPV4;
+    }
+
     context_t *context = newContext(line);
     context->payload   = payload;
     self->downStream(self, context);
 }
 
+static hio_t *newLineSocket(udp_connector_con_state_t *cstate)
+{
+    hloop_t *loop = getWorkerLoop(cstate->line->tid);
+
+    int sockfd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sockfd < 0)
+    {
+        LOGE("Connector: socket fd < 0");
+        return NULL;
+    }
+
+#ifdef OS_UNIX
+    so_reuseaddr(sockfd, 1);
+#endif
+    // one socket reaches both ipv4 and ipv6 destinations
+    ip_v6only(sockfd, 0);
+    sockaddr_u addr;
+
+    sockaddr_set_ipport(&addr, "::", 0);
+
+    if (bind(sockfd, &addr.sa, sockaddr_len(&addr)) < 0)
+    {
+        LOGE("UDP bind failed;");
+        closesocket(sockfd);
+        return NULL;
+    }
+
+    hio_t *upstream_io = hio_get(loop, sockfd);
+    assert(upstream_io != NULL);
+
+    hevent_set_userdata(upstream_io, cstate);
+    hio_setcb_read(upstream_io, onRecvFrom);
+    hio_read(upstream_io);
+    return upstream_io;
+}
+
+// the address of the destination that is currently set on the line, NULL means the datagram is dropped
+static const sockaddr_u *getDestinationAddr(udp_connector_con_state_t *cstate, line_t *line)
+{
+    socket_context_t *dest_ctx = &(line->dest_ctx);
+
+    if (dest_ctx->address_type != kSatDomainName)
+    {
+        return &(dest_ctx->address);
+    }
+    if (dest_ctx->domain == NULL)
+    {
+        return NULL;
+    }
+    if (dest_ctx->domain_resolved)
+    {
+        return &(dest_ctx->address);
+    }
+
+    hash_t         port_hash = CALC_HASH_PRIMITIVE(dest_ctx->address.sin.sin_port);
+    const hash_t   hash      = CALC_HASH_BYTES_WITH_SEED(dest_ctx->domain, dest_ctx->domain_len, port_hash);
+    const uint64_t now       = hloop_now_ms(getWorkerLoop(line->tid));
+
+    hmap_udp_resolved_t_iter find_result = hmap_udp_resolved_t_find(&(cstate->resolved), hash);
+    if (find_result.ref != hmap_udp_resolved_t_end(&(cstate->resolved)).ref)
+    {
+        if (now - find_result.ref->second.resolved_at_ms < kUdpResolveCacheTime)
+        {
+            return &(find_result.ref->second.addr);
+        }
+        hmap_udp_resolved_t_erase_at(&(cstate->resolved), find_result);
+    }
+
+    if (! resolveContextSync(dest_ctx))
+    {
+        return NULL;
+    }
+
+    if (hmap_udp_resolved_t_size(&(cstate->resolved)) >= kUdpResolvedLineLimit)
+    {
+        // a line that talks to this many domains just resolves them again
+        hmap_udp_resolved_t_clear(&(cstate->resolved));
+    }
+    udp_connector_resolved_t resolved = {.resolved_at_ms = now};
+    sockAddrCopy(&(resolved.addr), &(dest_ctx->address));
+    hmap_udp_resolved_t_insert(&(cstate->resolved), hash, resolved);
+    return &(dest_ctx->address);
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     udp_connector_con_state_t *cstate = CSTATE(c);
 
     if (c->payload != NULL)
     {
+        udp_connector_state_t *state = TSTATE(self);
+        const sockaddr_u      *peer =
+            state->dest_per_packet ? getDestinationAddr(cstate, c->line) : &(cstate->fixed_peer);
+        if (peer == NULL)
+        {
+            reuseContextPayload(c);
+            destroyContext(c);
+            return;
+        }
 
         if (hio_is_closed(cstate->io))
         {
@@ -54,6 +198,24 @@ static void upStream(tunnel_t *self, context_t *c)
             goto fail;
         }
 
+        // a queued datagram is sent to whatever peer address the socket has when it leaves, so while the
+        // socket buffer is full new datagrams are dropped instead of changing it
+        if (! hio_write_is_complete(cstate->io))
+        {
+            reuseContextPayload(c);
+            destroyContext(c);
+            return;
+        }
+
+        sockaddr_u mapped_peer;
+        if (peer->sa.sa_family == AF_INET)
+        {
+            mapToIPV6(&mapped_peer, peer);
+            peer = &mapped_peer;
+        }
+
+        // replies and earlier datagrams replace the peer address of the socket, it is the target of sendto
+        hio_set_peeraddr(cstate->io, (struct sockaddr *) &(peer->sa), (int) sockaddr_len((sockaddr_u *) peer));
         size_t nwrite = hio_write(cstate->io, c->payload);
         dropContexPayload(c);
         (void) nwrite;
@@ -73,42 +235,22 @@ static void upStream(tunnel_t *self, context_t *c)
             cstate->buffer_pool = getContextBufferPool(c);
             cstate->tunnel      = self;
             cstate->line        = c->line;
-            // sockaddr_set_ipport(&(dest->addr),"www.gstatic.com",80);
-            hloop_t   *loop      = getWorkerLoop(c->line->tid);
-            sockaddr_u host_addr = {0};
-            sockaddr_set_ipport(&host_addr, "0.0.0.0", 0);
-
-            int sockfd = socket(host_addr.sa.sa_family, SOCK_DGRAM, 0);
-            if (sockfd < 0)
+            cstate->resolved    = hmap_udp_resolved_t_with_capacity(kUdpResolvedInitCap);
+            cstate->io          = newLineSocket(cstate);
+            if (cstate->io == NULL)
             {
-                LOGE("Connector: socket fd < 0");
+                cleanup(CSTATE(c));
                 CSTATE_DROP(c);
-                cleanup(cstate);
                 goto fail;
             }
 
-#ifdef OS_UNIX
-            so_reuseaddr(sockfd, 1);
-#endif
-            sockaddr_u addr;
-
-            sockaddr_set_ipport(&addr, "0.0.0.0", 0);
-
-            if (bind(sockfd, &addr.sa, sockaddr_len(&addr)) < 0)
+            if (state->dest_per_packet)
             {
-                LOGE("UDP bind failed;");
-                closesocket(sockfd);
-                goto fail;
+                // every datagram carries its own destination
+                destroyContext(c);
+                return;
             }
 
-            hio_t *upstream_io = hio_get(loop, sockfd);
-            assert(upstream_io != NULL);
-
-            cstate->io = upstream_io;
-            hevent_set_userdata(upstream_io, cstate);
-            hio_setcb_read(upstream_io, onRecvFrom);
-            hio_read(upstream_io);
-
             socket_context_t *dest_ctx = &(c->line->dest_ctx);
             socket_context_t *src_ctx  = &(c->line->src_ctx);
             switch ((enum udp_connector_dynamic_value_status) state->dest_addr_selected.status)
@@ -145,18 +287,15 @@ static void upStream(tunnel_t *self, context_t *c)
                     goto fail;
                 }
             }
-            hio_set_peeraddr(cstate->io, &(dest_ctx->address.sa), (int) sockaddr_len(&(dest_ctx->address)));
 
+            sockAddrCopy(&(cstate->fixed_peer), &(dest_ctx->address));
             destroyContext(c);
         }
         else if (c->fin)
         {
-            hio_t *io = cstate->io;
-            hevent_set_userdata(io, NULL);
             cleanup(CSTATE(c));
             CSTATE_DROP(c);
             destroyContext(c);
-            hio_close(io);
         }
     }
     return;
@@ -171,8 +310,6 @@ static void downStream(tunnel_t *self, context_t *c)
 
     if (c->fin)
     {
-        hio_t *io = cstate->io;
-        hevent_set_userdata(io, NULL);
         CSTATE_DROP(c);
         cleanup(cstate);
     }
@@ -228,6 +365,10 @@ tunnel_t *newUdpConnector(node_instance_context_t *instance_info)
     {
         socketContextPortSet(&(state->constant_dest_addr), state->dest_port_selected.value);
     }
+    state->dest_per_packet =
+        (enum udp_connector_dynamic_value_status) state->dest_addr_selected.status == kCdvsFromDest &&
+        (enum udp_connector_dynamic_value_status) state->dest_port_selected.status == kCdvsFromDest;
+
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
@@ -25,6 +25,15 @@ enum capturedevice_filter_type_dynamic_value_status
 static const char *ip_tables_enable_queue_mi  = "iptables -I INPUT -s %s -j NFQUEUE --queue-num %d";
 static const char *ip_tables_disable_queue_mi = "iptables -D INPUT -s %s -j NFQUEUE --queue-num %d";
 
+// with more than 1 queue, the kernel hashes flows over the queue range
+static const char *ip_tables_enable_queue_balance_mi  = "iptables -I INPUT -s %s -j NFQUEUE --queue-balance %d:%d";
+static const char *ip_tables_disable_queue_balance_mi = "iptables -D INPUT -s %s -j NFQUEUE --queue-balance %d:%d";
+
+enum
+{
+    kMaxQueueCount = 64
+};
+
 typedef struct capture_device_state_s
 {
     capture_device_t *cdev;
@@ -33,6 +42,7 @@ typedef struct capture_device_state_s
     char             *name;
     char             *exitcmd;
     uint32_t          queue_number;
+    uint32_t          queue_count;
     uint32_t          except_fwmark;
 
 } capture_device_state_t;
@@ -168,6 +178,15 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
         LOGF("JSON Error: CaptureDevice->settings->filter-mode (string field) : mode is not specified or invalid");
         return NULL;
     }
+    int queue_count = 1;
+    getIntFromJsonObjectOrDefault(&queue_count, settings, "queue-count", 1);
+    if (queue_count < 1 || queue_count > kMaxQueueCount)
+    {
+        LOGF("JSON Error: CaptureDevice->settings->queue-count (number field) : must be between 1 and %d",
+             kMaxQueueCount);
+        return NULL;
+    }
+    state->queue_count  = (uint32_t) queue_count;
     state->queue_number = 200 + (fastRand() % 200);
     state->ip           = NULL;
     if (! getStringFromJsonObject(&state->ip, settings, "ip"))
@@ -182,7 +201,17 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
     {
         if ((int) fmode.status == kDvsSourceIp)
         {
-            snprintf(cmdbuf, 100, ip_tables_enable_queue_mi, state->ip, (int) state->queue_number);
+            const int queue_first = (int) state->queue_number;
+            const int queue_last  = (int) (state->queue_number + state->queue_count - 1);
+
+            if (state->queue_count == 1)
+            {
+                snprintf(cmdbuf, 100, ip_tables_enable_queue_mi, state->ip, queue_first);
+            }
+            else
+            {
+                snprintf(cmdbuf, 100, ip_tables_enable_queue_balance_mi, state->ip, queue_first, queue_last);
+            }
             if (execCmd(cmdbuf).exit_code != 0)
             {
                 LOGF("CaptureDevicer: command failed: %s", cmdbuf);
@@ -190,7 +219,14 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
             }
 
             state->exitcmd = cmdbuf;
-            snprintf(cmdbuf, 100, ip_tables_disable_queue_mi, state->ip, (int) state->queue_number);
+            if (state->queue_count == 1)
+            {
+                snprintf(cmdbuf, 100, ip_tables_disable_queue_mi, state->ip, queue_first);
+            }
+            else
+            {
+                snprintf(cmdbuf, 100, ip_tables_disable_queue_balance_mi, state->ip, queue_first, queue_last);
+            }
             registerAtExitCallback(exitHook, t);
         }
         else
@@ -205,7 +241,7 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
         state->thread_lines[i] = newLine(i);
     }
 
-    state->cdev = createCaptureDevice(state->name, state->queue_number, t, onIPPacketReceived);
+    state->cdev = createCaptureDevice(state->name, state->queue_number, state->queue_count, t, onIPPacketReceived);
 
     if (state->cdev == NULL)
     {
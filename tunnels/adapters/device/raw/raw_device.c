@@ -73,15 +73,9 @@ static void upStream(tunnel_t *self, context_t *c)
 {
     raw_device_state_t *state = TSTATE((tunnel_t *) self);
 
-    raw_device_t *rdev = state->rdev;
-    if (! writeToRawDevce(rdev, c->payload))
-    {
-        reuseContextPayload(c);
-    }
-    else
-    {
-        dropContexPayload(c);
-    }
+    // the device takes the payload even if the write fails
+    writeToRawDevce(state->rdev, c->payload, c->line->tid);
+    dropContexPayload(c);
     destroyContext(c);
 }
 
@@ -96,21 +96,42 @@ static void downStream(tunnel_t *self, context_t *c)
     destroyContext(c);
 }
 
-static void onIPPacketReceived(struct tun_device_s *tdev, void *userdata, shift_buffer_t *buf, tid_t tid)
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    tun_device_state_t *state = TSTATE((tunnel_t *) self);
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        if (! writeToTunDevce(state->tdev, v->bufs[i]))
+        {
+            reuseBuffer(getLineBufferPool(v->line), v->bufs[i]);
+        }
+    }
+    v->count = 0;
+}
+
+static void onIPPacketReceived(struct tun_device_s *tdev, void *userdata, shift_buffer_t **bufs, unsigned int count,
+                               tid_t tid)
 {
     (void) tdev;
     tunnel_t           *self  = userdata;
     tun_device_state_t *state = TSTATE((tunnel_t *) self);
 
+    static_assert((int) kTunReadBatchMax <= (int) kPacketVectorCap, "a read batch must fit in one packet vector");
+
+    packet_vector_t v;
+    v.line  = state->thread_lines[tid];
+    v.count = count;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
 #if LOG_PACKET_INFO
-    printIPPacketInfo(rawBuf(buf), bufLen(buf));
+        printIPPacketInfo(rawBuf(bufs[i]), bufLen(bufs[i]));
 #endif
+        v.bufs[i] = bufs[i];
+    }
 
-    // reuseBuffer(getWorkerBufferPool(tid), buf);
-
-    context_t *ctx = newContext(state->thread_lines[tid]);
-    ctx->payload   = buf;
-    self->up->upStream(self->up, ctx);
+    self->up->upStreamVector(self->up, &v);
 }
 
 tunnel_t *newTunDevice(node_instance_context_t *instance_info)
@@ -164,9 +185,10 @@ tunnel_t *newTunDevice(node_instance_context_t *instance_info)
     assignIpToTunDevice(state->tdev, state->ip_present, state->subnet_mask);
     bringTunDeviceUP(state->tdev);
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
 
     return t;
 }
@@ -0,0 +1,172 @@
+#include "xdp_device.h"
+#include "loggers/network_logger.h"
+#include "packet_types.h"
+#include "utils/jsonutils.h"
+#include "ww/devices/xdp/xdp.h"
+
+enum
+{
+    kMaxXdpQueues = 64
+};
+
+typedef struct xdp_device_state_s
+{
+    xdp_device_t *xdev;
+    line_t      **thread_lines;
+    char         *interface_name;
+    char         *peer_mac;
+
+} xdp_device_state_t;
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    xdp_device_state_t *state = TSTATE((tunnel_t *) self);
+
+    // the device takes the payload even if the write fails
+    writeToXdpDevice(state->xdev, c->payload, c->line->tid);
+    dropContexPayload(c);
+    destroyContext(c);
+}
+
+static void downStream(tunnel_t *self, context_t *c)
+{
+    (void) (self);
+    (void) (c);
+    assert(false);
+
+    if (c->payload)
+    {
+        dropContexPayload(c);
+    }
+    destroyContext(c);
+}
+
+static void onIPPacketReceived(struct xdp_device_s *xdev, void *userdata, shift_buffer_t *buf, tid_t tid)
+{
+    (void) xdev;
+    tunnel_t           *self  = userdata;
+    xdp_device_state_t *state = TSTATE((tunnel_t *) self);
+
+    context_t *ctx = newContext(state->thread_lines[tid]);
+    ctx->payload   = buf;
+    self->up->upStream(self->up, ctx);
+}
+
+static bool parseMacAddress(const char *str, uint8_t *mac)
+{
+    unsigned int parts[6];
+    char         tail;
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x%c", &parts[0], &parts[1], &parts[2], &parts[3], &parts[4], &parts[5], &tail) !=
+        6)
+    {
+        return false;
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        if (parts[i] > 0xFF)
+        {
+            return false;
+        }
+        mac[i] = (uint8_t) parts[i];
+    }
+    return true;
+}
+
+tunnel_t *newXdpDevice(node_instance_context_t *instance_info)
+{
+    xdp_device_state_t *state = globalMalloc(sizeof(xdp_device_state_t));
+    memset(state, 0, sizeof(xdp_device_state_t));
+
+    cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    {
+        LOGF("JSON Error: XdpDevice->settings (object field) : The object was empty or invalid");
+        return NULL;
+    }
+
+    if (! getStringFromJsonObject(&(state->interface_name), settings, "interface"))
+    {
+        LOGF("JSON Error: XdpDevice->settings->interface (string field) : The string was empty or invalid");
+        return NULL;
+    }
+
+    int queue_count = 1;
+    getIntFromJsonObjectOrDefault(&queue_count, settings, "queues", 1);
+    if (queue_count < 1 || queue_count > kMaxXdpQueues)
+    {
+        LOGF("JSON Error: XdpDevice->settings->queues (number field) : queues must be in range [1,%d]",
+             kMaxXdpQueues);
+        return NULL;
+    }
+
+    bool zero_copy = true;
+    getBoolFromJsonObjectOrDefault(&zero_copy, settings, "zero-copy", true);
+
+    // not forced, frames are broadcasted when the peer mac is not known
+    uint8_t  peer_mac[6];
+    uint8_t *peer_mac_ptr = NULL;
+    if (getStringFromJsonObject(&(state->peer_mac), settings, "peer-mac"))
+    {
+        if (! parseMacAddress(state->peer_mac, peer_mac))
+        {
+            LOGF("JSON Error: XdpDevice->settings->peer-mac (string field) : %s is not a valid mac address",
+                 state->peer_mac);
+            return NULL;
+        }
+        peer_mac_ptr = peer_mac;
+    }
+
+    state->thread_lines = globalMalloc(sizeof(line_t *) * WORKERS_COUNT);
+    for (unsigned int i = 0; i < WORKERS_COUNT; i++)
+    {
+        state->thread_lines[i] = newLine(i);
+    }
+
+    tunnel_t *t = newTunnel();
+
+    state->xdev = createXdpDevice(state->interface_name, (uint32_t) queue_count, zero_copy, peer_mac_ptr, t,
+                                  onIPPacketReceived);
+
+    if (state->xdev == NULL)
+    {
+        LOGF("XdpDevice: could not create device");
+        return NULL;
+    }
+    bringXdpDeviceUP(state->xdev);
+
+    t->state      = state;
+    t->upStream   = &upStream;
+    t->downStream = &downStream;
+
+    return t;
+}
+
+api_result_t apiXdpDevice(tunnel_t *self, const char *msg)
+{
+    (void) (self);
+    (void) (msg);
+    return (api_result_t) {0};
+}
+
+tunnel_t *destroyXdpDevice(tunnel_t *self)
+{
+    xdp_device_state_t *state = TSTATE(self);
+
+    closeXdpDevice(state->xdev);
+    for (unsigned int i = 0; i < WORKERS_COUNT; i++)
+    {
+        destroyLine(state->thread_lines[i]);
+    }
+    globalFree(state->thread_lines);
+    globalFree(state->interface_name);
+    globalFree(state->peer_mac);
+    globalFree(state);
+    globalFree(self);
+    return NULL;
+}
+
+tunnel_metadata_t getMetadataXdpDevice(void)
+{
+    return (tunnel_metadata_t) {.version = 0001, .flags = 0x0};
+}
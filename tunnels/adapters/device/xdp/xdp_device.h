@@ -0,0 +1,13 @@
+#pragma once
+#include "api.h"
+
+// 
+//      XdpDevice
+// 
+
+//  this node will not join a chain , it will be used by other nodes (if they accept a device)
+
+tunnel_t *        newXdpDevice(node_instance_context_t *instance_info);
+api_result_t      apiXdpDevice(tunnel_t *self, const char *msg);
+tunnel_t *        destroyXdpDevice(tunnel_t *self);
+tunnel_metadata_t getMetadataXdpDevice(void);
@@ -10,3 +10,4 @@ tunnel_t         *newTcpListener(node_instance_context_t *instance_info);
 api_result_t      apiTcpListener(tunnel_t *self, const char *msg);
 tunnel_t         *destroyTcpListener(tunnel_t *self);
 tunnel_metadata_t getMetadataTcpListener(void);
+void             *compileTcpListener(struct cJSON *settings, size_t *len);
@@ -279,6 +279,35 @@ static void parsePortSection(udp_listener_state_t *state, const cJSON *settings)
     }
 }
 
+// NULL terminated, NULL if there is no whitelist
+static char **parseWhiteList(const cJSON *settings)
+{
+    const cJSON *wlist = cJSON_GetObjectItemCaseSensitive(settings, "whitelist");
+    if (! cJSON_IsArray(wlist) || cJSON_GetArraySize(wlist) == 0)
+    {
+        return NULL;
+    }
+    size_t len  = cJSON_GetArraySize(wlist);
+    char **list = (char **) globalMalloc(sizeof(char *) * (len + 1));
+    memset((void *) list, 0, sizeof(char *) * (len + 1));
+    list[len]              = 0x0;
+    int          i         = 0;
+    const cJSON *list_item = NULL;
+    cJSON_ArrayForEach(list_item, wlist)
+    {
+        if (! getStringFromJson(&(list[i]), list_item) || ! verifyIpCdir(list[i], getNetworkLogger()))
+        {
+            LOGF("JSON Error: UdpListener->settings->whitelist (array of strings field) index %d : The data "
+                 "was empty or invalid",
+                 i);
+            exit(1);
+        }
+
+        i++;
+    }
+    return list;
+}
+
 tunnel_t *newUdpListener(node_instance_context_t *instance_info)
 {
     udp_listener_state_t *state = globalMalloc(sizeof(udp_listener_state_t));
@@ -318,33 +347,16 @@ tunnel_t *newUdpListener(node_instance_context_t *instance_info)
         }
     }
 
-    filter_opt.white_list_raddr = NULL;
-    const cJSON *wlist          = cJSON_GetObjectItemCaseSensitive(settings, "whitelist");
-    if (cJSON_IsArray(wlist))
+    if (instance_info->compiled_data != NULL)
     {
-        size_t len = cJSON_GetArraySize(wlist);
-        if (len > 0)
-        {
-            char **list = (char **) globalMalloc(sizeof(char *) * (len + 1));
-            memset((void *) list, 0, sizeof(char *) * (len + 1));
-            list[len]              = 0x0;
-            int          i         = 0;
-            const cJSON *list_item = NULL;
-            cJSON_ArrayForEach(list_item, wlist)
-            {
-                if (! getStringFromJson(&(list[i]), list_item) || ! verifyIpCdir(list[i], getNetworkLogger()))
-                {
-                    LOGF("JSON Error: UdpListener->settings->whitelist (array of strings field) index %d : The data "
-                         "was empty or invalid",
-                         i);
-                    exit(1);
-                }
-
-                i++;
-            }
-
-            filter_opt.white_list_raddr = list;
-        }
+        // the whitelist was parsed by --compile, the prefixes are used in place
+        filter_opt.white_list_parsed        = instance_info->compiled_data;
+        filter_opt.white_list_parsed_length =
+            (unsigned int) (instance_info->compiled_data_len / sizeof(socket_filter_prefix_t));
+    }
+    else
+    {
+        filter_opt.white_list_raddr = parseWhiteList(settings);
     }
 
     filter_opt.host             = state->address;
@@ -362,6 +374,27 @@ tunnel_t *newUdpListener(node_instance_context_t *instance_info)
     return t;
 }
 
+// the whitelist is parsed into the prefix table of the socket manager, the node reads it from the image
+void *compileUdpListener(cJSON *settings, size_t *len)
+{
+    char **list = parseWhiteList(settings);
+    if (list == NULL)
+    {
+        return NULL;
+    }
+    unsigned int            count    = 0;
+    socket_filter_prefix_t *prefixes = parseWhiteListPrefixes(list, &count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        globalFree(list[i]);
+    }
+    globalFree((void *) list);
+    cJSON_DeleteItemFromObjectCaseSensitive(settings, "whitelist");
+
+    *len = sizeof(socket_filter_prefix_t) * count;
+    return prefixes;
+}
+
 api_result_t apiUdpListener(tunnel_t *self, const char *msg)
 {
     (void) (self);
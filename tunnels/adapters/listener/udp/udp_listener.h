@@ -11,3 +11,4 @@ tunnel_t *        newUdpListener(node_instance_context_t *instance_info);
 api_result_t      apiUdpListener(tunnel_t *self, const char *msg);
 tunnel_t *        destroyUdpListener(tunnel_t *self);
 tunnel_metadata_t getMetadataUdpListener(void);
+void *            compileUdpListener(struct cJSON *settings, size_t *len);
@@ -11,6 +11,7 @@ enum
 };
 
 static void onPingTimer(htimer_t *timer);
+static bool sendNgHttp2Data(tunnel_t *self, http2_client_con_state_t *con);
 
 static nghttp2_nv makeNV(const char *name, const char *value)
 {
@@ -33,11 +34,36 @@ static void printFrameHd(const nghttp2_frame_hd *hd)
 static void onStreamLinePaused(void *arg)
 {
     http2_client_child_con_state_t *stream = (http2_client_child_con_state_t *) arg;
+    tunnel_t                       *self   = stream->tunnel;
+    http2_client_con_state_t       *con    = LSTATE(stream->parent);
+    if (con->framer)
+    {
+        // only this stream stops returning window, the other streams of the connection keep flowing
+        http2FramerPauseStream(con->framer, stream->fstream);
+        return;
+    }
     pauseLineUpSide(stream->parent);
 }
 static void onStreamLineResumed(void *arg)
 {
     http2_client_child_con_state_t *stream = (http2_client_child_con_state_t *) arg;
+    tunnel_t                       *self   = stream->tunnel;
+    http2_client_con_state_t       *con    = LSTATE(stream->parent);
+    if (con->framer)
+    {
+        http2FramerResumeStream(con->framer, stream->fstream);
+        line_t *h2line = con->line;
+        lockLine(h2line);
+        while (sendNgHttp2Data(con->tunnel, con))
+        {
+            if (! isAlive(h2line))
+            {
+                break;
+            }
+        }
+        unLockLine(h2line);
+        return;
+    }
     resumeLineUpSide(stream->parent);
 }
 
@@ -104,22 +130,22 @@ static void removeStream(http2_client_con_state_t *con, http2_client_child_con_s
 
 static http2_client_child_con_state_t *createHttp2Stream(http2_client_con_state_t *con, line_t *child_line)
 {
-    char       authority_addr[320];
-    nghttp2_nv nvs[15];
-    int        nvlen = 0;
+    char           authority_addr[320];
+    http2_header_t headers[15];
+    int            hlen = 0;
 
-    nvs[nvlen++] = makeNV(":method", httpMethodStr(con->method));
-    nvs[nvlen++] = makeNV(":path", con->path);
-    nvs[nvlen++] = makeNV(":scheme", con->scheme);
+    headers[hlen++] = (http2_header_t) {":method", httpMethodStr(con->method)};
+    headers[hlen++] = (http2_header_t) {":path", con->path};
+    headers[hlen++] = (http2_header_t) {":scheme", con->scheme};
 
     if (con->host_port == 0 || con->host_port == DEFAULT_HTTP_PORT || con->host_port == DEFAULT_HTTPS_PORT)
     {
-        nvs[nvlen++] = (makeNV(":authority", con->host));
+        headers[hlen++] = (http2_header_t) {":authority", con->host};
     }
     else
     {
         snprintf(authority_addr, sizeof(authority_addr), "%s:%d", con->host, con->host_port);
-        nvs[nvlen++] = (makeNV(":authority", authority_addr));
+        headers[hlen++] = (http2_header_t) {":authority", authority_addr};
     }
 
     // HTTP2_FLAG_END_STREAM;
@@ -128,25 +154,43 @@ static http2_client_child_con_state_t *createHttp2Stream(http2_client_con_state_
     if (con->content_type == kApplicationGrpc)
     {
         // flags = HTTP2_FLAG_NONE;
-        nvs[nvlen++] = (makeNV("content-type", "application/grpc+proto"));
+        headers[hlen++] = (http2_header_t) {"content-type", "application/grpc+proto"};
     }
     // todo (match chrome) this one is same as curl, but not same as chrome
-    nvs[nvlen++] = makeNV("Accept", "*/*");
+    headers[hlen++] = (http2_header_t) {"Accept", "*/*"};
     // chrome:
     // "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7");
 
-    nvs[nvlen++] = makeNV("Accept-Language", "en,fa;q=0.9,zh-CN;q=0.8,zh;q=0.7");
-    nvs[nvlen++] = makeNV("Cache-Control", "no-cache");
-    nvs[nvlen++] = makeNV("Pragma", "no-cache");
-    nvs[nvlen++] = makeNV("Sec-Ch-Ua", "Chromium\";v=\"122\", Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\"");
-    nvs[nvlen++] = makeNV("User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like "
-                                        "Gecko) Chrome/122.0.0.0 Safari/537.36");
-    nvs[nvlen++] = makeNV("Sec-Ch-Ua-Platform", "\"Windows\"");
+    headers[hlen++] = (http2_header_t) {"Accept-Language", "en,fa;q=0.9,zh-CN;q=0.8,zh;q=0.7"};
+    headers[hlen++] = (http2_header_t) {"Cache-Control", "no-cache"};
+    headers[hlen++] = (http2_header_t) {"Pragma", "no-cache"};
+    headers[hlen++] =
+        (http2_header_t) {"Sec-Ch-Ua", "Chromium\";v=\"122\", Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\""};
+    headers[hlen++] = (http2_header_t) {"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+                                                      "(KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36"};
+    headers[hlen++] = (http2_header_t) {"Sec-Ch-Ua-Platform", "\"Windows\""};
 
     http2_client_child_con_state_t *stream = globalMalloc(sizeof(http2_client_child_con_state_t));
     memset(stream, 0, sizeof(http2_client_child_con_state_t));
-    // stream->stream_id = nghttp2_submit_request2(con->session, NULL,  &nvs[0], nvlen, NULL,stream);
-    stream->stream_id          = nghttp2_submit_headers(con->session, flags, -1, NULL, &nvs[0], nvlen, stream);
+
+    if (con->framer)
+    {
+        // connections that got a goaway are never handed out again, so a stream id is always available
+        stream->fstream = http2FramerOpenStream(con->framer, stream);
+        assert(stream->fstream);
+        stream->stream_id = (int32_t) stream->fstream->id;
+        http2FramerSendHeaders(con->framer, stream->fstream, headers, hlen, false);
+    }
+    else
+    {
+        nghttp2_nv nvs[15];
+        for (int i = 0; i < hlen; i++)
+        {
+            nvs[i] = makeNV(headers[i].name, headers[i].value);
+        }
+        // stream->stream_id = nghttp2_submit_request2(con->session, NULL,  &nvs[0], nvlen, NULL,stream);
+        stream->stream_id = nghttp2_submit_headers(con->session, flags, -1, NULL, &nvs[0], hlen, stream);
+    }
     stream->grpc_buffer_stream = newBufferStream(getLineBufferPool(con->line));
     stream->parent             = con->line;
     stream->line               = child_line;
@@ -187,6 +231,13 @@ static http2_client_con_state_t *createHttp2Connection(tunnel_t *self, int tid)
     setupLineDownSide(con->line, onH2LinePaused, con, onH2LineResumed);
 
     hevent_set_userdata(con->ping_timer, con);
+
+    if (state->native_engine)
+    {
+        con->framer = newHttp2Framer(getWorkerBufferPool(tid), false, state->content_type == kApplicationGrpc);
+        return con;
+    }
+
     nghttp2_session_client_new2(&con->session, state->cbs, con, state->ngoptions);
     nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, kMaxConcurrentStreams},
                                          {NGHTTP2_SETTINGS_MAX_FRAME_SIZE, (1U << 18)},
@@ -194,6 +245,8 @@ static http2_client_con_state_t *createHttp2Connection(tunnel_t *self, int tid)
 
     };
     nghttp2_submit_settings(con->session, NGHTTP2_FLAG_NONE, settings, ARRAY_SIZE(settings));
+    // data frames are flow controlled by nghttp2, so the connection window must not be the bottleneck
+    nghttp2_session_set_local_window_size(con->session, NGHTTP2_FLAG_NONE, 0, kHttp2ConnectionWindow);
 
     return con;
 }
@@ -232,7 +285,16 @@ static void deleteHttp2Connection(http2_client_con_state_t *con)
     action_queue_t_drop(&con->actions);
     doneLineDownSide(con->line);
     LSTATE_DROP(con->line);
+    if (con->framer)
+    {
+        destroyHttp2Framer(con->framer);
+    }
     nghttp2_session_del(con->session);
+    http2DataSourceDestroyAll(&con->data_sources);
+    if (con->out_buf)
+    {
+        reuseBuffer(getLineBufferPool(con->line), con->out_buf);
+    }
     destroyContextQueue(con->queue);
     destroyLine(con->line);
     htimer_del(con->ping_timer);
@@ -251,7 +313,8 @@ static http2_client_con_state_t *takeHttp2Connection(tunnel_t *self, int tid)
         http2_client_con_state_t *con = NULL;
         c_foreach(k, vec_cons, *vector)
         {
-            if ((*k.ref)->childs_added < state->concurrency)
+            if ((*k.ref)->childs_added < state->concurrency &&
+                ! ((*k.ref)->framer && http2FramerWantsClose((*k.ref)->framer)))
             {
                 (*k.ref)->childs_added += 1;
                 con = (*k.ref);
@@ -278,6 +341,16 @@ static http2_client_con_state_t *takeHttp2Connection(tunnel_t *self, int tid)
     return con;
 }
 
+// the peer sent goaway (or broke the protocol) and nothing is left to send or receive
+static bool isHttp2ConnectionDone(http2_client_con_state_t *con)
+{
+    if (con->framer)
+    {
+        return http2FramerWantsClose(con->framer) && con->root.next == NULL;
+    }
+    return nghttp2_session_want_read(con->session) == 0 && nghttp2_session_want_write(con->session) == 0;
+}
+
 static void onPingTimer(htimer_t *timer)
 {
     http2_client_con_state_t *con = hevent_userdata(timer);
@@ -292,23 +365,21 @@ static void onPingTimer(htimer_t *timer)
     else
     {
         con->no_ping_ack = true;
-        nghttp2_submit_ping(con->session, 0, NULL);
-        char   *data = NULL;
-        size_t  len;
+        if (con->framer)
+        {
+            http2FramerPing(con->framer);
+        }
+        else
+        {
+            nghttp2_submit_ping(con->session, 0, NULL);
+        }
         line_t *h2line = con->line;
         lockLine(h2line);
-        while (0 < (len = nghttp2_session_mem_send2(con->session, (const uint8_t **) &data)))
+        while (sendNgHttp2Data(con->tunnel, con))
         {
-            shift_buffer_t *send_buf = popBuffer(getLineBufferPool(h2line));
-            setLen(send_buf, len);
-            writeRaw(send_buf, data, len);
-            context_t *req = newContext(h2line);
-            req->payload   = send_buf;
-            con->tunnel->up->upStream(con->tunnel->up, req);
             if (! isAlive(h2line))
             {
-                unLockLine(h2line);
-                return;
+                break;
             }
         }
         unLockLine(h2line);
@@ -23,6 +23,16 @@ static int onStreamClosedCallback(nghttp2_session *session, int32_t stream_id, u
     // todo (optimize) nghttp2 is calling this callback even if we close the con ourselves
     // this should be omitted
 
+    http2_data_source_t *src = http2DataSourceFind(con->data_sources, stream_id);
+    if (src)
+    {
+        if (stream)
+        {
+            stream->data_source = NULL;
+        }
+        http2DataSourceDestroy(src);
+    }
+
     if (! stream)
     {
         return 0;
@@ -109,9 +119,8 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
         return 0;
     }
 
-    shift_buffer_t *buf = popBuffer(getLineBufferPool(con->line));
-    setLen(buf, len);
-    writeRaw(buf, data, len);
+    shift_buffer_t *buf = http2TakeRecvChunk(getLineBufferPool(con->line), getWorkerShiftBufferPool(con->line->tid),
+                                             con->recv_buf, data, len);
     lockLine(stream->line);
 
     action_queue_t_push(
@@ -190,65 +199,96 @@ static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *fr
     return 0;
 }
 
+static int onSendDataCallback(nghttp2_session *session, nghttp2_frame *frame, const uint8_t *framehd, size_t length,
+                              nghttp2_data_source *source, void *userdata)
+{
+    http2_client_con_state_t *con = (http2_client_con_state_t *) userdata;
+    assert(frame->data.padlen == 0);
+
+    http2AppendBuffer(getLineBufferPool(con->line), &con->out_buf,
+                      http2DataSourceTakeFrame(source->ptr, framehd, length));
+
+    http2_client_child_con_state_t *stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (stream)
+    {
+        con->current_stream_write_line = stream->line;
+    }
+
+    // let the caller write what is merged so far, instead of copying more large frames behind it
+    if (bufLen(con->out_buf) >= kHttp2CoalesceLimit)
+    {
+        return NGHTTP2_ERR_PAUSE;
+    }
+    return 0;
+}
+
 static void sendStreamData(http2_client_con_state_t *con, http2_client_child_con_state_t *stream, shift_buffer_t *buf)
 {
-    http2_flag flags = kHttP2FlagNone;
     if (WW_UNLIKELY(! stream))
     {
         reuseBuffer(getLineBufferPool(con->line), buf);
         return;
     }
 
-    if (con->content_type == kApplicationGrpc)
+    if (con->framer)
     {
-        grpc_message_hd msghd;
-        msghd.flags  = 0;
-        msghd.length = bufLen(buf);
-        flags        = kHttP2FlagNone;
-        shiftl(buf, GRPC_MESSAGE_HDLEN);
-        grpcMessageHdPack(&msghd, rawBufMut(buf));
+        // out of send window, the payload stays queued in the framer until the peer returns credit
+        if (! http2FramerSendData(con->framer, stream->fstream, buf) && ! stream->paused)
+        {
+            stream->paused = true;
+            pauseLineDownSide(stream->line);
+        }
+        return;
     }
 
-    http2_frame_hd framehd;
-    framehd.length    = bufLen(buf);
-    framehd.type      = kHttP2Data;
-    framehd.flags     = flags;
-    framehd.stream_id = stream->stream_id;
-    shiftl(buf, HTTP2_FRAME_HDLEN);
-    http2FrameHdPack(&framehd, rawBufMut(buf));
-    context_t *data                = newContext(con->line);
-    data->payload                  = buf;
-    line_t *h2_line = data->line;
-    // make sure line is not freed, to be able to pause it
-    lockLine(stream->line);
-    con->current_stream_write_line = stream->line;
-    con->tunnel->up->upStream(con->tunnel->up, data);
-    unLockLine(stream->line);
-    if (isAlive(h2_line))
-    {
-        con->current_stream_write_line = NULL;
-    }
+    http2SubmitPayload(con->session, &con->data_sources, &stream->data_source, stream->stream_id,
+                       getLineBufferPool(con->line), buf, con->content_type == kApplicationGrpc);
 }
 
+// writes everything nghttp2 has to send as one buffer, returns false when there was nothing
 static bool sendNgHttp2Data(tunnel_t *self, http2_client_con_state_t *con)
 {
-    line_t *main_line = con->line;
-    char   *buf       = NULL;
-    size_t  len       = nghttp2_session_mem_send(con->session, (const uint8_t **) &buf);
+    line_t        *main_line = con->line;
+    const uint8_t *data      = NULL;
+    nghttp2_ssize  len;
+
+    if (con->framer)
+    {
+        con->out_buf = http2FramerTakeOutput(con->framer);
+    }
+    else
+    {
+        while ((len = nghttp2_session_mem_send2(con->session, &data)) > 0)
+        {
+            http2AppendBytes(getLineBufferPool(main_line), &con->out_buf, data, len);
+        }
+    }
 
-    if (len > 0)
+    if (con->out_buf == NULL)
     {
-        shift_buffer_t *send_buf = popBuffer(getLineBufferPool(main_line));
-        shiftl(send_buf, lCap(send_buf) / 2); // use some unused space
-        setLen(send_buf, len);
-        writeRaw(send_buf, buf, len);
-        context_t *data = newContext(main_line);
-        data->payload   = send_buf;
-        self->up->upStream(self->up, data);
-        return true;
+        return false;
     }
 
-    return false;
+    context_t *req = newContext(main_line);
+    req->payload   = con->out_buf;
+    con->out_buf   = NULL;
+    line_t *s_line = con->current_stream_write_line;
+
+    // make sure stream line is not freed, to be able to pause it
+    if (s_line)
+    {
+        lockLine(s_line);
+    }
+    self->up->upStream(self->up, req);
+    if (s_line)
+    {
+        unLockLine(s_line);
+    }
+    if (isAlive(main_line))
+    {
+        con->current_stream_write_line = NULL;
+    }
+    return true;
 }
 
 static void doHttp2Action(const http2_action_t action, http2_client_con_state_t *con)
@@ -282,7 +322,8 @@ static void doHttp2Action(const http2_action_t action, http2_client_con_state_t
     break;
 
     case kActionStreamDataReceived: {
-        if (con->content_type == kApplicationGrpc)
+        // the native framer delivers whole grpc messages already
+        if (con->content_type == kApplicationGrpc && con->framer == NULL)
         {
             bufferStreamPush(stream->grpc_buffer_stream, action.buf);
 
@@ -290,11 +331,12 @@ static void doHttp2Action(const http2_action_t action, http2_client_con_state_t
             {
                 if (stream->grpc_bytes_needed == 0 && bufferStreamLen(stream->grpc_buffer_stream) >= GRPC_MESSAGE_HDLEN)
                 {
-                    shift_buffer_t *gheader_buf = bufferStreamRead(stream->grpc_buffer_stream, GRPC_MESSAGE_HDLEN);
+                    uint8_t         gheader[GRPC_MESSAGE_HDLEN];
                     grpc_message_hd msghd;
-                    grpcMessageHdUnpack(&msghd, rawBuf(gheader_buf));
+                    bufferStreamViewBytesAt(stream->grpc_buffer_stream, 0, gheader, GRPC_MESSAGE_HDLEN);
+                    bufferStreamSkip(stream->grpc_buffer_stream, GRPC_MESSAGE_HDLEN);
+                    grpcMessageHdUnpack(&msghd, gheader);
                     stream->grpc_bytes_needed = msghd.length;
-                    reuseBuffer(getLineBufferPool(con->line), gheader_buf);
                 }
                 if (stream->grpc_bytes_needed > 0 &&
                     bufferStreamLen(stream->grpc_buffer_stream) >= stream->grpc_bytes_needed)
@@ -337,7 +379,14 @@ static void doHttp2Action(const http2_action_t action, http2_client_con_state_t
     case kActionStreamFinish: {
         context_t *fc   = newFinContext(stream->line);
         tunnel_t  *dest = stream->tunnel->dw;
-        nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+        if (con->framer)
+        {
+            http2FramerCloseStream(con->framer, stream->fstream);
+        }
+        else
+        {
+            nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+        }
         removeStream(con, stream);
         deleteHttp2Stream(stream);
         dest->downStream(dest, fc);
@@ -355,6 +404,151 @@ static void doHttp2Action(const http2_action_t action, http2_client_con_state_t
     unLockLine(action.stream_line);
 }
 
+static void onGoaway(tunnel_t *self, http2_client_con_state_t *con)
+{
+    http2_client_state_t *state = TSTATE(self);
+
+    // no new stream is opened on this connection, it is closed when its last stream finishes
+    vec_cons     *vector = &(state->thread_cpool[con->line->tid].cons);
+    vec_cons_iter it     = vec_cons_find(vector, con);
+    if (it.ref != vec_cons_end(vector).ref)
+    {
+        vec_cons_erase_at(vector, it);
+    }
+    con->childs_added = state->concurrency;
+}
+
+// turns one framer event into actions, the same actions the nghttp2 callbacks produce
+static void onFramerEvent(tunnel_t *self, http2_client_con_state_t *con, const http2_framer_event_t *ev)
+{
+    http2_client_child_con_state_t *stream = ev->stream ? ev->stream->userdata : NULL;
+
+    switch (ev->type)
+    {
+    case kHttp2EventHeaders:
+        if (! stream)
+        {
+            break;
+        }
+        if (ev->end_stream)
+        {
+            lockLine(stream->line);
+            action_queue_t_push(
+                &con->actions,
+                (http2_action_t) {.action_id = kActionStreamFinish, .stream_line = stream->line, .buf = NULL});
+            break;
+        }
+        con->handshake_completed = true;
+        flushWriteQueue(con);
+        lockLine(stream->line);
+        action_queue_t_push(&con->actions,
+                            (http2_action_t) {.action_id = kActionStreamEst, .stream_line = stream->line, .buf = NULL});
+        break;
+
+    case kHttp2EventData:
+        if (! stream)
+        {
+            reuseBuffer(getLineBufferPool(con->line), ev->buf);
+            break;
+        }
+        lockLine(stream->line);
+        action_queue_t_push(
+            &con->actions,
+            (http2_action_t) {.action_id = kActionStreamDataReceived, .stream_line = stream->line, .buf = ev->buf});
+        if (! ev->end_stream)
+        {
+            break;
+        }
+        // fallthrough
+    case kHttp2EventStreamEnd:
+    case kHttp2EventReset:
+        if (! stream)
+        {
+            break;
+        }
+        lockLine(stream->line);
+        action_queue_t_push(&con->actions, (http2_action_t) {.action_id   = kActionStreamFinish,
+                                                             .stream_line = stream->line,
+                                                             .buf         = NULL});
+        break;
+
+    case kHttp2EventWritable:
+        if (stream && stream->paused)
+        {
+            stream->paused = false;
+            resumeLineDownSide(stream->line);
+        }
+        break;
+
+    case kHttp2EventPingAck:
+        con->no_ping_ack = false;
+        break;
+
+    case kHttp2EventGoaway:
+        onGoaway(self, con);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// pulls the events of the fed bytes one by one, so a dead connection or stream is never touched
+static void recvFramerData(tunnel_t *self, http2_client_con_state_t *con)
+{
+    http2_client_state_t *state     = TSTATE(self);
+    line_t               *main_line = con->line;
+    http2_framer_event_t  ev;
+
+    lockLine(main_line);
+    while (http2FramerNextEvent(con->framer, &ev))
+    {
+        if (ev.type == kHttp2EventError)
+        {
+            LOGE("Http2Client: native framer closed a connection due to a protocol error");
+            sendNgHttp2Data(self, con);
+            if (isAlive(main_line))
+            {
+                context_t *fin_ctx = newFinContext(main_line);
+                deleteHttp2Connection(con);
+                self->up->upStream(self->up, fin_ctx);
+            }
+            unLockLine(main_line);
+            return;
+        }
+
+        onFramerEvent(self, con, &ev);
+
+        while (action_queue_t_size(&con->actions) > 0)
+        {
+            const http2_action_t action = action_queue_t_pull_front(&con->actions);
+            doHttp2Action(action, con);
+            if (! isAlive(main_line))
+            {
+                unLockLine(main_line);
+                return;
+            }
+        }
+    }
+
+    while (sendNgHttp2Data(self, con))
+    {
+        if (! isAlive(main_line))
+        {
+            unLockLine(main_line);
+            return;
+        }
+    }
+    unLockLine(main_line);
+
+    if (isHttp2ConnectionDone(con) || (con->root.next == NULL && con->childs_added >= state->concurrency))
+    {
+        context_t *con_fc = newFinContext(con->line);
+        deleteHttp2Connection(con);
+        self->up->upStream(self->up, con_fc);
+    }
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     http2_client_state_t *state = TSTATE(self);
@@ -370,23 +564,19 @@ static void upStream(tunnel_t *self, context_t *c)
             return;
         }
 
-        lockLine(con->line);
+        sendStreamData(con, stream, c->payload);
+        dropContexPayload(c);
 
+        lockLine(con->line);
         while (sendNgHttp2Data(self, con))
         {
             if (! isAlive(con->line))
             {
-                unLockLine(con->line);
-                destroyContext(c);
-                return;
+                break;
             }
         }
-
-        sendStreamData(con, stream, c->payload);
-        
         unLockLine(con->line);
 
-        dropContexPayload(c);
         destroyContext(c);
     }
     else
@@ -431,7 +621,18 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_DROP(c);
 
             int flags = NGHTTP2_FLAG_END_STREAM | NGHTTP2_FLAG_END_HEADERS;
-            if (con->content_type == kApplicationGrpc)
+            if (con->framer)
+            {
+                // an empty DATA frame ends the request after whatever is still queued on the stream
+                http2FramerEndStream(con->framer, stream->fstream, NULL, 0);
+                http2FramerCloseStream(con->framer, stream->fstream);
+            }
+            else if (stream->data_source)
+            {
+                // data is still queued on this stream, the trailer goes after it
+                http2FinishDataSource(con->session, stream->data_source);
+            }
+            else if (con->content_type == kApplicationGrpc)
             {
                 nghttp2_nv nv = makeNV("grpc-status", "0");
                 nghttp2_submit_headers(con->session, flags, stream->stream_id, NULL, &nv, 1, NULL);
@@ -441,7 +642,10 @@ static void upStream(tunnel_t *self, context_t *c)
                 nghttp2_submit_headers(con->session, flags, stream->stream_id, NULL, NULL, 0, NULL);
             }
             // LOGD("closing -> %d", (int) stream->stream_id);
-            nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+            if (! con->framer)
+            {
+                nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+            }
             removeStream(con, stream);
             deleteHttp2Stream(stream);
 
@@ -477,11 +681,22 @@ static void downStream(tunnel_t *self, context_t *c)
     http2_client_con_state_t *con   = CSTATE(c);
     if (c->payload != NULL)
     {
+        if (con->framer)
+        {
+            http2FramerFeed(con->framer, c->payload);
+            dropContexPayload(c);
+            destroyContext(c);
+            recvFramerData(self, con);
+            return;
+        }
+
         size_t len = 0;
         while ((len = bufLen(c->payload)) > 0)
         {
-            size_t  consumed = min(1 << 15UL, (ssize_t) len);
-            ssize_t ret      = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
+            size_t consumed = min(1 << 15UL, (ssize_t) len);
+            con->recv_buf   = c->payload;
+            ssize_t ret     = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
+            con->recv_buf   = NULL;
             shiftr(c->payload, consumed);
 
             if (ret != (ssize_t) consumed)
@@ -525,7 +740,7 @@ static void downStream(tunnel_t *self, context_t *c)
                     return;
                 }
             }
-            if (nghttp2_session_want_read(con->session) == 0 && nghttp2_session_want_write(con->session) == 0)
+            if (isHttp2ConnectionDone(con))
             {
                 context_t *fin_ctx = newFinContext(con->line);
                 deleteHttp2Connection(con);
@@ -570,6 +785,8 @@ tunnel_t *newHttp2Client(node_instance_context_t *instance_info)
     nghttp2_session_callbacks_set_on_data_chunk_recv_callback(state->cbs, onDataChunkRecvCallback);
     nghttp2_session_callbacks_set_on_frame_recv_callback(state->cbs, onFrameRecvCallback);
     nghttp2_session_callbacks_set_on_stream_close_callback(state->cbs, onStreamClosedCallback);
+    nghttp2_session_callbacks_set_send_data_callback(state->cbs, onSendDataCallback);
+    nghttp2_session_callbacks_set_data_source_read_length_callback2(state->cbs, onHttp2DataSourceReadLength);
 
     for (size_t i = 0; i < getWorkersCount(); i++)
     {
@@ -602,6 +819,20 @@ tunnel_t *newHttp2Client(node_instance_context_t *instance_info)
     getIntFromJsonObjectOrDefault(&(int_concurrency), settings, "concurrency", kDefaultConcurrency);
     state->concurrency = int_concurrency;
 
+    char *engine_buf = NULL;
+    getStringFromJsonObjectOrDefault(&engine_buf, settings, "engine", "nghttp2");
+    if (strcmp(engine_buf, "native") == 0)
+    {
+        state->native_engine = true;
+    }
+    else if (strcmp(engine_buf, "nghttp2") != 0)
+    {
+        LOGF("JSON Error: Http2Client->settings->engine (string field) : expected \"nghttp2\" or \"native\"");
+        globalFree(engine_buf);
+        return NULL;
+    }
+    globalFree(engine_buf);
+
     nghttp2_option_new(&(state->ngoptions));
     nghttp2_option_set_peer_max_concurrent_streams(state->ngoptions, 0xffffffffU);
     nghttp2_option_set_no_closed_streams(state->ngoptions, 1);
@@ -3,6 +3,8 @@
 #include "buffer_stream.h"
 #include "grpc_def.h"
 #include "http2_def.h"
+#include "http2_framer.h"
+#include "http2_io.h"
 #include "http_def.h"
 #include "loggers/network_logger.h"
 #include "nghttp2/nghttp2.h"
@@ -32,6 +34,8 @@ typedef struct http2_client_child_con_state_s
     struct http2_client_child_con_state_s *prev, *next;
     nghttp2_stream                        *ng_stream;
     buffer_stream_t                       *grpc_buffer_stream;
+    http2_data_source_t                   *data_source;
+    http2_framer_stream_t                 *fstream; // native engine only
     tunnel_t                              *tunnel;
     line_t                                *parent;
     line_t                                *line;
@@ -46,6 +50,10 @@ typedef struct http2_client_con_state_s
     http2_client_child_con_state_t root;
     action_queue_t                 actions;
     nghttp2_session               *session;
+    http2_framer_t                *framer; // set instead of session when the native engine is used
+    http2_data_source_t           *data_sources;
+    shift_buffer_t                *out_buf;  // frames of the current flush
+    shift_buffer_t                *recv_buf; // buffer being parsed by nghttp2
     context_queue_t               *queue;
     htimer_t                      *ping_timer;
     tunnel_t                      *tunnel;
@@ -89,5 +97,6 @@ typedef struct http2_client_state_s
     size_t                     concurrency;
     int                        host_port;
     int                        last_iid;
+    bool                       native_engine;
     thread_connection_pool_t   thread_cpool[];
 } http2_client_state_t;
@@ -2,14 +2,28 @@
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
 #include "mux_frame.h"
+#include "mux_scheduler.h"
 #include "utils/jsonutils.h"
 
+// how a main connection retires, a retired one takes no new children and closes once it is idle
 enum concurrency_mode
 {
+    kCuncurrencyModeNone    = 0,
     kCuncurrencyModeTimer   = 1,
     kCuncurrencyModeCounter = 2
 };
 
+enum
+{
+    kDefaultMaxChildren    = 16,
+    kDefaultMaxInflightKB  = 1024,
+    kDefaultMaxConnections = 8,
+    kChildLoadBytes        = 1 << 14, // cost of one child when comparing parents
+    kRttLoadBytes          = 1 << 10, // cost of one millisecond of rtt when comparing parents
+    kRttOverloadFactor     = 2,       // a parent whose rtt doubled over its lowest one is queueing
+    kRttOverloadSlackUs    = 5000     // but a few milliseconds of jitter on a short path are not
+};
+
 #define i_type    vec_cons                        // NOLINT
 #define i_key     struct mux_client_con_state_s * // NOLINT
 #define i_use_cmp                                 // NOLINT
@@ -17,18 +31,20 @@ enum concurrency_mode
 
 typedef struct thread_connection_pool_s
 {
-    vec_cons cons;
-    size_t   round_index;
+    vec_cons cons; // main connections that take new children
 
 } thread_connection_pool_t;
 
 typedef struct mux_client_state_s
 {
-    enum concurrency_mode    mode;
-    uint32_t                 connection_cunc_duration;
-    uint32_t                 connection_cunc_capacity;
-    uint32_t                 width;
-    thread_connection_pool_t threadlocal_cons[];
+    thread_connection_pool_t *threadlocal_cons;
+    enum concurrency_mode     mode;
+    uint32_t                  connection_cunc_duration;
+    uint32_t                  connection_cunc_capacity;
+    uint32_t                  max_children;
+    uint32_t                  max_connections;
+    uint64_t                  max_inflight;
+    bool                      flow_control;
 
 } mux_client_state_t;
 
@@ -39,11 +55,8 @@ typedef struct mux_client_child_con_state_s
     tunnel_t                            *tunnel;
     line_t                              *line;
     line_t                              *parent;
-    uint32_t                             sent_nack;
-    uint32_t                             recv_nack;
+    mux_stream_t                        *stream;
     uint16_t                             cid;
-    bool                                 paused;
-    bool                                 first_sent;
 
 } mux_client_child_con_state_t;
 
@@ -53,59 +66,86 @@ typedef struct mux_client_con_state_s
 
     tunnel_t        *tunnel;
     line_t          *line;
-    line_t          *current_writing_line;
     buffer_stream_t *read_stream;
+    mux_scheduler_t *scheduler;
     uint64_t         creation_epoch;
+    uint64_t         ping_sent_at; // us, 0 while no ping is on the way
+    uint32_t         rtt;          // us, smoothed, only valid once rtt_sampled
+    uint32_t         min_rtt;      // us, the lowest sample
+    uint32_t         children;
     uint16_t         last_cid;
     uint16_t         cid_min;
     uint16_t         cid_max;
-    uint16_t         contained;
+    uint16_t         contained; // children taken over the whole life of the connection
+    bool             paused;
+    bool             want_ping;
+    bool             hello_pending; // flow control was offered, the answer of the server is the first frame
+    bool             recv_held;     // the main line is held for a paused child (no flow control)
+    bool             rtt_sampled;
+    uint8_t          features; // accepted by the server
 
 } mux_client_con_state_t;
 
+static bool flushMainConnection(mux_client_con_state_t *con);
+
+// without flow control the only way to stop a child's sender is to stop reading the main line
+static void syncMainLineRecv(mux_client_con_state_t *con)
+{
+    const bool hold = muxSchedulerRecvPaused(con->scheduler);
+    if (hold == con->recv_held)
+    {
+        return;
+    }
+    con->recv_held = hold;
+    if (hold)
+    {
+        holdLineUpSide(con->line);
+    }
+    else
+    {
+        releaseLineUpSide(con->line);
+    }
+}
+
 static void onChildLinePaused(void *arg)
 {
-    mux_client_child_con_state_t *stream = (mux_client_child_con_state_t *) arg;
-    pauseLineUpSide(stream->parent);
+    mux_client_child_con_state_t *child_con = (mux_client_child_con_state_t *) arg;
+    tunnel_t                     *self      = child_con->tunnel;
+    mux_client_con_state_t       *main_con  = LSTATE(child_con->parent);
+
+    muxSchedulerPauseRecv(main_con->scheduler, child_con->stream);
+    syncMainLineRecv(main_con);
 }
+
 static void onChildLineResumed(void *arg)
 {
-    mux_client_child_con_state_t *stream = (mux_client_child_con_state_t *) arg;
-    resumeLineUpSide(stream->parent);
+    mux_client_child_con_state_t *child_con = (mux_client_child_con_state_t *) arg;
+    tunnel_t                     *self      = child_con->tunnel;
+    mux_client_con_state_t       *main_con  = LSTATE(child_con->parent);
+
+    muxSchedulerResumeRecv(main_con->scheduler, child_con->stream);
+    syncMainLineRecv(main_con);
+    flushMainConnection(main_con);
 }
 
 static void onMainLinePaused(void *arg)
 {
-    mux_client_con_state_t *con  = (mux_client_con_state_t *) arg;
-    tunnel_t               *self = con->tunnel;
-
-    line_t *wline = con->current_writing_line;
-    if (wline && isAlive(wline))
-    {
-        mux_client_child_con_state_t *child_con = LSTATE(wline);
-        child_con->paused                       = true;
-        pauseLineDownSide(child_con->line);
-    }
+    mux_client_con_state_t *con = (mux_client_con_state_t *) arg;
+    con->paused                 = true;
 }
 
 static void onMainLineResumed(void *arg)
 {
-    mux_client_con_state_t       *con = (mux_client_con_state_t *) arg;
-    mux_client_child_con_state_t *child_con_i;
-    for (child_con_i = con->children_root.next; child_con_i;)
-    {
-        if (child_con_i->paused)
-        {
-            child_con_i->paused = false;
-            resumeLineDownSide(child_con_i->line);
-        }
-        child_con_i = child_con_i->next;
-    }
+    mux_client_con_state_t *con = (mux_client_con_state_t *) arg;
+    con->paused                 = false;
+    flushMainConnection(con);
 }
 
-static void destroyChildConnecton(mux_client_child_con_state_t *child)
+static void destroyChildConnecton(mux_client_child_con_state_t *child, bool notify_peer)
 {
-    tunnel_t *self    = child->tunnel;
+    tunnel_t               *self   = child->tunnel;
+    mux_client_con_state_t *parent = LSTATE(child->parent);
+
     child->prev->next = child->next;
     if (child->next)
     {
@@ -113,9 +153,10 @@ static void destroyChildConnecton(mux_client_child_con_state_t *child)
     }
     else
     {
-        mux_client_con_state_t *parent = LSTATE(child->parent);
-        parent->children_root.prev     = NULL;
+        parent->children_root.prev = NULL;
     }
+    parent->children -= 1;
+    muxSchedulerCloseStream(parent->scheduler, child->stream, notify_peer);
     doneLineUpSide(child->line);
     LSTATE_DROP(child->line);
     globalFree(child);
@@ -123,15 +164,20 @@ static void destroyChildConnecton(mux_client_child_con_state_t *child)
 
 static mux_client_child_con_state_t *createChildConnection(mux_client_con_state_t *parent, line_t *child_line)
 {
-    mux_client_child_con_state_t *child = globalMalloc(sizeof(mux_client_con_state_t));
+    mux_client_child_con_state_t *child = globalMalloc(sizeof(mux_client_child_con_state_t));
 
     *child = (mux_client_child_con_state_t) {.tunnel = parent->tunnel,
                                              .line   = child_line,
+                                             .parent = parent->line,
                                              .cid    = parent->last_cid++,
                                              .next   = parent->children_root.next,
                                              .prev   = &(parent->children_root)
 
     };
+    child->stream = muxSchedulerAddStream(parent->scheduler, child->cid, child, false);
+    parent->children += 1;
+    parent->contained += 1;
+    parent->want_ping = true; // a fresh rtt sample for the next selection
 
     if (parent->children_root.next == NULL)
     {
@@ -150,26 +196,46 @@ static mux_client_child_con_state_t *createChildConnection(mux_client_con_state_
 
 static void destroyMainConnecton(mux_client_con_state_t *con)
 {
-    tunnel_t *self = con->tunnel;
+    tunnel_t           *self   = con->tunnel;
+    mux_client_state_t *state  = TSTATE(self);
+    vec_cons           *vector = &(state->threadlocal_cons[con->line->tid].cons);
+
+    vec_cons_iter find_result = vec_cons_find(vector, con);
+    if (find_result.ref != vec_cons_end(vector).ref)
+    {
+        vec_cons_erase_at(vector, find_result);
+    }
 
     mux_client_child_con_state_t *child_con_i;
     for (child_con_i = con->children_root.next; child_con_i;)
     {
 
-        mux_client_child_con_state_t *next    = child_con_i;
+        mux_client_child_con_state_t *next    = child_con_i->next;
         context_t                    *fin_ctx = newFinContext(child_con_i->line);
         tunnel_t                     *dest    = con->tunnel->dw;
 
-        destroyChildConnecton(child_con_i);
+        destroyChildConnecton(child_con_i, false);
         dest->downStream(dest, fin_ctx);
         child_con_i = next;
     }
+    destroyMuxScheduler(con->scheduler);
     destroyBufferStream(con->read_stream);
     doneLineDownSide(con->line);
     LSTATE_DROP(con->line);
     globalFree(con);
 }
 
+// closes the main connection from our side, the upstream gets a fin
+static void closeMainConnection(mux_client_con_state_t *con)
+{
+    tunnel_t *self      = con->tunnel;
+    line_t   *main_line = con->line;
+
+    destroyMainConnecton(con);
+    self->up->upStream(self->up, newFinContext(main_line));
+    destroyLine(main_line);
+}
+
 static mux_client_con_state_t *createMainConnection(tunnel_t *self, tid_t tid)
 {
     mux_client_con_state_t *con = globalMalloc(sizeof(mux_client_con_state_t));
@@ -178,72 +244,143 @@ static mux_client_con_state_t *createMainConnection(tunnel_t *self, tid_t tid)
                                      .line           = newLine(tid),
                                      .children_root  = {0},
                                      .creation_epoch = hloop_now(getWorkerLoop(tid)),
-                                     .read_stream    = newBufferStream(getWorkerBufferPool(tid))};
+                                     .read_stream    = newBufferStream(getWorkerBufferPool(tid)),
+                                     .scheduler      = newMuxScheduler(getWorkerBufferPool(tid))};
 
     setupLineDownSide(con->line, onMainLinePaused, con, onMainLineResumed);
 
+    mux_client_state_t *state = TSTATE(self);
+    if (state->flow_control)
+    {
+        // the hello is the first frame, windows are used right away and the server refuses the connection if it
+        // does not agree
+        muxSchedulerEnableFlowControl(con->scheduler);
+        muxSchedulerHello(con->scheduler, kMuxFeatureFlow | kMuxFeaturePing);
+        con->hello_pending = true;
+    }
+
     LSTATE_MUT(con->line) = con;
+    self->up->upStream(self->up, newInitContext(con->line));
     return con;
 }
 
+static bool isRetired(mux_client_state_t *state, mux_client_con_state_t *con)
+{
+    switch (state->mode)
+    {
+    case kCuncurrencyModeCounter:
+        return con->contained >= state->connection_cunc_capacity;
+
+    case kCuncurrencyModeTimer:
+        return hloop_now(getWorkerLoop(con->line->tid)) >= con->creation_epoch + state->connection_cunc_duration;
+
+    default:
+    case kCuncurrencyModeNone:
+        return false;
+    }
+}
+
+// the rtt only counts once the ping feature gave samples, the threshold follows the path of each parent
+static bool isRttOverloaded(mux_client_con_state_t *con)
+{
+    if (! con->rtt_sampled)
+    {
+        return false;
+    }
+    const uint64_t limit =
+        max((uint64_t) con->min_rtt * kRttOverloadFactor, (uint64_t) con->min_rtt + kRttOverloadSlackUs);
+    return con->rtt >= limit;
+}
+
+static bool isOverloaded(mux_client_state_t *state, mux_client_con_state_t *con)
+{
+    return con->children >= state->max_children || isRttOverloaded(con) ||
+           muxSchedulerBytesInFlight(con->scheduler) >= state->max_inflight;
+}
+
+// what a new child would wait behind on this parent, in bytes
+static uint64_t loadOf(mux_client_con_state_t *con)
+{
+    return muxSchedulerBytesInFlight(con->scheduler) + (uint64_t) con->children * kChildLoadBytes +
+           (uint64_t) (con->rtt / 1000) * kRttLoadBytes;
+}
+
+static mux_client_con_state_t *openConnection(tunnel_t *self, tid_t tid)
+{
+    mux_client_state_t     *state = TSTATE(self);
+    mux_client_con_state_t *con   = createMainConnection(self, tid);
+    vec_cons_push(&(state->threadlocal_cons[tid].cons), con);
+    return con;
+}
+
+/*
+    the least loaded parent that is under every threshold takes the child, a new parent is opened if there is none
+    (and the limit allows it), when the child made every parent loaded a spare one is opened right away so it is
+    already connected for the next child
+*/
 static mux_client_con_state_t *grabConnection(tunnel_t *self, tid_t tid)
 {
     mux_client_state_t *state  = TSTATE(self);
     vec_cons           *vector = &(state->threadlocal_cons[tid].cons);
 
-    while (true)
-    {
-        unsigned int i = state->threadlocal_cons[tid].round_index;
-        state->threadlocal_cons[tid].round_index++;
-        if (state->threadlocal_cons[tid].round_index > state->width - 1)
-        {
-            state->threadlocal_cons[tid].round_index = 0;
-        }
+    mux_client_con_state_t *best           = NULL;
+    mux_client_con_state_t *best_loaded    = NULL;
+    uint64_t                best_load      = UINT64_MAX;
+    uint64_t                best_over_load = UINT64_MAX;
 
-        if ((unsigned int)vec_cons_size(vector) <= i)
+    for (size_t i = 0; i < (size_t) vec_cons_size(vector);)
+    {
+        mux_client_con_state_t *con = *vec_cons_at(vector, (ptrdiff_t) i);
+        if (isRetired(state, con))
         {
-            mux_client_con_state_t *con = createMainConnection(self, tid);
-            vec_cons_push(vector, con);
-            return con;
+            // it stays open for its children, shouldClose finishes it
+            vec_cons_erase_n(vector, (ptrdiff_t) i, 1);
+            continue;
         }
-        struct mux_client_con_state_s *con = *vec_cons_at(vector, i);
 
-        switch (state->mode)
+        const uint64_t load = loadOf(con);
+        if (! isOverloaded(state, con))
         {
-        default:
-        case kCuncurrencyModeCounter:
-            if (con->contained < state->connection_cunc_capacity)
-            {
-                con->contained += 1;
-                if (con->contained >= state->connection_cunc_capacity)
-                {
-                    vec_cons_erase_n(vector, i, 1);
-                }
-                return con;
-            }
-            else
+            if (load < best_load)
             {
-                vec_cons_erase_n(vector, i, 1);
-                return grabConnection(self, tid);
+                best_load = load;
+                best      = con;
             }
+        }
+        else if (load < best_over_load)
+        {
+            best_over_load = load;
+            best_loaded    = con;
+        }
+        i++;
+    }
 
-            break;
+    if (best == NULL)
+    {
+        if (best_loaded == NULL || (size_t) vec_cons_size(vector) < state->max_connections)
+        {
+            return openConnection(self, tid);
+        }
+        return best_loaded;
+    }
 
-        case kCuncurrencyModeTimer:
-            if (con->creation_epoch < hloop_now(getWorkerLoop(tid)) + state->connection_cunc_duration)
+    if ((size_t) vec_cons_size(vector) < state->max_connections && best->children + 1 >= state->max_children)
+    {
+        bool spare = false;
+        c_foreach(k, vec_cons, *vector)
+        {
+            if (*k.ref != best && ! isOverloaded(state, *k.ref))
             {
-                return con;
+                spare = true;
                 break;
             }
-            else
-            {
-                vec_cons_erase_n(vector, i, 1);
-                return grabConnection(self, tid);
-            }
-
-            break;
+        }
+        if (! spare)
+        {
+            openConnection(self, tid);
         }
     }
+    return best;
 }
 
 static bool shouldClose(tunnel_t *self, mux_client_con_state_t *main_con)
@@ -252,101 +389,133 @@ static bool shouldClose(tunnel_t *self, mux_client_con_state_t *main_con)
     tid_t               tid    = main_con->line->tid;
     vec_cons           *vector = &(state->threadlocal_cons[tid].cons);
 
-    switch (state->mode)
+    if (! isRetired(state, main_con) || main_con->children_root.next != NULL ||
+        ! muxSchedulerIsIdle(main_con->scheduler))
     {
-    default:
-    case kCuncurrencyModeCounter:
-        if (main_con->contained >= state->connection_cunc_capacity && main_con->children_root.next == NULL)
-        {
-            vec_cons_iter find_result = vec_cons_find(vector, main_con);
-            if (find_result.ref != vec_cons_end(vector).ref)
-            {
-                vec_cons_erase_at(vector, find_result);
-            }
-            return true;
-        }
-        break;
-
-    case kCuncurrencyModeTimer:
-        if (main_con->creation_epoch >= hloop_now(getWorkerLoop(tid)) + state->connection_cunc_duration)
-        {
-            vec_cons_iter find_result = vec_cons_find(vector, main_con);
-            if (find_result.ref != vec_cons_end(vector).ref)
-            {
-                vec_cons_erase_at(vector, find_result);
-            }
-            return true;
-        }
+        return false;
+    }
 
-        break;
+    vec_cons_iter find_result = vec_cons_find(vector, main_con);
+    if (find_result.ref != vec_cons_end(vector).ref)
+    {
+        vec_cons_erase_at(vector, find_result);
     }
-    return false;
+    return true;
 }
 
-static void upStream(tunnel_t *self, context_t *c)
+static void sampleRtt(mux_client_con_state_t *con, uint64_t since)
 {
-    mux_client_child_con_state_t *child_con = CSTATE(c);
-    if (c->payload != NULL)
+    const uint64_t now    = hloop_now_us(getWorkerLoop(con->line->tid));
+    const uint32_t sample = now > since ? (uint32_t) min(now - since, (uint64_t) UINT32_MAX) : 0;
+
+    if (! con->rtt_sampled)
     {
-        line_t *current_writing_line = c->line;
-        line_t *main_line            = child_con->parent;
+        con->rtt_sampled = true;
+        con->rtt         = sample;
+        con->min_rtt     = sample;
+        return;
+    }
+    con->rtt     = (uint32_t) (((uint64_t) con->rtt * 7 + sample) / 8);
+    con->min_rtt = min(con->min_rtt, sample);
+}
 
-        switchLine(c, main_line);
-        mux_client_con_state_t *main_con = CSTATE(c);
+/*
+    writes what the scheduler has for the main line as long as it is not paused, then resumes the children that
+    drained their queue, returns false if the main connection is gone
+*/
+static bool flushMainConnection(mux_client_con_state_t *con)
+{
+    tunnel_t *self      = con->tunnel;
+    line_t   *main_line = con->line;
 
-        lockLine(main_line);
-        lockLine(current_writing_line);
-        main_con->current_writing_line = current_writing_line;
+    if (con->want_ping && con->ping_sent_at == 0 && ! con->paused && (con->features & kMuxFeaturePing))
+    {
+        // timed from here, it goes out with this flush
+        muxSchedulerPing(con->scheduler);
+        con->want_ping    = false;
+        con->ping_sent_at = hloop_now_us(getWorkerLoop(main_line->tid));
+    }
 
-        while (bufLen(c->payload) > kMuxMaxFrameLength)
+    lockLine(main_line);
+    shift_buffer_t *buf;
+    while (! con->paused && (buf = muxSchedulerNextOutput(con->scheduler)) != NULL)
+    {
+        context_t *ctx = newContext(main_line);
+        ctx->payload   = buf;
+        self->up->upStream(self->up, ctx);
+
+        if (! isAlive(main_line))
         {
-            shift_buffer_t *chunk = popBuffer(getContextBufferPool(c));
-            sliceBufferTo(chunk, c->payload, kMuxMaxFrameLength);
+            unLockLine(main_line);
+            return false;
+        }
+    }
 
-            if (! child_con->first_sent)
-            {
-                child_con->first_sent = true;
-                makeOpenFrame(chunk, child_con->cid);
-            }
-            else
-            {
-                makeDataFrame(chunk, child_con->cid);
-            }
+    mux_stream_t *stream;
+    while ((stream = muxSchedulerNextWritable(con->scheduler)) != NULL)
+    {
+        mux_client_child_con_state_t *child_con = stream->userdata;
+        resumeLineDownSide(child_con->line);
+    }
 
-            context_t *data_chunk_ctx = newContextFrom(c);
-            data_chunk_ctx->payload   = chunk;
-            self->up->upStream(self->up, data_chunk_ctx);
+    if (! isAlive(main_line))
+    {
+        unLockLine(main_line);
+        return false;
+    }
+    unLockLine(main_line);
 
-            if (! isAlive(main_line))
-            {
-                unLockLine(main_line);
-                unLockLine(current_writing_line);
+    if (shouldClose(self, con))
+    {
+        closeMainConnection(con);
+        return false;
+    }
+    return true;
+}
 
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
-            }
-        }
+// a connection that offered flow control gets the answer of the server as its first frame
+static bool checkHelloAnswer(mux_client_con_state_t *con, const mux_frame_t *frame, shift_buffer_t *frame_payload)
+{
+    if (! con->hello_pending || frame->flags != kMuxFlagHello)
+    {
+        LOGE("MuxClient: flow-control has to be enabled on both MuxClient and MuxServer");
+        return false;
+    }
 
-        if (! child_con->first_sent)
-        {
-            child_con->first_sent = true;
-            makeOpenFrame(c->payload, child_con->cid);
-        }
-        else
-        {
-            makeDataFrame(c->payload, child_con->cid);
-        }
+    mux_hello_t hello;
+    if (WW_UNLIKELY(bufLen(frame_payload) != sizeof(hello)))
+    {
+        LOGE("MuxClient: malformed hello frame");
+        return false;
+    }
+    readRaw(frame_payload, &hello, sizeof(hello));
 
-        self->up->upStream(self->up, c);
+    if (hello.version != kMuxVersion || (hello.features & kMuxFeatureFlow) == 0)
+    {
+        LOGE("MuxClient: the server did not accept flow-control (version %d)", (int) hello.version);
+        return false;
+    }
+    con->hello_pending = false;
+    con->features      = hello.features & (kMuxFeatureFlow | kMuxFeaturePing);
+    // the first rtt sample
+    con->want_ping = true;
+    return true;
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    mux_client_child_con_state_t *child_con = CSTATE(c);
+    if (c->payload != NULL)
+    {
+        mux_client_con_state_t *main_con = LSTATE(child_con->parent);
 
-        if (isAlive(main_line))
+        if (! muxSchedulerWrite(main_con->scheduler, child_con->stream, c->payload))
         {
-            main_con->current_writing_line = NULL;
+            pauseLineDownSide(c->line);
         }
-
-        unLockLine(main_line);
-        unLockLine(current_writing_line);
+        dropContexPayload(c);
+        destroyContext(c);
+        flushMainConnection(main_con);
     }
     else
     {
@@ -363,28 +532,11 @@ static void upStream(tunnel_t *self, context_t *c)
         {
             mux_client_con_state_t *main_con = LSTATE(child_con->parent);
 
-            context_t *data_fin_ctx = newContext(child_con->parent);
-            data_fin_ctx->payload   = popBuffer(getLineBufferPool(child_con->parent));
-            makeCloseFrame(data_fin_ctx->payload, child_con->cid);
-            destroyChildConnecton(child_con);
-            lockLine(main_con->line);
-            self->up->upStream(self->up, data_fin_ctx);
-
-            if (! isAlive(main_con->line))
-            {
-                unLockLine(main_con->line);
-                return;
-            }
-            unLockLine(main_con->line);
-
-            if (shouldClose(self, main_con))
-            {
-                context_t *main_con_fin_ctx = newFinContext(main_con->line);
-                destroyMainConnecton(main_con);
-                self->up->upStream(self->up, main_con_fin_ctx);
-            }
-
+            // the close frame goes out after the queued payload of the child
+            destroyChildConnecton(child_con, true);
             destroyContext(c);
+            syncMainLineRecv(main_con);
+            flushMainConnection(main_con);
         }
     }
 }
@@ -395,27 +547,29 @@ static void downStream(tunnel_t *self, context_t *c)
 
     if (WW_UNLIKELY(c->est))
     {
+        // the rtt is seeded by the first ping, the connect time also holds the handshakes of the nodes above
         destroyContext(c);
         return;
     }
     if (c->fin)
     {
+        line_t *main_line = c->line;
         destroyMainConnecton(main_con);
         destroyContext(c);
+        destroyLine(main_line);
         return;
     }
     assert(c->payload != NULL);
 
     bufferStreamPushContextPayload(main_con->read_stream, c);
-    while (bufferStreamLen(main_con->read_stream) > sizeof(mux_frame_t))
+    while (bufferStreamLen(main_con->read_stream) >= sizeof(mux_frame_t))
     {
         mux_length_t length;
         bufferStreamViewBytesAt(main_con->read_stream, 0, (uint8_t *) &length, 2);
         if (WW_UNLIKELY(length < kMuxMinFrameLength))
         {
             LOGE("MuxClient: payload length < kMuxMinFrameLength");
-            destroyMainConnecton(main_con);
-            self->up->upStream(self->up, newFinContext(c->line));
+            closeMainConnection(main_con);
             destroyContext(c);
             return;
         }
@@ -428,58 +582,108 @@ static void downStream(tunnel_t *self, context_t *c)
             memcpy(&frame, rawBuf(frame_payload), sizeof(mux_frame_t));
             shiftr(frame_payload, sizeof(mux_frame_t));
 
-            mux_client_child_con_state_t *child_con_i;
-            for (child_con_i = main_con->children_root.next; child_con_i;)
+            if (WW_UNLIKELY(main_con->hello_pending || frame.flags == kMuxFlagHello))
             {
-                if (child_con_i->cid == frame.cid)
+                const bool accepted = checkHelloAnswer(main_con, &frame, frame_payload);
+                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                if (! accepted)
                 {
+                    closeMainConnection(main_con);
+                    destroyContext(c);
+                    return;
+                }
+                continue;
+            }
 
-                    switch (frame.flags)
-                    {
-                    case kMuxFlagClose: {
-                        reuseBuffer(getLineBufferPool(c->line), frame_payload);
-                        context_t *fin_ctx = newFinContext(child_con_i->line);
-                        destroyChildConnecton(child_con_i);
-                        self->dw->downStream(self->dw, fin_ctx);
-                        frame_payload = NULL;
-                    }
+            if (frame.flags == kMuxFlagPing)
+            {
+                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                if (WW_UNLIKELY((main_con->features & kMuxFeaturePing) == 0))
+                {
+                    LOGE("MuxClient: ping frame without the ping feature");
+                    closeMainConnection(main_con);
+                    destroyContext(c);
+                    return;
+                }
+                if (main_con->ping_sent_at != 0)
+                {
+                    sampleRtt(main_con, main_con->ping_sent_at);
+                    main_con->ping_sent_at = 0;
+                }
+                continue;
+            }
 
-                    break;
+            if (frame.flags == kMuxFlagFlow)
+            {
+                // the child may already be closed on our side while its last payload waits for this credit
+                uint32_t credit;
+                if (WW_UNLIKELY(bufLen(frame_payload) != sizeof(credit)))
+                {
+                    LOGE("MuxClient: malformed flow frame");
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    closeMainConnection(main_con);
+                    destroyContext(c);
+                    return;
+                }
+                readRaw(frame_payload, &credit, sizeof(credit));
+                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                muxSchedulerOnFlow(main_con->scheduler, frame.cid, credit);
+                continue;
+            }
 
-                    case kMuxFlagData: {
-
-                        if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
-                        {
-                            LOGE("MuxClient: payload length <= 0");
-                            reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                            destroyMainConnecton(main_con);
-                            self->up->upStream(self->up, newFinContext(c->line));
-                            destroyContext(c);
-                            return;
-                        }
-                        context_t *data_ctx = newContext(child_con_i->line);
-                        data_ctx->payload   = frame_payload;
-                        self->dw->downStream(self->dw, data_ctx);
-                        frame_payload = NULL;
-                    }
+            mux_stream_t                 *stream      = muxSchedulerFindStream(main_con->scheduler, frame.cid);
+            mux_client_child_con_state_t *child_con_i = stream ? stream->userdata : NULL;
+            if (child_con_i)
+            {
+                switch (frame.flags)
+                {
+                case kMuxFlagClose: {
+                    reuseBuffer(getLineBufferPool(c->line), frame_payload);
+                    context_t *fin_ctx = newFinContext(child_con_i->line);
+                    destroyChildConnecton(child_con_i, false);
+                    syncMainLineRecv(main_con);
+                    self->dw->downStream(self->dw, fin_ctx);
+                    frame_payload = NULL;
+                }
 
-                    break;
+                break;
 
-                    case kMuxFlagFlow:
-                        LOGE("MuxClient: kMuxFlagFlow not implemented"); // fall through
-                    case kMuxFlagOpen:
-                    default:
-                        LOGE("MuxClient: incorrect frame flag");
+                case kMuxFlagData: {
+
+                    if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
+                    {
+                        LOGE("MuxClient: payload length <= 0");
                         reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                        destroyMainConnecton(main_con);
-                        self->up->upStream(self->up, newFinContext(c->line));
+                        closeMainConnection(main_con);
                         destroyContext(c);
                         return;
-                        break;
                     }
+                    if (WW_UNLIKELY(
+                            ! muxSchedulerOnData(main_con->scheduler, child_con_i->stream, bufLen(frame_payload))))
+                    {
+                        LOGE("MuxClient: peer ignored the flow window of cid: %d", (int) frame.cid);
+                        reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                        closeMainConnection(main_con);
+                        destroyContext(c);
+                        return;
+                    }
+                    context_t *data_ctx = newContext(child_con_i->line);
+                    data_ctx->payload   = frame_payload;
+                    self->dw->downStream(self->dw, data_ctx);
+                    frame_payload = NULL;
+                }
+
+                break;
+
+                case kMuxFlagOpen:
+                default:
+                    LOGE("MuxClient: incorrect frame flag");
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    closeMainConnection(main_con);
+                    destroyContext(c);
+                    return;
                     break;
                 }
-                child_con_i = child_con_i->next;
             }
             if (frame_payload != NULL)
             {
@@ -497,16 +701,72 @@ static void downStream(tunnel_t *self, context_t *c)
             break;
         }
     }
+
+    // credits and resumed children
+    destroyContext(c);
+    flushMainConnection(main_con);
 }
 
 tunnel_t *newMuxClient(node_instance_context_t *instance_info)
 {
+    const cJSON *settings = instance_info->node_settings_json;
+
+    if (! cJSON_IsObject(settings) && settings != NULL)
+    {
+        LOGF("JSON Error: MuxClient->settings (object field) : The object was empty or invalid");
+        return NULL;
+    }
 
     mux_client_state_t *state = globalMalloc(sizeof(mux_client_state_t));
     memset(state, 0, sizeof(mux_client_state_t));
 
-    const cJSON *settings = instance_info->node_settings_json;
-    (void) settings;
+    char *mode_str = NULL;
+    if (getStringFromJsonObject(&mode_str, settings, "concurrency-mode"))
+    {
+        int value = 0;
+        if (strcmp(mode_str, "timer") == 0)
+        {
+            state->mode = kCuncurrencyModeTimer;
+            getIntFromJsonObjectOrDefault(&value, settings, "concurrency-duration", 600);
+            state->connection_cunc_duration = (uint32_t) max(1, value);
+        }
+        else if (strcmp(mode_str, "counter") == 0)
+        {
+            state->mode = kCuncurrencyModeCounter;
+            getIntFromJsonObjectOrDefault(&value, settings, "concurrency-capacity", 64);
+            state->connection_cunc_capacity = (uint32_t) max(1, value);
+        }
+        else
+        {
+            LOGF("JSON Error: MuxClient->settings->concurrency-mode (string field) : mode \"%s\" is not supported, use "
+                 "\"timer\" or \"counter\"",
+                 mode_str);
+            globalFree(mode_str);
+            globalFree(state);
+            return NULL;
+        }
+        globalFree(mode_str);
+    }
+
+    int max_children    = 0;
+    int max_inflight    = 0;
+    int max_connections = 0;
+    getIntFromJsonObjectOrDefault(&max_children, settings, "max-children", kDefaultMaxChildren);
+    getIntFromJsonObjectOrDefault(&max_inflight, settings, "max-inflight", kDefaultMaxInflightKB);
+    getIntFromJsonObjectOrDefault(&max_connections, settings, "max-connections", kDefaultMaxConnections);
+
+    // per child flow control changes the wire format, the server needs the same setting
+    getBoolFromJsonObjectOrDefault(&(state->flow_control), settings, "flow-control", false);
+
+    state->max_children    = (uint32_t) max(1, max_children);
+    state->max_inflight    = (uint64_t) max(1, max_inflight) * 1024;
+    state->max_connections = (uint32_t) max(1, max_connections);
+
+    state->threadlocal_cons = globalMalloc(sizeof(thread_connection_pool_t) * getWorkersCount());
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        state->threadlocal_cons[i].cons = vec_cons_with_capacity(state->max_connections);
+    }
 
     tunnel_t *t   = newTunnel();
     t->state      = state;
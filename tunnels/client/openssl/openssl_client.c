@@ -18,6 +18,9 @@ typedef struct oss_client_state_s
     char *alpn;
     char *sni;
     bool  verify;
+    bool  session_resumption;
+
+    ssl_client_session_cache_t *session_cache;
 
 } oss_client_state_t;
 
@@ -163,6 +166,10 @@ static void upStream(tunnel_t *self, context_t *c)
             SSL_set_connect_state(cstate->ssl); /* sets ssl to work in client mode. */
             SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
             SSL_set_tlsext_host_name(cstate->ssl, state->sni);
+            if (state->session_resumption)
+            {
+                sslResumeCachedSession(cstate->ssl, state->sni);
+            }
             context_t *client_hello_ctx = newContextFrom(c);
             self->up->upStream(self->up, c);
             if (! isAlive(client_hello_ctx->line))
@@ -439,9 +446,16 @@ tunnel_t *newOpenSSLClient(node_instance_context_t *instance_info)
 
     getStringFromJsonObjectOrDefault(&(state->alpn), settings, "alpn", "http/1.1");
 
+    getBoolFromJsonObjectOrDefault(&(state->session_resumption), settings, "session-resumption", true);
+
     ssl_param->verify_peer = state->verify ? 1 : 0;
     ssl_param->endpoint    = kSslClient;
 
+    if (state->session_resumption)
+    {
+        state->session_cache = newSslClientSessionCache();
+    }
+
     size_t alpn_len = strlen(state->alpn);
 
     struct
@@ -464,6 +478,11 @@ tunnel_t *newOpenSSLClient(node_instance_context_t *instance_info)
         }
 
         SSL_CTX_set_alpn_protos(state->threadlocal_ssl_context[i], (const unsigned char *) ossl_alpn, 1 + alpn_len);
+
+        if (state->session_resumption)
+        {
+            sslCtxEnableClientSessionCache(state->threadlocal_ssl_context[i], state->session_cache);
+        }
     }
 
     globalFree(ssl_param);
@@ -49,7 +49,8 @@ static void doConnect(struct connect_arg *cg)
     tunnel_t                      *self   = cg->t;
     preconnect_client_con_state_t *cstate = createCstate(cg->tid);
     globalFree(cg);
-    LSTATE_MUT(cstate->u) = cstate;
+    cstate->connect_start_ms = hloop_now_ms(getWorkerLoop(cstate->u->tid));
+    LSTATE_MUT(cstate->u)    = cstate;
     self->up->upStream(self->up, newInitContext(cstate->u));
 }
 
@@ -72,35 +73,26 @@ static void beforeConnect(hevent_t *ev)
     }
 }
 
-static void initiateConnect(tunnel_t *self, bool delay)
+// must be called on the worker that owns the box, tops up the warm pool of that worker to its current target
+static void initiateConnect(tunnel_t *self, tid_t tid, bool delay)
 {
     preconnect_client_state_t *state = TSTATE(self);
+    thread_box_t              *box   = &(state->workers[tid]);
+    hloop_t                   *loop  = getWorkerLoop(tid);
 
-    if (state->unused_cons >= state->min_unused_cons)
-    {
-        return;
-    }
+    adaptivePoolUpdateTarget(&(box->pool), hloop_now_ms(loop));
 
-    tid_t tid = 0;
-    if (getWorkersCount() > 0)
+    while (box->length + box->connecting < box->pool.target)
     {
-        tid = atomic_fetch_add_explicit(&(state->round_index), 1, memory_order_relaxed);
-
-        if (tid >= getWorkersCount())
-        {
-            atomic_store_explicit(&(state->round_index), 0, memory_order_relaxed);
-            tid = 0;
-        }
-    }
-
-    hloop_t *worker_loop = getWorkerLoop(tid);
+        box->connecting += 1;
 
-    hevent_t            ev = {.loop = worker_loop, .cb = beforeConnect};
-    struct connect_arg *cg = globalMalloc(sizeof(struct connect_arg));
-    ev.userdata            = cg;
-    cg->t                  = self;
-    cg->tid                = tid;
-    cg->delay              = delay ? kPreconnectDelayLong : kPreconnectDelayShort;
+        hevent_t            ev = {.loop = loop, .cb = beforeConnect};
+        struct connect_arg *cg = globalMalloc(sizeof(struct connect_arg));
+        ev.userdata            = cg;
+        cg->t                  = self;
+        cg->tid                = tid;
+        cg->delay              = delay ? kPreconnectDelayLong : kPreconnectDelayShort;
 
-    hloop_post_event(worker_loop, &ev);
+        hloop_post_event(loop, &ev);
+    }
 }
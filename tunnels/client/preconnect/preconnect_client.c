@@ -36,8 +36,10 @@ static void upStream(tunnel_t *self, context_t *c)
         thread_box_t *this_tb = &(state->workers[tid]);
         if (c->init)
         {
+            const bool hit = this_tb->length > 0;
+            adaptivePoolOnArrival(&(this_tb->pool), hit, hloop_now_ms(getWorkerLoop(tid)));
 
-            if (this_tb->length > 0)
+            if (hit)
             {
                 atomic_fetch_add_explicit(&(state->unused_cons), -1, memory_order_relaxed);
                 atomic_fetch_add_explicit(&(state->active_cons), 1, memory_order_relaxed);
@@ -48,7 +50,7 @@ static void upStream(tunnel_t *self, context_t *c)
                 ucon->mode    = kConnectedPair;
                 CSTATE_MUT(c) = ucon;
                 self->dw->downStream(self->dw, newEstContext(c->line));
-                initiateConnect(self, false);
+                initiateConnect(self, tid, false);
             }
             else
             {
@@ -56,6 +58,7 @@ static void upStream(tunnel_t *self, context_t *c)
                 preconnect_client_con_state_t *dcon = createCstate(c->line->tid);
                 CSTATE_MUT(c)                       = dcon;
                 dcon->mode                          = kConnectedDirect;
+                initiateConnect(self, tid, false);
                 self->up->upStream(self->up, c);
                 return;
             }
@@ -136,7 +139,7 @@ static void downStream(tunnel_t *self, context_t *c)
                 atomic_fetch_add_explicit(&(state->active_cons), -1, memory_order_relaxed);
                 destroyCstate(ucon);
                 self->dw->downStream(self->dw, c);
-                initiateConnect(self, true);
+                initiateConnect(self, tid, true);
 
                 break;
 
@@ -146,7 +149,7 @@ static void downStream(tunnel_t *self, context_t *c)
                 LSTATE_DROP(ucon->d);
                 destroyCstate(ucon);
                 self->dw->downStream(self->dw, switchLine(c, d_line));
-                initiateConnect(self, false);
+                initiateConnect(self, tid, false);
 
                 break;
 
@@ -157,9 +160,13 @@ static void downStream(tunnel_t *self, context_t *c)
                     atomic_fetch_add_explicit(&(state->unused_cons), -1, memory_order_relaxed);
                     removeConnection(this_tb, ucon);
                 }
+                else
+                {
+                    this_tb->connecting -= 1;
+                }
                 destroyCstate(ucon);
                 destroyContext(c);
-                initiateConnect(self, true);
+                initiateConnect(self, tid, true);
 
                 break;
 
@@ -175,11 +182,14 @@ static void downStream(tunnel_t *self, context_t *c)
         {
             if (ucon->mode == kNotconnected)
             {
+                const uint64_t now = hloop_now_ms(getWorkerLoop(tid));
+                this_tb->connecting -= 1;
                 addConnection(this_tb, ucon);
+                adaptivePoolOnHandshake(&(this_tb->pool), now - ucon->connect_start_ms, now);
                 destroyContext(c);
                 unsigned int unused = atomic_fetch_add_explicit(&(state->unused_cons), 1, memory_order_relaxed);
                 LOGI("PreConnectClient: connected,    unused: %d active: %d", unused + 1, state->active_cons);
-                initiateConnect(self, false);
+                initiateConnect(self, tid, false);
             }
             else
             {
@@ -189,18 +199,22 @@ static void downStream(tunnel_t *self, context_t *c)
     }
 }
 
+static void startWorkerPreconnect(hevent_t *ev)
+{
+    tunnel_t *self = hevent_userdata(ev);
+    initiateConnect(self, (tid_t) hloop_tid(hevent_loop(ev)), true);
+}
+
 static void startPreconnect(htimer_t *timer)
 {
-    tunnel_t                  *self  = hevent_userdata(timer);
-    preconnect_client_state_t *state = TSTATE(self);
+    tunnel_t *self = hevent_userdata(timer);
 
+    // every worker fills its own pool, the boxes are not shared
     for (unsigned int i = 0; i < getWorkersCount(); i++)
     {
-        const size_t cpt = state->connection_per_thread;
-        for (size_t ci = 0; ci < cpt; ci++)
-        {
-            initiateConnect(self, true);
-        }
+        hevent_t ev = {.loop = getWorkerLoop(i), .cb = startWorkerPreconnect};
+        ev.userdata = self;
+        hloop_post_event(getWorkerLoop(i), &ev);
     }
 
     htimer_del(timer);
@@ -217,8 +231,29 @@ tunnel_t *newPreConnectClient(node_instance_context_t *instance_info)
 
     getIntFromJsonObject((int *) &(state->min_unused_cons), settings, "minimum-unused");
 
-    state->min_unused_cons       = min(max((getWorkersCount() * (ssize_t) 4), state->min_unused_cons), 128);
-    state->connection_per_thread = min(4, state->min_unused_cons / getWorkersCount());
+    state->min_unused_cons = min(max((getWorkersCount() * (ssize_t) 4), state->min_unused_cons), 128);
+
+    // the pool grows up to this when the traffic is bursty, and goes back to minimum when it calms down
+    getIntFromJsonObjectOrDefault((int *) &(state->max_unused_cons), settings, "maximum-unused",
+                                  (int) (state->min_unused_cons * 4));
+    state->max_unused_cons = min(max(state->min_unused_cons, state->max_unused_cons), 1024);
+
+    int  target_hit_ratio = 95;
+    bool adaptive         = true;
+    getIntFromJsonObjectOrDefault(&target_hit_ratio, settings, "target-hit-ratio", 95);
+    getBoolFromJsonObjectOrDefault(&adaptive, settings, "adaptive", true);
+    if (target_hit_ratio < 0 || target_hit_ratio > 100)
+    {
+        LOGF("JSON Error: PreConnectClient->settings->target-hit-ratio (number field) : must be in range [0,100]");
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        adaptivePoolInit(&(state->workers[i].pool), max(1U, state->min_unused_cons / getWorkersCount()),
+                         max(1U, state->max_unused_cons / getWorkersCount()), (unsigned int) target_hit_ratio,
+                         adaptive);
+    }
 
     tunnel_t *t   = newTunnel();
     t->state      = state;
@@ -233,9 +268,28 @@ tunnel_t *newPreConnectClient(node_instance_context_t *instance_info)
 
 api_result_t apiPreConnectClient(tunnel_t *self, const char *msg)
 {
-    (void) (self);
-    (void) (msg);
-    return (api_result_t){0};
+    preconnect_client_state_t *state = TSTATE(self);
+
+    if (msg == NULL || strcmp(msg, "stats") != 0)
+    {
+        return (api_result_t){0};
+    }
+
+    // the counters belong to workers, this is only a snapshot for monitoring
+    const size_t cap    = 256 * (getWorkersCount() + 1);
+    char        *result = globalMalloc(cap);
+    size_t       len    = 0;
+
+    for (unsigned int i = 0; i < getWorkersCount() && len < cap; i++)
+    {
+        int ret = adaptivePoolPrintStats(&(state->workers[i].pool), result + len, cap - len, i,
+                                         (unsigned int) state->workers[i].length);
+        if (ret > 0)
+        {
+            len = min(cap - 1, len + (size_t) ret);
+        }
+    }
+    return (api_result_t){.result = result, .result_len = len};
 }
 
 tunnel_t *destroyPreConnectClient(tunnel_t *self)
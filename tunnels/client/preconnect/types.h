@@ -1,4 +1,5 @@
 #pragma once
+#include "adaptive_pool.h"
 #include "api.h"
 #include "buffer_stream.h"
 #include "hatomic.h"
@@ -22,12 +23,15 @@ typedef struct preconnect_client_con_state_s
     line_t                               *u;
     line_t                               *d;
     connection_state                      mode;
+    uint64_t                              connect_start_ms;
 
 } preconnect_client_con_state_t;
 
 typedef struct thread_box_s
 {
     size_t                        length;
+    size_t                        connecting;
+    adaptive_pool_t               pool;
     preconnect_client_con_state_t root;
 
 } thread_box_t;
@@ -36,9 +40,8 @@ typedef struct preconnect_client_state_s
 {
     atomic_uint  active_cons;
     atomic_uint  unused_cons;
-    atomic_uint  round_index;
-    size_t       connection_per_thread;
     unsigned int min_unused_cons;
+    unsigned int max_unused_cons;
     thread_box_t workers[];
 
 } preconnect_client_state_t;
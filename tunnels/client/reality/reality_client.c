@@ -18,9 +18,8 @@
 typedef struct reality_client_state_s
 {
 
-    ssl_ctx_t       *threadlocal_ssl_context;
-    EVP_MD_CTX     **threadlocal_sign_context;
-    EVP_CIPHER_CTX **threadlocal_cipher_context;
+    ssl_ctx_t        *threadlocal_ssl_context;
+    reality_crypto_t *threadlocal_crypto;
 
     // settings
     uint8_t hashes[EVP_MAX_MD_SIZE];
@@ -35,16 +34,13 @@ typedef struct reality_client_state_s
 
 typedef struct reality_client_con_state_s
 {
-    SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
-    EVP_MD          *msg_digest;
-    EVP_PKEY        *sign_key;
-    EVP_MD_CTX      *sign_context;
-    EVP_CIPHER_CTX  *cipher_context;
-    buffer_stream_t *read_stream;
-    context_queue_t *queue;
-    bool             handshake_completed;
+    SSL              *ssl;
+    BIO              *rbio;
+    BIO              *wbio;
+    reality_crypto_t *crypto;
+    buffer_stream_t  *read_stream;
+    context_queue_t  *queue;
+    bool              handshake_completed;
 
 } reality_client_con_state_t;
 
@@ -78,11 +74,6 @@ static void cleanup(tunnel_t *self, context_t *c)
     {
         destroyBufferStream(cstate->read_stream);
     }
-    // EVP_CIPHER_CTX_free(cstate->cipher_context);
-    // EVP_MD_CTX_free(cstate->sign_context);
-    EVP_MD_free(cstate->msg_digest);
-    EVP_PKEY_free(cstate->sign_key);
-
     SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
     destroyContextQueue(cstate->queue);
 
@@ -122,8 +113,7 @@ static void upStream(tunnel_t *self, context_t *c)
         if (bufLen(buf) < chunk_size)
         {
 
-            buf = genericEncrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-            signMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+            buf = realitySeal(cstate->crypto, buf, getContextBufferPool(c));
             appendTlsHeader(buf);
             assert(bufLen(buf) % 16 == 5);
             c->payload = buf;
@@ -136,8 +126,7 @@ static void upStream(tunnel_t *self, context_t *c)
             {
                 const uint16_t  remain = (uint16_t) min(bufLen(buf), chunk_size);
                 shift_buffer_t *chunk  = shallowSliceBuffer(getWorkerShiftBufferPool(c->line->tid), buf, remain);
-                chunk = genericEncrypt(chunk, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-                signMessage(chunk, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+                chunk = realitySeal(cstate->crypto, chunk, getContextBufferPool(c));
                 appendTlsHeader(chunk);
                 context_t *cout = newContextFrom(c);
                 cout->payload   = chunk;
@@ -158,12 +147,8 @@ static void upStream(tunnel_t *self, context_t *c)
             cstate->rbio           = BIO_new(BIO_s_mem());
             cstate->wbio           = BIO_new(BIO_s_mem());
             cstate->ssl            = SSL_new(state->threadlocal_ssl_context[c->line->tid]);
-            cstate->cipher_context = state->threadlocal_cipher_context[c->line->tid];
-            cstate->sign_context   = state->threadlocal_sign_context[c->line->tid];
+            cstate->crypto         = &(state->threadlocal_crypto[c->line->tid]);
             cstate->queue          = newContextQueue();
-            cstate->msg_digest     = (EVP_MD *) EVP_get_digestbynid(MSG_DIGEST_ALG);
-            int sk_size            = EVP_MD_size(cstate->msg_digest);
-            cstate->sign_key       = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, state->hashes, sk_size);
 
             SSL_set_connect_state(cstate->ssl); /* sets ssl to work in client mode. */
             SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
@@ -230,7 +215,6 @@ failed:;
 
 static void downStream(tunnel_t *self, context_t *c)
 {
-    reality_client_state_t     *state  = TSTATE(self);
     reality_client_con_state_t *cstate = CSTATE(c);
 
     if (c->payload != NULL)
@@ -239,39 +223,29 @@ static void downStream(tunnel_t *self, context_t *c)
         if (cstate->handshake_completed)
         {
             bufferStreamPushContextPayload(cstate->read_stream, c);
-            uint8_t tls_header[1 + 2 + 2];
-            while (isAlive(c->line) && bufferStreamLen(cstate->read_stream) >= kTLSHeaderlen)
+            while (isAlive(c->line))
             {
-                bufferStreamViewBytesAt(cstate->read_stream, 0, tls_header, kTLSHeaderlen);
-                uint16_t length = ntohs(*(uint16_t *) (tls_header + 3));
-                if ((int) bufferStreamLen(cstate->read_stream) >= kTLSHeaderlen + length)
+                bool            failed = false;
+                shift_buffer_t *buf    = realityOpenRecords(cstate->crypto, cstate->read_stream, getContextBufferPool(c),
+                                                            getWorkerShiftBufferPool(c->line->tid), &failed);
+                if (failed)
                 {
-                    shift_buffer_t *buf = bufferStreamRead(cstate->read_stream, kTLSHeaderlen + length);
-                    bool            is_tls_applicationdata = ((uint8_t *) rawBuf(buf))[0] == kTLS12ApplicationData;
-                    uint16_t        tls_ver_b;
-                    memcpy(&tls_ver_b, ((uint8_t *) rawBuf(buf)) + 1, sizeof(uint16_t));
-                    bool is_tls_33 = tls_ver_b == kTLSVersion12;
-
-                    shiftr(buf, kTLSHeaderlen);
-
-                    if (! verifyMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key) ||
-                        ! is_tls_applicationdata || ! is_tls_33)
-                    {
-                        LOGE("RealityClient: verifyMessage failed");
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        goto failed;
-                    }
-
-                    buf = genericDecrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-
-                    context_t *plain_data_ctx = newContextFrom(c);
-                    plain_data_ctx->payload   = buf;
-                    self->dw->downStream(self->dw, plain_data_ctx);
+                    LOGE("RealityClient: verifyMessage failed");
+                    goto failed;
                 }
-                else
+                if (buf == NULL)
                 {
                     break;
                 }
+                if (bufLen(buf) == 0)
+                {
+                    reuseBuffer(getContextBufferPool(c), buf);
+                    continue;
+                }
+
+                context_t *plain_data_ctx = newContextFrom(c);
+                plain_data_ctx->payload   = buf;
+                self->dw->downStream(self->dw, plain_data_ctx);
             }
             destroyContext(c);
             return;
@@ -419,8 +393,7 @@ tunnel_t *newRealityClient(node_instance_context_t *instance_info)
     memset(state, 0, sizeof(reality_client_state_t));
 
     state->threadlocal_ssl_context    = globalMalloc(sizeof(ssl_ctx_t) * getWorkersCount());
-    state->threadlocal_cipher_context = globalMalloc(sizeof(EVP_CIPHER_CTX *) * getWorkersCount());
-    state->threadlocal_sign_context   = globalMalloc(sizeof(EVP_MD_CTX *) * getWorkersCount());
+    state->threadlocal_crypto         = globalMalloc(sizeof(reality_crypto_t) * getWorkersCount());
 
     ssl_ctx_opt_t *ssl_param = globalMalloc(sizeof(ssl_ctx_opt_t));
     memset(ssl_param, 0, sizeof(ssl_ctx_opt_t));
@@ -501,8 +474,7 @@ tunnel_t *newRealityClient(node_instance_context_t *instance_info)
 
         SSL_CTX_set_alpn_protos(state->threadlocal_ssl_context[i], (const unsigned char *) ossl_alpn, 1 + alpn_len);
 
-        state->threadlocal_cipher_context[i] = EVP_CIPHER_CTX_new();
-        state->threadlocal_sign_context[i]   = EVP_MD_CTX_create();
+        realityCryptoInit(&(state->threadlocal_crypto[i]), state->hashes, state->context_password);
     }
 
     globalFree(ssl_param);
@@ -65,6 +65,7 @@ static void doConnect(struct connect_arg *cg)
     // reverse_client_state_t     *state  = TSTATE(self);
     reverse_client_con_state_t *cstate = createCstate(self, cg->tid);
     globalFree(cg);
+    cstate->connect_start_ms  = hloop_now_ms(getWorkerLoop(cstate->u->tid));
     context_t *hello_data_ctx = newContext(cstate->u);
     self->up->upStream(self->up, newInitContext(cstate->u));
 
@@ -98,41 +99,28 @@ static void beforeConnect(hevent_t *ev)
     }
 }
 
+// must be called on the worker that owns the box, tops up the warm pool of that worker to its current target
 static void initiateConnect(tunnel_t *self, tid_t tid, bool delay)
 {
-    reverse_client_state_t *state = TSTATE(self);
+    reverse_client_state_t *state       = TSTATE(self);
+    thread_box_t           *box         = &(state->threadlocal_pool[tid]);
+    hloop_t                *worker_loop = getWorkerLoop(tid);
 
-    if (state->threadlocal_pool[tid].unused_cons_count + state->threadlocal_pool[tid].connecting_cons_count >=
-        state->min_unused_cons)
+    adaptivePoolUpdateTarget(&(box->pool), hloop_now_ms(worker_loop));
+
+    while (box->unused_cons_count + box->connecting_cons_count < box->pool.target)
     {
-        return;
+        box->connecting_cons_count += 1;
+
+        hevent_t            ev = {.loop = worker_loop, .cb = beforeConnect};
+        struct connect_arg *cg = globalMalloc(sizeof(struct connect_arg));
+        ev.userdata            = cg;
+        cg->t                  = self;
+        cg->tid                = tid;
+        cg->delay              = delay ? kPreconnectDelayLong : kPreconnectDelayShort;
+
+        hloop_post_event(worker_loop, &ev);
     }
-    state->threadlocal_pool[tid].connecting_cons_count += 1;
-    // bool more_delay = state->threadlocal_pool[tid].unused_cons_count <= 0;
-    // state->threadlocal_pool[tid].unused_cons_count += 1;
-
-    // int tid = 0;
-    // if (workers_count > 0)
-    // {
-    //     tid = atomic_fetch_add_explicit(&(state->round_index), 1, memory_order_relaxed);
-
-    //     if (tid >= workers_count)
-    //     {
-    //         atomic_store_explicit(&(state->round_index), 0, memory_order_relaxed);
-    //         tid = 0;
-    //     }
-    // }
-
-    hloop_t *worker_loop = getWorkerLoop(tid);
-
-    hevent_t            ev = {.loop = worker_loop, .cb = beforeConnect};
-    struct connect_arg *cg = globalMalloc(sizeof(struct connect_arg));
-    ev.userdata            = cg;
-    cg->t                  = self;
-    cg->tid                = tid;
-    cg->delay              = delay ? kPreconnectDelayLong : kPreconnectDelayShort;
-
-    hloop_post_event(worker_loop, &ev);
 }
 
 static void onStarvedConnectionExpire(idle_item_t *idle_con)
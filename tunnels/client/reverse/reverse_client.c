@@ -60,7 +60,12 @@ static void downStream(tunnel_t *self, context_t *c)
         }
         else
         {
+            // the peer only sees a connection when one is idle here, so taking the last idle one counts as a miss
+            // because the next pairing has to wait for a new handshake
             state->threadlocal_pool[tid].unused_cons_count -= 1;
+            adaptivePoolOnArrival(&(state->threadlocal_pool[tid].pool),
+                                  state->threadlocal_pool[tid].unused_cons_count > 0,
+                                  hloop_now_ms(getWorkerLoop(tid)));
             initiateConnect(self, tid, false);
             atomic_fetch_add_explicit(&(state->reverse_cons), 1, memory_order_relaxed);
 
@@ -123,7 +128,9 @@ static void downStream(tunnel_t *self, context_t *c)
         }
         else if (c->est)
         {
+            const uint64_t now   = hloop_now_ms(getWorkerLoop(tid));
             ucstate->established = true;
+            adaptivePoolOnHandshake(&(state->threadlocal_pool[tid].pool), now - ucstate->connect_start_ms, now);
             state->threadlocal_pool[tid].connecting_cons_count -= 1;
             state->threadlocal_pool[tid].unused_cons_count += 1;
             LOGI("ReverseClient: connected,    tid: %d unused: %u active: %d", tid,
@@ -146,12 +153,22 @@ static void downStream(tunnel_t *self, context_t *c)
     }
 }
 
+static void startWorkerReverseClient(hevent_t *ev)
+{
+    tunnel_t *self = hevent_userdata(ev);
+    initiateConnect(self, (tid_t) hloop_tid(hevent_loop(ev)), true);
+}
+
 static void startReverseClient(htimer_t *timer)
 {
     tunnel_t *self = hevent_userdata(timer);
+
+    // every worker fills its own pool, the boxes are not shared
     for (unsigned int i = 0; i < getWorkersCount(); i++)
     {
-        initiateConnect(self, i, true);
+        hevent_t ev = {.loop = getWorkerLoop(i), .cb = startWorkerReverseClient};
+        ev.userdata = self;
+        hloop_post_event(getWorkerLoop(i), &ev);
     }
 
     htimer_del(timer);
@@ -169,6 +186,27 @@ tunnel_t *newReverseClient(node_instance_context_t *instance_info)
     getIntFromJsonObject((int *) &(state->min_unused_cons), settings, "minimum-unused");
 
     state->min_unused_cons = min(max((getWorkersCount() * (ssize_t) 8), state->min_unused_cons), 128);
+
+    // the pool grows up to this when the traffic is bursty, and goes back to minimum when it calms down
+    getIntFromJsonObjectOrDefault((int *) &(state->max_unused_cons), settings, "maximum-unused",
+                                  (int) (state->min_unused_cons * 4));
+    state->max_unused_cons = min(max(state->min_unused_cons, state->max_unused_cons), 1024);
+
+    int  target_hit_ratio = 95;
+    bool adaptive         = true;
+    getIntFromJsonObjectOrDefault(&target_hit_ratio, settings, "target-hit-ratio", 95);
+    getBoolFromJsonObjectOrDefault(&adaptive, settings, "adaptive", true);
+    if (target_hit_ratio < 0 || target_hit_ratio > 100)
+    {
+        LOGF("JSON Error: ReverseClient->settings->target-hit-ratio (number field) : must be in range [0,100]");
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        adaptivePoolInit(&(state->threadlocal_pool[i].pool), state->min_unused_cons, state->max_unused_cons,
+                         (unsigned int) target_hit_ratio, adaptive);
+    }
     
     state->starved_connections = newIdleTable(getWorkerLoop(0));
 
@@ -184,9 +222,28 @@ tunnel_t *newReverseClient(node_instance_context_t *instance_info)
 
 api_result_t apiReverseClient(tunnel_t *self, const char *msg)
 {
-    (void) (self);
-    (void) (msg);
-    return (api_result_t){0};
+    reverse_client_state_t *state = TSTATE(self);
+
+    if (msg == NULL || strcmp(msg, "stats") != 0)
+    {
+        return (api_result_t){0};
+    }
+
+    // the counters belong to workers, this is only a snapshot for monitoring
+    const size_t cap    = 256 * (getWorkersCount() + 1);
+    char        *result = globalMalloc(cap);
+    size_t       len    = 0;
+
+    for (unsigned int i = 0; i < getWorkersCount() && len < cap; i++)
+    {
+        int ret = adaptivePoolPrintStats(&(state->threadlocal_pool[i].pool), result + len, cap - len, i,
+                                         state->threadlocal_pool[i].unused_cons_count);
+        if (ret > 0)
+        {
+            len = min(cap - 1, len + (size_t) ret);
+        }
+    }
+    return (api_result_t){.result = result, .result_len = len};
 }
 
 tunnel_t *destroyReverseClient(tunnel_t *self)
@@ -1,4 +1,5 @@
 #pragma once
+#include "adaptive_pool.h"
 #include "api.h"
 #include "idle_table.h"
 
@@ -14,6 +15,7 @@ typedef struct reverse_client_con_state_s
     bool         pair_connected;
     bool         established;
     idle_item_t *idle_handle;
+    uint64_t     connect_start_ms;
     line_t      *u;
     line_t      *d;
     tunnel_t    *self;
@@ -22,8 +24,9 @@ typedef struct reverse_client_con_state_s
 
 typedef struct thread_box_s
 {
-    uint32_t unused_cons_count;
-    uint32_t connecting_cons_count;
+    uint32_t        unused_cons_count;
+    uint32_t        connecting_cons_count;
+    adaptive_pool_t pool;
 
 } thread_box_t;
 
@@ -31,8 +34,8 @@ typedef struct reverse_client_state_s
 {
     idle_table_t *starved_connections;
     atomic_uint   reverse_cons;
-    atomic_uint   round_index;
     unsigned int  min_unused_cons;
+    unsigned int  max_unused_cons;
 
     thread_box_t threadlocal_pool[];
 
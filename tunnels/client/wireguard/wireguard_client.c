@@ -1 +1,735 @@
-// again another empty file going to be filled with the dirtiest code in the world :(
\ No newline at end of file
+#include "wireguard_client.h"
+#include "hmutex.h"
+#include "loggers/network_logger.h"
+#include "managers/node_manager.h"
+#include "packet_types.h"
+#include "utils/jsonutils.h"
+#include "wireguard.h"
+#include "wireguard_crypto.h"
+
+/*
+    WireGuard initiator, the data plane of one peer
+
+    packets of the layer3 chain are sealed in place, the transport header goes into the left space of the buffer
+    and the padding and tag are appended, a packet vector is sealed with one key setup and one atomic counter
+    reservation, then each packet goes to the UdpConnector on the line of its worker
+
+    every worker owns its line to the UdpConnector (so its own socket) and its own aead contexts, the handshake
+    state is shared and guarded by a mutex, it is only touched on handshakes and never per packet
+
+    a finished handshake is published as a session in a ring of kWgSessionSlots, workers pick the current one by
+    generation without locking, the sending counter and the replay window of a session are atomics so packets
+    of one session can be sealed and opened on any worker, a slot is written again only after
+    kWgSessionSlots - 1 newer handshakes (they are at least kWgRekeyTimeout seconds apart)
+
+    packets that arrive while there is no session are dropped and start a handshake, the peer is expected to
+    allow the whole tunnel (allowed ips are not checked here)
+*/
+
+enum
+{
+    kWgSessionSlots       = 4,
+    kWgReplayBlocks       = 128, // 32 packets per block
+    kWgReplayWindow       = (kWgReplayBlocks - 1) * 32,
+    kWgTransportHeaderLen = sizeof(struct message_transport_data),
+    kWgPaddingMultiple    = 16,
+    kWgTimerIntervalMs    = 1000,
+    kWgRekeyAttemptTime   = 90 // seconds a handshake is retried after the last packet that wanted it
+};
+
+typedef struct wireguard_session_s
+{
+    atomic_uint   local_index; // 0 while the slot is being written
+    uint32_t      remote_index;
+    uint32_t      created_ms;
+    uint8_t       sending_key[kWgSessionKeyLen];
+    uint8_t       receiving_key[kWgSessionKeyLen];
+    atomic_ullong sending_counter;
+    atomic_ullong replay_max;
+    // (block number << 32) | bitmap of the 32 counters of that block
+    atomic_ullong replay_blocks[kWgReplayBlocks];
+
+} wireguard_session_t;
+
+typedef struct wireguard_worker_s
+{
+    line_t               *line; // to the UdpConnector, owned by this node
+    wireguard_aead_ctx_t *sealer;
+    wireguard_aead_ctx_t *opener;
+    unsigned int          sealer_gen;   // generation of the session the sealer is keyed with, 0 means none
+    uint32_t              opener_index; // local index of the session the opener is keyed with
+
+} wireguard_worker_t;
+
+typedef struct wireguard_client_state_s
+{
+    char               *device_name;
+    tunnel_t           *device_tunnel;
+    htimer_t           *timer; // handshake retries and keepalives, on worker 0
+    hmutex_t            lock;  // device and peer (the handshake state)
+    wireguard_device_t  device;
+    wireguard_peer_t   *peer;
+    uint32_t            keepalive_ms;
+    atomic_uint         session_gen; // sessions[gen % kWgSessionSlots] is the current one, 0 means none yet
+    atomic_uint         initiation_tx_ms;
+    atomic_uint         wanted_at_ms; // last time a packet found no usable session
+    atomic_uint         last_tx_ms;
+    wireguard_session_t sessions[kWgSessionSlots];
+    wireguard_worker_t  workers[];
+
+} wireguard_client_state_t;
+
+typedef struct wireguard_client_con_state_s
+{
+    void *_;
+
+} wireguard_client_con_state_t;
+
+static void writeLE32(uint8_t *p, uint32_t v)
+{
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+static uint64_t readLE64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        v |= (uint64_t) p[i] << (8 * i);
+    }
+    return v;
+}
+
+static wireguard_session_t *currentSession(wireguard_client_state_t *state, unsigned int *gen)
+{
+    *gen = atomic_load_explicit(&(state->session_gen), memory_order_acquire);
+    return *gen == 0 ? NULL : &(state->sessions[*gen % kWgSessionSlots]);
+}
+
+static wireguard_session_t *findSession(wireguard_client_state_t *state, uint32_t local_index)
+{
+    for (unsigned int i = 0; i < kWgSessionSlots; i++)
+    {
+        if (atomic_load_explicit(&(state->sessions[i].local_index), memory_order_acquire) == local_index)
+        {
+            return &(state->sessions[i]);
+        }
+    }
+    return NULL;
+}
+
+// called with the lock held, right after wireguard_start_session
+static void publishSession(wireguard_client_state_t *state)
+{
+    const wireguard_keypair_t *keypair = &(state->peer->curr_keypair);
+    const unsigned int         gen     = atomic_load_explicit(&(state->session_gen), memory_order_relaxed) + 1;
+    wireguard_session_t       *s       = &(state->sessions[gen % kWgSessionSlots]);
+
+    atomic_store_explicit(&(s->local_index), 0, memory_order_release);
+
+    s->remote_index = keypair->remote_index;
+    s->created_ms   = wireguard_sys_now();
+    memcpy(s->sending_key, keypair->sending_key, kWgSessionKeyLen);
+    memcpy(s->receiving_key, keypair->receiving_key, kWgSessionKeyLen);
+    atomic_store_explicit(&(s->sending_counter), 0, memory_order_relaxed);
+    atomic_store_explicit(&(s->replay_max), 0, memory_order_relaxed);
+    for (unsigned int i = 0; i < kWgReplayBlocks; i++)
+    {
+        atomic_store_explicit(&(s->replay_blocks[i]), 0, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&(s->local_index), keypair->local_index, memory_order_release);
+    atomic_store_explicit(&(state->session_gen), gen, memory_order_release);
+}
+
+// marks the counter as seen, false if it was seen before or is behind the window
+static bool checkReplay(wireguard_session_t *s, uint64_t counter)
+{
+    uint64_t max = atomic_load_explicit(&(s->replay_max), memory_order_relaxed);
+    if (counter + kWgReplayWindow < max)
+    {
+        return false;
+    }
+
+    const uint32_t     block = (uint32_t) (counter >> 5);
+    const uint32_t     bit   = 1U << (counter & 31);
+    atomic_ullong     *slot  = &(s->replay_blocks[block % kWgReplayBlocks]);
+    unsigned long long old   = atomic_load_explicit(slot, memory_order_relaxed);
+    unsigned long long next;
+
+    do
+    {
+        const uint32_t tag = (uint32_t) (old >> 32);
+        if (tag == block)
+        {
+            if ((uint32_t) old & bit)
+            {
+                return false;
+            }
+            next = old | bit;
+        }
+        else if ((int32_t) (tag - block) > 0)
+        {
+            // the slot already moved to a newer block, this one left the window
+            return false;
+        }
+        else
+        {
+            next = ((unsigned long long) block << 32) | bit;
+        }
+    } while (! atomic_compare_exchange_weak_explicit(slot, &old, next, memory_order_relaxed, memory_order_relaxed));
+
+    while (counter > max && ! atomic_compare_exchange_weak_explicit(&(s->replay_max), &max, counter,
+                                                                    memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+    return true;
+}
+
+static void onWorkerLineFailed(wireguard_worker_t *w)
+{
+    line_t *l = w->line;
+    w->line   = NULL;
+    destroyLine(l);
+}
+
+static line_t *getWorkerLine(tunnel_t *self, tid_t tid)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    wireguard_worker_t       *w     = &(state->workers[tid]);
+
+    if (w->line == NULL)
+    {
+        w->line = newLine(tid);
+        self->up->upStream(self->up, newInitContext(w->line));
+        // the connector answers a failed init with a fin, that already cleared the line
+    }
+    return w->line;
+}
+
+static void sendToPeer(tunnel_t *self, tid_t tid, shift_buffer_t *buf)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    line_t                   *l     = getWorkerLine(self, tid);
+
+    if (l == NULL)
+    {
+        reuseBuffer(getWorkerBufferPool(tid), buf);
+        return;
+    }
+    atomic_store_explicit(&(state->last_tx_ms), wireguard_sys_now(), memory_order_relaxed);
+
+    context_t *c = newContext(l);
+    c->payload   = buf;
+    self->up->upStream(self->up, c);
+}
+
+static void sendInitiation(tunnel_t *self, tid_t tid)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    const uint32_t            now   = wireguard_sys_now();
+
+    if (now - atomic_load_explicit(&(state->initiation_tx_ms), memory_order_relaxed) < kWgRekeyTimeout * 1000)
+    {
+        return;
+    }
+
+    struct message_handshake_initiation msg;
+
+    hmutex_lock(&(state->lock));
+    if (now - atomic_load_explicit(&(state->initiation_tx_ms), memory_order_relaxed) < kWgRekeyTimeout * 1000 ||
+        ! wireguard_create_handshake_initiation(&(state->device), state->peer, &msg))
+    {
+        hmutex_unlock(&(state->lock));
+        return;
+    }
+    state->peer->last_initiation_tx = now;
+    atomic_store_explicit(&(state->initiation_tx_ms), now, memory_order_relaxed);
+    hmutex_unlock(&(state->lock));
+
+    shift_buffer_t *buf = popBuffer(getWorkerBufferPool(tid));
+    setLen(buf, sizeof(msg));
+    writeRaw(buf, (const unsigned char *) &msg, sizeof(msg));
+    sendToPeer(self, tid, buf);
+}
+
+static void sealPacket(wireguard_worker_t *w, wireguard_session_t *s, shift_buffer_t *buf, uint64_t counter)
+{
+    const unsigned int len    = bufLen(buf);
+    const unsigned int padded = (len + kWgPaddingMultiple - 1) & ~(unsigned int) (kWgPaddingMultiple - 1);
+
+    setLen(buf, padded + kWgAuthTagLen);
+    memset(rawBufMut(buf) + len, 0, padded - len);
+    wireguardAeadSeal(w->sealer, rawBufMut(buf), rawBuf(buf), padded, counter);
+
+    shiftl(buf, kWgTransportHeaderLen);
+    uint8_t *header = rawBufMut(buf);
+    header[0]       = kMessageTransportData;
+    header[1]       = 0;
+    header[2]       = 0;
+    header[3]       = 0;
+    writeLE32(header + 4, s->remote_index);
+    writeLE32(header + 8, (uint32_t) counter);
+    writeLE32(header + 12, (uint32_t) (counter >> 32));
+}
+
+// seals and sends the packets, false if there is no session they can go with (the caller still owns them)
+static bool sealAndSend(tunnel_t *self, tid_t tid, shift_buffer_t **bufs, unsigned int count)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    wireguard_worker_t       *w     = &(state->workers[tid]);
+    const uint32_t            now   = wireguard_sys_now();
+    unsigned int              gen;
+    wireguard_session_t      *s = currentSession(state, &gen);
+
+    if (s == NULL || now - s->created_ms >= kWgRejectAfterTime * 1000)
+    {
+        atomic_store_explicit(&(state->wanted_at_ms), now, memory_order_relaxed);
+        sendInitiation(self, tid);
+        return false;
+    }
+
+    const uint64_t first = atomic_fetch_add_explicit(&(s->sending_counter), count, memory_order_relaxed);
+    if (first + count >= kWgRejectAfterMessage)
+    {
+        sendInitiation(self, tid);
+        return false;
+    }
+    if (now - s->created_ms >= kWgRekeyAfterTime * 1000 || first + count >= kWgReKeyAfterMessages)
+    {
+        // the current session keeps carrying packets until the new one is ready
+        atomic_store_explicit(&(state->wanted_at_ms), now, memory_order_relaxed);
+        sendInitiation(self, tid);
+    }
+
+    if (w->sealer_gen != gen)
+    {
+        wireguardAeadSetKey(w->sealer, s->sending_key, true);
+        w->sealer_gen = gen;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        sealPacket(w, s, bufs[i], first + i);
+        sendToPeer(self, tid, bufs[i]);
+    }
+    return true;
+}
+
+static void sendKeepAlive(tunnel_t *self, tid_t tid)
+{
+    shift_buffer_t *buf = popBuffer(getWorkerBufferPool(tid));
+    setLen(buf, 0);
+    if (! sealAndSend(self, tid, &buf, 1))
+    {
+        reuseBuffer(getWorkerBufferPool(tid), buf);
+    }
+}
+
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    if (! sealAndSend(self, v->line->tid, v->bufs, v->count))
+    {
+        for (unsigned int i = 0; i < v->count; i++)
+        {
+            reuseBuffer(getLineBufferPool(v->line), v->bufs[i]);
+        }
+    }
+    v->count = 0;
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    if (c->payload != NULL)
+    {
+        packet_vector_t v;
+        v.line    = c->line;
+        v.count   = 1;
+        v.bufs[0] = c->payload;
+        dropContexPayload(c);
+        upStreamVector(self, &v);
+    }
+    destroyContext(c);
+}
+
+static void onHandshakeResponse(tunnel_t *self, tid_t tid, const shift_buffer_t *buf)
+{
+    wireguard_client_state_t         *state = TSTATE(self);
+    struct message_handshake_response msg;
+    bool                              established = false;
+
+    memcpy(&msg, rawBuf(buf), sizeof(msg));
+
+    hmutex_lock(&(state->lock));
+    wireguard_peer_t *peer = peer_lookup_by_handshake(&(state->device), msg.receiver);
+    if (peer != NULL &&
+        wireguard_check_mac1(&(state->device), rawBuf(buf), sizeof(msg) - (2 * kWgCookieLen), msg.mac1) &&
+        wireguard_process_handshake_response(&(state->device), peer, &msg))
+    {
+        wireguard_start_session(peer, true);
+        publishSession(state);
+        established = true;
+    }
+    hmutex_unlock(&(state->lock));
+
+    if (established)
+    {
+        // the responder may only use the session after it got a packet in it
+        LOGD("WireGuard: handshake completed");
+        sendKeepAlive(self, tid);
+    }
+    else
+    {
+        LOGW("WireGuard: dropped an invalid handshake response");
+    }
+}
+
+static void onCookieReply(tunnel_t *self, const shift_buffer_t *buf)
+{
+    wireguard_client_state_t   *state = TSTATE(self);
+    struct message_cookie_reply msg;
+
+    memcpy(&msg, rawBuf(buf), sizeof(msg));
+
+    hmutex_lock(&(state->lock));
+    wireguard_peer_t *peer = peer_lookup_by_handshake(&(state->device), msg.receiver);
+    if (peer != NULL && wireguard_process_cookie_message(&(state->device), peer, &msg))
+    {
+        // the next initiation carries mac2, the peer is under load so no extra retry is sent here
+        LOGD("WireGuard: got a cookie from the peer");
+    }
+    hmutex_unlock(&(state->lock));
+}
+
+// opens a transport packet in place, false if it is to be dropped
+static bool openPacket(wireguard_client_state_t *state, wireguard_worker_t *w, shift_buffer_t *buf)
+{
+    const uint8_t *header   = rawBuf(buf);
+    const uint32_t receiver = U8TO32_LITTLE(header + 4);
+    const uint64_t counter  = readLE64(header + 8);
+
+    wireguard_session_t *s = findSession(state, receiver);
+    if (s == NULL || wireguard_sys_now() - s->created_ms >= kWgRejectAfterTime * 1000 ||
+        counter >= kWgRejectAfterMessage)
+    {
+        return false;
+    }
+
+    if (w->opener_index != receiver)
+    {
+        wireguardAeadSetKey(w->opener, s->receiving_key, false);
+        w->opener_index = receiver;
+    }
+
+    const unsigned int len = bufLen(buf) - kWgTransportHeaderLen;
+    if (! wireguardAeadOpen(w->opener, rawBufMut(buf) + kWgTransportHeaderLen,
+                            ((const uint8_t *) rawBuf(buf)) + kWgTransportHeaderLen, len, counter))
+    {
+        return false;
+    }
+
+    // the slot was given to a newer session while we were reading it
+    if (atomic_load_explicit(&(s->local_index), memory_order_acquire) != receiver || ! checkReplay(s, counter))
+    {
+        return false;
+    }
+
+    shiftr(buf, kWgTransportHeaderLen);
+    setLen(buf, len - kWgAuthTagLen);
+    return true;
+}
+
+// the padding is not part of the ip packet, false if what is left is not one
+static bool trimPadding(shift_buffer_t *buf)
+{
+    const uint8_t *p   = rawBuf(buf);
+    unsigned int   len = bufLen(buf);
+    unsigned int   ip_len;
+
+    if ((p[0] >> 4) == 4 && len >= sizeof(struct ipv4header))
+    {
+        ip_len = ((unsigned int) p[2] << 8) | p[3];
+    }
+    else if ((p[0] >> 4) == 6 && len >= sizeof(struct ipv6header))
+    {
+        ip_len = (((unsigned int) p[4] << 8) | p[5]) + sizeof(struct ipv6header);
+    }
+    else
+    {
+        return false;
+    }
+
+    if (ip_len > len)
+    {
+        return false;
+    }
+    setLen(buf, ip_len);
+    return true;
+}
+
+static void downStream(tunnel_t *self, context_t *c)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    const tid_t               tid   = c->line->tid;
+    wireguard_worker_t       *w     = &(state->workers[tid]);
+
+    if (c->payload == NULL)
+    {
+        if (c->fin)
+        {
+            // the connector lost its socket, the next packet opens a new line
+            destroyContext(c);
+            onWorkerLineFailed(w);
+            return;
+        }
+        destroyContext(c);
+        return;
+    }
+
+    shift_buffer_t *buf = c->payload;
+
+    switch (wireguard_get_message_type(rawBuf(buf), bufLen(buf)))
+    {
+    case kMessageTransportData:
+        if (! openPacket(state, w, buf))
+        {
+            LOGD("WireGuard: dropped a transport packet that did not open");
+            break;
+        }
+        if (bufLen(buf) == 0)
+        {
+            // keepalive
+            break;
+        }
+        if (! trimPadding(buf))
+        {
+            LOGW("WireGuard: dropped a decrypted packet that is not ip");
+            break;
+        }
+        state->device_tunnel->upStream(state->device_tunnel, c);
+        return;
+
+    case kMessageHandshakeResponse:
+        onHandshakeResponse(self, tid, buf);
+        break;
+
+    case kMessageCookieReply:
+        onCookieReply(self, buf);
+        break;
+
+    default:
+        // this side only initiates, initiations of the peer are ignored like any other garbage
+        break;
+    }
+
+    reuseContextPayload(c);
+    destroyContext(c);
+}
+
+static void onTimer(htimer_t *timer)
+{
+    tunnel_t                 *self  = hevent_userdata(timer);
+    wireguard_client_state_t *state = TSTATE(self);
+    const uint32_t            now   = wireguard_sys_now();
+    unsigned int              gen;
+    wireguard_session_t      *s = currentSession(state, &gen);
+    const bool                wanted =
+        now - atomic_load_explicit(&(state->wanted_at_ms), memory_order_relaxed) < kWgRekeyAttemptTime * 1000;
+
+    if (wanted && (s == NULL || now - s->created_ms >= kWgRekeyAfterTime * 1000))
+    {
+        // retry, sendInitiation keeps them kWgRekeyTimeout apart
+        sendInitiation(self, 0);
+    }
+
+    if (state->keepalive_ms > 0 && s != NULL &&
+        now - atomic_load_explicit(&(state->last_tx_ms), memory_order_relaxed) >= state->keepalive_ms)
+    {
+        sendKeepAlive(self, 0);
+    }
+}
+
+static bool parseKey(const cJSON *settings, const char *name, uint8_t *out)
+{
+    char  *b64 = NULL;
+    size_t len = kWgPublicKeyLen;
+
+    if (! getStringFromJsonObject(&b64, settings, name))
+    {
+        return false;
+    }
+    const bool result = wireguard_base64_decode(b64, out, &len) && len == kWgPublicKeyLen;
+    crypto_zero(b64, strlen(b64));
+    globalFree(b64);
+    return result;
+}
+
+// before the keys are loaded, the state only owns the device name
+static void freeState(wireguard_client_state_t *state)
+{
+    if (state->device_name != NULL)
+    {
+        globalFree(state->device_name);
+    }
+    globalFree(state);
+}
+
+tunnel_t *newWireGuard(node_instance_context_t *instance_info)
+{
+    const size_t              state_size = sizeof(wireguard_client_state_t) + (sizeof(wireguard_worker_t) * WORKERS_COUNT);
+    wireguard_client_state_t *state      = globalMalloc(state_size);
+    memset(state, 0, state_size);
+    cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    {
+        LOGF("JSON Error: WireGuard->settings (object field) : The object was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    if (! getStringFromJsonObject(&(state->device_name), settings, "device"))
+    {
+        LOGF("JSON Error: WireGuard->settings->device (string field) : The string was empty or invalid");
+        freeState(state);
+        return NULL;
+    }
+
+    uint8_t private_key[kWgPrivateKeyLen];
+    uint8_t public_key[kWgPublicKeyLen];
+    uint8_t preshared_key[kWgSessionKeyLen];
+    bool    has_preshared_key = false;
+
+    if (! parseKey(settings, "private-key", private_key))
+    {
+        LOGF("JSON Error: WireGuard->settings->private-key (string field) : expected a base64 32 byte key");
+        freeState(state);
+        return NULL;
+    }
+    if (! parseKey(settings, "peer-public-key", public_key))
+    {
+        LOGF("JSON Error: WireGuard->settings->peer-public-key (string field) : expected a base64 32 byte key");
+        freeState(state);
+        return NULL;
+    }
+    if (cJSON_GetObjectItemCaseSensitive(settings, "preshared-key") != NULL)
+    {
+        if (! parseKey(settings, "preshared-key", preshared_key))
+        {
+            LOGF("JSON Error: WireGuard->settings->preshared-key (string field) : expected a base64 32 byte key");
+            freeState(state);
+            return NULL;
+        }
+        has_preshared_key = true;
+    }
+
+    int keepalive = 0;
+    getIntFromJsonObjectOrDefault(&keepalive, settings, "persistent-keepalive", 0);
+    state->keepalive_ms = (uint32_t) max(0, keepalive) * 1000;
+
+    hash_t  hash_tdev_name = CALC_HASH_BYTES(state->device_name, strlen(state->device_name));
+    node_t *tundevice_node = getNode(instance_info->node_manager_config, hash_tdev_name);
+
+    if (tundevice_node == NULL)
+    {
+        LOGF("WireGuard: could not find tun device node \"%s\"", state->device_name);
+        freeState(state);
+        return NULL;
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        runNode(instance_info->node_manager_config, tundevice_node, 0);
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        freeState(state);
+        return NULL;
+    }
+    state->device_tunnel = tundevice_node->instance;
+
+    wireguard_init();
+    state->peer = peer_alloc(&(state->device));
+
+    bool keys_ok = wireguard_device_init(&(state->device), private_key) &&
+                   wireguard_peer_init(&(state->device), state->peer, public_key,
+                                       has_preshared_key ? preshared_key : NULL);
+    crypto_zero(private_key, sizeof(private_key));
+    crypto_zero(preshared_key, sizeof(preshared_key));
+
+    if (! keys_ok)
+    {
+        LOGF("WireGuard: the private key or the public key of the peer is not usable");
+        crypto_zero(&(state->device), sizeof(state->device));
+        freeState(state);
+        return NULL;
+    }
+
+    hmutex_init(&(state->lock));
+    for (unsigned int i = 0; i < WORKERS_COUNT; i++)
+    {
+        state->workers[i].sealer = newWireguardAeadCtx();
+        state->workers[i].opener = newWireguardAeadCtx();
+    }
+
+    tunnel_t *t = newTunnel();
+
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
+
+    state->timer = htimer_add(getWorkerLoop(0), onTimer, kWgTimerIntervalMs, INFINITE);
+    hevent_set_userdata(state->timer, t);
+
+    return t;
+}
+
+api_result_t apiWireGuard(tunnel_t *self, const char *msg)
+{
+    (void) (self);
+    (void) (msg);
+    return (api_result_t) {0};
+}
+
+// called once the workers are stopped, the lines of the workers are closed from here
+tunnel_t *destroyWireGuard(tunnel_t *self)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+
+    htimer_del(state->timer);
+
+    for (unsigned int i = 0; i < WORKERS_COUNT; i++)
+    {
+        wireguard_worker_t *w = &(state->workers[i]);
+        if (w->line != NULL)
+        {
+            line_t *l = w->line;
+            w->line   = NULL;
+            self->up->upStream(self->up, newFinContext(l));
+            destroyLine(l);
+        }
+        destroyWireguardAeadCtx(w->sealer);
+        destroyWireguardAeadCtx(w->opener);
+    }
+
+    hmutex_destroy(&(state->lock));
+
+    // the device, the peer and the sessions hold the keys
+    crypto_zero(&(state->device), sizeof(state->device));
+    crypto_zero(state->sessions, sizeof(state->sessions));
+
+    globalFree(state->device_name);
+    globalFree(state);
+    globalFree(self);
+    return NULL;
+}
+
+tunnel_metadata_t getMetadataWireGuard(void)
+{
+    return (tunnel_metadata_t) {.version = 0001, .flags = 0x0};
+}
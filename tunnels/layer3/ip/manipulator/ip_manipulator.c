@@ -108,6 +108,31 @@ static void upStream(tunnel_t *self, context_t *c)
     self->up->upStream(self->up, c);
 }
 
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    layer3_ip_manipulator_state_t *state = TSTATE(self);
+
+    if (state->protocol_action.status != kDvsEmpty)
+    {
+        for (unsigned int i = 0; i < v->count; i++)
+        {
+            packet_mask *packet = (packet_mask *) (rawBufMut(v->bufs[i]));
+
+            if (v->metas[i].ip_version == 4)
+            {
+                handleProtocolAction4(&packet->ip4_header, &state->protocol_action);
+            }
+            else
+            {
+                handleProtocolAction6(&packet->ip6_header, &state->protocol_action);
+            }
+            v->metas[i].l4_protocol = (uint8_t) state->protocol_action.value;
+        }
+    }
+
+    self->up->upStreamVector(self->up, v);
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -148,9 +173,10 @@ tunnel_t *newLayer3IpManipulator(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
 
     return t;
 }
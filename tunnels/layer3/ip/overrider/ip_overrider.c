@@ -68,6 +68,48 @@ static void upStreamDestMode(tunnel_t *self, context_t *c)
     self->up->upStream(self->up, c);
 }
 
+static void upStreamVectorSrcMode(tunnel_t *self, packet_vector_t *v)
+{
+    layer3_ip_overrider_state_t *state = TSTATE(self);
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        packet_mask *packet = (packet_mask *) (rawBufMut(v->bufs[i]));
+
+        if (state->support4 && v->metas[i].ip_version == 4)
+        {
+            packet->ip4_header.saddr = state->ov_4;
+        }
+        else if (state->support6 && v->metas[i].ip_version == 6)
+        {
+            packet->ip6_header.saddr = state->ov_6;
+        }
+    }
+
+    self->up->upStreamVector(self->up, v);
+}
+
+static void upStreamVectorDestMode(tunnel_t *self, packet_vector_t *v)
+{
+    layer3_ip_overrider_state_t *state = TSTATE(self);
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        packet_mask *packet = (packet_mask *) (rawBufMut(v->bufs[i]));
+
+        if (v->metas[i].ip_version == 4)
+        {
+            packet->ip4_header.daddr = state->ov_4;
+        }
+        else
+        {
+            packet->ip6_header.daddr = state->ov_6;
+        }
+    }
+
+    self->up->upStreamVector(self->up, v);
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -130,9 +172,10 @@ tunnel_t *newLayer3IpOverrider(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
+    t->downStream     = &downStream;
+    t->upStreamVector = ((int) mode_dv.status == kDvsDestMode) ? &upStreamVectorDestMode : &upStreamVectorSrcMode;
 
     return t;
 }
@@ -1,4 +1,5 @@
 #include "ip_routing_table.h"
+#include "flow_table.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
 #include "packet_types.h"
@@ -33,11 +34,22 @@ typedef struct
 
 } routing_rule_t;
 
+enum
+{
+    kMaxRules          = 64,
+    kFlowCacheMinRules = 8, // walking this many rules is cheaper than hashing the flow key
+    kFlowTimeoutMs     = 60 * 1000,
+    kFlowTableMaxSize  = 1 << 16, // per worker
+    kDecisionDrop      = 0xFFFFFFFF
+};
+
 typedef struct layer3_ip_overrider_state_s
 {
-    routing_rule_t routes[8];
+    routing_rule_t routes[kMaxRules];
+    flow_table_t **flow_tables; // one per worker, caches the route of each flow, NULL for short rule lists
     int            default_rule;
     bool           default_drop;
+    bool           dest_mode;
     uint8_t        routes_len;
 
 } layer3_ip_overrider_state_t;
@@ -47,87 +59,132 @@ typedef struct layer3_ip_overrider_con_state_s
     void *_;
 } layer3_ip_overrider_con_state_t;
 
-static void upStreamSrcMode(tunnel_t *self, context_t *c)
+// walks the rules, with the flow cache only the first packet of a flow gets here
+static uint32_t matchRoute(layer3_ip_overrider_state_t *state, const packet_mask *packet)
 {
-    layer3_ip_overrider_state_t *state = TSTATE(self);
-
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
-
     if (packet->ip4_header.version == 4)
     {
+        const struct in_addr addr = {.s_addr = state->dest_mode ? packet->ip4_header.daddr : packet->ip4_header.saddr};
+
         for (unsigned int i = 0; i < state->routes_len; i++)
         {
-            const struct in_addr addr = {.s_addr = packet->ip4_header.saddr};
             if (state->routes[i].v4 && checkIPRange4(addr, state->routes[i].ip.ip4, state->routes[i].mask.mask4))
             {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-                return;
+                return i;
             }
         }
     }
     else if (packet->ip6_header.version == 6)
     {
+        const struct in6_addr addr = state->dest_mode ? packet->ip6_header.daddr : packet->ip6_header.saddr;
+
         for (unsigned int i = 0; i < state->routes_len; i++)
         {
             if ((! state->routes[i].v4) &&
-                checkIPRange6(packet->ip6_header.saddr, state->routes[i].ip.ip6, state->routes[i].mask.mask6))
+                checkIPRange6(addr, state->routes[i].ip.ip6, state->routes[i].mask.mask6))
             {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-                return;
+                return i;
             }
         }
     }
 
-    if (state->default_drop)
+    return state->default_drop ? kDecisionDrop : (uint32_t) state->default_rule;
+}
+
+static uint32_t findRoute(layer3_ip_overrider_state_t *state, tid_t tid, shift_buffer_t *buf, packet_meta_t meta)
+{
+    const packet_mask *packet = (const packet_mask *) rawBuf(buf);
+    flow_key_t         key;
+
+    if (state->flow_tables == NULL ||
+        ! makeFlowKey(&key, rawBuf(buf), bufLen(buf), meta.ip_version, meta.l4_offset, meta.l4_protocol))
     {
-        LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
-        reuseContextPayload(c);
-        destroyContext(c);
+        return matchRoute(state, packet);
     }
-    else
+
+    bool          created;
+    flow_entry_t *flow = trackFlow(state->flow_tables[tid], &key, bufLen(buf), &created);
+
+    if (created)
     {
-        state->routes[state->default_rule].next->upStream(state->routes[state->default_rule].next, c);
+        flow->decision = matchRoute(state, packet);
     }
+    return flow->decision;
 }
 
-static void upStreamDestMode(tunnel_t *self, context_t *c)
+static void upStream(tunnel_t *self, context_t *c)
 {
     layer3_ip_overrider_state_t *state = TSTATE(self);
 
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    const packet_mask *packet = (const packet_mask *) (rawBuf(c->payload));
+    packet_meta_t      meta   = {0};
 
     if (packet->ip4_header.version == 4)
     {
-        for (unsigned int i = 0; i < state->routes_len; i++)
-        {
-            const struct in_addr addr = {.s_addr = packet->ip4_header.saddr};
-            if (checkIPRange4(addr, state->routes[i].ip.ip4, state->routes[i].mask.mask4))
-            {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-            }
-        }
+        meta = (packet_meta_t) {.ip_version  = 4,
+                                .l4_offset   = (uint16_t) (packet->ip4_header.ihl * 4),
+                                .l4_protocol = packet->ip4_header.protocol};
     }
-    else if (packet->ip4_header.version == 6)
+    else if (packet->ip6_header.version == 6)
     {
-        for (unsigned int i = 0; i < state->routes_len; i++)
-        {
-            if (checkIPRange6(packet->ip6_header.daddr, state->routes[i].ip.ip6, state->routes[i].mask.mask6))
-            {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-            }
-        }
+        meta = (packet_meta_t) {.ip_version  = 6,
+                                .l4_offset   = sizeof(struct ipv6header),
+                                .l4_protocol = packet->ip6_header.nexthdr};
     }
 
-    if (state->default_drop)
+    const uint32_t route = findRoute(state, c->line->tid, c->payload, meta);
+
+    if (route == kDecisionDrop)
     {
         LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
         reuseContextPayload(c);
         destroyContext(c);
+        return;
     }
-    else
+    state->routes[route].next->upStream(state->routes[route].next, c);
+}
+
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    layer3_ip_overrider_state_t *state = TSTATE(self);
+
+    uint32_t routes[kPacketVectorCap];
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        routes[i] = findRoute(state, v->line->tid, v->bufs[i], v->metas[i]);
+
+        if (routes[i] == kDecisionDrop)
+        {
+            LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
+            reuseBuffer(getLineBufferPool(v->line), v->bufs[i]);
+        }
+    }
+
+    // one vector per route that got packets, the packets of a route keep their order
+    packet_vector_t out = {.line = v->line};
+
+    for (unsigned int i = 0; i < v->count; i++)
     {
-        state->routes[state->default_rule].next->upStream(state->routes[state->default_rule].next, c);
+        const uint32_t route = routes[i];
+        if (route == kDecisionDrop)
+        {
+            continue;
+        }
+        out.count = 0;
+        for (unsigned int j = i; j < v->count; j++)
+        {
+            if (routes[j] == route)
+            {
+                out.bufs[out.count]  = v->bufs[j];
+                out.metas[out.count] = v->metas[j];
+                out.count++;
+                routes[j] = kDecisionDrop;
+            }
+        }
+        state->routes[route].next->upStreamVector(state->routes[route].next, &out);
     }
+    v->count = 0;
 }
 
 static void downStream(tunnel_t *self, context_t *c)
@@ -226,6 +283,7 @@ tunnel_t *newLayer3IpRoutingTable(node_instance_context_t *instance_info)
              "want to filter based on source ip or dest ip?");
         exit(1);
     }
+    state->dest_mode = (int) mode_dv.status == kDvsDestMode;
     destroyDynamicValue(mode_dv);
 
 
@@ -240,6 +298,11 @@ tunnel_t *newLayer3IpRoutingTable(node_instance_context_t *instance_info)
     const cJSON *list_item = NULL;
     cJSON_ArrayForEach(list_item, rules)
     {
+        if (i == ARRAY_SIZE(state->routes))
+        {
+            LOGF("Layer3IpRoutingTable: too much rules, the limit is %d", kMaxRules);
+            exit(1);
+        }
         state->routes[i++] = parseRule(instance_info->node_manager_config, instance_info->chain_index, list_item);
     }
 
@@ -248,18 +311,23 @@ tunnel_t *newLayer3IpRoutingTable(node_instance_context_t *instance_info)
         LOGF("Layer3IpRoutingTable: no rules");
         exit(1);
     }
-    if (i > ARRAY_SIZE(state->routes))
+    state->routes_len = (uint8_t) i;
+
+    if (state->routes_len > kFlowCacheMinRules)
     {
-        LOGF("Layer3IpRoutingTable: too much rules");
-        exit(1);
+        state->flow_tables = globalMalloc(sizeof(flow_table_t *) * getWorkersCount());
+        for (unsigned int wi = 0; wi < getWorkersCount(); wi++)
+        {
+            state->flow_tables[wi] = newFlowTable(getWorkerLoop(wi), kFlowTimeoutMs, kFlowTableMaxSize, NULL);
+        }
     }
-    state->routes_len = i;
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
 
     return t;
 }
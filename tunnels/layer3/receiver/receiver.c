@@ -73,6 +73,92 @@ static void upStream(tunnel_t *self, context_t *c)
     self->up->upStream(self->up, c);
 }
 
+enum
+{
+    kIpv4MinIhl     = 5,
+    kUdpHeaderLen   = 8,
+    kIpv4OffsetMask = 0x1FFF
+};
+
+// the l4 header bytes that later nodes read at l4_offset, other protocols are passed without a look
+static unsigned int l4HeaderLen(uint8_t protocol)
+{
+    switch (protocol)
+    {
+    case IPPROTO_TCP:
+        return sizeof(struct tcpheader);
+    case IPPROTO_UDP:
+        return kUdpHeaderLen;
+    default:
+        return 0;
+    }
+}
+
+/*
+    fills the meta of a packet whose headers are all inside the buffer, the ip length can not be more than the buffer
+    and a first (or only) fragment has to hold the whole l4 header, later fragments carry no l4 header
+*/
+static bool fillPacketMeta(shift_buffer_t *buf, packet_meta_t *meta)
+{
+    const packet_mask *packet = (const packet_mask *) (rawBuf(buf));
+    const unsigned int len    = bufLen(buf);
+
+    if (packet->ip4_header.version == 4 && WW_LIKELY(len >= sizeof(struct ipv4header)))
+    {
+        const unsigned int header_len = packet->ip4_header.ihl * 4;
+        const unsigned int total_len  = ntohs(packet->ip4_header.tot_len);
+        const bool         first_part = (ntohs(packet->ip4_header.frag_off) & kIpv4OffsetMask) == 0;
+        const unsigned int l4_len     = first_part ? l4HeaderLen(packet->ip4_header.protocol) : 0;
+
+        if (packet->ip4_header.ihl < kIpv4MinIhl || total_len > len || total_len < header_len + l4_len)
+        {
+            return false;
+        }
+        *meta = (packet_meta_t) {
+            .l4_offset = (uint16_t) header_len, .ip_version = 4, .l4_protocol = packet->ip4_header.protocol};
+        return true;
+    }
+    if (packet->ip6_header.version == 6 && WW_LIKELY(len >= sizeof(struct ipv6header)))
+    {
+        const unsigned int payload_len = ntohs(packet->ip6_header.payload_len);
+
+        if (sizeof(struct ipv6header) + payload_len > len || payload_len < l4HeaderLen(packet->ip6_header.nexthdr))
+        {
+            return false;
+        }
+        *meta = (packet_meta_t) {
+            .l4_offset = sizeof(struct ipv6header), .ip_version = 6, .l4_protocol = packet->ip6_header.nexthdr};
+        return true;
+    }
+    return false;
+}
+
+// validates the packets and fills their meta, packets that are not valid ip are left out of the vector
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    unsigned int kept = 0;
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        shift_buffer_t *buf = v->bufs[i];
+
+        if (WW_UNLIKELY(! fillPacketMeta(buf, &(v->metas[kept]))))
+        {
+            LOGW("Layer3Receiver: dropped a packet that was not a valid ip packet");
+            reuseBuffer(getLineBufferPool(v->line), buf);
+            continue;
+        }
+        v->bufs[kept] = buf;
+        kept++;
+    }
+
+    v->count = kept;
+    if (kept > 0)
+    {
+        self->up->upStreamVector(self->up, v);
+    }
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -138,9 +224,10 @@ tunnel_t *newLayer3Receiver(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
 
     chain(tundevice_node->instance, t);
 
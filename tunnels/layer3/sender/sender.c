@@ -109,6 +109,34 @@ static void upStream(tunnel_t *self, context_t *c)
     state->device_tunnel->upStream(state->device_tunnel, c);
 }
 
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    layer3_senderstate_t *state = TSTATE(self);
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        packet_mask  *packet = (packet_mask *) (rawBufMut(v->bufs[i]));
+        packet_meta_t meta   = v->metas[i];
+
+        if (meta.ip_version == 4)
+        {
+            packet->ip4_header.check = 0x0;
+            packet->ip4_header.check = standardCheckSum((void *) packet, meta.l4_offset);
+
+            if (meta.l4_protocol == 6)
+            {
+                tcpCheckSum4(&(packet->ip4_header), (struct tcpheader *) (rawBufMut(v->bufs[i]) + meta.l4_offset));
+            }
+        }
+        else if (meta.l4_protocol == 6)
+        {
+            tcpCheckSum6(&(packet->ip6_header), (struct tcpheader *) (rawBufMut(v->bufs[i]) + meta.l4_offset));
+        }
+    }
+
+    state->device_tunnel->upStreamVector(state->device_tunnel, v);
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -202,9 +230,10 @@ tunnel_t *newLayer3Sender(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
 
     // for testing
     // htimer_t *tm = htimer_add(getWorkerLoop(0), onTimer, 500, INFINITE);
@@ -158,6 +158,46 @@ static void upStream(tunnel_t *self, context_t *c)
     self->up->upStream(self->up, c);
 }
 
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    layer3_tcp_manipulator_state_t *state = TSTATE(self);
+
+    unsigned int kept = 0;
+
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        shift_buffer_t *buf  = v->bufs[i];
+        packet_meta_t   meta = v->metas[i];
+
+        if (WW_UNLIKELY(bufLen(buf) < meta.l4_offset + sizeof(struct tcpheader)))
+        {
+            LOGW("TcpManipulator: dropped an ip packet, length is too short for TCP header");
+            reuseBuffer(getLineBufferPool(v->line), buf);
+            continue;
+        }
+
+        if (meta.l4_protocol == 6)
+        {
+            struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(buf) + meta.l4_offset);
+            const char       *packet_end = (const char *) rawBufMut(buf) + bufLen(buf);
+
+            handleResetBitAction(tcp_header, &(state->reset_bit_action));
+            handleSourcePortAction(tcp_header, &(state->source_port_action), state->corrupt_password, packet_end);
+            handleDestPortAction(tcp_header, &(state->dest_port_action), state->corrupt_password, packet_end);
+        }
+
+        v->bufs[kept]  = buf;
+        v->metas[kept] = meta;
+        kept++;
+    }
+
+    v->count = kept;
+    if (kept > 0)
+    {
+        self->up->upStreamVector(self->up, v);
+    }
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -197,9 +237,10 @@ tunnel_t *newLayer3TcpManipulator(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
 
     return t;
 }
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+    lwIP configuration of Layer3Terminator
+
+    the stack is driven by one worker (NO_SYS), there are no lwIP threads, mailboxes or locks, lwIP memory comes
+    from the system allocator so the limits below are only limits, not preallocated pools
+
+    windows and send buffers are sized for high bandwidth-delay links, the window is scaled and the
+    congestion control of lwIP gets a large enough send buffer to fill it
+
+    packets come from the local kernel through the tun device, their checksums are not checked again
+*/
+
+#define NO_SYS                1
+#define SYS_LIGHTWEIGHT_PROT  0
+#define LWIP_TIMERS           1
+#define LWIP_NETCONN          0
+#define LWIP_SOCKET           0
+#define LWIP_NETIF_API        0
+
+#define MEM_LIBC_MALLOC       1
+#define MEMP_MEM_MALLOC       1
+#define MEM_ALIGNMENT         8
+#define MEM_USE_POOLS         0
+
+#define LWIP_SUPPORT_CUSTOM_PBUF 1
+#define PBUF_POOL_SIZE           64
+
+#define LWIP_IPV4             1
+#define LWIP_IPV6             1
+#define LWIP_IPV6_SCOPES      0
+#define LWIP_IPV6_MLD         0
+#define LWIP_IPV6_AUTOCONFIG  0
+#define LWIP_IPV6_DHCP6       0
+#define LWIP_IPV6_SEND_ROUTER_SOLICIT    0
+#define LWIP_IPV6_DUP_DETECT_ATTEMPTS    0
+#define LWIP_ND6_QUEUEING     0
+#define LWIP_IPV6_FRAG        1
+#define LWIP_IPV6_REASS       1
+#define IP_FORWARD            0
+#define IP_REASSEMBLY         1
+#define IP_FRAG               1
+#define IP_DEFAULT_TTL        64
+
+#define LWIP_ARP              0
+#define LWIP_ETHERNET         0
+#define LWIP_DHCP             0
+#define LWIP_AUTOIP           0
+#define LWIP_ACD              0
+#define LWIP_IGMP             0
+#define LWIP_DNS              0
+#define LWIP_RAW              0
+#define LWIP_ICMP             1
+#define LWIP_UDP              0
+#define LWIP_TCP              1
+#define LWIP_HAVE_LOOPIF      0
+#define LWIP_NETIF_LOOPBACK   0
+#define LWIP_SINGLE_NETIF     1
+
+#define CHECKSUM_CHECK_IP     0
+#define CHECKSUM_CHECK_TCP    0
+#define CHECKSUM_CHECK_ICMP   0
+#define CHECKSUM_CHECK_ICMP6  0
+
+#define SO_REUSE              1
+
+#define MEMP_NUM_TCP_SEG          TCP_SND_QUEUELEN
+#define MEMP_NUM_REASSDATA        64
+#define MEMP_NUM_FRAG_PBUF        64
+#define MEMP_NUM_SYS_TIMEOUT      16
+
+// netinet/tcp.h (included by the event loop) defines TCP_MSS as the socket option
+#undef TCP_MSS
+#define TCP_MSS                   1460
+#define LWIP_WND_SCALE            1
+#define TCP_RCV_SCALE             5
+#define TCP_WND                   (1024 * 1024)
+#define TCP_SND_BUF               (1024 * 1024)
+#define TCP_SND_QUEUELEN          ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+#define TCP_SNDLOWAT              (0xFFFF - (4 * TCP_MSS) - 1)
+#define TCP_SNDQUEUELOWAT         (TCP_SND_QUEUELEN / 2)
+#define TCP_QUEUE_OOSEQ           1
+#define TCP_OOSEQ_MAX_BYTES       (TCP_WND)
+#define LWIP_TCP_SACK_OUT         1
+#define LWIP_TCP_MAX_SACK_NUM     4
+#define LWIP_TCP_TIMESTAMPS       1
+#define TCP_LISTEN_BACKLOG        0
+#define TCP_OVERSIZE              TCP_MSS
+#define TCP_CALCULATE_EFF_SEND_MSS 1
+#define LWIP_TCP_KEEPALIVE        1
+
+#define LWIP_STATS                0
+#define LWIP_NETIF_STATUS_CALLBACK 0
+#define LWIP_NETIF_LINK_CALLBACK  0
+#define LWIP_CHECKSUM_ON_COPY     0
+
+// the system headers already provide htons and friends
+#define LWIP_DONT_PROVIDE_BYTEORDER_FUNCTIONS 1
@@ -0,0 +1,1181 @@
+#include "terminator.h"
+#include "frand.h"
+#include "idle_table.h"
+#include "loggers/network_logger.h"
+#include "managers/node_manager.h"
+#include "utils/jsonutils.h"
+
+#include "lwip/init.h"
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+
+#include "stc/common.h"
+#define i_TYPE terminator_buf_queue_t, shift_buffer_t * // NOLINT
+#include "stc/deq.h"
+
+/*
+    Terminates the tcp and udp flows of the layer3 chain, every flow becomes a line that goes up the chain like
+    a line of TcpListener / UdpListener does, with the original destination in dest_ctx and the application in
+    src_ctx, so a TcpConnector / UdpConnector (or any proxy client) after it sees normal connections
+
+    tcp is terminated by lwIP, lwIP keeps its state in globals so there is one stack in the process and it is
+    driven by one worker (kStackTid), packets that reach other workers are posted to it, the lines of the flows
+    live on that worker too
+
+    known limitation: every tcp and udp flow of the process is terminated on worker 0, so this node does not
+    scale with the worker count, lwIP would need to be built with its state per stack to run one on each worker
+
+    incoming packets are given to lwIP as custom pbufs that point into the pool buffer, payload that lwIP
+    delivers in one piece goes up in the same buffer with the headers shifted off, the payload of a line is
+    given to lwIP by reference and the buffer is released when the peer acked it
+
+    lwIP accepts packets for any destination, the address of the netif is set to the destination of each packet
+    before it is handed in and a listen pcb is created for a port when the first syn to it arrives
+
+    udp does not go through lwIP, a flow is found by its addresses in an idle table, the payload is shifted out
+    of the packet and the reply gets its headers in the left space of its buffer
+*/
+
+enum
+{
+    kStackTid            = 0,
+    kLwipTimerIntervalMs = 250, // TCP_TMR_INTERVAL
+    kUdpFlowTimeoutMs    = 60 * 1000,
+    kIpv4HeaderLen       = 20,
+    kIpv6HeaderLen       = 40,
+    kUdpHeaderLen        = 8,
+    kIpProtoIcmp         = 1,
+    kIpProtoTcp          = 6,
+    kIpProtoUdp          = 17,
+    kTcpFlagSyn          = 0x02,
+    kTcpFlagAck          = 0x10
+};
+
+typedef struct layer3_terminator_state_s
+{
+    char                     *device_name;
+    tunnel_t                 *device_tunnel;
+    line_t                   *device_line; // carries the packets of the stack to the device, made on the stack worker
+    idle_table_t             *udp_table;
+    struct terminator_flow_s *flows; // every flow that is not freed, walked on destroy
+    htimer_t                 *timer;
+    struct netif              netif;
+    packet_vector_t           out; // packets the stack produced during the current event
+    uint8_t                   listening[65536 / 8];
+
+} layer3_terminator_state_t;
+
+typedef struct terminator_flow_s
+{
+    tunnel_t *tunnel;
+    line_t   *line; // NULL once the line is finished
+
+    // tcp
+    struct tcp_pcb        *pcb;  // NULL once lwIP is done with it (or we left it to lwIP)
+    terminator_buf_queue_t bufs; // payload of the line, lwIP references it until the peer acked it
+    unsigned int           write_index;  // bufs before this index are fully written to lwIP
+    unsigned int           write_offset; // bytes of bufs[write_index] that are written
+    uint32_t               acked;        // acked bytes of bufs[0]
+    uint32_t               recv_held;    // received bytes the window was not opened for, the line is paused
+    bool                   busy;         // inside a lwIP callback, the pcb is closed once it returns
+    bool                   closed;
+    bool                   read_paused;
+    bool                   write_paused;
+
+    // udp
+    bool         udp;
+    idle_item_t *idle_handle;
+    sockaddr_u   app_addr;
+    sockaddr_u   dest_addr; // the original destination, replies are sent from it
+
+    struct terminator_flow_s *prev;
+    struct terminator_flow_s *next;
+
+} terminator_flow_t;
+
+typedef struct terminator_pbuf_s
+{
+    struct pbuf_custom p; // first member, lwIP gives back the pbuf
+    shift_buffer_t    *buf;
+
+} terminator_pbuf_t;
+
+typedef struct terminator_msg_s
+{
+    tunnel_t       *tunnel;
+    unsigned int    count;
+    shift_buffer_t *bufs[kPacketVectorCap];
+
+} terminator_msg_t;
+
+static bool stack_created = false;
+
+u32_t        sys_now(void);
+unsigned int lwip_port_rand(void);
+
+u32_t sys_now(void)
+{
+    return (u32_t) hloop_now_ms(getWorkerLoop(kStackTid));
+}
+
+unsigned int lwip_port_rand(void)
+{
+    return fastRand32();
+}
+
+static void flushOutput(layer3_terminator_state_t *state)
+{
+    if (state->out.count > 0)
+    {
+        state->device_tunnel->upStreamVector(state->device_tunnel, &(state->out));
+        state->out.count = 0;
+    }
+}
+
+static void appendOutput(layer3_terminator_state_t *state, shift_buffer_t *buf)
+{
+    if (state->device_line == NULL)
+    {
+        state->device_line = newLine(kStackTid);
+        state->out.line    = state->device_line;
+    }
+    state->out.bufs[state->out.count]  = buf;
+    state->out.metas[state->out.count] = (packet_meta_t) {0};
+    if (++(state->out.count) == kPacketVectorCap)
+    {
+        flushOutput(state);
+    }
+}
+
+static void freeCustomPbuf(struct pbuf *p)
+{
+    terminator_pbuf_t *tp = (terminator_pbuf_t *) p;
+    if (tp->buf != NULL)
+    {
+        reuseBuffer(getWorkerBufferPool(kStackTid), tp->buf);
+    }
+    globalFree(tp);
+}
+
+/*
+    a packet that lwIP built in one of our pbufs (an icmp echo is answered in the request) goes to the device as
+    a shallow copy of that buffer, lwIP frees the pbuf once this returns and the buffer lives on in the copy
+
+    other packets are copied, a tcp segment is a header pbuf with the payload referenced in a buffer of the line,
+    the device needs the packet in one piece and the bytes before the payload belong to the previous segment
+    that lwIP may still send again, so the headers can not be written in front of it
+*/
+static err_t netifOutput(struct netif *netif, struct pbuf *p)
+{
+    tunnel_t                  *self  = netif->state;
+    layer3_terminator_state_t *state = TSTATE(self);
+    shift_buffer_t            *buf;
+
+    if (p->next == NULL && (p->flags & PBUF_FLAG_IS_CUSTOM) &&
+        ((struct pbuf_custom *) p)->custom_free_function == freeCustomPbuf &&
+        ((terminator_pbuf_t *) p)->buf != NULL)
+    {
+        shift_buffer_t *owner = ((terminator_pbuf_t *) p)->buf;
+        const uint8_t  *base  = rawBuf(owner);
+        const uint8_t  *data  = p->payload;
+
+        if (data >= base && data + p->len <= base + bufLen(owner))
+        {
+            buf = newShallowShiftBuffer(getWorkerShiftBufferPool(kStackTid), owner);
+            shiftr(buf, (unsigned int) (data - base));
+            setLen(buf, p->len);
+            appendOutput(state, buf);
+            return ERR_OK;
+        }
+    }
+
+    buf = popSizedBuffer(getWorkerBufferPool(kStackTid), p->tot_len);
+    setLen(buf, p->tot_len);
+    pbuf_copy_partial(p, rawBufMut(buf), p->tot_len, 0);
+    appendOutput(state, buf);
+    return ERR_OK;
+}
+
+static err_t netifOutput4(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+    (void) ipaddr;
+    return netifOutput(netif, p);
+}
+
+static err_t netifOutput6(struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
+{
+    (void) ipaddr;
+    return netifOutput(netif, p);
+}
+
+static err_t netifInit(struct netif *netif)
+{
+    netif->name[0]          = 'w';
+    netif->name[1]          = 'w';
+    netif->mtu              = 1500;
+    netif->output           = netifOutput4;
+    netif->output_ip6       = netifOutput6;
+    netif->ip6_addr_state[0] = IP6_ADDR_PREFERRED;
+    return ERR_OK;
+}
+
+// lwIP gives payload back as a pbuf chain, a single pbuf that is still ours is unwrapped without a copy
+static shift_buffer_t *takePayload(struct pbuf *p)
+{
+    shift_buffer_t *buf;
+
+    if (p->next == NULL && p->ref == 1 && (p->flags & PBUF_FLAG_IS_CUSTOM) &&
+        ((struct pbuf_custom *) p)->custom_free_function == freeCustomPbuf)
+    {
+        terminator_pbuf_t *tp = (terminator_pbuf_t *) p;
+        buf                   = tp->buf;
+        tp->buf               = NULL;
+        shiftr(buf, (unsigned int) ((const uint8_t *) p->payload - (const uint8_t *) rawBuf(buf)));
+        setLen(buf, p->len);
+    }
+    else
+    {
+        buf = popSizedBuffer(getWorkerBufferPool(kStackTid), p->tot_len);
+        setLen(buf, p->tot_len);
+        pbuf_copy_partial(p, rawBufMut(buf), p->tot_len, 0);
+    }
+    pbuf_free(p);
+    return buf;
+}
+
+static void setSocketContext(socket_context_t *ctx, const ip_addr_t *ip, uint16_t port,
+                             enum socket_address_protocol protocol)
+{
+    ctx->address_protocol = protocol;
+    if (IP_IS_V6(ip))
+    {
+        ctx->address_type = kSatIPV6;
+        memset(&(ctx->address.sin6), 0, sizeof(ctx->address.sin6));
+        ctx->address.sin6.sin6_family = AF_INET6;
+        memcpy(&(ctx->address.sin6.sin6_addr), ip_2_ip6(ip)->addr, sizeof(ctx->address.sin6.sin6_addr));
+        ctx->address.sin6.sin6_port = htons(port);
+    }
+    else
+    {
+        ctx->address_type = kSatIPV4;
+        memset(&(ctx->address.sin), 0, sizeof(ctx->address.sin));
+        ctx->address.sin.sin_family      = AF_INET;
+        ctx->address.sin.sin_addr.s_addr = ip4_addr_get_u32(ip_2_ip4(ip));
+        ctx->address.sin.sin_port        = htons(port);
+    }
+}
+
+static terminator_flow_t *newFlow(tunnel_t *self, bool udp)
+{
+    terminator_flow_t *flow = globalMalloc(sizeof(terminator_flow_t));
+    memset(flow, 0, sizeof(terminator_flow_t));
+    flow->tunnel = self;
+    flow->udp    = udp;
+    flow->line   = newLine(kStackTid);
+    flow->bufs   = terminator_buf_queue_t_init();
+    LSTATE_I_MUT(flow->line, self->chain_index) = flow;
+
+    layer3_terminator_state_t *state = TSTATE(self);
+    flow->next                       = state->flows;
+    if (state->flows != NULL)
+    {
+        state->flows->prev = flow;
+    }
+    state->flows = flow;
+    return flow;
+}
+
+static void freeFlow(terminator_flow_t *flow)
+{
+    layer3_terminator_state_t *state = TSTATE(flow->tunnel);
+    if (flow->prev != NULL)
+    {
+        flow->prev->next = flow->next;
+    }
+    else
+    {
+        state->flows = flow->next;
+    }
+    if (flow->next != NULL)
+    {
+        flow->next->prev = flow->prev;
+    }
+    while (terminator_buf_queue_t_size(&(flow->bufs)) > 0)
+    {
+        reuseBuffer(getWorkerBufferPool(kStackTid), terminator_buf_queue_t_pull_front(&(flow->bufs)));
+    }
+    terminator_buf_queue_t_drop(&(flow->bufs));
+    globalFree(flow);
+}
+
+// the flow ended on this side, the up side of the line gets a fin
+static void finishLine(terminator_flow_t *flow)
+{
+    tunnel_t *self = flow->tunnel;
+    line_t   *l    = flow->line;
+
+    if (l == NULL)
+    {
+        return;
+    }
+    flow->line = NULL;
+    LSTATE_DROP(l);
+    if (! flow->udp)
+    {
+        if (flow->write_paused)
+        {
+            resumeLineUpSide(l);
+        }
+        doneLineDownSide(l);
+    }
+    context_t *c = newFinContext(l);
+    destroyLine(l);
+    self->up->upStream(self->up, c);
+}
+
+static void detachPcb(terminator_flow_t *flow)
+{
+    struct tcp_pcb *pcb = flow->pcb;
+    flow->pcb           = NULL;
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+}
+
+static void openWindow(struct tcp_pcb *pcb, uint32_t len)
+{
+    while (len > 0)
+    {
+        const u16_t n = (u16_t) min(len, 0xFFFF);
+        tcp_recved(pcb, n);
+        len -= n;
+    }
+}
+
+static void writeTcpFlow(terminator_flow_t *flow)
+{
+    struct tcp_pcb *pcb   = flow->pcb;
+    bool            wrote = false;
+
+    while (flow->write_index < (unsigned int) terminator_buf_queue_t_size(&(flow->bufs)))
+    {
+        shift_buffer_t    *buf  = *terminator_buf_queue_t_at(&(flow->bufs), (ptrdiff_t) flow->write_index);
+        const unsigned int left = bufLen(buf) - flow->write_offset;
+        const unsigned int room = (unsigned int) tcp_sndbuf(pcb);
+
+        if (room == 0)
+        {
+            break;
+        }
+        const u16_t n = (u16_t) min(min(left, room), 0xFFFF);
+
+        // no copy, the buffer stays in the queue until it is acked
+        if (tcp_write(pcb, (const uint8_t *) rawBuf(buf) + flow->write_offset, n, 0) != ERR_OK)
+        {
+            break; // segment queue is full, continued when something is acked
+        }
+        wrote = true;
+        flow->write_offset += n;
+        if (flow->write_offset == bufLen(buf))
+        {
+            flow->write_index += 1;
+            flow->write_offset = 0;
+        }
+    }
+
+    if (wrote)
+    {
+        tcp_output(pcb);
+    }
+}
+
+/*
+    called after the line is finished, the pcb is closed once everything is written to lwIP and the flow is
+    freed once the peer acked it, returns ERR_ABRT if the pcb had to be aborted (for lwIP callbacks)
+*/
+static err_t finishTcpFlow(terminator_flow_t *flow)
+{
+    if (flow->line != NULL || flow->busy || flow->pcb == NULL)
+    {
+        return ERR_OK;
+    }
+
+    struct tcp_pcb *pcb = flow->pcb;
+
+    if (! flow->closed)
+    {
+        if (flow->write_index < (unsigned int) terminator_buf_queue_t_size(&(flow->bufs)))
+        {
+            return ERR_OK;
+        }
+        flow->closed = true;
+
+        // a close with unopened window would be a reset
+        openWindow(pcb, flow->recv_held);
+        flow->recv_held = 0;
+        tcp_recv(pcb, NULL);
+
+        if (tcp_close(pcb) != ERR_OK)
+        {
+            detachPcb(flow);
+            freeFlow(flow);
+            tcp_abort(pcb);
+            return ERR_ABRT;
+        }
+    }
+
+    if (terminator_buf_queue_t_size(&(flow->bufs)) == 0)
+    {
+        detachPcb(flow);
+        freeFlow(flow);
+    }
+    return ERR_OK;
+}
+
+static void onTcpFlowPaused(void *userdata)
+{
+    terminator_flow_t *flow = userdata;
+    flow->read_paused       = true;
+}
+
+static void onTcpFlowResumed(void *userdata)
+{
+    terminator_flow_t         *flow  = userdata;
+    layer3_terminator_state_t *state = TSTATE(flow->tunnel);
+
+    flow->read_paused = false;
+    if (flow->pcb != NULL && flow->recv_held > 0)
+    {
+        openWindow(flow->pcb, flow->recv_held);
+        flow->recv_held = 0;
+        flushOutput(state);
+    }
+}
+
+static err_t onTcpRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    terminator_flow_t *flow = arg;
+    (void) err;
+
+    if (p == NULL)
+    {
+        // the application closed its side, what the line still sends is written before the close
+        flow->busy = true;
+        finishLine(flow);
+        flow->busy = false;
+        return finishTcpFlow(flow);
+    }
+
+    const uint32_t len = p->tot_len;
+
+    if (flow->line == NULL)
+    {
+        tcp_recved(pcb, (u16_t) len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+
+    if (flow->read_paused)
+    {
+        flow->recv_held += len;
+    }
+    else
+    {
+        tcp_recved(pcb, (u16_t) len);
+    }
+
+    tunnel_t  *self = flow->tunnel;
+    context_t *c    = newContext(flow->line);
+    c->payload      = takePayload(p);
+
+    flow->busy = true;
+    self->up->upStream(self->up, c);
+    flow->busy = false;
+
+    return finishTcpFlow(flow);
+}
+
+static err_t onTcpSent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+    terminator_flow_t *flow = arg;
+    (void) pcb;
+
+    flow->acked += len;
+    while (flow->write_index > 0)
+    {
+        shift_buffer_t *buf = *terminator_buf_queue_t_front(&(flow->bufs));
+        if (bufLen(buf) > flow->acked)
+        {
+            break;
+        }
+        flow->acked -= bufLen(buf);
+        flow->write_index -= 1;
+        reuseBuffer(getWorkerBufferPool(kStackTid), terminator_buf_queue_t_pull_front(&(flow->bufs)));
+    }
+
+    if (! flow->closed)
+    {
+        writeTcpFlow(flow);
+    }
+
+    if (flow->write_paused && flow->write_index == (unsigned int) terminator_buf_queue_t_size(&(flow->bufs)))
+    {
+        flow->write_paused = false;
+        if (flow->line != NULL)
+        {
+            resumeLineUpSide(flow->line);
+        }
+    }
+
+    return finishTcpFlow(flow);
+}
+
+static void onTcpError(void *arg, err_t err)
+{
+    terminator_flow_t *flow = arg;
+
+    LOGD("Layer3Terminator: tcp flow closed by lwIP, error %d", (int) err);
+
+    // the pcb is already freed
+    flow->pcb = NULL;
+    finishLine(flow);
+    freeFlow(flow);
+}
+
+static err_t onTcpAccept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    tunnel_t *self = arg;
+
+    if (err != ERR_OK || pcb == NULL)
+    {
+        return ERR_VAL;
+    }
+
+    terminator_flow_t *flow = newFlow(self, false);
+    line_t            *l    = flow->line;
+
+    setSocketContext(&(l->src_ctx), &(pcb->remote_ip), pcb->remote_port, kSapTcp);
+    setSocketContext(&(l->dest_ctx), &(pcb->local_ip), pcb->local_port, kSapTcp);
+    setupLineDownSide(l, onTcpFlowPaused, flow, onTcpFlowResumed);
+
+    flow->pcb = pcb;
+    tcp_arg(pcb, flow);
+    tcp_recv(pcb, onTcpRecv);
+    tcp_sent(pcb, onTcpSent);
+    tcp_err(pcb, onTcpError);
+    tcp_nagle_disable(pcb);
+
+    flow->busy = true;
+    lockLine(l);
+    self->up->upStream(self->up, newInitContext(l));
+    flow->busy = false;
+
+    if (! isAlive(l))
+    {
+        LOGD("Layer3Terminator: tcp flow got closed by upstream before anything happend");
+        unLockLine(l);
+        detachPcb(flow);
+        freeFlow(flow);
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    unLockLine(l);
+    return ERR_OK;
+}
+
+static void ensureListening(tunnel_t *self, uint16_t port)
+{
+    layer3_terminator_state_t *state = TSTATE(self);
+
+    if (port == 0 || (state->listening[port >> 3] & (1U << (port & 7))))
+    {
+        return;
+    }
+
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        LOGE("Layer3Terminator: could not allocate a listen pcb");
+        return;
+    }
+    ip_set_option(pcb, SOF_REUSEADDR);
+
+    if (tcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK)
+    {
+        LOGE("Layer3Terminator: could not bind a listen pcb to port %d", (int) port);
+        tcp_abort(pcb);
+        return;
+    }
+
+    struct tcp_pcb *lpcb = tcp_listen(pcb);
+    if (lpcb == NULL)
+    {
+        LOGE("Layer3Terminator: could not listen on port %d", (int) port);
+        tcp_abort(pcb);
+        return;
+    }
+    tcp_arg(lpcb, self);
+    tcp_accept(lpcb, onTcpAccept);
+
+    state->listening[port >> 3] |= (uint8_t) (1U << (port & 7));
+}
+
+static uint32_t sumBytes(uint32_t sum, const uint8_t *p, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i + 1 < len; i += 2)
+    {
+        sum += ((uint32_t) p[i] << 8) | p[i + 1];
+    }
+    if (i < len)
+    {
+        sum += (uint32_t) p[i] << 8;
+    }
+    return sum;
+}
+
+static uint16_t foldSum(uint32_t sum)
+{
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t) ~sum;
+}
+
+static void writeBE16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static bool sameAddress(const sockaddr_u *a, const sockaddr_u *b)
+{
+    if (a->sa.sa_family != b->sa.sa_family)
+    {
+        return false;
+    }
+    if (a->sa.sa_family == AF_INET)
+    {
+        return a->sin.sin_port == b->sin.sin_port && a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+    }
+    return a->sin6.sin6_port == b->sin6.sin6_port &&
+           memcmp(&(a->sin6.sin6_addr), &(b->sin6.sin6_addr), sizeof(a->sin6.sin6_addr)) == 0;
+}
+
+static void onUdpFlowExpire(idle_item_t *idle)
+{
+    terminator_flow_t *flow = idle->userdata;
+    flow->idle_handle       = NULL;
+
+    LOGD("Layer3Terminator: expired idle udp flow");
+    finishLine(flow);
+    freeFlow(flow);
+}
+
+// the reply leaves from the original destination of the flow, headers go into the left space of the payload
+static void sendUdpReply(tunnel_t *self, terminator_flow_t *flow, shift_buffer_t *buf)
+{
+    layer3_terminator_state_t *state    = TSTATE(self);
+    const bool                 v4       = flow->app_addr.sa.sa_family == AF_INET;
+    const unsigned int         udp_len  = bufLen(buf) + kUdpHeaderLen;
+    const unsigned int         ip_hlen  = v4 ? kIpv4HeaderLen : kIpv6HeaderLen;
+    const uint8_t             *src_ip   = v4 ? (const uint8_t *) &(flow->dest_addr.sin.sin_addr)
+                                             : (const uint8_t *) &(flow->dest_addr.sin6.sin6_addr);
+    const uint8_t             *dst_ip   = v4 ? (const uint8_t *) &(flow->app_addr.sin.sin_addr)
+                                             : (const uint8_t *) &(flow->app_addr.sin6.sin6_addr);
+    const unsigned int         addr_len = v4 ? 4 : 16;
+
+    if (udp_len + ip_hlen > 0xFFFF)
+    {
+        LOGW("Layer3Terminator: dropped a udp reply that does not fit in an ip packet");
+        reuseBuffer(getWorkerBufferPool(kStackTid), buf);
+        return;
+    }
+
+    shiftl(buf, kUdpHeaderLen);
+    uint8_t *udp = rawBufMut(buf);
+    memcpy(udp, v4 ? &(flow->dest_addr.sin.sin_port) : &(flow->dest_addr.sin6.sin6_port), 2);
+    memcpy(udp + 2, v4 ? &(flow->app_addr.sin.sin_port) : &(flow->app_addr.sin6.sin6_port), 2);
+    writeBE16(udp + 4, (uint16_t) udp_len);
+    writeBE16(udp + 6, 0);
+
+    uint32_t sum = sumBytes(0, src_ip, addr_len);
+    sum          = sumBytes(sum, dst_ip, addr_len);
+    sum += kIpProtoUdp + udp_len;
+    uint16_t check = foldSum(sumBytes(sum, udp, udp_len));
+    writeBE16(udp + 6, check == 0 ? 0xFFFF : check);
+
+    shiftl(buf, ip_hlen);
+    uint8_t *ip = rawBufMut(buf);
+    memset(ip, 0, ip_hlen);
+    if (v4)
+    {
+        ip[0] = 0x45;
+        writeBE16(ip + 2, (uint16_t) (udp_len + ip_hlen));
+        ip[6] = 0x40; // don't fragment
+        ip[8] = IP_DEFAULT_TTL;
+        ip[9] = kIpProtoUdp;
+        memcpy(ip + 12, src_ip, 4);
+        memcpy(ip + 16, dst_ip, 4);
+        writeBE16(ip + 10, foldSum(sumBytes(0, ip, kIpv4HeaderLen)));
+    }
+    else
+    {
+        ip[0] = 0x60;
+        writeBE16(ip + 4, (uint16_t) udp_len);
+        ip[6] = kIpProtoUdp;
+        ip[7] = IP_DEFAULT_TTL;
+        memcpy(ip + 8, src_ip, 16);
+        memcpy(ip + 24, dst_ip, 16);
+    }
+
+    appendOutput(state, buf);
+}
+
+static void readPacketAddress(sockaddr_u *addr, const uint8_t *packet, bool v4, bool source, const uint8_t *ports)
+{
+    memset(addr, 0, sizeof(*addr));
+    if (v4)
+    {
+        addr->sin.sin_family = AF_INET;
+        memcpy(&(addr->sin.sin_addr), packet + (source ? 12 : 16), 4);
+        memcpy(&(addr->sin.sin_port), ports + (source ? 0 : 2), 2);
+    }
+    else
+    {
+        addr->sin6.sin6_family = AF_INET6;
+        memcpy(&(addr->sin6.sin6_addr), packet + (source ? 8 : 24), 16);
+        memcpy(&(addr->sin6.sin6_port), ports + (source ? 0 : 2), 2);
+    }
+}
+
+static terminator_flow_t *newUdpFlow(tunnel_t *self, const sockaddr_u *app_addr, const sockaddr_u *dest_addr,
+                                     hash_t hash)
+{
+    layer3_terminator_state_t *state = TSTATE(self);
+    terminator_flow_t         *flow  = newFlow(self, true);
+    line_t                    *l     = flow->line;
+
+    flow->app_addr  = *app_addr;
+    flow->dest_addr = *dest_addr;
+
+    l->src_ctx.address          = *app_addr;
+    l->src_ctx.address_protocol = kSapUdp;
+    l->src_ctx.address_type     = app_addr->sa.sa_family == AF_INET ? kSatIPV4 : kSatIPV6;
+    l->dest_ctx.address          = *dest_addr;
+    l->dest_ctx.address_protocol = kSapUdp;
+    l->dest_ctx.address_type     = l->src_ctx.address_type;
+
+    flow->idle_handle = newIdleItem(state->udp_table, hash, flow, onUdpFlowExpire, kStackTid, kUdpFlowTimeoutMs);
+
+    lockLine(l);
+    self->up->upStream(self->up, newInitContext(l));
+    if (! isAlive(l))
+    {
+        LOGD("Layer3Terminator: udp flow got closed by upstream before anything happend");
+        unLockLine(l);
+        return NULL;
+    }
+    unLockLine(l);
+    return flow;
+}
+
+static void inputUdp(tunnel_t *self, shift_buffer_t *buf, bool v4, unsigned int l4_offset)
+{
+    layer3_terminator_state_t *state  = TSTATE(self);
+    const uint8_t             *packet = rawBuf(buf);
+    const unsigned int         len    = bufLen(buf);
+
+    if (len < l4_offset + kUdpHeaderLen)
+    {
+        reuseBuffer(getWorkerBufferPool(kStackTid), buf);
+        return;
+    }
+
+    const uint8_t     *udp     = packet + l4_offset;
+    const unsigned int udp_len = ((unsigned int) udp[4] << 8) | udp[5];
+
+    if (udp_len < kUdpHeaderLen || l4_offset + udp_len > len)
+    {
+        reuseBuffer(getWorkerBufferPool(kStackTid), buf);
+        return;
+    }
+
+    sockaddr_u app_addr;
+    sockaddr_u dest_addr;
+    readPacketAddress(&app_addr, packet, v4, true, udp);
+    readPacketAddress(&dest_addr, packet, v4, false, udp);
+
+    uint8_t            key[36];
+    const unsigned int addr_len = v4 ? 4 : 16;
+    memcpy(key, packet + (v4 ? 12 : 8), 2 * addr_len); // source and destination are next to each other
+    memcpy(key + (2 * addr_len), udp, 4);
+    const hash_t hash = CALC_HASH_BYTES(key, (2 * addr_len) + 4);
+
+    terminator_flow_t *flow;
+    idle_item_t       *idle = getIdleItemByHash(kStackTid, state->udp_table, hash);
+
+    if (idle == NULL)
+    {
+        flow = newUdpFlow(self, &app_addr, &dest_addr, hash);
+        if (flow == NULL)
+        {
+            reuseBuffer(getWorkerBufferPool(kStackTid), buf);
+            return;
+        }
+    }
+    else
+    {
+        flow = idle->userdata;
+        if (! sameAddress(&(flow->app_addr), &app_addr) || ! sameAddress(&(flow->dest_addr), &dest_addr))
+        {
+            LOGW("Layer3Terminator: dropped a udp packet, its flow hash collides with another flow");
+            reuseBuffer(getWorkerBufferPool(kStackTid), buf);
+            return;
+        }
+        keepIdleItemForAtleast(state->udp_table, idle, kUdpFlowTimeoutMs);
+    }
+
+    shiftr(buf, l4_offset + kUdpHeaderLen);
+    setLen(buf, udp_len - kUdpHeaderLen);
+
+    context_t *c = newContext(flow->line);
+    c->payload   = buf;
+    self->up->upStream(self->up, c);
+}
+
+static void inputToStack(tunnel_t *self, shift_buffer_t *buf, bool v4)
+{
+    layer3_terminator_state_t *state  = TSTATE(self);
+    const uint8_t             *packet = rawBuf(buf);
+
+    // the stack accepts whatever the packet was sent to
+    if (v4)
+    {
+        ip4_addr_t dest;
+        memcpy(&dest, packet + 16, sizeof(dest));
+        ip_addr_copy_from_ip4(state->netif.ip_addr, dest);
+    }
+    else
+    {
+        ip6_addr_p_t dest;
+        memcpy(&dest, packet + 24, sizeof(dest));
+        ip_addr_copy_from_ip6_packed(state->netif.ip6_addr[0], dest);
+    }
+
+    terminator_pbuf_t *tp        = globalMalloc(sizeof(terminator_pbuf_t));
+    tp->p.custom_free_function   = freeCustomPbuf;
+    tp->buf                      = buf;
+    const u16_t        len       = (u16_t) bufLen(buf);
+    struct pbuf       *p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &(tp->p), rawBufMut(buf), len);
+
+    state->netif.input(p, &(state->netif));
+}
+
+static void inputPacket(tunnel_t *self, shift_buffer_t *buf)
+{
+    const uint8_t     *packet = rawBuf(buf);
+    const unsigned int len    = bufLen(buf);
+    const unsigned int version = len > 0 ? packet[0] >> 4 : 0;
+    unsigned int       l4_offset;
+    unsigned int       protocol;
+
+    if (version == 4 && len >= kIpv4HeaderLen)
+    {
+        l4_offset = (packet[0] & 0x0F) * 4;
+        protocol  = packet[9];
+
+        // fragments go to lwIP which reassembles tcp and icmp, udp fragments are not supported
+        if (protocol == kIpProtoUdp && (((packet[6] & 0x3F) | packet[7]) != 0))
+        {
+            protocol = 0;
+        }
+    }
+    else if (version == 6 && len >= kIpv6HeaderLen)
+    {
+        l4_offset = kIpv6HeaderLen;
+        protocol  = packet[6];
+    }
+    else
+    {
+        reuseBuffer(getWorkerBufferPool(kStackTid), buf);
+        return;
+    }
+
+    switch (protocol)
+    {
+    case kIpProtoUdp:
+        inputUdp(self, buf, version == 4, l4_offset);
+        return;
+
+    case kIpProtoTcp:
+        if (len >= l4_offset + 14 && (packet[l4_offset + 13] & (kTcpFlagSyn | kTcpFlagAck)) == kTcpFlagSyn)
+        {
+            ensureListening(self, (uint16_t) (((unsigned int) packet[l4_offset + 2] << 8) | packet[l4_offset + 3]));
+        }
+        inputToStack(self, buf, version == 4);
+        return;
+
+    default:
+        // icmp echo and the ipv6 extension headers are handled by lwIP, the rest is dropped there
+        inputToStack(self, buf, version == 4);
+        return;
+    }
+}
+
+static void inputPackets(tunnel_t *self, shift_buffer_t **bufs, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        inputPacket(self, bufs[i]);
+    }
+    flushOutput(TSTATE(self));
+}
+
+static void onPacketsPosted(hevent_t *ev)
+{
+    terminator_msg_t *msg = hevent_userdata(ev);
+    inputPackets(msg->tunnel, msg->bufs, msg->count);
+    globalFree(msg);
+}
+
+static void upStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    if (v->line->tid == kStackTid)
+    {
+        inputPackets(self, v->bufs, v->count);
+        v->count = 0;
+        return;
+    }
+
+    terminator_msg_t *msg = globalMalloc(sizeof(terminator_msg_t));
+    msg->tunnel           = self;
+    msg->count            = v->count;
+    memcpy(msg->bufs, v->bufs, v->count * sizeof(shift_buffer_t *));
+    v->count = 0;
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop = getWorkerLoop(kStackTid);
+    ev.cb   = onPacketsPosted;
+    hevent_set_userdata(&ev, msg);
+    hloop_post_event(getWorkerLoop(kStackTid), &ev);
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    if (c->payload != NULL)
+    {
+        packet_vector_t v;
+        v.line    = c->line;
+        v.count   = 1;
+        v.bufs[0] = c->payload;
+        dropContexPayload(c);
+        upStreamVector(self, &v);
+    }
+    destroyContext(c);
+}
+
+static void downStream(tunnel_t *self, context_t *c)
+{
+    layer3_terminator_state_t *state = TSTATE(self);
+    terminator_flow_t         *flow  = CSTATE(c);
+
+    if (c->payload != NULL)
+    {
+        if (flow->udp)
+        {
+            keepIdleItemForAtleast(state->udp_table, flow->idle_handle, kUdpFlowTimeoutMs);
+            sendUdpReply(self, flow, c->payload);
+            dropContexPayload(c);
+        }
+        else
+        {
+            terminator_buf_queue_t_push_back(&(flow->bufs), c->payload);
+            dropContexPayload(c);
+            writeTcpFlow(flow);
+
+            if (! flow->write_paused &&
+                flow->write_index < (unsigned int) terminator_buf_queue_t_size(&(flow->bufs)))
+            {
+                flow->write_paused = true;
+                pauseLineUpSide(c->line);
+            }
+        }
+        destroyContext(c);
+        flushOutput(state);
+        return;
+    }
+
+    if (c->fin)
+    {
+        line_t *l  = c->line;
+        flow->line = NULL;
+        CSTATE_DROP(c);
+
+        if (flow->udp)
+        {
+            removeIdleItemByHash(kStackTid, state->udp_table, flow->idle_handle->hash);
+            destroyLine(l);
+            destroyContext(c);
+            freeFlow(flow);
+            return;
+        }
+
+        if (flow->write_paused)
+        {
+            resumeLineUpSide(l);
+        }
+        doneLineDownSide(l);
+        destroyLine(l);
+        destroyContext(c);
+
+        finishTcpFlow(flow);
+        flushOutput(state);
+        return;
+    }
+
+    // est (the handshake with the application is already done)
+    destroyContext(c);
+}
+
+static void onLwipTimer(htimer_t *timer)
+{
+    tunnel_t *self = hevent_userdata(timer);
+    sys_check_timeouts();
+    flushOutput(TSTATE(self));
+}
+
+tunnel_t *newLayer3Terminator(node_instance_context_t *instance_info)
+{
+    if (stack_created)
+    {
+        LOGF("Layer3Terminator: only one Layer3Terminator node is supported, lwIP has one stack per process");
+        return NULL;
+    }
+
+    layer3_terminator_state_t *state = globalMalloc(sizeof(layer3_terminator_state_t));
+    memset(state, 0, sizeof(layer3_terminator_state_t));
+    cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    {
+        LOGF("JSON Error: Layer3Terminator->settings (object field) : The object was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    if (! getStringFromJsonObject(&(state->device_name), settings, "device"))
+    {
+        LOGF("JSON Error: Layer3Terminator->settings->device (string field) : The string was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    hash_t  hash_tdev_name = CALC_HASH_BYTES(state->device_name, strlen(state->device_name));
+    node_t *tundevice_node = getNode(instance_info->node_manager_config, hash_tdev_name);
+
+    if (tundevice_node == NULL)
+    {
+        LOGF("Layer3Terminator: could not find tun device node \"%s\"", state->device_name);
+        globalFree(state);
+        return NULL;
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        runNode(instance_info->node_manager_config, tundevice_node, 0);
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        globalFree(state);
+        return NULL;
+    }
+
+    state->device_tunnel = tundevice_node->instance;
+    state->udp_table     = newIdleTable(getWorkerLoop(kStackTid));
+
+    tunnel_t *t = newTunnel();
+
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->upStreamVector = &upStreamVector;
+
+    stack_created = true;
+    lwip_init();
+    netif_add_noaddr(&(state->netif), t, netifInit, ip_input);
+    netif_set_default(&(state->netif));
+    netif_set_link_up(&(state->netif));
+    netif_set_up(&(state->netif));
+
+    state->timer = htimer_add(getWorkerLoop(kStackTid), onLwipTimer, kLwipTimerIntervalMs, INFINITE);
+    hevent_set_userdata(state->timer, t);
+
+    return t;
+}
+
+api_result_t apiLayer3Terminator(tunnel_t *self, const char *msg)
+{
+    (void) (self);
+    (void) (msg);
+    return (api_result_t) {0};
+}
+
+/*
+    called on the stack worker, the flows get a fin up their lines and the applications get a reset
+
+    pcbs that are left to lwIP (closing, time wait) and the listen pcbs stay in the pools of lwIP, no packet
+    reaches them once the netif is removed, lwIP itself can not be initialized again so stack_created stays set
+*/
+tunnel_t *destroyLayer3Terminator(tunnel_t *self)
+{
+    layer3_terminator_state_t *state = TSTATE(self);
+
+    htimer_del(state->timer);
+
+    while (state->flows != NULL)
+    {
+        terminator_flow_t *flow = state->flows;
+        if (flow->udp)
+        {
+            removeIdleItemByHash(kStackTid, state->udp_table, flow->idle_handle->hash);
+            finishLine(flow);
+            freeFlow(flow);
+        }
+        else if (flow->pcb != NULL)
+        {
+            // onTcpError finishes the line and frees the flow
+            tcp_abort(flow->pcb);
+        }
+        else
+        {
+            finishLine(flow);
+            freeFlow(flow);
+        }
+    }
+    destroyIdleTable(state->udp_table);
+
+    netif_remove(&(state->netif));
+    flushOutput(state);
+    if (state->device_line != NULL)
+    {
+        destroyLine(state->device_line);
+    }
+
+    globalFree(state->device_name);
+    globalFree(state);
+    globalFree(self);
+    return NULL;
+}
+
+tunnel_metadata_t getMetadataLayer3Terminator(void)
+{
+    return (tunnel_metadata_t) {.version = 0001, .flags = 0x0};
+}
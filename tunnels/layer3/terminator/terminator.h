@@ -0,0 +1,11 @@
+#pragma once
+#include "api.h"
+
+// Layer3Packet ------>  Layer3Terminator  ------>  tcp / udp lines (one per flow)
+//                              |
+//                              +------->  TunDevice (packets of the stack)
+
+tunnel_t         *newLayer3Terminator(node_instance_context_t *instance_info);
+api_result_t      apiLayer3Terminator(tunnel_t *self, const char *msg);
+tunnel_t         *destroyLayer3Terminator(tunnel_t *self);
+tunnel_metadata_t getMetadataLayer3Terminator(void);
@@ -0,0 +1,530 @@
+#include "rate_limiter.h"
+#include "hmutex.h"
+#include "loggers/network_logger.h"
+#include "tunnel.h"
+#include "utils/hashutils.h"
+#include "utils/jsonutils.h"
+#include "utils/mathutils.h"
+
+/*
+    Buckets work in debt mode, a payload is always forwarded and charged to the line, user, listener and total
+    buckets of its direction, when any of them goes below zero the side that produces that direction is held and
+    the line goes on the timer wheel of its worker, the wheel releases it once all of its buckets are out of debt
+
+    holds are counted on the line apart from backpressure pauses (holdLineUpSide), so a release here never
+    resumes a side that another node has paused
+
+    so there is no timer per packet and nothing is buffered here, a throttled line costs one wheel entry and the
+    buckets are refilled lazily from the elapsed time whenever they are charged or checked
+
+    line buckets are only touched by the worker of the line, user, listener and total buckets are shared by all
+    workers, a listener is told apart by the protocol and the local port the line was accepted on
+*/
+
+enum
+{
+    kRateWheelSlots   = 128,
+    kRateWheelTickMs  = 10,
+    kRateMinBurst     = 1 << 16,
+    kRateBurstDivisor = 4, // a bucket holds a quarter second of its rate
+    kRateUsersCap     = 64,
+    kRateListenersCap = 8,
+    kRateSpeedUnit    = 1024
+};
+
+typedef struct rate_bucket_s
+{
+    atomic_llong  tokens;
+    atomic_ullong refilled_at_ms;
+    int64_t       rate; // bytes per second, 0 means unlimited
+    int64_t       burst;
+
+} rate_bucket_t;
+
+// buckets shared by the lines of one user or one listener
+typedef struct rate_group_s
+{
+    rate_bucket_t up;
+    rate_bucket_t dw;
+    hash_t        hash;
+    unsigned int  refs; // guarded by the groups mutex
+
+} rate_group_t;
+
+#define i_TYPE hmap_rate_groups_t, hash_t, rate_group_t * // NOLINT
+#include "stc/hmap.h"
+
+struct rate_limiter_con_state_s;
+
+typedef struct rate_wheel_s
+{
+    struct rate_limiter_con_state_s *slots[kRateWheelSlots];
+    tunnel_t                        *tunnel;
+    htimer_t                        *timer; // only runs while the wheel is not empty
+    uint64_t                         tick;  // the last processed tick
+    unsigned int                     count;
+    tid_t                            tid;
+
+} rate_wheel_t;
+
+typedef struct rate_limiter_state_s
+{
+    rate_bucket_t      total_up;
+    rate_bucket_t      total_dw;
+    int64_t            line_rate;
+    int64_t            user_rate;
+    int64_t            listener_rate;
+    rate_wheel_t      *wheels; // one for each worker
+    hhybridmutex_t     groups_mutex;
+    hmap_rate_groups_t users;
+    hmap_rate_groups_t listeners;
+
+} rate_limiter_state_t;
+
+typedef struct rate_limiter_con_state_s
+{
+    struct rate_limiter_con_state_s  *wheel_next;
+    struct rate_limiter_con_state_s **wheel_pprev; // NULL while the line is not on the wheel
+    line_t                           *line;
+    rate_group_t                     *user;
+    rate_group_t                     *listener;
+    rate_bucket_t                     up;
+    rate_bucket_t                     dw;
+    bool                              up_held; // this node holds the down side, the producer of up payloads
+    bool                              dw_held;
+
+} rate_limiter_con_state_t;
+
+static void initBucket(rate_bucket_t *b, int64_t rate, uint64_t now_ms)
+{
+    b->rate  = rate;
+    b->burst = max(rate / kRateBurstDivisor, (int64_t) kRateMinBurst);
+    atomic_init(&(b->tokens), b->burst);
+    atomic_init(&(b->refilled_at_ms), now_ms);
+}
+
+static void refillBucket(rate_bucket_t *b, uint64_t now_ms)
+{
+    uint64_t last = atomic_load_explicit(&(b->refilled_at_ms), memory_order_relaxed);
+    if (now_ms <= last)
+    {
+        return;
+    }
+    const int64_t add = (int64_t) ((now_ms - last) * (uint64_t) b->rate / 1000);
+    if (add <= 0)
+    {
+        return;
+    }
+    // only the time that made whole bytes is used up, the rest is kept for the next refill
+    const uint64_t used_ms = max((uint64_t) 1, (uint64_t) add * 1000 / (uint64_t) b->rate);
+
+    if (! atomic_compare_exchange_strong_explicit(&(b->refilled_at_ms), &last, last + used_ms, memory_order_relaxed,
+                                                  memory_order_relaxed))
+    {
+        // another worker refilled it
+        return;
+    }
+    const int64_t tokens = atomic_fetch_add_explicit(&(b->tokens), add, memory_order_relaxed) + add;
+    if (tokens > b->burst)
+    {
+        atomic_fetch_sub_explicit(&(b->tokens), tokens - b->burst, memory_order_relaxed);
+    }
+}
+
+// returns the milliseconds the bucket needs to get out of debt, 0 if it is not in debt
+static uint64_t chargeBucket(rate_bucket_t *b, int64_t bytes, uint64_t now_ms)
+{
+    if (b->rate == 0)
+    {
+        return 0;
+    }
+    refillBucket(b, now_ms);
+    const int64_t tokens = atomic_fetch_sub_explicit(&(b->tokens), bytes, memory_order_relaxed) - bytes;
+    return tokens >= 0 ? 0 : (uint64_t) ((-tokens) * 1000 / b->rate) + 1;
+}
+
+static uint64_t chargeUp(rate_limiter_state_t *state, rate_limiter_con_state_t *cstate, int64_t bytes, uint64_t now_ms)
+{
+    uint64_t wait = chargeBucket(&(cstate->up), bytes, now_ms);
+    if (cstate->user)
+    {
+        wait = max(wait, chargeBucket(&(cstate->user->up), bytes, now_ms));
+    }
+    if (cstate->listener)
+    {
+        wait = max(wait, chargeBucket(&(cstate->listener->up), bytes, now_ms));
+    }
+    return max(wait, chargeBucket(&(state->total_up), bytes, now_ms));
+}
+
+static uint64_t chargeDw(rate_limiter_state_t *state, rate_limiter_con_state_t *cstate, int64_t bytes, uint64_t now_ms)
+{
+    uint64_t wait = chargeBucket(&(cstate->dw), bytes, now_ms);
+    if (cstate->user)
+    {
+        wait = max(wait, chargeBucket(&(cstate->user->dw), bytes, now_ms));
+    }
+    if (cstate->listener)
+    {
+        wait = max(wait, chargeBucket(&(cstate->listener->dw), bytes, now_ms));
+    }
+    return max(wait, chargeBucket(&(state->total_dw), bytes, now_ms));
+}
+
+static void wheelRemove(rate_wheel_t *wheel, rate_limiter_con_state_t *cstate)
+{
+    if (cstate->wheel_pprev == NULL)
+    {
+        return;
+    }
+    *(cstate->wheel_pprev) = cstate->wheel_next;
+    if (cstate->wheel_next)
+    {
+        cstate->wheel_next->wheel_pprev = cstate->wheel_pprev;
+    }
+    cstate->wheel_next  = NULL;
+    cstate->wheel_pprev = NULL;
+    wheel->count--;
+}
+
+static void onWheelTick(htimer_t *timer);
+
+static void wheelInsert(rate_wheel_t *wheel, rate_limiter_con_state_t *cstate, uint64_t wait_ms, uint64_t now_ms)
+{
+    wheelRemove(wheel, cstate);
+
+    if (wheel->timer == NULL)
+    {
+        wheel->tick  = now_ms / kRateWheelTickMs;
+        wheel->timer = htimer_add(getWorkerLoop(wheel->tid), onWheelTick, kRateWheelTickMs, INFINITE);
+        hevent_set_userdata(wheel->timer, wheel);
+    }
+
+    // longer waits land on the last slot and are checked again there
+    const uint64_t ticks =
+        min(max((wait_ms + kRateWheelTickMs - 1) / kRateWheelTickMs, (uint64_t) 1), (uint64_t) kRateWheelSlots - 1);
+
+    rate_limiter_con_state_t **slot = &(wheel->slots[(wheel->tick + ticks) % kRateWheelSlots]);
+
+    cstate->wheel_next  = *slot;
+    cstate->wheel_pprev = slot;
+    if (*slot)
+    {
+        (*slot)->wheel_pprev = &(cstate->wheel_next);
+    }
+    *slot = cstate;
+    wheel->count++;
+}
+
+static void reviewThrottledLine(tunnel_t *self, rate_wheel_t *wheel, rate_limiter_con_state_t *cstate,
+                                uint64_t now_ms)
+{
+    rate_limiter_state_t *state   = TSTATE(self);
+    line_t               *line    = cstate->line;
+    uint64_t              up_wait = 0;
+    uint64_t              dw_wait = 0;
+
+    if (cstate->up_held)
+    {
+        up_wait = chargeUp(state, cstate, 0, now_ms);
+    }
+    if (cstate->dw_held)
+    {
+        dw_wait = chargeDw(state, cstate, 0, now_ms);
+    }
+
+    const uint64_t wait = up_wait == 0 ? dw_wait : (dw_wait == 0 ? up_wait : min(up_wait, dw_wait));
+    if (wait > 0)
+    {
+        wheelInsert(wheel, cstate, wait, now_ms);
+    }
+
+    // a released side may read and close the line right away, which frees cstate
+    lockLine(line);
+    if (cstate->up_held && up_wait == 0)
+    {
+        cstate->up_held = false;
+        releaseLineDownSide(line);
+    }
+    if (isAlive(line) && cstate->dw_held && dw_wait == 0)
+    {
+        cstate->dw_held = false;
+        releaseLineUpSide(line);
+    }
+    unLockLine(line);
+}
+
+static void onWheelTick(htimer_t *timer)
+{
+    rate_wheel_t  *wheel  = hevent_userdata(timer);
+    tunnel_t      *self   = wheel->tunnel;
+    const uint64_t now_ms = hloop_now_ms(getWorkerLoop(wheel->tid));
+    const uint64_t target = now_ms / kRateWheelTickMs;
+
+    // a late timer does not need to walk the same slot twice
+    if (target > wheel->tick + kRateWheelSlots)
+    {
+        wheel->tick = target - kRateWheelSlots;
+    }
+
+    while (wheel->tick < target && wheel->count > 0)
+    {
+        wheel->tick++;
+        rate_limiter_con_state_t **slot = &(wheel->slots[wheel->tick % kRateWheelSlots]);
+
+        // a released line can close and leave the wheel in the middle of this loop, so the slot head is read
+        // again after each entry
+        rate_limiter_con_state_t *cstate;
+        while ((cstate = *slot) != NULL)
+        {
+            wheelRemove(wheel, cstate);
+            reviewThrottledLine(self, wheel, cstate, now_ms);
+        }
+    }
+
+    if (wheel->count == 0)
+    {
+        htimer_del(wheel->timer);
+        wheel->timer = NULL;
+    }
+}
+
+static rate_group_t *acquireGroup(rate_limiter_state_t *state, hmap_rate_groups_t *groups, hash_t hash,
+                                  int64_t rate, uint64_t now_ms)
+{
+    hhybridmutex_lock(&(state->groups_mutex));
+    rate_group_t *group = NULL;
+
+    hmap_rate_groups_t_iter find_result = hmap_rate_groups_t_find(groups, hash);
+    if (find_result.ref != hmap_rate_groups_t_end(groups).ref)
+    {
+        group = find_result.ref->second;
+    }
+    else
+    {
+        group       = globalMalloc(sizeof(rate_group_t));
+        group->hash = hash;
+        group->refs = 0;
+        initBucket(&(group->up), rate, now_ms);
+        initBucket(&(group->dw), rate, now_ms);
+        hmap_rate_groups_t_insert(groups, hash, group);
+    }
+    group->refs++;
+    hhybridmutex_unlock(&(state->groups_mutex));
+    return group;
+}
+
+static void releaseGroup(rate_limiter_state_t *state, hmap_rate_groups_t *groups, rate_group_t *group)
+{
+    hhybridmutex_lock(&(state->groups_mutex));
+    if (--(group->refs) == 0)
+    {
+        hmap_rate_groups_t_erase(groups, group->hash);
+        globalFree(group);
+    }
+    hhybridmutex_unlock(&(state->groups_mutex));
+}
+
+// listeners put their local port on src_ctx
+static hash_t listenerHash(line_t *line)
+{
+    const uint32_t key = ((uint32_t) line->src_ctx.address_protocol << 16) | sockaddr_port(&(line->src_ctx.address));
+    return CALC_HASH_PRIMITIVE(key);
+}
+
+static rate_limiter_con_state_t *newConState(tunnel_t *self, line_t *line)
+{
+    rate_limiter_state_t     *state  = TSTATE(self);
+    const uint64_t            now_ms = hloop_now_ms(getWorkerLoop(line->tid));
+    rate_limiter_con_state_t *cstate = globalMalloc(sizeof(rate_limiter_con_state_t));
+
+    *cstate = (rate_limiter_con_state_t) {.line = line};
+    initBucket(&(cstate->up), state->line_rate, now_ms);
+    initBucket(&(cstate->dw), state->line_rate, now_ms);
+
+    // the auth node in front of us tells who the user is, lines without a user only get the line limit
+    if (state->user_rate > 0 && line->auth_user != 0)
+    {
+        cstate->user = acquireGroup(state, &(state->users), line->auth_user, state->user_rate, now_ms);
+    }
+    if (state->listener_rate > 0)
+    {
+        cstate->listener = acquireGroup(state, &(state->listeners), listenerHash(line), state->listener_rate, now_ms);
+    }
+    return cstate;
+}
+
+static void destroyConState(tunnel_t *self, rate_limiter_con_state_t *cstate)
+{
+    rate_limiter_state_t *state = TSTATE(self);
+
+    wheelRemove(&(state->wheels[cstate->line->tid]), cstate);
+    if (cstate->user)
+    {
+        releaseGroup(state, &(state->users), cstate->user);
+    }
+    if (cstate->listener)
+    {
+        releaseGroup(state, &(state->listeners), cstate->listener);
+    }
+    globalFree(cstate);
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    rate_limiter_state_t *state = TSTATE(self);
+
+    if (c->payload != NULL)
+    {
+        rate_limiter_con_state_t *cstate = CSTATE(c);
+        line_t                   *line   = c->line;
+
+        // a datagram listener can not be paused, its payloads are dropped while the line is in debt
+        if (cstate->up_held && line->dw_state == NULL)
+        {
+            reuseContextPayload(c);
+            destroyContext(c);
+            return;
+        }
+
+        const uint64_t now_ms = hloop_now_ms(getWorkerLoop(line->tid));
+        const uint64_t wait   = chargeUp(state, cstate, (int64_t) bufLen(c->payload), now_ms);
+        if (wait > 0)
+        {
+            if (! cstate->up_held)
+            {
+                cstate->up_held = true;
+                holdLineDownSide(line);
+            }
+            wheelInsert(&(state->wheels[line->tid]), cstate, wait, now_ms);
+        }
+        self->up->upStream(self->up, c);
+        return;
+    }
+
+    if (c->init)
+    {
+        CSTATE_MUT(c) = newConState(self, c->line);
+    }
+    else if (c->fin)
+    {
+        destroyConState(self, CSTATE(c));
+        CSTATE_DROP(c);
+    }
+    self->up->upStream(self->up, c);
+}
+
+static void downStream(tunnel_t *self, context_t *c)
+{
+    rate_limiter_state_t *state = TSTATE(self);
+
+    if (c->payload != NULL)
+    {
+        rate_limiter_con_state_t *cstate = CSTATE(c);
+        line_t                   *line   = c->line;
+
+        if (cstate->dw_held && line->up_state == NULL)
+        {
+            reuseContextPayload(c);
+            destroyContext(c);
+            return;
+        }
+
+        const uint64_t now_ms = hloop_now_ms(getWorkerLoop(line->tid));
+        const uint64_t wait   = chargeDw(state, cstate, (int64_t) bufLen(c->payload), now_ms);
+        if (wait > 0)
+        {
+            if (! cstate->dw_held)
+            {
+                cstate->dw_held = true;
+                holdLineUpSide(line);
+            }
+            wheelInsert(&(state->wheels[line->tid]), cstate, wait, now_ms);
+        }
+        self->dw->downStream(self->dw, c);
+        return;
+    }
+
+    if (c->fin)
+    {
+        destroyConState(self, CSTATE(c));
+        CSTATE_DROP(c);
+    }
+    self->dw->downStream(self->dw, c);
+}
+
+tunnel_t *newRateLimiter(node_instance_context_t *instance_info)
+{
+    const cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    {
+        LOGF("JSON Error: RateLimiter->settings (object field) : The object was empty or invalid");
+        return NULL;
+    }
+
+    // all speeds are in KB/s and apply to each direction separately, 0 means unlimited
+    int line_speed     = 0;
+    int user_speed     = 0;
+    int listener_speed = 0;
+    int total_speed    = 0;
+    getIntFromJsonObjectOrDefault(&line_speed, settings, "line-speed", 0);
+    getIntFromJsonObjectOrDefault(&user_speed, settings, "user-speed", 0);
+    getIntFromJsonObjectOrDefault(&listener_speed, settings, "listener-speed", 0);
+    getIntFromJsonObjectOrDefault(&total_speed, settings, "total-speed", 0);
+
+    if (line_speed < 0 || user_speed < 0 || listener_speed < 0 || total_speed < 0)
+    {
+        LOGF("JSON Error: RateLimiter->settings : speeds can not be negative");
+        return NULL;
+    }
+    if (line_speed == 0 && user_speed == 0 && listener_speed == 0 && total_speed == 0)
+    {
+        LOGW("RateLimiter: no speed limit is set, the node will only pass the traffic");
+    }
+
+    rate_limiter_state_t *state = globalMalloc(sizeof(rate_limiter_state_t));
+    memset(state, 0, sizeof(rate_limiter_state_t));
+
+    state->line_rate     = (int64_t) line_speed * kRateSpeedUnit;
+    state->user_rate     = (int64_t) user_speed * kRateSpeedUnit;
+    state->listener_rate = (int64_t) listener_speed * kRateSpeedUnit;
+    initBucket(&(state->total_up), (int64_t) total_speed * kRateSpeedUnit, hloop_now_ms(getWorkerLoop(0)));
+    initBucket(&(state->total_dw), (int64_t) total_speed * kRateSpeedUnit, hloop_now_ms(getWorkerLoop(0)));
+
+    state->users     = hmap_rate_groups_t_with_capacity(kRateUsersCap);
+    state->listeners = hmap_rate_groups_t_with_capacity(kRateListenersCap);
+    hhybridmutex_init(&(state->groups_mutex));
+
+    tunnel_t *t = newTunnel();
+
+    state->wheels = globalMalloc(sizeof(rate_wheel_t) * getWorkersCount());
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        state->wheels[i] = (rate_wheel_t) {.tunnel = t, .tid = (tid_t) i};
+    }
+
+    t->state      = state;
+    t->upStream   = &upStream;
+    t->downStream = &downStream;
+
+    return t;
+}
+
+api_result_t apiRateLimiter(tunnel_t *self, const char *msg)
+{
+    (void) (self);
+    (void) (msg);
+    return (api_result_t) {0};
+}
+
+tunnel_t *destroyRateLimiter(tunnel_t *self)
+{
+    (void) (self);
+    return NULL;
+}
+
+tunnel_metadata_t getMetadataRateLimiter(void)
+{
+    return (tunnel_metadata_t) {.version = 0001, .flags = 0x0};
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "api.h"
+
+//
+// dw <------>  RateLimiter (line / user / listener / total token buckets)  <------> up
+//
+// a line that spent more than its share keeps its payload flowing but the side that produces it is held
+// until the buckets recover, datagram lines (nothing to pause) drop payloads while they are in debt
+//
+
+tunnel_t         *newRateLimiter(node_instance_context_t *instance_info);
+api_result_t      apiRateLimiter(tunnel_t *self, const char *msg);
+tunnel_t         *destroyRateLimiter(tunnel_t *self);
+tunnel_metadata_t getMetadataRateLimiter(void);
@@ -282,6 +282,7 @@ static void upStream(tunnel_t *self, context_t *c)
                         CSTATE_DROP(c);
                         globalFree(cstate);
 
+                        // rare when the listener steers pairs to one worker (TcpListener "halfduplex-pairing")
                         pipeTo(self, c->line, tid_download_line);
                         pipeUpStream(c);
                         return; // piped to another worker which has waiting connections
@@ -5,6 +5,8 @@
 
 #define kMaxConcurrentStreams 0xffffffffU // NOLINT
 
+static bool sendNgHttp2Data(tunnel_t *self, http2_server_con_state_t *con);
+
 static nghttp2_nv makeNV(const char *name, const char *value)
 {
     nghttp2_nv nv;
@@ -46,11 +48,36 @@ static void removeStream(http2_server_con_state_t *con, http2_server_child_con_s
 static void onStreamLinePaused(void *arg)
 {
     http2_server_child_con_state_t *stream = (http2_server_child_con_state_t *) arg;
+    tunnel_t                       *self   = stream->tunnel;
+    http2_server_con_state_t       *con    = LSTATE(stream->parent);
+    if (con->framer)
+    {
+        // only this stream stops returning window, the other streams of the connection keep flowing
+        http2FramerPauseStream(con->framer, stream->fstream);
+        return;
+    }
     pauseLineDownSide(stream->parent);
 }
 static void onStreamLineResumed(void *arg)
 {
     http2_server_child_con_state_t *stream = (http2_server_child_con_state_t *) arg;
+    tunnel_t                       *self   = stream->tunnel;
+    http2_server_con_state_t       *con    = LSTATE(stream->parent);
+    if (con->framer)
+    {
+        http2FramerResumeStream(con->framer, stream->fstream);
+        line_t *h2line = con->line;
+        lockLine(h2line);
+        while (sendNgHttp2Data(self, con))
+        {
+            if (! isAlive(h2line))
+            {
+                break;
+            }
+        }
+        unLockLine(h2line);
+        return;
+    }
     resumeLineDownSide(stream->parent);
 }
 
@@ -94,7 +121,10 @@ static http2_server_child_con_state_t *createHttp2Stream(http2_server_con_state_
     }
 
     LSTATE_MUT(stream->line) = stream;
-    nghttp2_session_set_stream_user_data(con->session, stream_id, stream);
+    if (! con->framer)
+    {
+        nghttp2_session_set_stream_user_data(con->session, stream_id, stream);
+    }
     setupLineDownSide(stream->line, onStreamLinePaused, stream, onStreamLineResumed);
 
     return stream;
@@ -122,12 +152,20 @@ static http2_server_con_state_t *createHttp2Connection(tunnel_t *self, line_t *l
     http2_server_state_t     *state = TSTATE(self);
     http2_server_con_state_t *con   = globalMalloc(sizeof(http2_server_con_state_t));
     memset(con, 0, sizeof(http2_server_con_state_t));
-    nghttp2_session_server_new2(&con->session, state->cbs, con, state->ngoptions);
     con->tunnel  = self;
     con->line    = line;
     con->actions = action_queue_t_with_capacity(16);
     setupLineUpSide(line, onH2LinePaused, con, onH2LineResumed);
 
+    if (state->native_engine)
+    {
+        // grpc is decided per stream from the request content-type
+        con->framer = newHttp2Framer(getLineBufferPool(line), true, false);
+        return con;
+    }
+
+    nghttp2_session_server_new2(&con->session, state->cbs, con, state->ngoptions);
+
     nghttp2_settings_entry settings[] = {
         {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, kMaxConcurrentStreams},
         {NGHTTP2_SETTINGS_MAX_FRAME_SIZE, (1U << 18)},
@@ -135,6 +173,8 @@ static http2_server_con_state_t *createHttp2Connection(tunnel_t *self, line_t *l
 
     };
     nghttp2_submit_settings(con->session, NGHTTP2_FLAG_NONE, settings, ARRAY_SIZE(settings));
+    // data frames are flow controlled by nghttp2, so the connection window must not be the bottleneck
+    nghttp2_session_set_local_window_size(con->session, NGHTTP2_FLAG_NONE, 0, kHttp2ConnectionWindow);
     return con;
 }
 static void deleteHttp2Connection(http2_server_con_state_t *con)
@@ -163,7 +203,26 @@ static void deleteHttp2Connection(http2_server_con_state_t *con)
     action_queue_t_drop(&con->actions);
 
     doneLineUpSide(con->line);
+    if (con->framer)
+    {
+        destroyHttp2Framer(con->framer);
+    }
     nghttp2_session_del(con->session);
+    http2DataSourceDestroyAll(&con->data_sources);
+    if (con->out_buf)
+    {
+        reuseBuffer(getLineBufferPool(con->line), con->out_buf);
+    }
     LSTATE_DROP(con->line);
     globalFree(con);
 }
+
+// the peer sent goaway (or broke the protocol) and nothing is left to send or receive
+static bool isHttp2ConnectionDone(http2_server_con_state_t *con)
+{
+    if (con->framer)
+    {
+        return http2FramerWantsClose(con->framer) && con->root.next == NULL;
+    }
+    return nghttp2_session_want_read(con->session) == 0 && nghttp2_session_want_write(con->session) == 0;
+}
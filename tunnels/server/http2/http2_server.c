@@ -5,8 +5,27 @@
 #include "loggers/network_logger.h"
 #include "nghttp2/nghttp2.h"
 #include "types.h"
+#include "utils/jsonutils.h"
 #include "utils/mathutils.h"
 
+enum
+{
+    kMaxResponseHeaders = 10
+};
+
+static int makeResponseHeaders(http2_server_con_state_t *con, http2_header_t *headers)
+{
+    int hlen        = 0;
+    headers[hlen++] = (http2_header_t) {":status", "200"};
+    if (con->content_type == kApplicationGrpc)
+    {
+        // correct content_type: application/grpc
+        headers[hlen++] = (http2_header_t) {"content-type", httpContentTypeStr(kApplicationGrpc)};
+        headers[hlen++] = (http2_header_t) {"accept-encoding", "identity"};
+    }
+    return hlen;
+}
+
 static int onStreamClosedCallback(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *userdata)
 {
     (void) error_code;
@@ -17,7 +36,17 @@ static int onStreamClosedCallback(nghttp2_session *session, int32_t stream_id, u
 
     // todo (optimize) nghttp2 is calling this callback even if we close the con ourselves
     // this should be omitted
-    
+
+    http2_data_source_t *src = http2DataSourceFind(con->data_sources, stream_id);
+    if (src)
+    {
+        if (stream)
+        {
+            stream->data_source = NULL;
+        }
+        http2DataSourceDestroy(src);
+    }
+
     if (! stream)
     {
         return 0;
@@ -96,9 +125,8 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
         return 0;
     }
 
-    shift_buffer_t *buf = popBuffer(getLineBufferPool(con->line));
-    setLen(buf, len);
-    writeRaw(buf, data, len);
+    shift_buffer_t *buf = http2TakeRecvChunk(getLineBufferPool(con->line), getWorkerShiftBufferPool(con->line->tid),
+                                             con->recv_buf, data, len);
 
     lockLine(stream->line);
     action_queue_t_push(
@@ -156,15 +184,12 @@ static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *fr
 
         if (frame->headers.cat == NGHTTP2_HCAT_REQUEST)
         {
-
-            nghttp2_nv nvs[10];
-            int        nvlen = 0;
-            nvs[nvlen++]     = makeNV(":status", "200");
-            if (con->content_type == kApplicationGrpc)
+            http2_header_t headers[kMaxResponseHeaders];
+            nghttp2_nv     nvs[kMaxResponseHeaders];
+            const int      nvlen = makeResponseHeaders(con, headers);
+            for (int i = 0; i < nvlen; i++)
             {
-                // correct content_type: application/grpc
-                nvs[nvlen++] = makeNV("content-type", httpContentTypeStr(kApplicationGrpc));
-                nvs[nvlen++] = makeNV("accept-encoding", "identity");
+                nvs[i] = makeNV(headers[i].name, headers[i].value);
             }
 
             int flags = NGHTTP2_FLAG_END_HEADERS;
@@ -186,57 +211,77 @@ static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *fr
 
 
 
+static int onSendDataCallback(nghttp2_session *session, nghttp2_frame *frame, const uint8_t *framehd, size_t length,
+                              nghttp2_data_source *source, void *userdata)
+{
+    (void) session;
+    http2_server_con_state_t *con = (http2_server_con_state_t *) userdata;
+    assert(frame->data.padlen == 0);
+
+    http2AppendBuffer(getLineBufferPool(con->line), &con->out_buf,
+                      http2DataSourceTakeFrame(source->ptr, framehd, length));
+
+    // let the caller write what is merged so far, instead of copying more large frames behind it
+    if (bufLen(con->out_buf) >= kHttp2CoalesceLimit)
+    {
+        return NGHTTP2_ERR_PAUSE;
+    }
+    return 0;
+}
+
 static void sendStreamResposnseData(http2_server_con_state_t *con, http2_server_child_con_state_t *stream,
                                     shift_buffer_t *buf)
 {
-    http2_flag flags = kHttP2FlagNone;
     if (WW_UNLIKELY(! stream))
     {
         reuseBuffer(getLineBufferPool(con->line), buf);
         return;
     }
 
-    if (con->content_type == kApplicationGrpc)
+    if (con->framer)
     {
-        grpc_message_hd msghd;
-        msghd.flags  = 0;
-        msghd.length = bufLen(buf);
-        flags        = kHttP2FlagNone;
-        shiftl(buf, GRPC_MESSAGE_HDLEN);
-        grpcMessageHdPack(&msghd, rawBufMut(buf));
-    }
-
-    http2_frame_hd framehd;
-    framehd.length    = bufLen(buf);
-    framehd.type      = kHttP2Data;
-    framehd.flags     = flags;
-    framehd.stream_id = stream->stream_id;
-    shiftl(buf, HTTP2_FRAME_HDLEN);
-    http2FrameHdPack(&framehd, rawBufMut(buf));
-    context_t *response_data = newContext(con->line);
-    response_data->payload   = buf;
-    con->tunnel->dw->downStream(con->tunnel->dw, response_data);
+        // out of send window, the payload stays queued in the framer until the peer returns credit
+        if (! http2FramerSendData(con->framer, stream->fstream, buf) && ! stream->paused)
+        {
+            stream->paused = true;
+            pauseLineUpSide(stream->line);
+        }
+        return;
+    }
+
+    http2SubmitPayload(con->session, &con->data_sources, &stream->data_source, stream->stream_id,
+                       getLineBufferPool(con->line), buf, con->content_type == kApplicationGrpc);
 }
 
+// writes everything nghttp2 has to send as one buffer, returns false when there was nothing
 static bool sendNgHttp2Data(tunnel_t *self, http2_server_con_state_t *con)
 {
-    line_t *main_line = con->line;
-    char   *data      = NULL;
-    size_t  len       = nghttp2_session_mem_send(con->session, (const uint8_t **) &data);
+    line_t        *main_line = con->line;
+    const uint8_t *data      = NULL;
+    nghttp2_ssize  len;
+
+    if (con->framer)
+    {
+        con->out_buf = http2FramerTakeOutput(con->framer);
+    }
+    else
+    {
+        while ((len = nghttp2_session_mem_send2(con->session, &data)) > 0)
+        {
+            http2AppendBytes(getLineBufferPool(main_line), &con->out_buf, data, len);
+        }
+    }
 
-    if (len > 0)
+    if (con->out_buf == NULL)
     {
-        shift_buffer_t *send_buf = popBuffer(getLineBufferPool(main_line));
-        shiftl(send_buf, lCap(send_buf) / 2); // use some unused space
-        setLen(send_buf, len);
-        writeRaw(send_buf, data, len);
-        context_t *response_data = newContext(main_line);
-        response_data->payload   = send_buf;
-        self->dw->downStream(self->dw, response_data);
-        return true;
+        return false;
     }
 
-    return false;
+    context_t *response_data = newContext(main_line);
+    response_data->payload   = con->out_buf;
+    con->out_buf             = NULL;
+    self->dw->downStream(self->dw, response_data);
+    return true;
 }
 
 static void doHttp2Action(const http2_action_t action, http2_server_con_state_t *con)
@@ -267,7 +312,8 @@ static void doHttp2Action(const http2_action_t action, http2_server_con_state_t
     break;
 
     case kActionStreamDataReceived: {
-        if (con->content_type == kApplicationGrpc)
+        // the native framer delivers whole grpc messages already
+        if (con->content_type == kApplicationGrpc && con->framer == NULL)
         {
             bufferStreamPush(stream->grpc_buffer_stream, action.buf);
 
@@ -275,11 +321,12 @@ static void doHttp2Action(const http2_action_t action, http2_server_con_state_t
             {
                 if (stream->grpc_bytes_needed == 0 && bufferStreamLen(stream->grpc_buffer_stream) >= GRPC_MESSAGE_HDLEN)
                 {
-                    shift_buffer_t *gheader_buf = bufferStreamRead(stream->grpc_buffer_stream, GRPC_MESSAGE_HDLEN);
+                    uint8_t         gheader[GRPC_MESSAGE_HDLEN];
                     grpc_message_hd msghd;
-                    grpcMessageHdUnpack(&msghd, rawBuf(gheader_buf));
+                    bufferStreamViewBytesAt(stream->grpc_buffer_stream, 0, gheader, GRPC_MESSAGE_HDLEN);
+                    bufferStreamSkip(stream->grpc_buffer_stream, GRPC_MESSAGE_HDLEN);
+                    grpcMessageHdUnpack(&msghd, gheader);
                     stream->grpc_bytes_needed = msghd.length;
-                    reuseBuffer(getLineBufferPool(con->line), gheader_buf);
                 }
                 if (stream->grpc_bytes_needed > 0 &&
                     bufferStreamLen(stream->grpc_buffer_stream) >= stream->grpc_bytes_needed)
@@ -323,7 +370,14 @@ static void doHttp2Action(const http2_action_t action, http2_server_con_state_t
     case kActionStreamFinish: {
         context_t *fc   = newFinContext(stream->line);
         tunnel_t  *dest = stream->tunnel->up;
-        nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+        if (con->framer)
+        {
+            http2FramerCloseStream(con->framer, stream->fstream);
+        }
+        else
+        {
+            nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+        }
         removeStream(con, stream);
         deleteHttp2Stream(stream);
         dest->upStream(dest, fc);
@@ -340,6 +394,143 @@ static void doHttp2Action(const http2_action_t action, http2_server_con_state_t
     unLockLine(action.stream_line);
 }
 
+// turns one framer event into actions, the same actions the nghttp2 callbacks produce
+static void onFramerEvent(tunnel_t *self, http2_server_con_state_t *con, const http2_framer_event_t *ev)
+{
+    http2_server_child_con_state_t *stream = ev->stream ? ev->stream->userdata : NULL;
+
+    switch (ev->type)
+    {
+    case kHttp2EventHeaders:
+        if (stream)
+        {
+            if (ev->end_stream)
+            {
+                lockLine(stream->line);
+                action_queue_t_push(
+                    &con->actions,
+                    (http2_action_t) {.action_id = kActionStreamFinish, .stream_line = stream->line, .buf = NULL});
+            }
+            break;
+        }
+        if (ev->end_stream)
+        {
+            // a request without a body has nothing to tunnel
+            http2FramerCloseStream(con->framer, ev->stream);
+            break;
+        }
+        if (ev->grpc)
+        {
+            con->content_type = kApplicationGrpc;
+        }
+        {
+            http2_header_t headers[kMaxResponseHeaders];
+            http2FramerSendHeaders(con->framer, ev->stream, headers, makeResponseHeaders(con, headers), false);
+        }
+        stream               = createHttp2Stream(con, con->line, self, (int32_t) ev->stream->id);
+        stream->fstream      = ev->stream;
+        ev->stream->userdata = stream;
+        addStream(con, stream);
+
+        lockLine(stream->line);
+        action_queue_t_push(&con->actions,
+                            (http2_action_t) {.action_id = kActionStreamInit, .stream_line = stream->line, .buf = NULL});
+        break;
+
+    case kHttp2EventData:
+        if (! stream)
+        {
+            reuseBuffer(getLineBufferPool(con->line), ev->buf);
+            break;
+        }
+        lockLine(stream->line);
+        action_queue_t_push(
+            &con->actions,
+            (http2_action_t) {.action_id = kActionStreamDataReceived, .stream_line = stream->line, .buf = ev->buf});
+        if (! ev->end_stream)
+        {
+            break;
+        }
+        // fallthrough
+    case kHttp2EventStreamEnd:
+    case kHttp2EventReset:
+        if (! stream)
+        {
+            break;
+        }
+        lockLine(stream->line);
+        action_queue_t_push(&con->actions, (http2_action_t) {.action_id   = kActionStreamFinish,
+                                                             .stream_line = stream->line,
+                                                             .buf         = NULL});
+        break;
+
+    case kHttp2EventWritable:
+        if (stream && stream->paused)
+        {
+            stream->paused = false;
+            resumeLineUpSide(stream->line);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// pulls the events of the fed bytes one by one, so a dead connection or stream is never touched
+static void recvFramerData(tunnel_t *self, http2_server_con_state_t *con)
+{
+    line_t              *main_line = con->line;
+    http2_framer_event_t ev;
+
+    lockLine(main_line);
+    while (http2FramerNextEvent(con->framer, &ev))
+    {
+        if (ev.type == kHttp2EventError)
+        {
+            LOGE("Http2Server: native framer closed a connection due to a protocol error");
+            sendNgHttp2Data(self, con);
+            if (isAlive(main_line))
+            {
+                deleteHttp2Connection(con);
+                self->dw->downStream(self->dw, newFinContext(main_line));
+            }
+            unLockLine(main_line);
+            return;
+        }
+
+        onFramerEvent(self, con, &ev);
+
+        while (action_queue_t_size(&con->actions) > 0)
+        {
+            const http2_action_t action = action_queue_t_pull_front(&con->actions);
+            doHttp2Action(action, con);
+            if (! isAlive(main_line))
+            {
+                unLockLine(main_line);
+                return;
+            }
+        }
+    }
+
+    while (sendNgHttp2Data(self, con))
+    {
+        if (! isAlive(main_line))
+        {
+            unLockLine(main_line);
+            return;
+        }
+    }
+    unLockLine(main_line);
+
+    if (isHttp2ConnectionDone(con))
+    {
+        context_t *fin_ctx = newFinContext(con->line);
+        deleteHttp2Connection(con);
+        self->dw->downStream(self->dw, fin_ctx);
+    }
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     if (c->payload != NULL)
@@ -347,10 +538,21 @@ static void upStream(tunnel_t *self, context_t *c)
         http2_server_con_state_t *con = CSTATE(c);
         size_t                    len = 0;
 
+        if (con->framer)
+        {
+            http2FramerFeed(con->framer, c->payload);
+            dropContexPayload(c);
+            destroyContext(c);
+            recvFramerData(self, con);
+            return;
+        }
+
         while ((len = bufLen(c->payload)) > 0)
         {
-            size_t  consumed = min(1 << 15UL, (ssize_t) len);
-            ssize_t ret      = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
+            size_t consumed = min(1 << 15UL, (ssize_t) len);
+            con->recv_buf   = c->payload;
+            ssize_t ret     = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
+            con->recv_buf   = NULL;
             shiftr(c->payload, consumed);
 
             if (ret != (ssize_t) consumed)
@@ -395,7 +597,7 @@ static void upStream(tunnel_t *self, context_t *c)
                 }
             }
 
-            if (nghttp2_session_want_read(con->session) == 0 && nghttp2_session_want_write(con->session) == 0)
+            if (isHttp2ConnectionDone(con))
             {
                 context_t *fin_ctx = newFinContext(con->line);
                 deleteHttp2Connection(con);
@@ -433,28 +635,45 @@ static void downStream(tunnel_t *self, context_t *c)
 
     if (c->payload != NULL)
     {
+        sendStreamResposnseData(con, stream, c->payload);
+        dropContexPayload(c);
+
         lockLine(con->line);
         while (sendNgHttp2Data(self, con))
         {
             if (! isAlive(con->line))
             {
-                unLockLine(con->line);
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
+                break;
             }
         }
         unLockLine(con->line);
 
-        sendStreamResposnseData(con, stream, c->payload);
-        dropContexPayload(c);
         destroyContext(c);
     }
     else
     {
         if (c->fin)
         {
-            if (con->content_type == kApplicationGrpc)
+            if (con->framer)
+            {
+                // the trailer goes after whatever is still queued on the stream
+                if (stream->fstream->grpc)
+                {
+                    const http2_header_t trailer = {"grpc-status", "0"};
+                    http2FramerEndStream(con->framer, stream->fstream, &trailer, 1);
+                }
+                else
+                {
+                    http2FramerEndStream(con->framer, stream->fstream, NULL, 0);
+                }
+                http2FramerCloseStream(con->framer, stream->fstream);
+            }
+            else if (stream->data_source)
+            {
+                // data is still queued on this stream, the trailer goes after it
+                http2FinishDataSource(con->session, stream->data_source);
+            }
+            else if (con->content_type == kApplicationGrpc)
             {
                 nghttp2_nv nv = makeNV("grpc-status", "0");
                 nghttp2_submit_trailer(con->session, stream->stream_id, &nv, 1);
@@ -465,7 +684,10 @@ static void downStream(tunnel_t *self, context_t *c)
             }
 
             // LOGE("closing -> %d", stream->stream_id);
-            nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+            if (! con->framer)
+            {
+                nghttp2_session_set_stream_user_data(con->session, stream->stream_id, NULL);
+            }
             removeStream(con, stream);
             deleteHttp2Stream(stream);
 
@@ -481,7 +703,7 @@ static void downStream(tunnel_t *self, context_t *c)
             }
             unLockLine(con->line);
 
-            if (nghttp2_session_want_read(con->session) == 0 && nghttp2_session_want_write(con->session) == 0)
+            if (isHttp2ConnectionDone(con))
             {
                 context_t *fin_ctx = newFinContext(con->line);
                 deleteHttp2Connection(con);
@@ -499,15 +721,31 @@ static void downStream(tunnel_t *self, context_t *c)
 
 tunnel_t *newHttp2Server(node_instance_context_t *instance_info)
 {
-    (void) instance_info;
     http2_server_state_t *state = globalMalloc(sizeof(http2_server_state_t));
     memset(state, 0, sizeof(http2_server_state_t));
+    cJSON *settings = instance_info->node_settings_json;
+
+    char *engine_buf = NULL;
+    getStringFromJsonObjectOrDefault(&engine_buf, settings, "engine", "nghttp2");
+    if (strcmp(engine_buf, "native") == 0)
+    {
+        state->native_engine = true;
+    }
+    else if (strcmp(engine_buf, "nghttp2") != 0)
+    {
+        LOGF("JSON Error: Http2Server->settings->engine (string field) : expected \"nghttp2\" or \"native\"");
+        globalFree(engine_buf);
+        return NULL;
+    }
+    globalFree(engine_buf);
 
     nghttp2_session_callbacks_new(&(state->cbs));
     nghttp2_session_callbacks_set_on_header_callback(state->cbs, onHeaderCallback);
     nghttp2_session_callbacks_set_on_data_chunk_recv_callback(state->cbs, onDataChunkRecvCallback);
     nghttp2_session_callbacks_set_on_frame_recv_callback(state->cbs, onFrameRecvCallback);
     nghttp2_session_callbacks_set_on_stream_close_callback(state->cbs, onStreamClosedCallback);
+    nghttp2_session_callbacks_set_send_data_callback(state->cbs, onSendDataCallback);
+    nghttp2_session_callbacks_set_data_source_read_length_callback2(state->cbs, onHttp2DataSourceReadLength);
 
     nghttp2_option_new(&(state->ngoptions));
     nghttp2_option_set_peer_max_concurrent_streams(state->ngoptions, kMaxConcurrentStreams);
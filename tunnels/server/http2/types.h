@@ -2,6 +2,8 @@
 #include "api.h"
 #include "buffer_stream.h"
 
+#include "http2_framer.h"
+#include "http2_io.h"
 #include "http_def.h"
 #include "nghttp2/nghttp2.h"
 
@@ -33,11 +35,14 @@ typedef struct http2_server_child_con_state_s
     struct http2_server_child_con_state_s *prev, *next;
     char                                  *request_path;
     buffer_stream_t                       *grpc_buffer_stream;
+    http2_data_source_t                   *data_source;
+    http2_framer_stream_t                 *fstream; // native engine only
     line_t                                *parent;
     line_t                                *line;
     tunnel_t                              *tunnel;
     size_t                                 grpc_bytes_needed;
     int32_t                                stream_id;
+    bool                                   paused;
 
 } http2_server_child_con_state_t;
 
@@ -46,6 +51,10 @@ typedef struct http2_server_con_state_s
     http2_server_child_con_state_t root;
     action_queue_t                 actions;
     nghttp2_session               *session;
+    http2_framer_t                *framer; // set instead of session when the native engine is used
+    http2_data_source_t           *data_sources;
+    shift_buffer_t                *out_buf;  // frames of the current flush
+    shift_buffer_t                *recv_buf; // buffer being parsed by nghttp2
     tunnel_t                      *tunnel;
     line_t                        *line;
     enum http_content_type         content_type;
@@ -60,5 +69,6 @@ typedef struct http2_server_state_s
     nghttp2_session_callbacks *cbs;
     tunnel_t                  *fallback;
     nghttp2_option            *ngoptions;
+    bool                       native_engine;
 
 } http2_server_state_t;
@@ -2,10 +2,12 @@
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
 #include "mux_frame.h"
+#include "mux_scheduler.h"
+#include "utils/jsonutils.h"
 
 typedef struct mux_server_state_s
 {
-    void *_;
+    bool flow_control;
 
 } mux_server_state_t;
 
@@ -16,10 +18,8 @@ typedef struct mux_server_child_con_state_s
     tunnel_t                            *tunnel;
     line_t                              *line;
     line_t                              *parent;
-    uint32_t                             sent_nack;
-    uint32_t                             recv_nack;
+    mux_stream_t                        *stream;
     uint16_t                             cid;
-    bool                                 paused;
 
 } mux_server_child_con_state_t;
 
@@ -29,58 +29,79 @@ typedef struct mux_server_con_state_s
 
     tunnel_t        *tunnel;
     line_t          *line;
-    line_t          *current_writing_line;
     buffer_stream_t *read_stream;
+    mux_scheduler_t *scheduler;
     uint16_t         last_cid;
     uint16_t         cid_min;
     uint16_t         cid_max;
     uint16_t         contained;
+    bool             paused;
+    bool             greeted;   // the first frame was checked for a hello
+    bool             recv_held; // the main line is held for a paused child (no flow control)
+    uint8_t          features;  // accepted from the hello of the client
 
 } mux_server_con_state_t;
 
+static bool flushMainConnection(mux_server_con_state_t *con);
+
+// without flow control the only way to stop a child's sender is to stop reading the main line
+static void syncMainLineRecv(mux_server_con_state_t *con)
+{
+    const bool hold = muxSchedulerRecvPaused(con->scheduler);
+    if (hold == con->recv_held)
+    {
+        return;
+    }
+    con->recv_held = hold;
+    if (hold)
+    {
+        holdLineDownSide(con->line);
+    }
+    else
+    {
+        releaseLineDownSide(con->line);
+    }
+}
+
 static void onChildLinePaused(void *arg)
 {
-    mux_server_child_con_state_t *stream = (mux_server_child_con_state_t *) arg;
-    pauseLineDownSide(stream->parent);
+    mux_server_child_con_state_t *child_con = (mux_server_child_con_state_t *) arg;
+    tunnel_t                     *self      = child_con->tunnel;
+    mux_server_con_state_t       *main_con  = LSTATE(child_con->parent);
+
+    muxSchedulerPauseRecv(main_con->scheduler, child_con->stream);
+    syncMainLineRecv(main_con);
 }
+
 static void onChildLineResumed(void *arg)
 {
-    mux_server_child_con_state_t *stream = (mux_server_child_con_state_t *) arg;
-    resumeLineDownSide(stream->parent);
+    mux_server_child_con_state_t *child_con = (mux_server_child_con_state_t *) arg;
+    tunnel_t                     *self      = child_con->tunnel;
+    mux_server_con_state_t       *main_con  = LSTATE(child_con->parent);
+
+    muxSchedulerResumeRecv(main_con->scheduler, child_con->stream);
+    syncMainLineRecv(main_con);
+    flushMainConnection(main_con);
 }
 
 static void onMainLinePaused(void *arg)
 {
-    mux_server_con_state_t *con  = (mux_server_con_state_t *) arg;
-    tunnel_t               *self = con->tunnel;
-
-    line_t *wline = con->current_writing_line;
-    if (wline && isAlive(wline))
-    {
-        mux_server_child_con_state_t *child_con = LSTATE(wline);
-        child_con->paused                       = true;
-        pauseLineUpSide(child_con->line);
-    }
+    mux_server_con_state_t *con = (mux_server_con_state_t *) arg;
+    con->paused                 = true;
 }
 
 static void onMainLineResumed(void *arg)
 {
-    mux_server_con_state_t       *con = (mux_server_con_state_t *) arg;
-    mux_server_child_con_state_t *child_con_i;
-    for (child_con_i = con->children_root.next; child_con_i;)
-    {
-        if (child_con_i->paused)
-        {
-            child_con_i->paused = false;
-            resumeLineUpSide(child_con_i->line);
-        }
-        child_con_i = child_con_i->next;
-    }
+    mux_server_con_state_t *con = (mux_server_con_state_t *) arg;
+    con->paused                 = false;
+    flushMainConnection(con);
 }
 
-static void destroyChildConnecton(mux_server_child_con_state_t *child)
+static void destroyChildConnecton(mux_server_child_con_state_t *child, bool notify_peer)
 {
-    tunnel_t *self    = child->tunnel;
+    tunnel_t               *self   = child->tunnel;
+    mux_server_con_state_t *parent = LSTATE(child->parent);
+
     child->prev->next = child->next;
     if (child->next)
     {
@@ -88,25 +109,28 @@ static void destroyChildConnecton(mux_server_child_con_state_t *child)
     }
     else
     {
-        mux_server_con_state_t *parent = LSTATE(child->parent);
-        parent->children_root.prev     = NULL;
+        parent->children_root.prev = NULL;
     }
+    muxSchedulerCloseStream(parent->scheduler, child->stream, notify_peer);
     doneLineDownSide(child->line);
     LSTATE_DROP(child->line);
     globalFree(child);
 }
 
-static mux_server_child_con_state_t *createChildConnection(mux_server_con_state_t *parent, tid_t tid)
+static mux_server_child_con_state_t *createChildConnection(mux_server_con_state_t *parent, cid_t cid, tid_t tid)
 {
-    mux_server_child_con_state_t *child = globalMalloc(sizeof(mux_server_con_state_t));
+    tunnel_t                     *self  = parent->tunnel;
+    mux_server_child_con_state_t *child = globalMalloc(sizeof(mux_server_child_con_state_t));
 
     *child = (mux_server_child_con_state_t) {.tunnel = parent->tunnel,
                                              .line   = newLine(tid),
-                                             .cid    = parent->last_cid++,
+                                             .parent = parent->line,
+                                             .cid    = cid,
                                              .next   = parent->children_root.next,
                                              .prev   = &(parent->children_root)
 
     };
+    child->stream = muxSchedulerAddStream(parent->scheduler, cid, child, true);
 
     if (parent->children_root.next == NULL)
     {
@@ -118,6 +142,7 @@ static mux_server_child_con_state_t *createChildConnection(mux_server_con_state_
     {
         child->next->prev = child;
     }
+    LSTATE_MUT(child->line) = child;
     setupLineDownSide(child->line, onChildLinePaused, child, onChildLineResumed);
 
     return child;
@@ -131,20 +156,32 @@ static void destroyMainConnecton(mux_server_con_state_t *con)
     for (child_con_i = con->children_root.next; child_con_i;)
     {
 
-        mux_server_child_con_state_t *next    = child_con_i;
-        context_t                    *fin_ctx = newFinContext(child_con_i->line);
-        tunnel_t                     *dest    = con->tunnel->up;
+        mux_server_child_con_state_t *next       = child_con_i->next;
+        line_t                       *child_line = child_con_i->line;
+        tunnel_t                     *dest       = con->tunnel->up;
 
-        destroyChildConnecton(child_con_i);
-        dest->upStream(dest, fin_ctx);
+        destroyChildConnecton(child_con_i, false);
+        dest->upStream(dest, newFinContext(child_line));
+        destroyLine(child_line);
         child_con_i = next;
     }
+    destroyMuxScheduler(con->scheduler);
     destroyBufferStream(con->read_stream);
     doneLineUpSide(con->line);
     LSTATE_DROP(con->line);
     globalFree(con);
 }
 
+// closes the main connection from our side, the downstream gets a fin
+static void closeMainConnection(mux_server_con_state_t *con)
+{
+    tunnel_t *self      = con->tunnel;
+    line_t   *main_line = con->line;
+
+    destroyMainConnecton(con);
+    self->dw->downStream(self->dw, newFinContext(main_line));
+}
+
 static mux_server_con_state_t *createMainConnection(tunnel_t *self, line_t *main_line)
 {
     mux_server_con_state_t *con = globalMalloc(sizeof(mux_server_con_state_t));
@@ -152,30 +189,145 @@ static mux_server_con_state_t *createMainConnection(tunnel_t *self, line_t *main
     *con = (mux_server_con_state_t) {.tunnel        = self,
                                      .line          = main_line,
                                      .children_root = {0},
-                                     .read_stream   = newBufferStream(getLineBufferPool(main_line))};
+                                     .read_stream   = newBufferStream(getLineBufferPool(main_line)),
+                                     .scheduler     = newMuxScheduler(getLineBufferPool(main_line))};
 
-    setupLineDownSide(con->line, onMainLinePaused, con, onMainLineResumed);
+    setupLineUpSide(con->line, onMainLinePaused, con, onMainLineResumed);
 
     LSTATE_MUT(con->line) = con;
     return con;
 }
 
+/*
+    writes what the scheduler has for the main line as long as it is not paused, then resumes the children that
+    drained their queue, returns false if the main connection is gone
+*/
+static bool flushMainConnection(mux_server_con_state_t *con)
+{
+    tunnel_t *self      = con->tunnel;
+    line_t   *main_line = con->line;
+
+    lockLine(main_line);
+    shift_buffer_t *buf;
+    while (! con->paused && (buf = muxSchedulerNextOutput(con->scheduler)) != NULL)
+    {
+        context_t *ctx = newContext(main_line);
+        ctx->payload   = buf;
+        self->dw->downStream(self->dw, ctx);
+
+        if (! isAlive(main_line))
+        {
+            unLockLine(main_line);
+            return false;
+        }
+    }
+
+    mux_stream_t *stream;
+    while ((stream = muxSchedulerNextWritable(con->scheduler)) != NULL)
+    {
+        mux_server_child_con_state_t *child_con = stream->userdata;
+        resumeLineUpSide(child_con->line);
+    }
+
+    const bool alive = isAlive(main_line);
+    unLockLine(main_line);
+    return alive;
+}
+
+/*
+    the first frame tells if the client wants flow control, both nodes must agree on it since the format changes
+    once it is on, an accepted hello is answered with the features we took
+*/
+static bool checkHello(tunnel_t *self, mux_server_con_state_t *con, const mux_frame_t *frame,
+                       shift_buffer_t *frame_payload)
+{
+    mux_server_state_t *state = TSTATE(self);
+
+    if (con->greeted)
+    {
+        if (frame->flags == kMuxFlagHello)
+        {
+            LOGE("MuxServer: unexpected hello frame");
+            return false;
+        }
+        return true;
+    }
+    con->greeted = true;
+
+    if (frame->flags != kMuxFlagHello)
+    {
+        if (state->flow_control)
+        {
+            LOGE("MuxServer: the client did not offer flow-control, it has to be enabled on both ends");
+            return false;
+        }
+        return true;
+    }
+
+    mux_hello_t hello;
+    if (WW_UNLIKELY(bufLen(frame_payload) != sizeof(hello)))
+    {
+        LOGE("MuxServer: malformed hello frame");
+        return false;
+    }
+    memcpy(&hello, rawBuf(frame_payload), sizeof(hello));
+
+    if (! state->flow_control)
+    {
+        LOGE("MuxServer: the client offered flow-control but it is not enabled on this node");
+        return false;
+    }
+    if (hello.version != kMuxVersion || (hello.features & kMuxFeatureFlow) == 0)
+    {
+        LOGE("MuxServer: unsupported hello (version %d)", (int) hello.version);
+        return false;
+    }
+    con->features = hello.features & (kMuxFeatureFlow | kMuxFeaturePing);
+    muxSchedulerEnableFlowControl(con->scheduler);
+    muxSchedulerHello(con->scheduler, con->features);
+    return true;
+}
+
+// the first frame of a child carries its first payload
+static bool openChildConnection(tunnel_t *self, mux_server_con_state_t *main_con, cid_t cid,
+                                shift_buffer_t *frame_payload)
+{
+    line_t                       *main_line  = main_con->line;
+    mux_server_child_con_state_t *child      = createChildConnection(main_con, cid, main_line->tid);
+    line_t                       *child_line = child->line;
+    muxSchedulerOnData(main_con->scheduler, child->stream, bufLen(frame_payload));
+
+    lockLine(child_line);
+    self->up->upStream(self->up, newInitContext(child_line));
+
+    if (! isAlive(child_line))
+    {
+        unLockLine(child_line);
+        reuseBuffer(getLineBufferPool(main_line), frame_payload);
+        return isAlive(main_line);
+    }
+    unLockLine(child_line);
+
+    context_t *data_ctx = newContext(child_line);
+    data_ctx->payload   = frame_payload;
+    self->up->upStream(self->up, data_ctx);
+    return isAlive(main_line);
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     mux_server_con_state_t *main_con = CSTATE(c);
     if (c->payload != NULL)
     {
         bufferStreamPushContextPayload(main_con->read_stream, c);
-        while (bufferStreamLen(main_con->read_stream) > sizeof(mux_frame_t))
+        while (bufferStreamLen(main_con->read_stream) >= sizeof(mux_frame_t))
         {
             mux_length_t length;
             bufferStreamViewBytesAt(main_con->read_stream, 0, (uint8_t *) &length, 2);
             if (WW_UNLIKELY(length < kMuxMinFrameLength))
             {
                 LOGE("MuxServer: payload length < kMuxMinFrameLength");
-                destroyMainConnecton(main_con);
-                self->dw->downStream(self->dw, newFinContext(c->line));
-
+                closeMainConnection(main_con);
                 destroyContext(c);
                 return;
             }
@@ -188,95 +340,127 @@ static void upStream(tunnel_t *self, context_t *c)
                 memcpy(&frame, rawBuf(frame_payload), sizeof(mux_frame_t));
                 shiftr(frame_payload, sizeof(mux_frame_t));
 
-                if (frame.flags == kMuxFlagOpen)
+                if (WW_UNLIKELY(! main_con->greeted || frame.flags == kMuxFlagHello))
                 {
-                    if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
+                    if (! checkHello(self, main_con, &frame, frame_payload))
                     {
-                        LOGE("MuxServer: payload length <= 0");
                         reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                        destroyMainConnecton(main_con);
-                        self->dw->downStream(self->dw, newFinContext(c->line));
+                        closeMainConnection(main_con);
                         destroyContext(c);
+                        return;
+                    }
+                    if (frame.flags == kMuxFlagHello)
+                    {
+                        reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
                         continue;
                     }
+                }
 
-                    mux_server_child_con_state_t *child      = createChildConnection(main_con, c->line->tid);
-                    line_t                       *child_line = child->line;
-                    lockLine(child_line);
-
-                    self->up->upStream(self->up, newInitContext(child->line));
-
-                    if (! isAlive(child_line))
+                if (frame.flags == kMuxFlagOpen)
+                {
+                    if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
                     {
-                        unLockLine(child_line);
+                        LOGE("MuxServer: payload length <= 0");
                         reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                        continue;
+                        closeMainConnection(main_con);
+                        destroyContext(c);
+                        return;
                     }
-                    unLockLine(child_line);
 
-                    context_t *data_ctx = newContext(child_line);
-                    data_ctx->payload   = frame_payload;
-                    self->up->upStream(self->up, data_ctx);
+                    if (! openChildConnection(self, main_con, frame.cid, frame_payload))
+                    {
+                        destroyContext(c);
+                        return;
+                    }
+                    continue;
+                }
 
-                    if (! isAlive(c->line))
+                if (frame.flags == kMuxFlagPing)
+                {
+                    // answered with the flush after this read, the client times it
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    if (WW_UNLIKELY((main_con->features & kMuxFeaturePing) == 0))
                     {
+                        LOGE("MuxServer: ping frame without the ping feature");
+                        closeMainConnection(main_con);
                         destroyContext(c);
                         return;
                     }
+                    muxSchedulerPing(main_con->scheduler);
                     continue;
                 }
 
-                mux_server_child_con_state_t *child_con_i;
-                for (child_con_i = main_con->children_root.next; child_con_i;)
+                if (frame.flags == kMuxFlagFlow)
                 {
-                    if (child_con_i->cid == frame.cid)
+                    // the child may already be closed on our side while its last payload waits for this credit
+                    uint32_t credit;
+                    if (WW_UNLIKELY(bufLen(frame_payload) != sizeof(credit)))
                     {
+                        LOGE("MuxServer: malformed flow frame");
+                        reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                        closeMainConnection(main_con);
+                        destroyContext(c);
+                        return;
+                    }
+                    readRaw(frame_payload, &credit, sizeof(credit));
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    muxSchedulerOnFlow(main_con->scheduler, frame.cid, credit);
+                    continue;
+                }
 
-                        switch (frame.flags)
-                        {
-                        case kMuxFlagClose: {
-                            reuseBuffer(getLineBufferPool(c->line), frame_payload);
-                            context_t *fin_ctx = newFinContext(child_con_i->line);
-                            destroyChildConnecton(child_con_i);
-                            self->dw->downStream(self->dw, fin_ctx);
-                            frame_payload = NULL;
-                        }
+                mux_stream_t                 *stream      = muxSchedulerFindStream(main_con->scheduler, frame.cid);
+                mux_server_child_con_state_t *child_con_i = stream ? stream->userdata : NULL;
+                if (child_con_i)
+                {
+                    switch (frame.flags)
+                    {
+                    case kMuxFlagClose: {
+                        reuseBuffer(getLineBufferPool(c->line), frame_payload);
+                        line_t *child_line = child_con_i->line;
+                        destroyChildConnecton(child_con_i, false);
+                        syncMainLineRecv(main_con);
+                        self->up->upStream(self->up, newFinContext(child_line));
+                        destroyLine(child_line);
+                        frame_payload = NULL;
+                    }
 
-                        break;
+                    break;
 
-                        case kMuxFlagData: {
-                            if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
-                            {
-                                LOGE("MuxServer: payload length <= 0");
-                                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                                destroyMainConnecton(main_con);
-                                self->dw->downStream(self->dw, newFinContext(c->line));
-                                destroyContext(c);
-                                return;
-                            }
-
-                            context_t *data_ctx = newContext(child_con_i->line);
-                            data_ctx->payload   = frame_payload;
-                            self->dw->downStream(self->dw, data_ctx);
-                            frame_payload = NULL;
+                    case kMuxFlagData: {
+                        if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
+                        {
+                            LOGE("MuxServer: payload length <= 0");
+                            reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                            closeMainConnection(main_con);
+                            destroyContext(c);
+                            return;
                         }
-
-                        break;
-
-                        case kMuxFlagFlow:
-                            LOGE("MuxServer: kMuxFlagFlow not implemented"); // fall through
-                        default:
-                            LOGE("MuxServer: incorrect frame flag");
+                        if (WW_UNLIKELY(! muxSchedulerOnData(main_con->scheduler, child_con_i->stream,
+                                                             bufLen(frame_payload))))
+                        {
+                            LOGE("MuxServer: peer ignored the flow window of cid: %d", (int) frame.cid);
                             reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                            destroyMainConnecton(main_con);
-                            self->dw->downStream(self->dw, newFinContext(c->line));
+                            closeMainConnection(main_con);
                             destroyContext(c);
                             return;
-                            break;
                         }
+
+                        context_t *data_ctx = newContext(child_con_i->line);
+                        data_ctx->payload   = frame_payload;
+                        self->up->upStream(self->up, data_ctx);
+                        frame_payload = NULL;
+                    }
+
+                    break;
+
+                    default:
+                        LOGE("MuxServer: incorrect frame flag");
+                        reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                        closeMainConnection(main_con);
+                        destroyContext(c);
+                        return;
                         break;
                     }
-                    child_con_i = child_con_i->next;
                 }
                 if (frame_payload != NULL)
                 {
@@ -294,6 +478,10 @@ static void upStream(tunnel_t *self, context_t *c)
                 break;
             }
         }
+
+        // credits and resumed children
+        destroyContext(c);
+        flushMainConnection(main_con);
     }
     else
     {
@@ -319,58 +507,29 @@ static void downStream(tunnel_t *self, context_t *c)
 
     if (c->payload != NULL)
     {
-        line_t                 *current_writing_line = c->line;
-        line_t                 *main_line            = child_con->parent;
-        mux_server_con_state_t *main_con             = LSTATE(main_line);
-
-        switchLine(c, main_line);
-
-        lockLine(main_line);
-        lockLine(current_writing_line);
-        main_con->current_writing_line = current_writing_line;
-
-        while (bufLen(c->payload) > kMuxMaxFrameLength)
-        {
-            shift_buffer_t *chunk = popBuffer(getContextBufferPool(c));
-            sliceBufferTo(chunk, c->payload, kMuxMaxFrameLength);
-            makeDataFrame(chunk, child_con->cid);
+        mux_server_con_state_t *main_con = LSTATE(child_con->parent);
 
-            context_t *data_chunk_ctx = newContextFrom(c);
-            data_chunk_ctx->payload   = chunk;
-            self->dw->downStream(self->dw, data_chunk_ctx);
-
-            if (! isAlive(main_line))
-            {
-                unLockLine(main_line);
-                unLockLine(current_writing_line);
-
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
-            }
-        }
-
-        makeDataFrame(c->payload, child_con->cid);
-
-        self->up->upStream(self->up, c);
-
-        if (isAlive(main_line))
+        if (! muxSchedulerWrite(main_con->scheduler, child_con->stream, c->payload))
         {
-            main_con->current_writing_line = NULL;
+            pauseLineUpSide(c->line);
         }
-
-        unLockLine(main_line);
-        unLockLine(current_writing_line);
+        dropContexPayload(c);
+        destroyContext(c);
+        flushMainConnection(main_con);
     }
     else
     {
         if (c->fin)
         {
-            context_t *data_fin_ctx = newContext(child_con->parent);
-            data_fin_ctx->payload   = popBuffer(getLineBufferPool(child_con->parent));
-            makeCloseFrame(data_fin_ctx->payload, child_con->cid);
-            destroyChildConnecton(child_con);
-            self->dw->downStream(self->dw, data_fin_ctx);
+            mux_server_con_state_t *main_con   = LSTATE(child_con->parent);
+            line_t                 *child_line = c->line;
+
+            // the close frame goes out after the queued payload of the child
+            destroyChildConnecton(child_con, true);
+            destroyContext(c);
+            destroyLine(child_line);
+            syncMainLineRecv(main_con);
+            flushMainConnection(main_con);
             return;
         }
         if (WW_UNLIKELY(c->est))
@@ -383,10 +542,20 @@ static void downStream(tunnel_t *self, context_t *c)
 
 tunnel_t *newMuxServer(node_instance_context_t *instance_info)
 {
-    (void) instance_info;
+    const cJSON *settings = instance_info->node_settings_json;
+
+    if (! cJSON_IsObject(settings) && settings != NULL)
+    {
+        LOGF("JSON Error: MuxServer->settings (object field) : The object was empty or invalid");
+        return NULL;
+    }
+
     mux_server_state_t *state = globalMalloc(sizeof(mux_server_state_t));
     memset(state, 0, sizeof(mux_server_state_t));
 
+    // per child flow control changes the wire format, the client needs the same setting
+    getBoolFromJsonObjectOrDefault(&(state->flow_control), settings, "flow-control", false);
+
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
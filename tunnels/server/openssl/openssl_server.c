@@ -28,6 +28,9 @@ typedef struct oss_server_state_s
     // settings
     tunnel_t *fallback;
     bool      anti_tit; // solve tls in tls using paddings
+    bool      session_resumption;
+
+    ssl_server_resumption_t *resumption;
 
 } oss_server_state_t;
 
@@ -661,10 +664,16 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
     }
     globalFree(fallback_node);
     getBoolFromJsonObjectOrDefault(&(state->anti_tit), settings, "anti-tls-in-tls", false);
+    getBoolFromJsonObjectOrDefault(&(state->session_resumption), settings, "session-resumption", true);
 
     ssl_param->verify_peer = 0; // no mtls
     ssl_param->endpoint    = kSslServer;
 
+    if (state->session_resumption)
+    {
+        state->resumption = newSslServerResumption();
+    }
+
     for (unsigned int i = 0; i < getWorkersCount(); i++)
     {
         state->threadlocal_ssl_context[i] = sslCtxNew(ssl_param);
@@ -675,6 +684,11 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
         }
 
         SSL_CTX_set_alpn_select_cb(state->threadlocal_ssl_context[i], onAlpnSelect, state);
+
+        if (state->session_resumption)
+        {
+            sslCtxEnableServerSessionResumption(state->threadlocal_ssl_context[i], state->resumption);
+        }
     }
     // int brotli_alg = TLSEXT_comp_cert_brotli;
     // SSL_set1_cert_comp_preference(state->ssl_context,&brotli_alg,1);
@@ -21,9 +21,8 @@ enum connection_auth_state
 typedef struct reality_server_state_s
 {
 
-    tunnel_t        *dest;
-    EVP_MD_CTX     **threadlocal_sign_context;
-    EVP_CIPHER_CTX **threadlocal_cipher_context;
+    tunnel_t         *dest;
+    reality_crypto_t *threadlocal_crypto;
 
     // settings
     uint8_t      hashes[EVP_MAX_MD_SIZE];
@@ -36,10 +35,7 @@ typedef struct reality_server_state_s
 
 typedef struct reality_server_con_state_s
 {
-    EVP_MD                    *msg_digest;
-    EVP_PKEY                  *sign_key;
-    EVP_MD_CTX                *sign_context;
-    EVP_CIPHER_CTX            *cipher_context;
+    reality_crypto_t          *crypto;
     buffer_stream_t           *read_stream;
     uint8_t                    giveup_counter;
     enum connection_auth_state auth_state;
@@ -52,10 +48,6 @@ static void cleanup(tunnel_t *self, context_t *c)
     reality_server_con_state_t *cstate = CSTATE(c);
 
     destroyBufferStream(cstate->read_stream);
-    // EVP_CIPHER_CTX_free(cstate->cipher_context);
-    // EVP_MD_CTX_free(cstate->sign_context);
-    EVP_MD_free(cstate->msg_digest);
-    EVP_PKEY_free(cstate->sign_key);
 
     globalFree(cstate);
     CSTATE_DROP(c);
@@ -88,7 +80,8 @@ static void upStream(tunnel_t *self, context_t *c)
                     shift_buffer_t *record_buf = bufferStreamRead(cstate->read_stream, kTLSHeaderlen + length);
                     shiftr(record_buf, kTLSHeaderlen);
 
-                    if (verifyMessage(record_buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key))
+                    // only the tag is checked here, these bytes may still belong to the real tls session
+                    if (realityVerify(cstate->crypto, rawBuf(record_buf), bufLen(record_buf)))
                     {
                         reuseContextPayload(c);
                         cstate->auth_state = kConAuthorized;
@@ -103,8 +96,15 @@ static void upStream(tunnel_t *self, context_t *c)
                             return;
                         }
 
-                        record_buf = genericDecrypt(record_buf, cstate->cipher_context, state->context_password,
-                                                    getContextBufferPool(c));
+                        size_t plain_len = 0;
+                        if (! realityOpen(cstate->crypto, rawBufMut(record_buf), bufLen(record_buf), &plain_len))
+                        {
+                            reuseBuffer(getContextBufferPool(c), record_buf);
+                            goto failed;
+                        }
+                        shiftr(record_buf, kSignLen + kIVlen);
+                        setLen(record_buf, plain_len);
+
                         context_t *plain_data_ctx = newContextFrom(c);
                         plain_data_ctx->payload   = record_buf;
                         self->up->upStream(self->up, plain_data_ctx);
@@ -143,38 +143,29 @@ static void upStream(tunnel_t *self, context_t *c)
         case kConAuthorized: {
             bufferStreamPushContextPayload(cstate->read_stream, c);
         authorized:;
-            uint8_t tls_header[1 + 2 + 2];
-            while (isAlive(c->line) && bufferStreamLen(cstate->read_stream) >= kTLSHeaderlen)
+            while (isAlive(c->line))
             {
-                bufferStreamViewBytesAt(cstate->read_stream, 0, tls_header, kTLSHeaderlen);
-                uint16_t length = ntohs(*(uint16_t *) (tls_header + 3));
-                if ((int) bufferStreamLen(cstate->read_stream) >= kTLSHeaderlen + length)
+                bool            failed = false;
+                shift_buffer_t *buf    = realityOpenRecords(cstate->crypto, cstate->read_stream, getContextBufferPool(c),
+                                                            getWorkerShiftBufferPool(c->line->tid), &failed);
+                if (failed)
                 {
-                    shift_buffer_t *buf = bufferStreamRead(cstate->read_stream, kTLSHeaderlen + length);
-                    bool            is_tls_applicationdata = ((uint8_t *) rawBuf(buf))[0] == kTLS12ApplicationData;
-                    uint16_t        tls_ver_b;
-                    memcpy(&tls_ver_b, ((uint8_t *) rawBuf(buf)) + 1, sizeof(uint16_t));
-                    bool is_tls_33 = tls_ver_b == kTLSVersion12;
-                    shiftr(buf, kTLSHeaderlen);
-
-                    if (! verifyMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key) ||
-                        ! is_tls_applicationdata || ! is_tls_33)
-                    {
-                        LOGE("RealityServer: verifyMessage failed");
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        goto failed;
-                    }
-
-                    buf = genericDecrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-
-                    context_t *plain_data_ctx = newContextFrom(c);
-                    plain_data_ctx->payload   = buf;
-                    self->up->upStream(self->up, plain_data_ctx);
+                    LOGE("RealityServer: verifyMessage failed");
+                    goto failed;
                 }
-                else
+                if (buf == NULL)
                 {
                     break;
                 }
+                if (bufLen(buf) == 0)
+                {
+                    reuseBuffer(getContextBufferPool(c), buf);
+                    continue;
+                }
+
+                context_t *plain_data_ctx = newContextFrom(c);
+                plain_data_ctx->payload   = buf;
+                self->up->upStream(self->up, plain_data_ctx);
             }
             destroyContext(c);
         }
@@ -191,12 +182,8 @@ static void upStream(tunnel_t *self, context_t *c)
             memset(CSTATE(c), 0, sizeof(reality_server_con_state_t));
             cstate->auth_state     = kConAuthPending;
             cstate->giveup_counter = state->counter_threshold;
-            cstate->cipher_context = state->threadlocal_cipher_context[c->line->tid];
-            cstate->sign_context   = state->threadlocal_sign_context[c->line->tid];
+            cstate->crypto         = &(state->threadlocal_crypto[c->line->tid]);
             cstate->read_stream    = newBufferStream(getContextBufferPool(c));
-            cstate->msg_digest     = (EVP_MD *) EVP_get_digestbynid(MSG_DIGEST_ALG);
-            int sk_size            = EVP_MD_size(cstate->msg_digest);
-            cstate->sign_key       = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, state->hashes, sk_size);
 
             state->dest->upStream(state->dest, c);
         }
@@ -221,7 +208,6 @@ failed:;
 
 static void downStream(tunnel_t *self, context_t *c)
 {
-    reality_server_state_t     *state  = TSTATE(self);
     reality_server_con_state_t *cstate = CSTATE(c);
 
     if (c->payload != NULL)
@@ -240,8 +226,7 @@ static void downStream(tunnel_t *self, context_t *c)
 
             if (bufLen(buf) < chunk_size)
             {
-                buf = genericEncrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-                signMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+                buf = realitySeal(cstate->crypto, buf, getContextBufferPool(c));
                 appendTlsHeader(buf);
                 assert(bufLen(buf) % 16 == 5);
                 c->payload = buf;
@@ -253,9 +238,7 @@ static void downStream(tunnel_t *self, context_t *c)
                 {
                     const uint16_t  remain = (uint16_t) min(bufLen(buf), chunk_size);
                     shift_buffer_t *chunk  = shallowSliceBuffer(getWorkerShiftBufferPool(c->line->tid), buf, remain);
-                    chunk =
-                        genericEncrypt(chunk, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-                    signMessage(chunk, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+                    chunk = realitySeal(cstate->crypto, chunk, getContextBufferPool(c));
                     appendTlsHeader(chunk);
                     context_t *cout = newContextFrom(c);
                     cout->payload   = chunk;
@@ -295,15 +278,6 @@ tunnel_t *newRealityServer(node_instance_context_t *instance_info)
     memset(state, 0, sizeof(reality_server_state_t));
     const cJSON *settings = instance_info->node_settings_json;
 
-    state->threadlocal_cipher_context = globalMalloc(sizeof(EVP_CIPHER_CTX *) * getWorkersCount());
-    state->threadlocal_sign_context   = globalMalloc(sizeof(EVP_MD_CTX *) * getWorkersCount());
-
-    for (unsigned int i = 0; i < getWorkersCount(); i++)
-    {
-        state->threadlocal_cipher_context[i] = EVP_CIPHER_CTX_new();
-        state->threadlocal_sign_context[i]   = EVP_MD_CTX_create();
-    }
-
     if (! (cJSON_IsObject(settings) && settings->child != NULL))
     {
         LOGF("JSON Error: RealityServer->settings (object field) : The object was empty or invalid");
@@ -337,6 +311,12 @@ tunnel_t *newRealityServer(node_instance_context_t *instance_info)
         p64[i] = p64[i - 1];
     }
 
+    state->threadlocal_crypto = globalMalloc(sizeof(reality_crypto_t) * getWorkersCount());
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        realityCryptoInit(&(state->threadlocal_crypto[i]), state->hashes, state->context_password);
+    }
+
     char *dest_node_name = NULL;
     if (! getStringFromJsonObject(&dest_node_name, settings, "destination"))
     {
@@ -132,6 +132,8 @@ static void encapsulateUdpPacket(context_t *c)
         }                                                                                                              \
     } while (0);
 
+// every datagram carries its own destination, it is written into dest_ctx of the line before the datagram is
+// sent up, the udp connector sends it with sendto from the one full cone socket of the line
 static void udpUpStream(tunnel_t *self, context_t *c)
 {
     socks5_server_con_state_t *cstate       = CSTATE(c);
@@ -145,82 +147,69 @@ static void udpUpStream(tunnel_t *self, context_t *c)
         goto disconnect;
     }
 
-    if (cstate->init_sent)
+    if (((uint8_t *) rawBuf(bytes))[0] != 0 || ((uint8_t *) rawBuf(bytes))[1] != 0)
     {
-        // drop fargmented pcakets
-        if (((uint8_t *) rawBuf(bytes))[2] != 0)
-        {
-            reuseContextPayload(c);
-            return;
-        }
-        const uint8_t satyp = ((uint8_t *) rawBuf(bytes))[3];
-        shiftr(bytes, 4);
-        int atleast = 0;
-        switch ((socks5_addr_type) satyp)
-        {
-        case kIPv4Addr:
-            atleast = 4;
-            break;
-        case kFqdnAddr:
-            dest_context->address_type = kSatDomainName;
-            // already checked for at least 10 length
-            const uint8_t domain_len = ((uint8_t *) rawBuf(bytes))[0];
-            atleast                  = 1 + domain_len;
-            break;
-        case kIPv6Addr:
-            atleast = 16;
-            break;
-        default:
-            reuseContextPayload(c);
-            goto disconnect;
-        }
-        ATLEAST(atleast);
-        shiftr(bytes, atleast);
-        self->up->upStream(self->up, c);
+        reuseContextPayload(c);
+        goto disconnect;
     }
-    else
+    // drop fargmented pcakets
+    if (((uint8_t *) rawBuf(bytes))[2] != 0)
     {
-        if (((uint8_t *) rawBuf(bytes))[0] != 0 || ((uint8_t *) rawBuf(bytes))[1] != 0 ||
-            ((uint8_t *) rawBuf(bytes))[2] != 0)
+        if (! cstate->init_sent)
         {
             reuseContextPayload(c);
             goto disconnect;
         }
-        const uint8_t satyp = ((uint8_t *) rawBuf(bytes))[3];
-        shiftr(bytes, 4);
-        dest_context->address_protocol = kSapUdp;
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+    const uint8_t satyp = ((uint8_t *) rawBuf(bytes))[3];
+    shiftr(bytes, 4);
+    dest_context->address_protocol = kSapUdp;
 
-        switch ((socks5_addr_type) satyp)
+    switch ((socks5_addr_type) satyp)
+    {
+    case kIPv4Addr:
+        dest_context->address_type         = kSatIPV4;
+        dest_context->address.sa.sa_family = AF_INET;
+        ATLEAST(4 + 2);
+        memcpy(&(dest_context->address.sin.sin_addr), rawBuf(c->payload), 4);
+        shiftr(c->payload, 4);
+        break;
+    case kFqdnAddr: {
+        dest_context->address_type         = kSatDomainName;
+        dest_context->address.sa.sa_family = AF_INET;
+        dest_context->domain_resolved      = false;
+        // already checked for at least 10 length
+        const uint8_t domain_len = ((uint8_t *) rawBuf(bytes))[0];
+        ATLEAST(1 + domain_len + 2);
+        shiftr(c->payload, 1);
+        if (! cstate->init_sent)
         {
-        case kIPv4Addr:
-            dest_context->address_type = kSatIPV4;
-            ATLEAST(4);
-            memcpy(&(dest_context->address.sin.sin_addr), rawBuf(c->payload), 4);
-            shiftr(c->payload, 4);
-            break;
-        case kFqdnAddr:
-            dest_context->address_type = kSatDomainName;
-            // already checked for at least 10 length
-            const uint8_t domain_len = ((uint8_t *) rawBuf(bytes))[0];
-            ATLEAST(1 + domain_len);
             LOGD("Socks5Server: udp domain %.*s", domain_len, rawBuf(c->payload));
-            socketContextDomainSet(dest_context, rawBuf(c->payload), domain_len);
-            shiftr(c->payload, domain_len);
-
-            break;
-        case kIPv6Addr:
-            dest_context->address_type = kSatIPV6;
-            ATLEAST(16);
-            memcpy(&(dest_context->address.sin.sin_addr), rawBuf(c->payload), 16);
-            shiftr(c->payload, 16);
-            break;
-        default:
-            reuseContextPayload(c);
-            goto disconnect;
         }
-        ATLEAST(2); // port
-        memcpy(&(dest_context->address.sin.sin_port), rawBuf(c->payload), 2);
-        shiftr(c->payload, 2);
+        socketContextDomainSet(dest_context, rawBuf(c->payload), domain_len);
+        shiftr(c->payload, domain_len);
+        break;
+    }
+    case kIPv6Addr:
+        dest_context->address_type         = kSatIPV6;
+        dest_context->address.sa.sa_family = AF_INET6;
+        ATLEAST(16 + 2);
+        memcpy(&(dest_context->address.sin6.sin6_addr), rawBuf(c->payload), 16);
+        shiftr(c->payload, 16);
+        break;
+    default:
+        reuseContextPayload(c);
+        goto disconnect;
+    }
+    // sin_port and sin6_port share the same offset
+    memcpy(&(dest_context->address.sin.sin_port), rawBuf(c->payload), 2);
+    shiftr(c->payload, 2);
+
+    if (! cstate->init_sent)
+    {
         self->up->upStream(self->up, newInitContext(c->line));
         if (! isAlive(c->line))
         {
@@ -229,9 +218,8 @@ static void udpUpStream(tunnel_t *self, context_t *c)
             goto disconnect;
         }
         cstate->init_sent = true;
-        // send whatever left as the udp payload
-        self->up->upStream(self->up, c);
     }
+    self->up->upStream(self->up, c);
 
     return;
 disconnect:;
@@ -1,27 +1,26 @@
 #include "trojan_auth_server.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
+#include "shared/trojan/trojan_user_index.h"
 #include "utils/jsonutils.h"
 #include "utils/userutils.h"
-
-#define i_type hmap_users_t    // NOLINT
-#define i_key  hash_t          // NOLINT
-#define i_val  trojan_user_t * // NOLINT
+#include <sys/stat.h>
 
 enum
 {
-    kVecCap  = 100,
     kCRLFLen = 2
 };
 
-#include "stc/hmap.h"
-
 typedef struct trojan_auth_server_state_s
 {
     config_file_t *config_file;
     tunnel_t      *fallback;
     int            fallback_delay;
-    hmap_users_t   users;
+    char          *users_file;
+    time_t         users_file_mtime;
+
+    // replaced as a whole by reloads, workers only load the pointer, see swapUserIndex
+    _Atomic(trojan_user_index_t *) users;
 
 } trojan_auth_server_state_t;
 
@@ -107,16 +106,23 @@ static void upStream(tunnel_t *self, context_t *c)
                     goto failed;
                 }
 
-                hash_t kh = CALC_HASH_BYTES(rawBuf(c->payload), sizeof(sha224_hex_t));
+                sha224_t digest;
+                if (! trojanDecodeHexPassword(rawBuf(c->payload), digest))
+                {
+                    LOGW("TrojanAuthServer: detected non trojan protocol, rejected");
+                    goto failed;
+                }
 
-                hmap_users_t_iter find_result = hmap_users_t_find(&(state->users), kh);
-                if (find_result.ref == hmap_users_t_end(&(state->users)).ref)
+                // the index may be swapped by a reload at any time, but it is only freed after every worker
+                // went back to its loop, so it stays valid until this callback returns
+                trojan_user_t *tuser =
+                    trojanUserIndexFind(atomic_load_explicit(&(state->users), memory_order_acquire), digest);
+                if (tuser == NULL)
                 {
                     // user not in database
                     LOGW("TrojanAuthServer: a trojan-user rejected because not found in database");
                     goto failed;
                 }
-                trojan_user_t *tuser = (find_result.ref->second);
                 if (! tuser->user.enable)
                 {
                     // user disabled
@@ -127,6 +133,7 @@ static void upStream(tunnel_t *self, context_t *c)
                 LOGD("TrojanAuthServer: user \"%s\" accepted", tuser->user.name);
                 cstate->authenticated = true;
                 markAuthenticated(c->line);
+                c->line->auth_user = tuser->user.hash_uid;
                 cstate->init_sent = true;
                 self->up->upStream(self->up, newInitContext(c->line));
                 if (! isAlive(c->line))
@@ -229,21 +236,56 @@ static void downStream(tunnel_t *self, context_t *c)
     self->dw->downStream(self->dw, c);
 }
 
-static void parse(tunnel_t *t, cJSON *settings, node_instance_context_t *instance_info)
+struct retired_index_s
 {
-    trojan_auth_server_state_t *state = t->state;
-    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    trojan_user_index_t *index;
+    atomic_uint          pending_workers;
+};
+
+static void onWorkerPassedRetiredIndex(hevent_t *ev)
+{
+    struct retired_index_s *retired = hevent_userdata(ev);
+    if (atomic_fetch_sub_explicit(&(retired->pending_workers), 1, memory_order_acq_rel) == 1)
     {
-        LOGF("JSON Error: TrojanAuthServer->Settings (object field) was empty or invalid");
-        exit(1);
+        destroyTrojanUserIndex(retired->index);
+        globalFree(retired);
     }
-    const cJSON *users_array = cJSON_GetObjectItemCaseSensitive(settings, "users");
-    if (! (cJSON_IsArray(users_array) && users_array->child != NULL))
+}
+
+/*
+    workers never pause for a reload, they keep using whichever index they loaded and the new one is
+    published with a pointer swap
+
+    a lookup never outlives the callback it runs in, so once every worker handled an event posted after the
+    swap, none of them can still hold the old index and it is freed by the last one
+*/
+static void swapUserIndex(trojan_auth_server_state_t *state, trojan_user_index_t *index)
+{
+    trojan_user_index_t *old = atomic_exchange_explicit(&(state->users), index, memory_order_acq_rel);
+    if (old == NULL)
     {
-        LOGF("JSON Error: TrojanAuthServer->Settings->Users (array field) was empty or invalid");
-        exit(1);
+        return;
     }
-    cJSON *element = NULL;
+
+    struct retired_index_s *retired = globalMalloc(sizeof(struct retired_index_s));
+    retired->index                  = old;
+    atomic_init(&(retired->pending_workers), getWorkersCount());
+
+    for (unsigned int tid = 0; tid < getWorkersCount(); tid++)
+    {
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop = getWorkerLoop(tid);
+        ev.cb   = onWorkerPassedRetiredIndex;
+        hevent_set_userdata(&ev, retired);
+        hloop_post_event(getWorkerLoop(tid), &ev);
+    }
+}
+
+static trojan_user_index_t *parseUsersArray(const cJSON *users_array)
+{
+    trojan_user_index_t *index   = newTrojanUserIndex(cJSON_GetArraySize(users_array));
+    cJSON               *element = NULL;
 
     unsigned int total_parsed = 0;
     unsigned int total_users  = 0;
@@ -263,25 +305,103 @@ static void parse(tunnel_t *t, cJSON *settings, node_instance_context_t *instanc
             globalFree(user);
             sha224((uint8_t *) tuser->user.uid, strlen(tuser->user.uid), &(tuser->sha224_of_user_uid[0]));
 
-            for (size_t i = 0; i < sizeof(sha224_t); i++)
-            {
-                sprintf((char *) &(tuser->hexed_sha224_of_user_uid[i * 2]), "%02x", (tuser->sha224_of_user_uid[i]));
-            }
-            LOGD("TrojanAuthServer: user \"%s\" parsed, sha224: %.12s...", tuser->user.name,
-                 tuser->hexed_sha224_of_user_uid);
-
-            tuser->hash_of_hexed_sha224_of_user_uid =
-                CALC_HASH_BYTES(tuser->hexed_sha224_of_user_uid, sizeof(sha224_hex_t));
+            char hex_prefix[13] = {0};
+            trojanEncodeHex(tuser->sha224_of_user_uid, 6, hex_prefix);
+            LOGD("TrojanAuthServer: user \"%s\" parsed, sha224: %s...", tuser->user.name, hex_prefix);
 
-            if (! hmap_users_t_insert(&(state->users), tuser->hash_of_hexed_sha224_of_user_uid, tuser).inserted)
+            if (! trojanUserIndexInsert(index, tuser))
             {
                 LOGW("TrojanAuthServer: duplicate passwords, 2 users have exactly same password");
+                total_parsed--;
             }
         }
 
         total_users++;
     }
-    LOGI("TrojanAuthServer: %zu users parsed (out of total %zu) and can connect", total_parsed, total_users);
+    LOGI("TrojanAuthServer: %u users parsed (out of total %u) and can connect", total_parsed, total_users);
+    return index;
+}
+
+static bool reloadUsersFile(trojan_auth_server_state_t *state)
+{
+    trojan_user_index_t *index = loadTrojanUserIndexFile(state->users_file);
+    if (index == NULL)
+    {
+        return false;
+    }
+    LOGI("TrojanAuthServer: %u users loaded from \"%s\"", index->count, state->users_file);
+    swapUserIndex(state, index);
+    return true;
+}
+
+static void onUsersFileTimer(htimer_t *timer)
+{
+    trojan_auth_server_state_t *state = hevent_userdata(timer);
+    struct stat                 st;
+
+    if (stat(state->users_file, &st) != 0 || st.st_mtime == state->users_file_mtime)
+    {
+        return;
+    }
+    // a panel rewriting the file may not be done yet, a broken file is retried on the next change
+    state->users_file_mtime = st.st_mtime;
+    reloadUsersFile(state);
+}
+
+static void parse(tunnel_t *t, cJSON *settings, node_instance_context_t *instance_info)
+{
+    trojan_auth_server_state_t *state = t->state;
+    // a compiled config may have left nothing but the users, which moved to the compiled data
+    if (! (cJSON_IsObject(settings) && (settings->child != NULL || instance_info->compiled_data != NULL)))
+    {
+        LOGF("JSON Error: TrojanAuthServer->Settings (object field) was empty or invalid");
+        exit(1);
+    }
+
+    if (getStringFromJsonObject(&(state->users_file), settings, "users-file"))
+    {
+        struct stat st;
+        if (stat(state->users_file, &st) == 0)
+        {
+            state->users_file_mtime = st.st_mtime;
+        }
+        if (! reloadUsersFile(state))
+        {
+            LOGF("TrojanAuthServer: could not load users-file \"%s\"", state->users_file);
+            exit(1);
+        }
+
+        int check_interval = 0;
+        getIntFromJsonObjectOrDefault(&check_interval, settings, "users-file-check-interval", 0);
+        if (check_interval > 0)
+        {
+            htimer_t *timer = htimer_add(getWorkerLoop(0), onUsersFileTimer, check_interval, INFINITE);
+            hevent_set_userdata(timer, state);
+        }
+    }
+    else if (instance_info->compiled_data != NULL)
+    {
+        // the users were parsed and hashed by --compile
+        trojan_user_index_t *index =
+            loadTrojanUserIndexData(instance_info->compiled_data, instance_info->compiled_data_len, "config image");
+        if (index == NULL)
+        {
+            LOGF("TrojanAuthServer: the users of the config image are malformed");
+            exit(1);
+        }
+        LOGI("TrojanAuthServer: %u users loaded from the config image", index->count);
+        swapUserIndex(state, index);
+    }
+    else
+    {
+        const cJSON *users_array = cJSON_GetObjectItemCaseSensitive(settings, "users");
+        if (! (cJSON_IsArray(users_array) && users_array->child != NULL))
+        {
+            LOGF("JSON Error: TrojanAuthServer->Settings->Users (array field) was empty or invalid");
+            exit(1);
+        }
+        swapUserIndex(state, parseUsersArray(users_array));
+    }
 
     char *fallback_node_name = NULL;
     if (! getStringFromJsonObject(&fallback_node_name, settings, "fallback"))
@@ -322,10 +442,9 @@ tunnel_t *newTrojanAuthServer(node_instance_context_t *instance_info)
 {
     trojan_auth_server_state_t *state = globalMalloc(sizeof(trojan_auth_server_state_t));
     memset(state, 0, sizeof(trojan_auth_server_state_t));
-    state->users    = hmap_users_t_with_capacity(kVecCap);
     cJSON *settings = instance_info->node_settings_json;
 
-    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    if (! (cJSON_IsObject(settings) && (settings->child != NULL || instance_info->compiled_data != NULL)))
     {
         LOGF("JSON Error: TrojanAuthServer->settings (object field) : The object was empty or invalid");
         return NULL;
@@ -340,11 +459,33 @@ tunnel_t *newTrojanAuthServer(node_instance_context_t *instance_info)
     return t;
 }
 
+// the users array is parsed and hashed once here, the node loads the index from the image instead of the json
+void *compileTrojanAuthServer(cJSON *settings, size_t *len)
+{
+    const cJSON *users_array = cJSON_GetObjectItemCaseSensitive(settings, "users");
+    if (cJSON_GetObjectItemCaseSensitive(settings, "users-file") != NULL ||
+        ! (cJSON_IsArray(users_array) && users_array->child != NULL))
+    {
+        return NULL;
+    }
+
+    trojan_user_index_t *index = parseUsersArray(users_array);
+    void                *data  = serializeTrojanUserIndex(index, len);
+    destroyTrojanUserIndex(index);
+
+    cJSON_DeleteItemFromObjectCaseSensitive(settings, "users");
+    return data;
+}
+
 api_result_t apiTrojanAuthServer(tunnel_t *self, const char *msg)
 {
+    trojan_auth_server_state_t *state = TSTATE(self);
 
-    (void) (self);
-    (void) (msg);
+    // the outcome is logged by the reload
+    if (msg != NULL && strcmp(msg, "reload-users") == 0 && state->users_file != NULL)
+    {
+        reloadUsersFile(state);
+    }
     return (api_result_t) {0};
 }
 
@@ -13,3 +13,4 @@ tunnel_t         *newTrojanAuthServer(node_instance_context_t *instance_info);
 api_result_t      apiTrojanAuthServer(tunnel_t *self, const char *msg);
 tunnel_t         *destroyTrojanAuthServer(tunnel_t *self);
 tunnel_metadata_t getMetadataTrojanAuthServer(void);
+void             *compileTrojanAuthServer(struct cJSON *settings, size_t *len);
@@ -201,197 +201,136 @@ static bool parseAddress(context_t *c)
     return true;
 }
 
+/*
+    every datagram of the association carries its own destination, it is written into dest_ctx of the line just
+    before the datagram is sent up, the udp connector sends it with sendto from the one full cone socket of the line
+
+    datagrams that lie inside one received buffer are shallow slices of it, only a datagram that spans two tcp
+    reads is copied
+*/
 static bool processUdp(tunnel_t *self, trojan_socks_server_con_state_t *cstate, line_t *line)
 {
     buffer_stream_t *bstream = cstate->udp_stream;
-    if (bufferStreamLen(bstream) <= 0)
-    {
-        return true;
-    }
 
-    uint8_t  address_type = bufferStreamViewByteAt(bstream, 0);
-    uint16_t packet_size  = 0;
-    uint16_t full_len     = 0;
-    uint8_t  domain_len   = 0;
-    switch (address_type)
+    while (bufferStreamLen(bstream) > 0)
     {
-    case kTrojanatypIpV4:
         // address_type | DST.ADDR | DST.PORT | Length |  CRLF   | Payload
-        //       1      |    4     |    2     |   2    |    2
-
-        if (bufferStreamLen(bstream) < 1 + 4 + 2 + 2 + 2)
-        {
-            return true;
-        }
-
+        //       1      | 4/16/1+x |    2     |   2    |    2
+        uint8_t      header[1 + 1 + UINT8_MAX + 2 + 2 + kCrlfLen];
+        uint8_t      address_type = bufferStreamViewByteAt(bstream, 0);
+        unsigned int address_len  = 0;
+        switch (address_type)
         {
-            uint8_t packet_size_h = bufferStreamViewByteAt(bstream, 1 + 4 + 2);
-            uint8_t packet_size_l = bufferStreamViewByteAt(bstream, 1 + 4 + 2 + 1);
-            packet_size           = (packet_size_h << 8) | packet_size_l;
-            if (packet_size > 8192)
+        case kTrojanatypIpV4:
+            address_len = 4;
+            break;
+        case kTrojanatypDomainName:
+            if (bufferStreamLen(bstream) < 2)
             {
-                return false;
+                return true;
             }
+            address_len = 1 + bufferStreamViewByteAt(bstream, 1);
+            break;
+        case kTrojanatypIpV6:
+            address_len = 16;
+            break;
+        default:
+            return false;
         }
-        full_len = 1 + 4 + 2 + 2 + 2 + packet_size;
 
-        break;
-    case kTrojanatypDomainName:
-        // address_type | DST.ADDR | DST.PORT | Length |  CRLF   | Payload
-        //      1       | x(1) + x |    2     |   2    |    2
-        if (bufferStreamLen(bstream) < 1 + 1 + 2 + 2 + 2)
+        const unsigned int header_len = 1 + address_len + 2 + 2 + kCrlfLen;
+        if (bufferStreamLen(bstream) < header_len)
         {
             return true;
         }
-        domain_len = bufferStreamViewByteAt(bstream, 1);
+        bufferStreamViewBytesAt(bstream, 0, header, header_len);
 
-        if ((int) bufferStreamLen(bstream) < 1 + 1 + domain_len + 2 + 2 + 2)
-        {
-            return true;
-        }
+        const uint8_t *port_ptr    = header + 1 + address_len;
+        uint16_t       packet_size = (uint16_t) ((port_ptr[2] << 8) | port_ptr[3]);
+        if (packet_size > 8192)
         {
-            uint8_t packet_size_h = bufferStreamViewByteAt(bstream, 1 + 1 + domain_len + 2);
-            uint8_t packet_size_l = bufferStreamViewByteAt(bstream, 1 + 1 + domain_len + 2 + 1);
-            packet_size           = (packet_size_h << 8) | packet_size_l;
-            if (packet_size > 8192)
-            {
-                return false;
-            }
+            return false;
         }
-        full_len = 1 + 1 + domain_len + 2 + 2 + 2 + packet_size;
-
-        break;
-    case kTrojanatypIpV6:
-        // address_type | DST.ADDR | DST.PORT | Length |  CRLF   | Payload
-        //      1       |   16     |    2     |   2    |    2
-
-        if (bufferStreamLen(bstream) < 1 + 16 + 2 + 2 + 2)
+        if (bufferStreamLen(bstream) < header_len + packet_size)
         {
             return true;
         }
-        {
 
-            uint8_t packet_size_h = bufferStreamViewByteAt(bstream, 1 + 16 + 2);
-            uint8_t packet_size_l = bufferStreamViewByteAt(bstream, 1 + 16 + 2 + 1);
-            packet_size           = (packet_size_h << 8) | packet_size_l;
-            if (packet_size > 8192)
+        socket_context_t *dest_context = &(line->dest_ctx);
+        switch (address_type)
+        {
+        case kTrojanatypIpV4:
+            dest_context->address_type         = kSatIPV4;
+            dest_context->address.sa.sa_family = AF_INET;
+            memcpy(&(dest_context->address.sin.sin_addr), header + 1, 4);
+            memcpy(&(dest_context->address.sin.sin_port), port_ptr, 2);
+            if (! cstate->udp_logged)
             {
-                return false;
+                cstate->udp_logged = true;
+                LOGD("TrojanSocksServer: udp ipv4");
             }
+            break;
+        case kTrojanatypDomainName:
+            dest_context->address_type         = kSatDomainName;
+            dest_context->address.sa.sa_family = AF_INET;
+            dest_context->domain_resolved      = false;
+            socketContextDomainSet(dest_context, (const char *) header + 2, (uint8_t) (address_len - 1));
+            memcpy(&(dest_context->address.sin.sin_port), port_ptr, 2);
+            if (! cstate->udp_logged)
+            {
+                cstate->udp_logged = true;
+                LOGD("TrojanSocksServer: udp domain %.*s", (int) (address_len - 1), header + 2);
+            }
+            break;
+        case kTrojanatypIpV6:
+        default:
+            dest_context->address_type         = kSatIPV6;
+            dest_context->address.sa.sa_family = AF_INET6;
+            memcpy(&(dest_context->address.sin6.sin6_addr), header + 1, 16);
+            memcpy(&(dest_context->address.sin6.sin6_port), port_ptr, 2);
+            if (! cstate->udp_logged)
+            {
+                cstate->udp_logged = true;
+                LOGD("TrojanSocksServer: udp ipv6");
+            }
+            break;
         }
 
-        full_len = 1 + 16 + 2 + 2 + 2 + packet_size;
-
-        break;
-
-    default:
-        return false;
-        break;
-    }
-    if (bufferStreamLen(bstream) < full_len)
-    {
-        return true;
-    }
-
-    context_t        *c            = newContext(line);
-    socket_context_t *dest_context = &(c->line->dest_ctx);
-    c->payload                     = bufferStreamRead(bstream, full_len);
-
-    if (cstate->init_sent)
-    {
-        shiftr(c->payload, full_len - packet_size);
-        self->up->upStream(self->up, c);
-        if (! isAlive(line))
+        bufferStreamSkip(bstream, header_len);
+        if (packet_size == 0)
         {
-            return true;
+            continue;
         }
-        return processUdp(self, cstate, line);
-    }
 
-    dest_context->address.sa.sa_family = AF_INET;
-    shiftr(c->payload, 1);
-
-    switch (address_type)
-    {
-    case kTrojanatypIpV4:
-        dest_context->address.sa.sa_family = AF_INET;
-        dest_context->address_type         = kSatIPV4;
-        memcpy(&(dest_context->address.sin.sin_addr), rawBuf(c->payload), 4);
-        shiftr(c->payload, 4);
-        if (! cstate->udp_logged)
+        // send init ctx
+        if (! cstate->init_sent)
         {
-            cstate->udp_logged = true;
-            LOGD("TrojanSocksServer: udp ipv4");
+            self->up->upStream(self->up, newInitContext(line));
+            if (! isAlive(line))
+            {
+                LOGW("TrojanSocksServer: next node instantly closed the init with fin");
+                return true;
+            }
+            cstate->init_sent = true;
         }
 
-        break;
-    case kTrojanatypDomainName:
-        dest_context->address_type = kSatDomainName;
-        // size_t addr_len = (unsigned char)(rawBuf(c->payload)[0]);
-        shiftr(c->payload, 1);
-        if (! cstate->udp_logged)
+        context_t *c = newContext(line);
+        if (bufLen(bufferStreamFront(bstream)) >= packet_size)
         {
-            cstate->udp_logged = true;
-            LOGD("TrojanSocksServer: udp domain %.*s", domain_len, rawBuf(c->payload));
+            c->payload = bufferStreamShallowRead(bstream, getWorkerShiftBufferPool(line->tid), packet_size);
         }
-
-        socketContextDomainSet(dest_context, rawBuf(c->payload), domain_len);
-        shiftr(c->payload, domain_len);
-
-        break;
-    case kTrojanatypIpV6:
-        dest_context->address_type         = kSatIPV6;
-        dest_context->address.sa.sa_family = AF_INET6;
-        memcpy(&(dest_context->address.sin.sin_addr), rawBuf(c->payload), 16);
-        shiftr(c->payload, 16);
-        if (! cstate->udp_logged)
+        else
         {
-            cstate->udp_logged = true;
-            LOGD("TrojanSocksServer: udp ipv6");
+            c->payload = bufferStreamRead(bstream, packet_size);
         }
-        break;
-
-    default:
-        reuseContextPayload(c);
-        destroyContext(c);
-        return false;
-        break;
-    }
-
-    // port(2)
-    if (bufLen(c->payload) < 2)
-    {
-        return false;
-    }
-    memcpy(&(dest_context->address.sin.sin_port), rawBuf(c->payload), 2);
-
-    // port 2 length 2 crlf 2
-    shiftr(c->payload, 2 + 2 + kCrlfLen);
-    assert(bufLen(c->payload) == packet_size);
+        self->up->upStream(self->up, c);
 
-    // send init ctx
-    if (! cstate->init_sent)
-    {
-        context_t *up_init_ctx = newContextFrom(c);
-        up_init_ctx->init      = true;
-        self->up->upStream(self->up, up_init_ctx);
-        if (! isAlive(c->line))
+        if (! isAlive(line))
         {
-            LOGW("TrojanSocksServer: next node instantly closed the init with fin");
-            reuseContextPayload(c);
-            destroyContext(c);
             return true;
         }
-        cstate->init_sent = true;
-    }
-
-    self->up->upStream(self->up, c);
-
-    if (! isAlive(line))
-    {
-        return true;
     }
-    return processUdp(self, cstate, line);
+    return true;
 }
 
 static void upStream(tunnel_t *self, context_t *c)
@@ -493,10 +432,6 @@ static void upStream(tunnel_t *self, context_t *c)
                     {
                         self->up->upStream(self->up, newFinContext(c->line));
                     }
-                    if (cstate->udp_stream)
-                    {
-                        destroyBufferStream(cstate->udp_stream);
-                    }
                     cleanup(cstate);
                     CSTATE_DROP(c);
                     context_t *fin_dw = newFinContextFrom(c);
@@ -0,0 +1,503 @@
+#include "hpack.h"
+#include "ww.h"
+#include <string.h>
+#include <strings.h>
+
+typedef struct hpack_static_entry_s
+{
+    const char *name;
+    const char *value;
+
+} hpack_static_entry_t;
+
+static const hpack_static_entry_t kHpackStaticTable[kHpackStaticTableLen] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// rfc 7541 appendix B, generated: child >= 0 is a node index, child < 0 is symbol -(child + 1)
+static const int16_t kHuffmanTree[256][2] = {
+    {66, 1}, {93, 2}, {104, 3}, {119, 4}, {144, 5}, {75, 6}, {123, 7}, {71, 8},
+    {77, 9}, {73, 10}, {11, 13}, {12, 102}, {-1, -37}, {127, 14}, {128, 15}, {98, 16},
+    {-124, 17}, {124, 18}, {150, 19}, {20, 25}, {199, 21}, {216, 22}, {23, 162}, {24, 161},
+    {-2, -136}, {167, 26}, {41, 27}, {191, 28}, {211, 29}, {229, 30}, {31, 45}, {32, 38},
+    {33, 35}, {-255, 34}, {-3, -4}, {36, 37}, {-5, -6}, {-7, -8}, {39, 52}, {40, 51},
+    {-9, -12}, {208, 42}, {43, 165}, {-240, 44}, {-10, -143}, {55, 46}, {63, 47}, {147, 48},
+    {-250, 49}, {50, 59}, {-11, -14}, {-13, -15}, {53, 54}, {-16, -17}, {-18, -19}, {56, 60},
+    {57, 58}, {-20, -21}, {-22, -24}, {-23, -257}, {61, 62}, {-25, -26}, {-27, -28}, {64, 65},
+    {-29, -30}, {-31, -32}, {85, 67}, {68, 82}, {143, 69}, {70, 81}, {-33, -38}, {72, 79},
+    {-34, -35}, {-125, 74}, {-36, -63}, {76, 80}, {-39, -43}, {-64, 78}, {-40, -44}, {-41, -42},
+    {-45, -60}, {-46, -47}, {83, 90}, {84, 89}, {-48, -52}, {86, 130}, {87, 88}, {-49, -50},
+    {-51, -98}, {-53, -54}, {91, 92}, {-55, -56}, {-57, -58}, {99, 94}, {138, 95}, {142, 96},
+    {97, 103}, {-59, -67}, {-61, -97}, {100, 132}, {101, 129}, {-62, -66}, {-65, -92}, {-68, -69},
+    {105, 112}, {106, 109}, {107, 108}, {-70, -71}, {-72, -73}, {110, 111}, {-74, -75}, {-76, -77},
+    {113, 116}, {114, 115}, {-78, -79}, {-80, -81}, {117, 118}, {-82, -83}, {-84, -85}, {120, 136},
+    {121, 122}, {-86, -87}, {-88, -90}, {-89, -91}, {125, 155}, {126, 148}, {-93, -196}, {-94, -127},
+    {-95, -126}, {-96, -99}, {131, 135}, {-100, -102}, {133, 134}, {-101, -103}, {-104, -105}, {-106, -112},
+    {137, 141}, {-107, -108}, {139, 140}, {-109, -110}, {-111, -113}, {-114, -119}, {-115, -118}, {-116, -117},
+    {145, 146}, {-120, -121}, {-122, -123}, {-128, -221}, {-209, 149}, {-129, -131}, {196, 151}, {152, 178},
+    {153, 158}, {-231, 154}, {-130, -133}, {156, 175}, {157, 204}, {-132, -163}, {159, 160}, {-134, -135},
+    {-137, -147}, {-138, -139}, {163, 164}, {-140, -141}, {-142, -144}, {166, 171}, {-145, -146}, {168, 185},
+    {169, 173}, {170, 172}, {-148, -150}, {-149, -160}, {-151, -152}, {174, 181}, {-153, -156}, {241, 176},
+    {177, 188}, {-154, -162}, {179, 183}, {180, 182}, {-155, -157}, {-158, -159}, {-161, -164}, {184, 190},
+    {-165, -170}, {186, 194}, {187, 189}, {-166, -167}, {-168, -173}, {-169, -175}, {-171, -174}, {192, 218},
+    {193, 234}, {-172, -207}, {195, 203}, {-176, -181}, {197, 235}, {198, 202}, {-177, -178}, {200, 206},
+    {201, 205}, {-179, -182}, {-180, -210}, {-183, -184}, {-185, -195}, {-186, -187}, {207, 210}, {-188, -190},
+    {209, 215}, {-189, -192}, {-191, -197}, {212, 224}, {213, 222}, {214, 221}, {-193, -194}, {-198, -232},
+    {217, 243}, {-199, -229}, {245, 219}, {220, 244}, {-200, -208}, {-201, -202}, {223, 228}, {-203, -206},
+    {237, 225}, {248, 226}, {-256, 227}, {-204, -205}, {-211, -214}, {230, 249}, {231, 239}, {232, 233},
+    {-212, -213}, {-215, -222}, {-216, -226}, {236, 242}, {-217, -218}, {238, 246}, {-219, -220}, {240, 247},
+    {-223, -224}, {-225, -227}, {-228, -230}, {-233, -234}, {-235, -236}, {-237, -238}, {-239, -241}, {-242, -245},
+    {-243, -244}, {250, 253}, {251, 252}, {-246, -247}, {-248, -249}, {254, 255}, {-251, -252}, {-253, -254},
+};
+
+void hpackDecoderInit(hpack_decoder_t *d, size_t max_size)
+{
+    *d = (hpack_decoder_t) {.max_size = max_size, .settings_max_size = max_size};
+}
+
+void hpackDecoderDestroy(hpack_decoder_t *d)
+{
+    for (uint32_t i = 0; i < d->count; i++)
+    {
+        globalFree(d->entries[(d->first + i) % d->cap].data);
+    }
+    if (d->entries)
+    {
+        globalFree(d->entries);
+    }
+    if (d->scratch)
+    {
+        globalFree(d->scratch);
+    }
+    *d = (hpack_decoder_t) {0};
+}
+
+static size_t entrySize(const hpack_entry_t *e)
+{
+    return 32 + e->name_len + e->value_len;
+}
+
+static void evictOldest(hpack_decoder_t *d)
+{
+    hpack_entry_t *e = &d->entries[d->first];
+    d->size -= entrySize(e);
+    globalFree(e->data);
+    d->first = (d->first + 1) % d->cap;
+    d->count -= 1;
+}
+
+static void shrinkTable(hpack_decoder_t *d, size_t limit)
+{
+    while (d->count > 0 && d->size > limit)
+    {
+        evictOldest(d);
+    }
+}
+
+static void addEntry(hpack_decoder_t *d, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    const size_t esize = 32 + name_len + value_len;
+    if (esize > d->max_size)
+    {
+        // an entry larger than the table empties it and is not added (rfc 7541 4.4)
+        shrinkTable(d, 0);
+        return;
+    }
+    shrinkTable(d, d->max_size - esize);
+
+    if (d->count == d->cap)
+    {
+        uint32_t       new_cap = d->cap == 0 ? 16 : d->cap * 2;
+        hpack_entry_t *entries = globalMalloc(sizeof(hpack_entry_t) * new_cap);
+        for (uint32_t i = 0; i < d->count; i++)
+        {
+            entries[i] = d->entries[(d->first + i) % d->cap];
+        }
+        if (d->entries)
+        {
+            globalFree(d->entries);
+        }
+        d->entries = entries;
+        d->cap     = new_cap;
+        d->first   = 0;
+    }
+
+    hpack_entry_t *e = &d->entries[(d->first + d->count) % d->cap];
+    e->data          = globalMalloc(name_len + value_len + 1);
+    e->name_len      = (uint32_t) name_len;
+    e->value_len     = (uint32_t) value_len;
+    memcpy(e->data, name, name_len);
+    memcpy(e->data + name_len, value, value_len);
+    d->count += 1;
+    d->size += esize;
+}
+
+// index is 1 based, static entries first, then the dynamic table from the newest entry
+static bool lookupIndex(hpack_decoder_t *d, uint64_t index, const char **name, size_t *name_len, const char **value,
+                        size_t *value_len)
+{
+    if (index == 0)
+    {
+        return false;
+    }
+    if (index <= kHpackStaticTableLen)
+    {
+        const hpack_static_entry_t *se = &kHpackStaticTable[index - 1];
+        *name                          = se->name;
+        *name_len                      = strlen(se->name);
+        *value                         = se->value;
+        *value_len                     = strlen(se->value);
+        return true;
+    }
+    index -= kHpackStaticTableLen;
+    if (index > d->count)
+    {
+        return false;
+    }
+    const hpack_entry_t *e = &d->entries[(d->first + d->count - (uint32_t) index) % d->cap];
+    *name                  = e->data;
+    *name_len              = e->name_len;
+    *value                 = e->data + e->name_len;
+    *value_len             = e->value_len;
+    return true;
+}
+
+static bool decodeInteger(const uint8_t **pos, const uint8_t *end, unsigned int prefix_bits, uint64_t *result)
+{
+    const uint8_t *p    = *pos;
+    const uint8_t  mask = (uint8_t) ((1U << prefix_bits) - 1);
+    if (p >= end)
+    {
+        return false;
+    }
+    uint64_t value = *p++ & mask;
+    if (value == mask)
+    {
+        unsigned int shift = 0;
+        while (true)
+        {
+            if (p >= end || shift > 28)
+            {
+                return false;
+            }
+            const uint8_t b = *p++;
+            value += (uint64_t) (b & 0x7F) << shift;
+            shift += 7;
+            if ((b & 0x80) == 0)
+            {
+                break;
+            }
+        }
+    }
+    *pos    = p;
+    *result = value;
+    return true;
+}
+
+static void reserveScratch(hpack_decoder_t *d, size_t needed)
+{
+    if (needed > d->scratch_cap)
+    {
+        size_t new_cap = d->scratch_cap == 0 ? 256 : d->scratch_cap;
+        while (new_cap < needed)
+        {
+            new_cap *= 2;
+        }
+        char *scratch = globalMalloc(new_cap);
+        if (d->scratch)
+        {
+            memcpy(scratch, d->scratch, d->scratch_cap);
+            globalFree(d->scratch);
+        }
+        d->scratch     = scratch;
+        d->scratch_cap = new_cap;
+    }
+}
+
+static bool huffmanDecode(const uint8_t *in, size_t len, char *out, size_t *out_len)
+{
+    size_t       written  = 0;
+    int          node     = 0;
+    unsigned int pad_bits = 0;
+    bool         all_ones = true;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int bit_i = 7; bit_i >= 0; bit_i--)
+        {
+            const unsigned int bit   = (in[i] >> bit_i) & 1;
+            const int16_t      child = kHuffmanTree[node][bit];
+            if (child < 0)
+            {
+                const int sym = -(child + 1);
+                if (sym == 256)
+                {
+                    // eos inside the string is a decoding error
+                    return false;
+                }
+                out[written++] = (char) sym;
+                node           = 0;
+                pad_bits       = 0;
+                all_ones       = true;
+            }
+            else
+            {
+                node = child;
+                pad_bits += 1;
+                all_ones = all_ones && bit == 1;
+            }
+        }
+    }
+    if (pad_bits > 7 || ! all_ones)
+    {
+        return false;
+    }
+    *out_len = written;
+    return true;
+}
+
+// decodes a string literal into scratch at offset, its length is returned in out_len
+static bool decodeString(hpack_decoder_t *d, const uint8_t **pos, const uint8_t *end, size_t offset, size_t *out_len)
+{
+    if (*pos >= end)
+    {
+        return false;
+    }
+    const bool huffman = (**pos & 0x80) != 0;
+    uint64_t   len;
+    if (! decodeInteger(pos, end, 7, &len) || len > kHpackMaxStringLen || len > (uint64_t) (end - *pos))
+    {
+        return false;
+    }
+
+    // huffman codes are at least 5 bits, so the output is at most 8/5 of the input
+    const size_t max_out = huffman ? ((len * 8) / 5) + 1 : len;
+    reserveScratch(d, offset + max_out + 1);
+
+    if (huffman)
+    {
+        if (! huffmanDecode(*pos, len, d->scratch + offset, out_len))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        memcpy(d->scratch + offset, *pos, len);
+        *out_len = len;
+    }
+    *pos += len;
+    return true;
+}
+
+bool hpackDecode(hpack_decoder_t *d, const uint8_t *data, size_t len, HpackHeaderCb cb, void *userdata)
+{
+    const uint8_t *pos             = data;
+    const uint8_t *end             = data + len;
+    bool           header_received = false;
+
+    while (pos < end)
+    {
+        const uint8_t b = *pos;
+        uint64_t      index;
+
+        if (b & 0x80)
+        {
+            // indexed header field
+            const char *name;
+            const char *value;
+            size_t      name_len;
+            size_t      value_len;
+            if (! decodeInteger(&pos, end, 7, &index) ||
+                ! lookupIndex(d, index, &name, &name_len, &value, &value_len))
+            {
+                return false;
+            }
+            cb(userdata, name, name_len, value, value_len);
+            header_received = true;
+            continue;
+        }
+
+        if ((b & 0xE0) == 0x20)
+        {
+            // dynamic table size update, only allowed at the start of a block
+            if (header_received || ! decodeInteger(&pos, end, 5, &index) || index > d->settings_max_size)
+            {
+                return false;
+            }
+            d->max_size = (size_t) index;
+            shrinkTable(d, d->max_size);
+            continue;
+        }
+
+        // literal header field, with incremental indexing (01), without indexing (0000) or never indexed (0001)
+        const bool         indexing    = (b & 0xC0) == 0x40;
+        const unsigned int prefix_bits = indexing ? 6 : 4;
+        size_t             name_len;
+        size_t             value_len;
+
+        if (! decodeInteger(&pos, end, prefix_bits, &index))
+        {
+            return false;
+        }
+        if (index == 0)
+        {
+            if (! decodeString(d, &pos, end, 0, &name_len))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            const char *iname;
+            const char *ivalue;
+            size_t      ivalue_len;
+            if (! lookupIndex(d, index, &iname, &name_len, &ivalue, &ivalue_len))
+            {
+                return false;
+            }
+            reserveScratch(d, name_len + 1);
+            memcpy(d->scratch, iname, name_len);
+        }
+        if (! decodeString(d, &pos, end, name_len, &value_len))
+        {
+            return false;
+        }
+
+        cb(userdata, d->scratch, name_len, d->scratch + name_len, value_len);
+        header_received = true;
+
+        if (indexing)
+        {
+            addEntry(d, d->scratch, name_len, d->scratch + name_len, value_len);
+        }
+    }
+    return true;
+}
+
+static size_t encodeInteger(uint8_t *out, uint8_t first_byte_flags, unsigned int prefix_bits, uint64_t value)
+{
+    const uint64_t max_prefix = (1U << prefix_bits) - 1;
+    if (value < max_prefix)
+    {
+        out[0] = first_byte_flags | (uint8_t) value;
+        return 1;
+    }
+    size_t i = 0;
+    out[i++] = first_byte_flags | (uint8_t) max_prefix;
+    value -= max_prefix;
+    while (value >= 0x80)
+    {
+        out[i++] = (uint8_t) ((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out[i++] = (uint8_t) value;
+    return i;
+}
+
+size_t hpackEncodeHeader(uint8_t *out, const char *name, const char *value)
+{
+    const size_t name_len   = strlen(name);
+    const size_t value_len  = strlen(value);
+    unsigned int name_index = 0;
+
+    for (unsigned int i = 0; i < kHpackStaticTableLen; i++)
+    {
+        const hpack_static_entry_t *se = &kHpackStaticTable[i];
+        if (strlen(se->name) != name_len || strncasecmp(se->name, name, name_len) != 0)
+        {
+            continue;
+        }
+        if (strcmp(se->value, value) == 0)
+        {
+            // indexed header field
+            return encodeInteger(out, 0x80, 7, i + 1);
+        }
+        if (name_index == 0)
+        {
+            name_index = i + 1;
+        }
+    }
+
+    // literal header field without indexing
+    size_t written = 0;
+    if (name_index != 0)
+    {
+        written += encodeInteger(out, 0x00, 4, name_index);
+    }
+    else
+    {
+        written += encodeInteger(out, 0x00, 4, 0);
+        written += encodeInteger(out + written, 0x00, 7, name_len);
+        for (size_t i = 0; i < name_len; i++)
+        {
+            const char c     = name[i];
+            out[written + i] = (uint8_t) ((c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c);
+        }
+        written += name_len;
+    }
+    written += encodeInteger(out + written, 0x00, 7, value_len);
+    memcpy(out + written, value, value_len);
+    written += value_len;
+    return written;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Minimal HPACK (rfc 7541) used by the native http2 framer
+
+    the encoder never inserts into the dynamic table, it only emits static table references and literals
+    without indexing (no huffman), every decoder accepts that and the encoder needs no state
+
+    the decoder is complete (dynamic table, huffman, table size updates) since the peer is free to use all of it
+*/
+
+enum
+{
+    kHpackStaticTableLen   = 61,
+    kHpackDefaultTableSize = 4096,
+    kHpackMaxStringLen     = 1 << 16
+};
+
+typedef struct hpack_entry_s
+{
+    char    *data; // name followed by value
+    uint32_t name_len;
+    uint32_t value_len;
+
+} hpack_entry_t;
+
+typedef struct hpack_decoder_s
+{
+    hpack_entry_t *entries; // ring, oldest at first
+    uint32_t       cap;
+    uint32_t       first;
+    uint32_t       count;
+    size_t         size;
+    size_t         max_size;          // the limit the peer announced with a size update
+    size_t         settings_max_size; // the limit we advertised, size updates can not go above it
+    char          *scratch;
+    size_t         scratch_cap;
+
+} hpack_decoder_t;
+
+typedef void (*HpackHeaderCb)(void *userdata, const char *name, size_t name_len, const char *value,
+                              size_t value_len);
+
+void hpackDecoderInit(hpack_decoder_t *d, size_t max_size);
+void hpackDecoderDestroy(hpack_decoder_t *d);
+
+// decodes one complete header block, false means a compression error (the connection must be closed)
+bool hpackDecode(hpack_decoder_t *d, const uint8_t *data, size_t len, HpackHeaderCb cb, void *userdata);
+
+// the encoded length is never above this
+static inline size_t hpackEncodedHeaderMaxLen(size_t name_len, size_t value_len)
+{
+    return 1 + 6 + name_len + 6 + value_len;
+}
+
+// writes one header field, the name is lowercased as http2 requires, returns the written length
+size_t hpackEncodeHeader(uint8_t *out, const char *name, const char *value);
@@ -0,0 +1,1175 @@
+#include "http2_framer.h"
+#include "grpc_def.h"
+#include "http2_def.h"
+#include "utils/mathutils.h"
+#include "ww.h"
+#include <assert.h>
+#include <string.h>
+
+#define i_TYPE h2_stream_map_t, uint32_t, struct http2_framer_stream_s * // NOLINT
+#include "stc/hmap.h"
+
+enum
+{
+    kSettingsHeaderTableSize   = 0x1,
+    kSettingsEnablePush        = 0x2,
+    kSettingsMaxConcurrent     = 0x3,
+    kSettingsInitialWindowSize = 0x4,
+    kSettingsMaxFrameSize      = 0x5,
+    kSettingsMaxHeaderListSize = 0x6,
+    kDefaultWindowSize         = 65535,
+    kDefaultMaxFrameSize       = 16384,
+    kMaxWindowSize             = 0x7FFFFFFF,
+    kMaxStreamId               = 0x7FFFFFFF,
+    kPingPayloadLen            = 8,
+    kHttp2ErrorNone            = 0x0,
+    kHttp2ErrorProtocol        = 0x1,
+    kHttp2ErrorFlowControl     = 0x3,
+    kHttp2ErrorStreamClosed    = 0x5,
+    kHttp2ErrorFrameSize       = 0x6,
+    kHttp2ErrorCancel          = 0x8,
+    kHttp2ErrorCompression     = 0x9,
+    kHttp2ErrorEnhanceYourCalm = 0xb
+};
+
+struct http2_framer_s
+{
+    buffer_pool_t         *pool;
+    buffer_stream_t       *in;
+    shift_buffer_t        *out;
+    shift_buffer_t        *header_block; // HEADERS and CONTINUATION fragments being collected
+    h2_stream_map_t        streams;
+    http2_framer_stream_t *blocked;
+    http2_framer_stream_t *writable;
+    http2_framer_stream_t *grpc_ready; // its grpc buffer may hold complete messages
+    hpack_decoder_t        hpack;
+    int64_t                send_window;
+    int64_t                recv_window;
+    uint32_t               recv_unacked;
+    uint32_t               peer_initial_window;
+    uint32_t               peer_max_frame_size;
+    uint32_t               next_stream_id;
+    uint32_t               last_peer_stream_id;
+    uint32_t               header_stream_id;
+    bool                   header_end_stream;
+    bool                   header_grpc;
+    bool                   server;
+    bool                   grpc;
+    bool                   preface_received;
+    bool                   goaway;
+    bool                   error;
+};
+
+static void appendOut(http2_framer_t *f, shift_buffer_t *frame)
+{
+    if (f->out == NULL)
+    {
+        f->out = frame;
+        return;
+    }
+    f->out = appendBufferMerge(f->pool, f->out, frame);
+}
+
+static void appendControlFrame(http2_framer_t *f, http2_frame_type type, http2_flag flags, uint32_t stream_id,
+                               const uint8_t *payload, uint32_t len)
+{
+    if (f->out == NULL)
+    {
+        f->out = popBuffer(f->pool);
+    }
+    const unsigned int old_len = bufLen(f->out);
+    setLen(f->out, old_len + HTTP2_FRAME_HDLEN + len);
+
+    uint8_t       *p  = rawBufMut(f->out) + old_len;
+    http2_frame_hd hd = {.length = len, .type = type, .flags = flags, .stream_id = stream_id};
+    http2FrameHdPack(&hd, p);
+    if (len > 0)
+    {
+        memcpy(p + HTTP2_FRAME_HDLEN, payload, len);
+    }
+}
+
+static void writeUint32Be(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+static uint32_t readUint32Be(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static void sendWindowUpdate(http2_framer_t *f, uint32_t stream_id, uint32_t increment)
+{
+    uint8_t payload[4];
+    writeUint32Be(payload, increment);
+    appendControlFrame(f, kHttP2WindowUpdate, kHttP2FlagNone, stream_id, payload, sizeof(payload));
+}
+
+static void sendRstStream(http2_framer_t *f, uint32_t stream_id, uint32_t error_code)
+{
+    uint8_t payload[4];
+    writeUint32Be(payload, error_code);
+    appendControlFrame(f, kHttP2RstStream, kHttP2FlagNone, stream_id, payload, sizeof(payload));
+}
+
+static void sendGoaway(http2_framer_t *f, uint32_t error_code)
+{
+    uint8_t payload[8];
+    writeUint32Be(payload, f->last_peer_stream_id);
+    writeUint32Be(payload + 4, error_code);
+    appendControlFrame(f, kHttP2Goaway, kHttP2FlagNone, 0, payload, sizeof(payload));
+}
+
+static void appendSetting(uint8_t *p, uint16_t id, uint32_t value)
+{
+    p[0] = (uint8_t) (id >> 8);
+    p[1] = (uint8_t) id;
+    writeUint32Be(p + 2, value);
+}
+
+static void sendPreface(http2_framer_t *f)
+{
+    uint8_t      settings[6 * 5];
+    unsigned int len = 0;
+
+    if (! f->server)
+    {
+        f->out = popBuffer(f->pool);
+        setLen(f->out, HTTP2_MAGIC_LEN);
+        writeRaw(f->out, HTTP2_MAGIC, HTTP2_MAGIC_LEN);
+
+        appendSetting(settings + len, kSettingsEnablePush, 0);
+        len += 6;
+    }
+    appendSetting(settings + len, kSettingsMaxConcurrent, 0xFFFFFFFFU);
+    len += 6;
+    appendSetting(settings + len, kSettingsInitialWindowSize, kHttp2FramerStreamWindow);
+    len += 6;
+    appendSetting(settings + len, kSettingsMaxFrameSize, kHttp2FramerMaxFrameSize);
+    len += 6;
+    // advisory, the compressed block is what we actually limit
+    appendSetting(settings + len, kSettingsMaxHeaderListSize, kHttp2FramerMaxHeaderBlock);
+    len += 6;
+
+    appendControlFrame(f, kHttP2Settings, kHttP2FlagNone, 0, settings, len);
+    sendWindowUpdate(f, 0, kHttp2FramerConnectionWindow - kDefaultWindowSize);
+}
+
+http2_framer_t *newHttp2Framer(buffer_pool_t *pool, bool server, bool grpc)
+{
+    http2_framer_t *f = globalMalloc(sizeof(http2_framer_t));
+    *f                = (http2_framer_t) {.pool                = pool,
+                                          .in                  = newBufferStream(pool),
+                                          .streams             = h2_stream_map_t_with_capacity(16),
+                                          .send_window         = kDefaultWindowSize,
+                                          .recv_window         = kHttp2FramerConnectionWindow,
+                                          .peer_initial_window = kDefaultWindowSize,
+                                          .peer_max_frame_size = kDefaultMaxFrameSize,
+                                          .next_stream_id      = 1,
+                                          .server              = server,
+                                          .grpc                = grpc,
+                                          .preface_received    = ! server};
+    hpackDecoderInit(&f->hpack, kHpackDefaultTableSize);
+    sendPreface(f);
+    return f;
+}
+
+static void destroyStreamBuffers(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    destroyBufferStream(s->pending);
+    if (s->grpc_stream)
+    {
+        destroyBufferStream(s->grpc_stream);
+    }
+    if (s->end_frame)
+    {
+        reuseBuffer(f->pool, s->end_frame);
+    }
+}
+
+void destroyHttp2Framer(http2_framer_t *f)
+{
+    c_foreach(k, h2_stream_map_t, f->streams)
+    {
+        destroyStreamBuffers(f, k.ref->second);
+        globalFree(k.ref->second);
+    }
+    h2_stream_map_t_drop(&f->streams);
+    destroyBufferStream(f->in);
+    if (f->out)
+    {
+        reuseBuffer(f->pool, f->out);
+    }
+    if (f->header_block)
+    {
+        reuseBuffer(f->pool, f->header_block);
+    }
+    hpackDecoderDestroy(&f->hpack);
+    globalFree(f);
+}
+
+static http2_framer_stream_t *findStream(http2_framer_t *f, uint32_t id)
+{
+    h2_stream_map_t_iter it = h2_stream_map_t_find(&f->streams, id);
+    if (it.ref == h2_stream_map_t_end(&f->streams).ref)
+    {
+        return NULL;
+    }
+    return it.ref->second;
+}
+
+static http2_framer_stream_t *newStream(http2_framer_t *f, uint32_t id, bool grpc)
+{
+    http2_framer_stream_t *s = globalMalloc(sizeof(http2_framer_stream_t));
+    *s                       = (http2_framer_stream_t) {
+                              .pending     = newBufferStream(f->pool),
+                              .grpc_stream = grpc ? newBufferStream(f->pool) : NULL,
+                              .send_window = f->peer_initial_window,
+                              .recv_window = kHttp2FramerStreamWindow,
+                              .id          = id,
+                              .grpc        = grpc};
+    h2_stream_map_t_insert(&f->streams, id, s);
+    return s;
+}
+
+static void unlinkBlocked(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    if (! s->blocked)
+    {
+        return;
+    }
+    http2_framer_stream_t **it = &f->blocked;
+    while (*it != s)
+    {
+        it = &((*it)->next_blocked);
+    }
+    *it             = s->next_blocked;
+    s->blocked      = false;
+    s->next_blocked = NULL;
+}
+
+static void unlinkWritable(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    if (! s->writable_queued)
+    {
+        return;
+    }
+    http2_framer_stream_t **it = &f->writable;
+    while (*it != s)
+    {
+        it = &((*it)->next_writable);
+    }
+    *it                = s->next_writable;
+    s->writable_queued = false;
+    s->next_writable   = NULL;
+}
+
+static void freeStream(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    unlinkBlocked(f, s);
+    unlinkWritable(f, s);
+    if (f->grpc_ready == s)
+    {
+        f->grpc_ready = NULL;
+    }
+    h2_stream_map_t_erase(&f->streams, s->id);
+    destroyStreamBuffers(f, s);
+    globalFree(s);
+}
+
+static int64_t sendAllowance(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    return min(min(s->send_window, f->send_window), (int64_t) f->peer_max_frame_size);
+}
+
+static void appendDataFrame(http2_framer_t *f, http2_framer_stream_t *s, shift_buffer_t *buf, bool end_stream)
+{
+    const unsigned int len = bufLen(buf);
+    s->send_window -= len;
+    f->send_window -= len;
+
+    http2_frame_hd hd = {.length    = len,
+                         .type      = kHttP2Data,
+                         .flags     = end_stream ? kHttP2FlagEndStream : kHttP2FlagNone,
+                         .stream_id = s->id};
+    shiftl(buf, HTTP2_FRAME_HDLEN);
+    http2FrameHdPack(&hd, rawBufMut(buf));
+    appendOut(f, buf);
+}
+
+// sends queued payload while there is window, true when nothing is left
+static bool drainStream(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    while (bufferStreamLen(s->pending) > 0)
+    {
+        const int64_t allowed = sendAllowance(f, s);
+        if (allowed <= 0)
+        {
+            return false;
+        }
+        shift_buffer_t *buf = (int64_t) bufLen(bufferStreamFront(s->pending)) <= allowed
+                                  ? bufferStreamIdealRead(s->pending)
+                                  : bufferStreamRead(s->pending, (size_t) allowed);
+        appendDataFrame(f, s, buf, false);
+    }
+    if (s->end_frame)
+    {
+        appendOut(f, s->end_frame);
+        s->end_frame = NULL;
+    }
+    return true;
+}
+
+static void onStreamDrained(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    if (s->detached)
+    {
+        freeStream(f, s);
+        return;
+    }
+    if (! s->writable_queued)
+    {
+        s->writable_queued = true;
+        s->next_writable   = f->writable;
+        f->writable        = s;
+    }
+}
+
+static void drainBlocked(http2_framer_t *f)
+{
+    http2_framer_stream_t **it = &f->blocked;
+    while (*it && f->send_window > 0)
+    {
+        http2_framer_stream_t *s = *it;
+        if (drainStream(f, s))
+        {
+            *it             = s->next_blocked;
+            s->blocked      = false;
+            s->next_blocked = NULL;
+            onStreamDrained(f, s);
+        }
+        else
+        {
+            it = &(s->next_blocked);
+        }
+    }
+}
+
+http2_framer_stream_t *http2FramerOpenStream(http2_framer_t *f, void *userdata)
+{
+    if (f->goaway || f->error || f->next_stream_id > kMaxStreamId)
+    {
+        return NULL;
+    }
+    http2_framer_stream_t *s = newStream(f, f->next_stream_id, f->grpc);
+    s->userdata              = userdata;
+    f->next_stream_id += 2;
+    return s;
+}
+
+static shift_buffer_t *buildHeadersFrame(http2_framer_t *f, http2_framer_stream_t *s, const http2_header_t *headers,
+                                         unsigned int count, bool end_stream)
+{
+    size_t max_len = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        max_len += hpackEncodedHeaderMaxLen(strlen(headers[i].name), strlen(headers[i].value));
+    }
+
+    shift_buffer_t *frame = popSizedBuffer(f->pool, (unsigned int) (HTTP2_FRAME_HDLEN + max_len));
+    setLen(frame, (unsigned int) (HTTP2_FRAME_HDLEN + max_len));
+    uint8_t *p         = rawBufMut(frame) + HTTP2_FRAME_HDLEN;
+    size_t   block_len = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        block_len += hpackEncodeHeader(p + block_len, headers[i].name, headers[i].value);
+    }
+
+    // our header blocks are small, they never need CONTINUATION frames
+    if (block_len > f->peer_max_frame_size)
+    {
+        reuseBuffer(f->pool, frame);
+        return NULL;
+    }
+
+    http2_frame_hd hd = {.length    = (unsigned int) block_len,
+                         .type      = kHttP2Headers,
+                         .flags     = kHttP2FlagEndHeaders | (end_stream ? kHttP2FlagEndStream : kHttP2FlagNone),
+                         .stream_id = s->id};
+    http2FrameHdPack(&hd, rawBufMut(frame));
+    setLen(frame, (unsigned int) (HTTP2_FRAME_HDLEN + block_len));
+    return frame;
+}
+
+bool http2FramerSendHeaders(http2_framer_t *f, http2_framer_stream_t *s, const http2_header_t *headers,
+                            unsigned int count, bool end_stream)
+{
+    if (s->local_closed || s->reset)
+    {
+        return false;
+    }
+    shift_buffer_t *frame = buildHeadersFrame(f, s, headers, count, end_stream);
+    if (frame == NULL)
+    {
+        return false;
+    }
+    appendOut(f, frame);
+    s->local_closed = end_stream;
+    return true;
+}
+
+bool http2FramerSendData(http2_framer_t *f, http2_framer_stream_t *s, shift_buffer_t *buf)
+{
+    if (s->local_closed || s->reset)
+    {
+        reuseBuffer(f->pool, buf);
+        return true;
+    }
+
+    if (s->grpc)
+    {
+        grpc_message_hd msghd = {.flags = 0, .length = bufLen(buf)};
+        shiftl(buf, GRPC_MESSAGE_HDLEN);
+        grpcMessageHdPack(&msghd, rawBufMut(buf));
+    }
+
+    if (bufferStreamLen(s->pending) == 0)
+    {
+        while (true)
+        {
+            const int64_t allowed = sendAllowance(f, s);
+            if (allowed >= (int64_t) bufLen(buf))
+            {
+                appendDataFrame(f, s, buf, false);
+                return true;
+            }
+            if (allowed <= 0)
+            {
+                break;
+            }
+            shift_buffer_t *part = popBuffer(f->pool);
+            sliceBufferTo(part, buf, (unsigned int) allowed);
+            appendDataFrame(f, s, part, false);
+        }
+    }
+
+    bufferStreamPush(s->pending, buf);
+    if (! s->blocked)
+    {
+        s->blocked      = true;
+        s->next_blocked = f->blocked;
+        f->blocked      = s;
+    }
+    return false;
+}
+
+void http2FramerEndStream(http2_framer_t *f, http2_framer_stream_t *s, const http2_header_t *trailers,
+                          unsigned int count)
+{
+    if (s->local_closed || s->reset)
+    {
+        return;
+    }
+
+    shift_buffer_t *frame = NULL;
+    if (count > 0)
+    {
+        frame = buildHeadersFrame(f, s, trailers, count, true);
+    }
+    if (frame == NULL)
+    {
+        frame             = popBuffer(f->pool);
+        http2_frame_hd hd = {.length = 0, .type = kHttP2Data, .flags = kHttP2FlagEndStream, .stream_id = s->id};
+        setLen(frame, HTTP2_FRAME_HDLEN);
+        http2FrameHdPack(&hd, rawBufMut(frame));
+    }
+
+    s->local_closed = true;
+    if (bufferStreamLen(s->pending) > 0)
+    {
+        s->end_frame = frame;
+    }
+    else
+    {
+        appendOut(f, frame);
+    }
+}
+
+void http2FramerResetStream(http2_framer_t *f, http2_framer_stream_t *s, uint32_t error_code)
+{
+    if (s->reset)
+    {
+        return;
+    }
+    s->reset = true;
+    unlinkBlocked(f, s);
+    emptyBufferStream(s->pending);
+    sendRstStream(f, s->id, error_code);
+}
+
+void http2FramerCloseStream(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    s->userdata = NULL;
+    if (! s->local_closed && ! s->reset)
+    {
+        http2FramerResetStream(f, s, s->remote_closed ? kHttp2ErrorNone : kHttp2ErrorCancel);
+    }
+    if (! s->reset && (bufferStreamLen(s->pending) > 0 || s->end_frame != NULL))
+    {
+        // the stream is finished locally, its queued payload still goes out before it is freed
+        s->detached = true;
+        unlinkWritable(f, s);
+        if (f->grpc_ready == s)
+        {
+            f->grpc_ready = NULL;
+        }
+        return;
+    }
+    freeStream(f, s);
+}
+
+static void maybeAckStream(http2_framer_t *f, http2_framer_stream_t *s, bool force)
+{
+    if (s->recv_paused || s->remote_closed || s->recv_unacked == 0)
+    {
+        return;
+    }
+    if (force || s->recv_unacked >= kHttp2FramerStreamWindow / 2)
+    {
+        sendWindowUpdate(f, s->id, s->recv_unacked);
+        s->recv_window += s->recv_unacked;
+        s->recv_unacked = 0;
+    }
+}
+
+void http2FramerPauseStream(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    (void) f;
+    s->recv_paused = true;
+}
+
+void http2FramerResumeStream(http2_framer_t *f, http2_framer_stream_t *s)
+{
+    s->recv_paused = false;
+    maybeAckStream(f, s, true);
+}
+
+void http2FramerPing(http2_framer_t *f)
+{
+    const uint8_t payload[kPingPayloadLen] = {0};
+    appendControlFrame(f, kHttP2Ping, kHttP2FlagNone, 0, payload, sizeof(payload));
+}
+
+size_t http2FramerStreamsCount(http2_framer_t *f)
+{
+    return (size_t) h2_stream_map_t_size(&f->streams);
+}
+
+bool http2FramerWantsClose(http2_framer_t *f)
+{
+    return f->goaway || f->error;
+}
+
+void http2FramerFeed(http2_framer_t *f, shift_buffer_t *buf)
+{
+    bufferStreamPush(f->in, buf);
+}
+
+shift_buffer_t *http2FramerTakeOutput(http2_framer_t *f)
+{
+    shift_buffer_t *out = f->out;
+    f->out              = NULL;
+    return out;
+}
+
+static bool protocolError(http2_framer_t *f, http2_framer_event_t *ev, uint32_t error_code)
+{
+    sendGoaway(f, error_code);
+    f->error = true;
+    ev->type = kHttp2EventError;
+    return true;
+}
+
+// resets one stream, the connection goes on
+static bool streamError(http2_framer_t *f, http2_framer_stream_t *s, http2_framer_event_t *ev, uint32_t error_code)
+{
+    sendRstStream(f, s->id, error_code);
+    s->reset              = true;
+    s->remote_closed      = true;
+    s->remote_end_pending = false;
+    s->grpc_in_message    = false;
+    unlinkBlocked(f, s);
+    emptyBufferStream(s->pending);
+    if (s->grpc_stream)
+    {
+        emptyBufferStream(s->grpc_stream);
+    }
+    if (f->grpc_ready == s)
+    {
+        f->grpc_ready = NULL;
+    }
+    if (s->detached)
+    {
+        freeStream(f, s);
+        return false;
+    }
+    ev->type   = kHttp2EventReset;
+    ev->stream = s;
+    return true;
+}
+
+static void onHeaderField(void *userdata, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    http2_framer_t    *f          = userdata;
+    static const char  kCt[]      = "content-type";
+    static const char  kGrpcCt[]  = "application/grpc";
+    const size_t       grpc_ctlen = sizeof(kGrpcCt) - 1;
+
+    if (name_len == sizeof(kCt) - 1 && memcmp(name, kCt, name_len) == 0 && value_len >= grpc_ctlen &&
+        memcmp(value, kGrpcCt, grpc_ctlen) == 0)
+    {
+        f->header_grpc = true;
+    }
+}
+
+// false when the block grows past kHttp2FramerMaxHeaderBlock, the fragment is left in the input
+static bool collectHeaderFragment(http2_framer_t *f, size_t len)
+{
+    if (f->header_block == NULL)
+    {
+        f->header_block = popBuffer(f->pool);
+    }
+    if (len == 0)
+    {
+        return true;
+    }
+    const unsigned int old_len = bufLen(f->header_block);
+    if (old_len + len > kHttp2FramerMaxHeaderBlock)
+    {
+        return false;
+    }
+    setLen(f->header_block, (unsigned int) (old_len + len));
+    bufferStreamViewBytesAt(f->in, 0, rawBufMut(f->header_block) + old_len, len);
+    bufferStreamSkip(f->in, len);
+    return true;
+}
+
+static bool finishHeaderBlock(http2_framer_t *f, http2_framer_event_t *ev)
+{
+    const uint32_t id         = f->header_stream_id;
+    const bool     end_stream = f->header_end_stream;
+    f->header_stream_id       = 0;
+    f->header_grpc            = false;
+
+    // the block is always decoded, even for unknown streams, to keep the dynamic table in sync
+    const bool ok = hpackDecode(&f->hpack, rawBuf(f->header_block), bufLen(f->header_block), onHeaderField, f);
+    reuseBuffer(f->pool, f->header_block);
+    f->header_block = NULL;
+    if (! ok)
+    {
+        return protocolError(f, ev, kHttp2ErrorCompression);
+    }
+
+    http2_framer_stream_t *s = findStream(f, id);
+    if (s == NULL)
+    {
+        if (! f->server || (id & 1) == 0 || id <= f->last_peer_stream_id || f->goaway)
+        {
+            return false;
+        }
+        s                      = newStream(f, id, f->header_grpc);
+        f->last_peer_stream_id = id;
+    }
+    if (s->detached)
+    {
+        return false;
+    }
+    if (end_stream)
+    {
+        s->remote_closed = true;
+    }
+
+    ev->type       = kHttp2EventHeaders;
+    ev->stream     = s;
+    ev->end_stream = end_stream;
+    ev->grpc       = f->header_grpc;
+    return true;
+}
+
+static bool readPadding(http2_framer_t *f, const http2_frame_hd *hd, uint32_t *len, uint8_t *pad)
+{
+    *pad = 0;
+    if (hd->flags & kHttP2FlagPadded)
+    {
+        if (*len < 1)
+        {
+            return false;
+        }
+        *pad = bufferStreamViewByteAt(f->in, 0);
+        bufferStreamSkip(f->in, 1);
+        *len -= 1;
+        if (*pad > *len)
+        {
+            return false;
+        }
+        *len -= *pad;
+    }
+    return true;
+}
+
+static bool processData(http2_framer_t *f, const http2_frame_hd *hd, http2_framer_event_t *ev)
+{
+    uint32_t len = hd->length;
+    uint8_t  pad;
+
+    // nothing is parsed after a protocol error, so the rest of the frame is left in the input
+    if (hd->stream_id == 0 || ! readPadding(f, hd, &len, &pad))
+    {
+        return protocolError(f, ev, kHttp2ErrorProtocol);
+    }
+
+    if ((int64_t) hd->length > f->recv_window)
+    {
+        return protocolError(f, ev, kHttp2ErrorFlowControl);
+    }
+    f->recv_window -= hd->length;
+
+    // the connection window is returned right away, so a paused stream never blocks the others
+    f->recv_unacked += hd->length;
+    if (f->recv_unacked >= kHttp2FramerConnectionWindow / 2)
+    {
+        sendWindowUpdate(f, 0, f->recv_unacked);
+        f->recv_window += f->recv_unacked;
+        f->recv_unacked = 0;
+    }
+
+    http2_framer_stream_t *s = findStream(f, hd->stream_id);
+    if (s == NULL || s->reset)
+    {
+        // a stream that is already gone on our side, the peer may not have seen the reset yet
+        bufferStreamSkip(f->in, len + pad);
+        return false;
+    }
+    if (s->remote_closed)
+    {
+        bufferStreamSkip(f->in, len + pad);
+        return streamError(f, s, ev, kHttp2ErrorStreamClosed);
+    }
+    if ((int64_t) hd->length > s->recv_window)
+    {
+        return protocolError(f, ev, kHttp2ErrorFlowControl);
+    }
+    s->recv_window -= hd->length;
+    if (s->detached)
+    {
+        // nobody reads it anymore, the window stays closed since it is reset or finished soon
+        bufferStreamSkip(f->in, len + pad);
+        return false;
+    }
+
+    shift_buffer_t *buf = len > 0 ? bufferStreamRead(f->in, len) : NULL;
+    if (pad > 0)
+    {
+        bufferStreamSkip(f->in, pad);
+    }
+
+    const bool end_stream = (hd->flags & kHttP2FlagEndStream) != 0;
+    if (end_stream)
+    {
+        s->remote_closed = true;
+    }
+
+    if (s->grpc)
+    {
+        // only the padding is returned now, the payload once the messages it carries are complete
+        s->recv_unacked += hd->length - len;
+        maybeAckStream(f, s, false);
+
+        if (buf)
+        {
+            bufferStreamPush(s->grpc_stream, buf);
+        }
+        s->remote_end_pending = end_stream;
+        f->grpc_ready         = s;
+        return false;
+    }
+
+    s->recv_unacked += hd->length;
+    maybeAckStream(f, s, false);
+
+    if (buf)
+    {
+        ev->type       = kHttp2EventData;
+        ev->stream     = s;
+        ev->buf        = buf;
+        ev->end_stream = end_stream;
+        return true;
+    }
+    if (end_stream)
+    {
+        ev->type   = kHttp2EventStreamEnd;
+        ev->stream = s;
+        return true;
+    }
+    return false;
+}
+
+static bool processHeaders(http2_framer_t *f, const http2_frame_hd *hd, http2_framer_event_t *ev)
+{
+    uint32_t len = hd->length;
+    uint8_t  pad;
+
+    if (hd->stream_id == 0 || ! readPadding(f, hd, &len, &pad))
+    {
+        return protocolError(f, ev, kHttp2ErrorProtocol);
+    }
+    if (hd->flags & kHttP2FlagPriority)
+    {
+        if (len < 5)
+        {
+            return protocolError(f, ev, kHttp2ErrorProtocol);
+        }
+        bufferStreamSkip(f->in, 5);
+        len -= 5;
+    }
+
+    if (! collectHeaderFragment(f, len))
+    {
+        return protocolError(f, ev, kHttp2ErrorEnhanceYourCalm);
+    }
+    if (pad > 0)
+    {
+        bufferStreamSkip(f->in, pad);
+    }
+
+    f->header_stream_id  = hd->stream_id;
+    f->header_end_stream = (hd->flags & kHttP2FlagEndStream) != 0;
+
+    if (hd->flags & kHttP2FlagEndHeaders)
+    {
+        return finishHeaderBlock(f, ev);
+    }
+    return false;
+}
+
+static bool processSettings(http2_framer_t *f, const http2_frame_hd *hd, http2_framer_event_t *ev)
+{
+    if (hd->stream_id != 0)
+    {
+        return protocolError(f, ev, kHttp2ErrorProtocol);
+    }
+    if (hd->flags & 0x1)
+    {
+        // ack of our settings, it carries no payload
+        if (hd->length != 0)
+        {
+            bufferStreamSkip(f->in, hd->length);
+            return protocolError(f, ev, kHttp2ErrorFrameSize);
+        }
+        return false;
+    }
+    if (hd->length % 6 != 0)
+    {
+        return protocolError(f, ev, kHttp2ErrorFrameSize);
+    }
+
+    for (uint32_t i = 0; i < hd->length; i += 6)
+    {
+        uint8_t entry[6];
+        bufferStreamViewBytesAt(f->in, 0, entry, sizeof(entry));
+        bufferStreamSkip(f->in, sizeof(entry));
+        const uint16_t id    = (uint16_t) ((entry[0] << 8) | entry[1]);
+        const uint32_t value = readUint32Be(entry + 2);
+
+        switch (id)
+        {
+        case kSettingsInitialWindowSize: {
+            if (value > kMaxWindowSize)
+            {
+                bufferStreamSkip(f->in, hd->length - i - 6);
+                return protocolError(f, ev, kHttp2ErrorFlowControl);
+            }
+            const int64_t delta = (int64_t) value - (int64_t) f->peer_initial_window;
+            f->peer_initial_window = value;
+            c_foreach(k, h2_stream_map_t, f->streams)
+            {
+                k.ref->second->send_window += delta;
+            }
+        }
+        break;
+        case kSettingsMaxFrameSize:
+            if (value < kDefaultMaxFrameSize || value > 0xFFFFFF)
+            {
+                bufferStreamSkip(f->in, hd->length - i - 6);
+                return protocolError(f, ev, kHttp2ErrorProtocol);
+            }
+            f->peer_max_frame_size = value;
+            break;
+        default:
+            // header table size needs nothing since the encoder never indexes, the rest is advisory
+            break;
+        }
+    }
+
+    appendControlFrame(f, kHttP2Settings, (http2_flag) 0x1, 0, NULL, 0);
+    drainBlocked(f);
+    return false;
+}
+
+static bool processWindowUpdate(http2_framer_t *f, const http2_frame_hd *hd, http2_framer_event_t *ev)
+{
+    if (hd->length != 4)
+    {
+        bufferStreamSkip(f->in, hd->length);
+        return protocolError(f, ev, kHttp2ErrorFrameSize);
+    }
+    uint8_t payload[4];
+    bufferStreamViewBytesAt(f->in, 0, payload, sizeof(payload));
+    bufferStreamSkip(f->in, sizeof(payload));
+    const uint32_t increment = readUint32Be(payload) & 0x7FFFFFFF;
+
+    if (hd->stream_id == 0)
+    {
+        if (increment == 0 || f->send_window + increment > kMaxWindowSize)
+        {
+            return protocolError(f, ev, kHttp2ErrorFlowControl);
+        }
+        f->send_window += increment;
+        drainBlocked(f);
+        return false;
+    }
+
+    http2_framer_stream_t *s = findStream(f, hd->stream_id);
+    if (s == NULL || increment == 0)
+    {
+        return false;
+    }
+    s->send_window += increment;
+    if (s->blocked && f->send_window > 0 && drainStream(f, s))
+    {
+        unlinkBlocked(f, s);
+        onStreamDrained(f, s);
+    }
+    return false;
+}
+
+static bool processFrame(http2_framer_t *f, const http2_frame_hd *hd, http2_framer_event_t *ev)
+{
+    if (f->header_stream_id != 0 && (hd->type != kHttP2Continuation || hd->stream_id != f->header_stream_id))
+    {
+        bufferStreamSkip(f->in, hd->length);
+        return protocolError(f, ev, kHttp2ErrorProtocol);
+    }
+
+    switch (hd->type)
+    {
+    case kHttP2Data:
+        return processData(f, hd, ev);
+
+    case kHttP2Headers:
+        return processHeaders(f, hd, ev);
+
+    case kHttP2Continuation:
+        if (f->header_stream_id == 0)
+        {
+            bufferStreamSkip(f->in, hd->length);
+            return protocolError(f, ev, kHttp2ErrorProtocol);
+        }
+        if (! collectHeaderFragment(f, hd->length))
+        {
+            return protocolError(f, ev, kHttp2ErrorEnhanceYourCalm);
+        }
+        if (hd->flags & kHttP2FlagEndHeaders)
+        {
+            return finishHeaderBlock(f, ev);
+        }
+        return false;
+
+    case kHttP2Settings:
+        return processSettings(f, hd, ev);
+
+    case kHttP2WindowUpdate:
+        return processWindowUpdate(f, hd, ev);
+
+    case kHttP2Ping: {
+        if (hd->length != kPingPayloadLen || hd->stream_id != 0)
+        {
+            bufferStreamSkip(f->in, hd->length);
+            return protocolError(f, ev, kHttp2ErrorFrameSize);
+        }
+        uint8_t payload[kPingPayloadLen];
+        bufferStreamViewBytesAt(f->in, 0, payload, sizeof(payload));
+        bufferStreamSkip(f->in, sizeof(payload));
+        if (hd->flags & 0x1)
+        {
+            ev->type = kHttp2EventPingAck;
+            return true;
+        }
+        appendControlFrame(f, kHttP2Ping, (http2_flag) 0x1, 0, payload, sizeof(payload));
+        return false;
+    }
+
+    case kHttP2RstStream: {
+        bufferStreamSkip(f->in, hd->length);
+        http2_framer_stream_t *s = findStream(f, hd->stream_id);
+        if (s == NULL)
+        {
+            return false;
+        }
+        if (s->detached)
+        {
+            freeStream(f, s);
+            return false;
+        }
+        s->reset         = true;
+        s->remote_closed = true;
+        unlinkBlocked(f, s);
+        emptyBufferStream(s->pending);
+        ev->type   = kHttp2EventReset;
+        ev->stream = s;
+        return true;
+    }
+
+    case kHttP2Goaway:
+        bufferStreamSkip(f->in, hd->length);
+        f->goaway = true;
+        ev->type  = kHttp2EventGoaway;
+        return true;
+
+    case kHttP2PushPromise:
+        // push is disabled in our settings
+        bufferStreamSkip(f->in, hd->length);
+        return protocolError(f, ev, kHttp2ErrorProtocol);
+
+    default:
+        // priority and unknown frame types are ignored
+        bufferStreamSkip(f->in, hd->length);
+        return false;
+    }
+}
+
+static bool nextGrpcMessage(http2_framer_t *f, http2_framer_stream_t *s, http2_framer_event_t *ev)
+{
+    while (true)
+    {
+        if (! s->grpc_in_message)
+        {
+            if (bufferStreamLen(s->grpc_stream) < GRPC_MESSAGE_HDLEN)
+            {
+                break;
+            }
+            uint8_t         gheader[GRPC_MESSAGE_HDLEN];
+            grpc_message_hd msghd;
+            bufferStreamViewBytesAt(s->grpc_stream, 0, gheader, GRPC_MESSAGE_HDLEN);
+            bufferStreamSkip(s->grpc_stream, GRPC_MESSAGE_HDLEN);
+            grpcMessageHdUnpack(&msghd, gheader);
+            if (msghd.length > kHttp2FramerMaxGrpcMessage)
+            {
+                return streamError(f, s, ev, kHttp2ErrorEnhanceYourCalm);
+            }
+            s->grpc_needed     = msghd.length;
+            s->grpc_in_message = true;
+        }
+        const size_t buffered = bufferStreamLen(s->grpc_stream);
+        if (buffered < s->grpc_needed)
+        {
+            // the credit of the complete messages before it must reach the peer, or this one never completes
+            if (s->recv_window < (int64_t) (s->grpc_needed - buffered))
+            {
+                maybeAckStream(f, s, true);
+            }
+            break;
+        }
+        s->grpc_in_message = false;
+        s->recv_unacked += GRPC_MESSAGE_HDLEN + s->grpc_needed;
+        maybeAckStream(f, s, false);
+        if (s->grpc_needed == 0)
+        {
+            continue;
+        }
+        ev->type   = kHttp2EventData;
+        ev->stream = s;
+        ev->buf    = bufferStreamRead(s->grpc_stream, s->grpc_needed);
+        return true;
+    }
+
+    f->grpc_ready = NULL;
+    if (s->remote_end_pending)
+    {
+        s->remote_end_pending = false;
+        ev->type              = kHttp2EventStreamEnd;
+        ev->stream            = s;
+        return true;
+    }
+    return false;
+}
+
+bool http2FramerNextEvent(http2_framer_t *f, http2_framer_event_t *ev)
+{
+    *ev = (http2_framer_event_t) {.type = kHttp2EventNone};
+
+    while (! f->error)
+    {
+        if (f->writable)
+        {
+            http2_framer_stream_t *s = f->writable;
+            f->writable              = s->next_writable;
+            s->writable_queued       = false;
+            s->next_writable         = NULL;
+            ev->type                 = kHttp2EventWritable;
+            ev->stream               = s;
+            return true;
+        }
+
+        if (f->grpc_ready && nextGrpcMessage(f, f->grpc_ready, ev))
+        {
+            return true;
+        }
+
+        if (! f->preface_received)
+        {
+            if (bufferStreamLen(f->in) < HTTP2_MAGIC_LEN)
+            {
+                return false;
+            }
+            uint8_t magic[HTTP2_MAGIC_LEN];
+            bufferStreamViewBytesAt(f->in, 0, magic, HTTP2_MAGIC_LEN);
+            bufferStreamSkip(f->in, HTTP2_MAGIC_LEN);
+            if (memcmp(magic, HTTP2_MAGIC, HTTP2_MAGIC_LEN) != 0)
+            {
+                return protocolError(f, ev, kHttp2ErrorProtocol);
+            }
+            f->preface_received = true;
+        }
+
+        if (bufferStreamLen(f->in) < HTTP2_FRAME_HDLEN)
+        {
+            return false;
+        }
+        uint8_t        hdbytes[HTTP2_FRAME_HDLEN];
+        http2_frame_hd hd;
+        bufferStreamViewBytesAt(f->in, 0, hdbytes, HTTP2_FRAME_HDLEN);
+        http2FrameHdUnpack(hdbytes, &hd);
+        hd.stream_id &= kMaxStreamId;
+
+        if (hd.length > kHttp2FramerMaxFrameSize)
+        {
+            return protocolError(f, ev, kHttp2ErrorFrameSize);
+        }
+        if (bufferStreamLen(f->in) < HTTP2_FRAME_HDLEN + hd.length)
+        {
+            return false;
+        }
+        bufferStreamSkip(f->in, HTTP2_FRAME_HDLEN);
+
+        if (processFrame(f, &hd, ev))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "hpack.h"
+#include "shiftbuffer.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Native http2 framer, an alternative engine to nghttp2 for Http2Client and Http2Server
+
+    it only covers what a tunnel stream needs: the few request/response headers we send are encoded with the
+    static hpack table (the peer's headers are fully decoded so any standard grpc server or client works),
+    priority is ignored, push is disabled and frames are written into the left space of the payload buffers
+
+    flow control is credit based per stream, a stream that runs out of send window queues its payload and the
+    caller is told to pause the producer line, it gets a writable event once the peer returns credit,
+    on the receive side the window of a stream is only returned to the peer while its consumer is not paused,
+    in grpc mode only for messages that are complete, a peer that sends beyond our windows is a
+    FLOW_CONTROL_ERROR
+
+    header blocks are limited to kHttp2FramerMaxHeaderBlock (ENHANCE_YOUR_CALM) and grpc messages to
+    kHttp2FramerMaxGrpcMessage (the stream is reset)
+
+    received bytes are fed with http2FramerFeed, then events are pulled one by one with http2FramerNextEvent,
+    so the caller can stop as soon as its connection is gone, there is no callback in the middle of parsing
+
+    everything the framer wants to send is merged into one buffer, taken with http2FramerTakeOutput
+
+    in grpc mode the framer also adds and strips the 5 byte grpc message prefix, data events carry whole messages
+*/
+
+enum
+{
+    kHttp2FramerMaxFrameSize     = 1 << 18,
+    kHttp2FramerStreamWindow     = 1 << 18,
+    kHttp2FramerConnectionWindow = 1 << 22,
+    kHttp2FramerMaxHeaderBlock   = 1 << 16, // compressed, HEADERS and all of its CONTINUATION frames
+    // a message and its prefix always fit in one stream window, so holding back credit can not stall it
+    kHttp2FramerMaxGrpcMessage = kHttp2FramerStreamWindow - 5
+};
+
+enum http2_framer_event_type
+{
+    kHttp2EventNone,
+    kHttp2EventHeaders,   // a new stream (server) or response headers / trailers, see end_stream
+    kHttp2EventData,      // payload of a stream, the buffer belongs to the caller
+    kHttp2EventStreamEnd, // the peer finished sending on the stream
+    kHttp2EventReset,     // the peer reset the stream
+    kHttp2EventWritable,  // a stream that was out of send window can send again
+    kHttp2EventPingAck,
+    kHttp2EventGoaway,
+    kHttp2EventError // protocol error, the connection must be closed
+};
+
+typedef struct http2_framer_stream_s
+{
+    struct http2_framer_stream_s *next_blocked;
+    struct http2_framer_stream_s *next_writable;
+    buffer_stream_t              *pending;     // payload waiting for send window
+    buffer_stream_t              *grpc_stream; // received bytes of incomplete grpc messages
+    shift_buffer_t               *end_frame;   // END_STREAM frame that waits behind pending payload
+    void                         *userdata;
+    int64_t                       send_window;
+    int64_t                       recv_window;  // what the peer may still send before we return credit
+    uint32_t                      recv_unacked; // received bytes not returned to the peer yet
+    uint32_t                      id;
+    uint32_t                      grpc_needed;
+    bool                          grpc; // payloads carry the 5 byte grpc message prefix
+    bool                          grpc_in_message;
+    bool                          blocked;
+    bool                          writable_queued;
+    bool                          recv_paused;
+    bool                          local_closed;
+    bool                          remote_closed;
+    bool                          remote_end_pending; // grpc messages are delivered before the end event
+    bool                          reset;
+    bool                          detached; // the owner is gone, kept until its pending payload is sent
+
+} http2_framer_stream_t;
+
+typedef struct http2_framer_event_s
+{
+    enum http2_framer_event_type type;
+    http2_framer_stream_t       *stream;
+    shift_buffer_t              *buf;
+    bool                         end_stream;
+    bool                         grpc; // headers carried an application/grpc content-type
+
+} http2_framer_event_t;
+
+typedef struct http2_header_s
+{
+    const char *name;
+    const char *value;
+
+} http2_header_t;
+
+typedef struct http2_framer_s http2_framer_t;
+
+http2_framer_t *newHttp2Framer(buffer_pool_t *pool, bool server, bool grpc);
+void            destroyHttp2Framer(http2_framer_t *f);
+
+void            http2FramerFeed(http2_framer_t *f, shift_buffer_t *buf);
+bool            http2FramerNextEvent(http2_framer_t *f, http2_framer_event_t *ev);
+shift_buffer_t *http2FramerTakeOutput(http2_framer_t *f);
+
+// client side, returns NULL once the stream ids of this connection are used up
+http2_framer_stream_t *http2FramerOpenStream(http2_framer_t *f, void *userdata);
+
+bool http2FramerSendHeaders(http2_framer_t *f, http2_framer_stream_t *s, const http2_header_t *headers,
+                            unsigned int count, bool end_stream);
+
+// takes the buffer, returns false when the stream ran out of send window (the producer should pause)
+bool http2FramerSendData(http2_framer_t *f, http2_framer_stream_t *s, shift_buffer_t *buf);
+
+// ends our side after the queued payload, with trailers or with an empty DATA frame when count is 0
+void http2FramerEndStream(http2_framer_t *f, http2_framer_stream_t *s, const http2_header_t *trailers,
+                          unsigned int count);
+
+void http2FramerResetStream(http2_framer_t *f, http2_framer_stream_t *s, uint32_t error_code);
+
+// the owner is done with the stream, it must not be used after this call
+void http2FramerCloseStream(http2_framer_t *f, http2_framer_stream_t *s);
+
+void http2FramerPauseStream(http2_framer_t *f, http2_framer_stream_t *s);
+void http2FramerResumeStream(http2_framer_t *f, http2_framer_stream_t *s);
+
+void   http2FramerPing(http2_framer_t *f);
+size_t http2FramerStreamsCount(http2_framer_t *f);
+bool   http2FramerWantsClose(http2_framer_t *f);
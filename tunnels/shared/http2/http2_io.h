@@ -0,0 +1,241 @@
+#pragma once
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "grpc_def.h"
+#include "http2_def.h"
+#include "nghttp2/nghttp2.h"
+#include "shiftbuffer.h"
+#include "utils/mathutils.h"
+#include "ww.h"
+
+/*
+    Zero copy data path shared by Http2Client and Http2Server
+
+    outgoing payloads are queued on a data source and given to nghttp2 with NGHTTP2_DATA_FLAG_NO_COPY, so nghttp2
+    only decides frame sizes and flow control, the send_data callback then writes the 9 byte frame header into
+    the left space of the payload buffer itself (the grpc length prefix is written there too, when queued)
+
+    everything that nghttp2 produces in one flush (control frames and data frames) is merged into one buffer,
+    so the next node gets a single write per flush
+
+    received DATA chunks are shallow slices of the buffer that was given to nghttp2, small chunks are copied
+    since that is cheaper than keeping the large buffer alive for them
+
+    data sources belong to the connection, a stream can be gone while its data is still waiting for window,
+    a source is freed after it sent its trailer, when nghttp2 closes its stream or with the connection
+*/
+
+enum
+{
+    kHttp2ShallowChunkMin  = 512,
+    kHttp2CoalesceLimit    = 1 << 16,
+    kHttp2ConnectionWindow = 1 << 22
+};
+
+typedef struct http2_data_source_s
+{
+    struct http2_data_source_s  *next;
+    struct http2_data_source_s **head;
+    buffer_stream_t             *pending;
+    int32_t                      stream_id;
+    bool                         grpc;
+    bool                         deferred;
+    bool                         eof;
+
+} http2_data_source_t;
+
+static inline http2_data_source_t *http2DataSourceFind(http2_data_source_t *head, int32_t stream_id)
+{
+    for (http2_data_source_t *src = head; src; src = src->next)
+    {
+        if (src->stream_id == stream_id)
+        {
+            return src;
+        }
+    }
+    return NULL;
+}
+
+static inline void http2DataSourceDestroy(http2_data_source_t *src)
+{
+    http2_data_source_t **it = src->head;
+    while (*it != src)
+    {
+        it = &((*it)->next);
+    }
+    *it = src->next;
+    destroyBufferStream(src->pending);
+    globalFree(src);
+}
+
+static inline void http2DataSourceDestroyAll(http2_data_source_t **head)
+{
+    while (*head)
+    {
+        http2DataSourceDestroy(*head);
+    }
+}
+
+static nghttp2_ssize onHttp2DataSourceRead(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                                           uint32_t *data_flags, nghttp2_data_source *source, void *userdata)
+{
+    (void) buf;
+    (void) userdata;
+    http2_data_source_t *src = source->ptr;
+
+    if (bufferStreamLen(src->pending) == 0)
+    {
+        if (src->eof)
+        {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF | NGHTTP2_DATA_FLAG_NO_END_STREAM;
+            if (src->grpc)
+            {
+                nghttp2_nv nv = {.name     = (uint8_t *) "grpc-status",
+                                 .value    = (uint8_t *) "0",
+                                 .namelen  = sizeof("grpc-status") - 1,
+                                 .valuelen = sizeof("0") - 1,
+                                 .flags    = NGHTTP2_NV_FLAG_NONE};
+                nghttp2_submit_trailer(session, stream_id, &nv, 1);
+            }
+            else
+            {
+                nghttp2_submit_trailer(session, stream_id, NULL, 0);
+            }
+            // nghttp2 is done with this source after eof and sends no frame body from it
+            http2DataSourceDestroy(src);
+            return 0;
+        }
+        src->deferred = true;
+        return NGHTTP2_ERR_DEFERRED;
+    }
+
+    // one frame never spans two queued buffers, so every frame header lands in the left space of its payload
+    *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+    return (nghttp2_ssize) min(length, (size_t) bufLen(bufferStreamFront(src->pending)));
+}
+
+static nghttp2_ssize onHttp2DataSourceReadLength(nghttp2_session *session, uint8_t frame_type, int32_t stream_id,
+                                                 int32_t session_remote_window_size,
+                                                 int32_t stream_remote_window_size, uint32_t remote_max_frame_size,
+                                                 void *userdata)
+{
+    (void) session;
+    (void) frame_type;
+    (void) stream_id;
+    (void) userdata;
+    // nghttp2 would cap data frames to 16k otherwise, the window check is repeated by nghttp2 itself
+    return (nghttp2_ssize) min((int64_t) remote_max_frame_size,
+                               (int64_t) min(session_remote_window_size, stream_remote_window_size));
+}
+
+// queues a payload on the stream, the buffer is owned by the source after this call
+static inline void http2SubmitPayload(nghttp2_session *session, http2_data_source_t **head,
+                                      http2_data_source_t **stream_src, int32_t stream_id, buffer_pool_t *pool,
+                                      shift_buffer_t *buf, bool grpc)
+{
+    if (grpc)
+    {
+        grpc_message_hd msghd = {.flags = 0, .length = bufLen(buf)};
+        shiftl(buf, GRPC_MESSAGE_HDLEN);
+        grpcMessageHdPack(&msghd, rawBufMut(buf));
+    }
+
+    http2_data_source_t *src = *stream_src;
+    if (src == NULL)
+    {
+        src  = globalMalloc(sizeof(http2_data_source_t));
+        *src = (http2_data_source_t) {
+            .next = *head, .head = head, .pending = newBufferStream(pool), .stream_id = stream_id, .grpc = grpc};
+        *head       = src;
+        *stream_src = src;
+        bufferStreamPush(src->pending, buf);
+
+        nghttp2_data_provider2 provider = {.source = {.ptr = src}, .read_callback = onHttp2DataSourceRead};
+        if (nghttp2_submit_data2(session, NGHTTP2_FLAG_NONE, stream_id, &provider) != 0)
+        {
+            *stream_src = NULL;
+            http2DataSourceDestroy(src);
+        }
+        return;
+    }
+
+    bufferStreamPush(src->pending, buf);
+    if (src->deferred)
+    {
+        src->deferred = false;
+        nghttp2_session_resume_data(session, stream_id);
+    }
+}
+
+// the trailer is submitted once everything queued before it has been sent
+static inline void http2FinishDataSource(nghttp2_session *session, http2_data_source_t *src)
+{
+    src->eof = true;
+    if (src->deferred)
+    {
+        src->deferred = false;
+        nghttp2_session_resume_data(session, src->stream_id);
+    }
+}
+
+// called from the send_data callback, returns the complete frame built in place
+static inline shift_buffer_t *http2DataSourceTakeFrame(http2_data_source_t *src, const uint8_t *framehd,
+                                                       size_t length)
+{
+    shift_buffer_t *buf;
+    if (bufLen(bufferStreamFront(src->pending)) == length)
+    {
+        buf = bufferStreamIdealRead(src->pending);
+    }
+    else
+    {
+        buf = bufferStreamRead(src->pending, length);
+    }
+    shiftl(buf, HTTP2_FRAME_HDLEN);
+    writeRaw(buf, framehd, HTTP2_FRAME_HDLEN);
+    return buf;
+}
+
+static inline void http2AppendBytes(buffer_pool_t *pool, shift_buffer_t **out, const uint8_t *data, size_t len)
+{
+    if (*out == NULL)
+    {
+        *out = popBuffer(pool);
+    }
+    const unsigned int old_len = bufLen(*out);
+    setLen(*out, old_len + len);
+    memcpy(rawBufMut(*out) + old_len, data, len);
+}
+
+static inline void http2AppendBuffer(buffer_pool_t *pool, shift_buffer_t **out, shift_buffer_t *buf)
+{
+    if (*out == NULL)
+    {
+        *out = buf;
+        return;
+    }
+    *out = appendBufferMerge(pool, *out, buf);
+}
+
+// data points into owner, which is the buffer currently being parsed by nghttp2_session_mem_recv2
+static inline shift_buffer_t *http2TakeRecvChunk(buffer_pool_t *pool, generic_pool_t *sb_pool, shift_buffer_t *owner,
+                                                 const uint8_t *data, size_t len)
+{
+    const uint8_t *base = owner ? rawBuf(owner) : NULL;
+
+    if (len < kHttp2ShallowChunkMin || base == NULL || data < base || data + len > base + bufLen(owner))
+    {
+        shift_buffer_t *buf = popBuffer(pool);
+        setLen(buf, len);
+        writeRaw(buf, data, len);
+        return buf;
+    }
+
+    shift_buffer_t *chunk = newShallowShiftBuffer(sb_pool, owner);
+    shiftr(chunk, (unsigned int) (data - base));
+    setLen(chunk, len);
+    // the neighbours are other frames, growing to either side must make a private copy
+    constrainLeft(chunk);
+    constrainRight(chunk);
+    return chunk;
+}
@@ -19,31 +19,50 @@ enum
 {
     kMuxFlagOpen  = 0,
     kMuxFlagClose = 1,
-    kMuxFlagFlow  = 2,
+    kMuxFlagFlow  = 2, // carries the credit (uint32_t) returned to the send window of the child
     kMuxFlagData  = 3,
+    kMuxFlagPing  = 4, // no payload and cid is ignored, MuxServer answers it, MuxClient times the answer
+    kMuxFlagHello = 5, // carries mux_hello_t, cid is ignored, see below
     kMuxMinFrameLength = (sizeof(mux_frame_t) - sizeof(mux_length_t)),
     kMuxMaxFrameLength = (1U << (8*sizeof(mux_length_t))) - (1+kMuxMinFrameLength)
 };
 
+/*
+    the original format only has open, close and data frames and stays the default, the other frames are only sent
+    when both nodes have flow-control enabled
 
+    such a MuxClient sends a hello as its first frame and MuxServer answers with the features it accepted, a server
+    that gets a hello without flow-control enabled (or no hello with it enabled) closes the connection
+*/
+enum
+{
+    kMuxVersion     = 1,
+    kMuxFeatureFlow = 1 << 0, // per child windows, kMuxFlagFlow frames
+    kMuxFeaturePing = 1 << 1  // kMuxFlagPing frames
+};
 
+typedef struct __attribute__((__packed__))
+{
+    uint8_t version;
+    uint8_t features;
 
+} mux_hello_t;
 
-static void makeOpenFrame(shift_buffer_t *buf, cid_t cid)
+static inline void makeOpenFrame(shift_buffer_t *buf, cid_t cid)
 {
     shiftl(buf, sizeof(mux_frame_t));
     mux_frame_t frame = {.length = bufLen(buf) - sizeof(frame.length), .cid = cid, .flags = kMuxFlagOpen};
     writeRaw(buf, &frame, sizeof(mux_frame_t));
 }
 
-static void makeCloseFrame(shift_buffer_t *buf, cid_t cid)
+static inline void makeCloseFrame(shift_buffer_t *buf, cid_t cid)
 {
     shiftl(buf, sizeof(mux_frame_t));
     mux_frame_t frame = {.length = sizeof(mux_frame_t) - sizeof(frame.length), .cid = cid, .flags = kMuxFlagClose};
     writeRaw(buf, &frame, sizeof(mux_frame_t));
 }
 
-static void makeDataFrame(shift_buffer_t *buf, cid_t cid)
+static inline void makeDataFrame(shift_buffer_t *buf, cid_t cid)
 {
     shiftl(buf, sizeof(mux_frame_t));
     mux_frame_t frame = {.length = bufLen(buf) - sizeof(frame.length), .cid = cid, .flags = kMuxFlagData};
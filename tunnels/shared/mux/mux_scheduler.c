@@ -0,0 +1,476 @@
+#include "mux_scheduler.h"
+#include "managers/memory_manager.h"
+#include <assert.h>
+#include <string.h>
+
+#define i_TYPE hmap_mux_streams_t, cid_t, mux_stream_t * // NOLINT
+#include "stc/hmap.h"
+
+enum
+{
+    kMuxStreamsCap = 16
+};
+
+struct mux_scheduler_s
+{
+    buffer_pool_t     *pool;
+    mux_stream_t       root;    // head of the list of all streams
+    hmap_mux_streams_t streams; // cid to the newest stream that uses it
+    mux_stream_t      *active_head;
+    mux_stream_t      *active_tail;
+    mux_stream_t      *writable_head;
+    shift_buffer_t    *out;  // merged small frames
+    shift_buffer_t    *held; // a large frame that goes out after the merged ones
+    // queued on the streams plus sent and not credited yet, updated whenever one of them changes
+    uint64_t           stream_bytes;
+    unsigned int       recv_paused_streams;
+    bool               flow_control;
+};
+
+mux_scheduler_t *newMuxScheduler(buffer_pool_t *pool)
+{
+    mux_scheduler_t *s = globalMalloc(sizeof(mux_scheduler_t));
+    memset(s, 0, sizeof(mux_scheduler_t));
+    s->pool    = pool;
+    s->streams = hmap_mux_streams_t_with_capacity(kMuxStreamsCap);
+    return s;
+}
+
+// bytes of the stream that the peer did not credit yet
+static uint64_t uncreditedBytes(const mux_stream_t *stream)
+{
+    return stream->send_window < kMuxStreamWindow ? (uint64_t) (kMuxStreamWindow - stream->send_window) : 0;
+}
+
+static void freeStream(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    s->stream_bytes -= uncreditedBytes(stream) + bufferStreamLen(stream->pending);
+
+    hmap_mux_streams_t_iter find_result = hmap_mux_streams_t_find(&(s->streams), stream->cid);
+    if (find_result.ref != hmap_mux_streams_t_end(&(s->streams)).ref && find_result.ref->second == stream)
+    {
+        hmap_mux_streams_t_erase(&(s->streams), stream->cid);
+    }
+    stream->prev->next = stream->next;
+    if (stream->next)
+    {
+        stream->next->prev = stream->prev;
+    }
+    destroyBufferStream(stream->pending);
+    globalFree(stream);
+}
+
+void destroyMuxScheduler(mux_scheduler_t *s)
+{
+    while (s->root.next)
+    {
+        freeStream(s, s->root.next);
+    }
+    hmap_mux_streams_t_drop(&(s->streams));
+    if (s->out)
+    {
+        reuseBuffer(s->pool, s->out);
+    }
+    if (s->held)
+    {
+        reuseBuffer(s->pool, s->held);
+    }
+    globalFree(s);
+}
+
+void muxSchedulerEnableFlowControl(mux_scheduler_t *s)
+{
+    assert(s->root.next == NULL);
+    s->flow_control = true;
+}
+
+// appends a whole frame to the end of buf
+static void appendFrame(shift_buffer_t *buf, cid_t cid, uint8_t flags, const void *data, mux_length_t len)
+{
+    const unsigned int at    = bufLen(buf);
+    mux_frame_t        frame = {.length = (mux_length_t) (kMuxMinFrameLength + len), .cid = cid, .flags = flags};
+
+    setLen(buf, at + sizeof(mux_frame_t) + len);
+    memcpy(rawBufMut(buf) + at, &frame, sizeof(mux_frame_t));
+    if (len > 0)
+    {
+        memcpy(rawBufMut(buf) + at + sizeof(mux_frame_t), data, len);
+    }
+}
+
+static shift_buffer_t *outBuffer(mux_scheduler_t *s)
+{
+    if (s->out == NULL)
+    {
+        s->out = popBuffer(s->pool);
+    }
+    return s->out;
+}
+
+static void maybeFreeStream(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    if (stream->finished && ! stream->active && ! stream->writable_queued)
+    {
+        freeStream(s, stream);
+    }
+}
+
+static void activateStream(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    if (stream->active || stream->finished || stream->send_window <= 0 || bufferStreamLen(stream->pending) == 0)
+    {
+        return;
+    }
+    stream->active      = true;
+    stream->deficit     = 0;
+    stream->next_active = NULL;
+    if (s->active_tail)
+    {
+        s->active_tail->next_active = stream;
+    }
+    else
+    {
+        s->active_head = stream;
+    }
+    s->active_tail = stream;
+}
+
+static mux_stream_t *popActive(mux_scheduler_t *s)
+{
+    mux_stream_t *stream = s->active_head;
+    s->active_head       = stream->next_active;
+    if (s->active_head == NULL)
+    {
+        s->active_tail = NULL;
+    }
+    stream->next_active = NULL;
+    return stream;
+}
+
+static void queueWritable(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    if (! stream->producer_paused || bufferStreamLen(stream->pending) > kMuxStreamPendingLimit / 2)
+    {
+        return;
+    }
+    stream->producer_paused = false;
+    if (! stream->writable_queued && stream->userdata != NULL)
+    {
+        stream->writable_queued = true;
+        stream->next_writable   = s->writable_head;
+        s->writable_head        = stream;
+    }
+}
+
+static void returnCredit(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    if (! s->flow_control || stream->recv_paused || stream->recv_unacked < kMuxWindowUpdate)
+    {
+        return;
+    }
+    const uint32_t credit = stream->recv_unacked;
+    appendFrame(outBuffer(s), stream->cid, kMuxFlagFlow, &credit, sizeof(credit));
+    stream->recv_window += credit;
+    stream->recv_unacked = 0;
+}
+
+mux_stream_t *muxSchedulerAddStream(mux_scheduler_t *s, cid_t cid, void *userdata, bool opened_by_peer)
+{
+    mux_stream_t *stream = globalMalloc(sizeof(mux_stream_t));
+    *stream              = (mux_stream_t) {.next        = s->root.next,
+                                           .prev        = &s->root,
+                                           .pending     = newBufferStream(s->pool),
+                                           .userdata    = userdata,
+                                           .send_window = kMuxStreamWindow,
+                                           .recv_window = kMuxStreamWindow,
+                                           .cid         = cid,
+                                           .open_sent   = opened_by_peer};
+    if (s->root.next)
+    {
+        s->root.next->prev = stream;
+    }
+    s->root.next = stream;
+
+    // a finished stream may still wait for its last credit under the same cid, the new one takes it over
+    hmap_mux_streams_t_iter find_result = hmap_mux_streams_t_find(&(s->streams), cid);
+    if (find_result.ref != hmap_mux_streams_t_end(&(s->streams)).ref)
+    {
+        find_result.ref->second = stream;
+    }
+    else
+    {
+        hmap_mux_streams_t_insert(&(s->streams), cid, stream);
+    }
+    return stream;
+}
+
+mux_stream_t *muxSchedulerFindStream(mux_scheduler_t *s, cid_t cid)
+{
+    hmap_mux_streams_t_iter find_result = hmap_mux_streams_t_find(&(s->streams), cid);
+    if (find_result.ref == hmap_mux_streams_t_end(&(s->streams)).ref || find_result.ref->second->finished)
+    {
+        return NULL;
+    }
+    return find_result.ref->second;
+}
+
+void muxSchedulerCloseStream(mux_scheduler_t *s, mux_stream_t *stream, bool notify_peer)
+{
+    stream->userdata = NULL;
+
+    if (stream->recv_paused)
+    {
+        stream->recv_paused = false;
+        s->recv_paused_streams--;
+    }
+
+    if (! notify_peer || (! stream->open_sent && bufferStreamLen(stream->pending) == 0))
+    {
+        // the peer closed it, or it never heard of it
+        s->stream_bytes -= bufferStreamLen(stream->pending);
+        emptyBufferStream(stream->pending);
+        stream->finished = true;
+    }
+    else if (bufferStreamLen(stream->pending) == 0)
+    {
+        appendFrame(outBuffer(s), stream->cid, kMuxFlagClose, NULL, 0);
+        stream->finished = true;
+    }
+    else
+    {
+        stream->closing = true;
+    }
+    maybeFreeStream(s, stream);
+}
+
+bool muxSchedulerWrite(mux_scheduler_t *s, mux_stream_t *stream, shift_buffer_t *buf)
+{
+    s->stream_bytes += bufLen(buf);
+    bufferStreamPush(stream->pending, buf);
+    activateStream(s, stream);
+
+    if (! stream->producer_paused && bufferStreamLen(stream->pending) >= kMuxStreamPendingLimit)
+    {
+        stream->producer_paused = true;
+        return false;
+    }
+    return true;
+}
+
+bool muxSchedulerOnData(mux_scheduler_t *s, mux_stream_t *stream, uint32_t len)
+{
+    if (! s->flow_control)
+    {
+        return true;
+    }
+    stream->recv_window -= len;
+    if (stream->recv_window < 0)
+    {
+        return false;
+    }
+    stream->recv_unacked += len;
+    returnCredit(s, stream);
+    return true;
+}
+
+void muxSchedulerOnFlow(mux_scheduler_t *s, cid_t cid, uint32_t credit)
+{
+    mux_stream_t *stream = muxSchedulerFindStream(s, cid);
+    if (stream)
+    {
+        // back on the active list if it was waiting for window
+        s->stream_bytes -= uncreditedBytes(stream);
+        stream->send_window += credit;
+        s->stream_bytes += uncreditedBytes(stream);
+        activateStream(s, stream);
+    }
+}
+
+void muxSchedulerHello(mux_scheduler_t *s, uint8_t features)
+{
+    const mux_hello_t hello = {.version = kMuxVersion, .features = features};
+    appendFrame(outBuffer(s), 0, kMuxFlagHello, &hello, sizeof(hello));
+}
+
+void muxSchedulerPing(mux_scheduler_t *s)
+{
+    appendFrame(outBuffer(s), 0, kMuxFlagPing, NULL, 0);
+}
+
+uint64_t muxSchedulerBytesInFlight(mux_scheduler_t *s)
+{
+    uint64_t bytes = s->stream_bytes;
+    if (s->out)
+    {
+        bytes += bufLen(s->out);
+    }
+    if (s->held)
+    {
+        bytes += bufLen(s->held);
+    }
+    return bytes;
+}
+
+void muxSchedulerPauseRecv(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    if (! stream->recv_paused)
+    {
+        stream->recv_paused = true;
+        s->recv_paused_streams++;
+    }
+}
+
+void muxSchedulerResumeRecv(mux_scheduler_t *s, mux_stream_t *stream)
+{
+    if (stream->recv_paused)
+    {
+        stream->recv_paused = false;
+        s->recv_paused_streams--;
+    }
+    returnCredit(s, stream);
+}
+
+bool muxSchedulerRecvPaused(mux_scheduler_t *s)
+{
+    return ! s->flow_control && s->recv_paused_streams > 0;
+}
+
+static shift_buffer_t *takeOut(mux_scheduler_t *s)
+{
+    if (s->out == NULL || bufLen(s->out) == 0)
+    {
+        return NULL;
+    }
+    shift_buffer_t *out = s->out;
+    s->out              = NULL;
+    return out;
+}
+
+shift_buffer_t *muxSchedulerNextOutput(mux_scheduler_t *s)
+{
+    if (s->held)
+    {
+        shift_buffer_t *held = s->held;
+        s->held              = NULL;
+        return held;
+    }
+
+    while (s->active_head)
+    {
+        mux_stream_t *stream = s->active_head;
+
+        if (bufferStreamLen(stream->pending) == 0 || stream->send_window <= 0 || stream->finished)
+        {
+            popActive(s);
+            stream->active  = false;
+            stream->deficit = 0;
+            maybeFreeStream(s, stream);
+            continue;
+        }
+
+        if (stream->deficit == 0)
+        {
+            stream->deficit = kMuxQuantum;
+        }
+
+        int64_t budget = stream->deficit;
+        if (s->flow_control && budget > stream->send_window)
+        {
+            budget = stream->send_window;
+        }
+        if (budget > kMuxMaxFrameLength)
+        {
+            budget = kMuxMaxFrameLength;
+        }
+
+        // a frame never merges queued buffers, the front one is sent as it is or sliced
+        shift_buffer_t *payload = bufLen(bufferStreamFront(stream->pending)) <= budget
+                                      ? bufferStreamIdealRead(stream->pending)
+                                      : bufferStreamRead(stream->pending, (size_t) budget);
+        const uint32_t  len     = bufLen(payload);
+
+        stream->deficit -= len;
+        s->stream_bytes -= len;
+        if (s->flow_control)
+        {
+            s->stream_bytes -= uncreditedBytes(stream);
+            stream->send_window -= len;
+            s->stream_bytes += uncreditedBytes(stream);
+        }
+
+        if (! stream->open_sent)
+        {
+            stream->open_sent = true;
+            makeOpenFrame(payload, stream->cid);
+        }
+        else
+        {
+            makeDataFrame(payload, stream->cid);
+        }
+
+        queueWritable(s, stream);
+
+        if (bufferStreamLen(stream->pending) == 0 || stream->send_window <= 0)
+        {
+            popActive(s);
+            stream->active  = false;
+            stream->deficit = 0;
+            if (stream->closing && bufferStreamLen(stream->pending) == 0)
+            {
+                // behind the last payload, in the same buffer
+                appendFrame(payload, stream->cid, kMuxFlagClose, NULL, 0);
+                stream->finished = true;
+            }
+            maybeFreeStream(s, stream);
+        }
+        else if (stream->deficit == 0)
+        {
+            popActive(s);
+            stream->active = false;
+            activateStream(s, stream);
+        }
+
+        if (bufLen(payload) < kMuxCoalesceThreshold)
+        {
+            concatBuffer(outBuffer(s), payload);
+            reuseBuffer(s->pool, payload);
+            if (bufLen(s->out) >= kMuxCoalesceLimit)
+            {
+                return takeOut(s);
+            }
+            continue;
+        }
+
+        if (s->out != NULL && bufLen(s->out) > 0)
+        {
+            s->held = payload;
+            return takeOut(s);
+        }
+        return payload;
+    }
+
+    return takeOut(s);
+}
+
+mux_stream_t *muxSchedulerNextWritable(mux_scheduler_t *s)
+{
+    while (s->writable_head)
+    {
+        mux_stream_t *stream     = s->writable_head;
+        s->writable_head         = stream->next_writable;
+        stream->next_writable    = NULL;
+        stream->writable_queued  = false;
+
+        if (stream->userdata != NULL)
+        {
+            return stream;
+        }
+        maybeFreeStream(s, stream);
+    }
+    return NULL;
+}
+
+bool muxSchedulerIsIdle(mux_scheduler_t *s)
+{
+    return s->root.next == NULL && s->held == NULL && (s->out == NULL || bufLen(s->out) == 0);
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "mux_frame.h"
+#include "shiftbuffer.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Flow control and write scheduling of the children of a mux connection, used by MuxClient and MuxServer
+
+    every child has a send window that is refilled by the flow frames of the peer, payload that does not fit the
+    window (or that the parent line can not take yet) is queued on the child and the caller is told to pause the
+    producer, the child is reported as writable once its queue drained to the half
+
+    the parent line is fed by a deficit round robin over the children that have queued payload and window, a child
+    sends at most kMuxQuantum bytes per turn, so a bulk child delays an interactive one by one quantum at most
+
+    frames smaller than kMuxCoalesceThreshold (and all control frames) are merged into one parent buffer, larger
+    ones keep their own buffer, the frame header goes into the left space of the payload
+
+    on the receive side the window of a child is only returned to the peer while its consumer is not paused, a slow
+    child stops its own sender instead of pausing the parent line and every other child with it
+
+    all of that needs the flow frames, without flow control (the default wire format) the windows are not used and
+    a paused child can only be handled by pausing the parent line, muxSchedulerRecvPaused tells when to do that
+
+    there are no callbacks, the caller pulls parent buffers with muxSchedulerNextOutput and children to resume with
+    muxSchedulerNextWritable whenever it is able to write
+*/
+
+enum
+{
+    kMuxStreamWindow       = 1 << 18,
+    kMuxWindowUpdate       = kMuxStreamWindow / 4,
+    kMuxStreamPendingLimit = 1 << 17,
+    kMuxQuantum            = 1 << 14,
+    kMuxCoalesceThreshold  = 1 << 11,
+    kMuxCoalesceLimit      = 1 << 14
+};
+
+typedef struct mux_stream_s
+{
+    struct mux_stream_s *next, *prev; // all streams of the connection
+    struct mux_stream_s *next_active;
+    struct mux_stream_s *next_writable;
+    buffer_stream_t     *pending; // payload waiting for window or for its turn
+    void                *userdata;
+    int64_t              send_window;
+    int64_t              recv_window;  // bytes the peer may still send before we return credit
+    uint32_t             recv_unacked; // received bytes not returned to the peer yet
+    uint32_t             deficit;
+    cid_t                cid;
+    bool                 open_sent; // the first frame of a locally opened child is an open frame
+    bool                 active;
+    bool                 writable_queued;
+    bool                 producer_paused;
+    bool                 recv_paused;
+    bool                 closing;  // the owner is gone, a close frame follows the queued payload
+    bool                 finished; // nothing left to send, freed once it leaves the lists
+
+} mux_stream_t;
+
+typedef struct mux_scheduler_s mux_scheduler_t;
+
+mux_scheduler_t *newMuxScheduler(buffer_pool_t *pool);
+void             destroyMuxScheduler(mux_scheduler_t *s);
+
+// only before the first stream is added, once the peer agreed to it
+void muxSchedulerEnableFlowControl(mux_scheduler_t *s);
+
+// queues a hello frame, it goes out with the next merged buffer
+void muxSchedulerHello(mux_scheduler_t *s, uint8_t features);
+
+// opened_by_peer streams never send an open frame
+mux_stream_t *muxSchedulerAddStream(mux_scheduler_t *s, cid_t cid, void *userdata, bool opened_by_peer);
+
+// the stream that carries cid, NULL if there is none or it is finished, its userdata is NULL once the owner closed it
+mux_stream_t *muxSchedulerFindStream(mux_scheduler_t *s, cid_t cid);
+
+// the owner is done with the stream, it must not be used after this call
+void muxSchedulerCloseStream(mux_scheduler_t *s, mux_stream_t *stream, bool notify_peer);
+
+// takes the buffer, returns false when the producer should pause
+bool muxSchedulerWrite(mux_scheduler_t *s, mux_stream_t *stream, shift_buffer_t *buf);
+
+// returns false when the peer sent more than the window it was given
+bool muxSchedulerOnData(mux_scheduler_t *s, mux_stream_t *stream, uint32_t len);
+void muxSchedulerOnFlow(mux_scheduler_t *s, cid_t cid, uint32_t credit);
+
+// queues a ping frame, it goes out with the next merged buffer
+void muxSchedulerPing(mux_scheduler_t *s);
+
+// bytes sent but not credited by the peer yet, plus the bytes queued for sending, a running count (constant time)
+uint64_t muxSchedulerBytesInFlight(mux_scheduler_t *s);
+
+void muxSchedulerPauseRecv(mux_scheduler_t *s, mux_stream_t *stream);
+void muxSchedulerResumeRecv(mux_scheduler_t *s, mux_stream_t *stream);
+
+// without flow control, true while any stream has its receive side paused, the caller pauses the parent line then
+bool muxSchedulerRecvPaused(mux_scheduler_t *s);
+
+shift_buffer_t *muxSchedulerNextOutput(mux_scheduler_t *s);
+mux_stream_t   *muxSchedulerNextWritable(mux_scheduler_t *s);
+
+// no stream is left and everything was taken, closed children may still have payload queued before that
+bool muxSchedulerIsIdle(mux_scheduler_t *s);
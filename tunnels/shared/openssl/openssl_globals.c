@@ -1,14 +1,24 @@
 #include "openssl_globals.h"
+#include "basic_types.h"
 #include "cacert.h"
+#include "hmutex.h"
 #include "loggers/network_logger.h"
+#include "utils/hashutils.h"
 #include "ww.h"
 #include <assert.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
-
-
+#include <time.h>
+#if OPENSSL_VERSION_MAJOR >= 3
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 static int                        openssl_lib_initialized = false;
 static struct dedicated_memory_s *openssl_dedicated_memory_manager;
@@ -173,6 +183,456 @@ error:
     return NULL;
 }
 
+/*
+    Resumption state of one node, shared by the contexts of its workers through the ex data of each SSL_CTX
+*/
+
+enum
+{
+    kSessionStoreShards    = 16,
+    kSessionStoreBuckets   = 256,
+    kSessionStoreWays      = 4,
+    kSessionIdContextLen   = 32,
+    kClientSessionBuckets  = 64,
+    kClientSessionsPerDest = 4
+};
+
+typedef struct ssl_ticket_key_s
+{
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    time_t        created;
+
+} ssl_ticket_key_t;
+
+typedef struct stored_session_s
+{
+    unsigned char  id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    unsigned int   id_len;
+    time_t         expire;
+    unsigned char *der;
+    int            der_len;
+
+} stored_session_t;
+
+typedef struct session_shard_s
+{
+    hhybridmutex_t   mutex;
+    stored_session_t buckets[kSessionStoreBuckets][kSessionStoreWays];
+
+} ATTR_ALIGNED_LINE_CACHE session_shard_t;
+
+struct ssl_server_resumption_s
+{
+    hhybridmutex_t   ticket_mutex;
+    ssl_ticket_key_t current_key;
+    ssl_ticket_key_t previous_key;
+    bool             has_previous_key;
+    unsigned char    session_id_context[kSessionIdContextLen];
+    session_shard_t *store;
+};
+
+typedef struct client_session_slot_s
+{
+    hash_t       destination;
+    SSL_SESSION *sessions[kClientSessionsPerDest];
+    unsigned int count;
+
+} client_session_slot_t;
+
+struct ssl_client_session_cache_s
+{
+    hhybridmutex_t        mutex;
+    client_session_slot_t slots[kClientSessionBuckets];
+};
+
+static int resumption_ex_index = -1;
+
+static void setCtxResumptionData(SSL_CTX *ctx, void *data)
+{
+    if (resumption_ex_index < 0)
+    {
+        // nodes are created on the main thread
+        resumption_ex_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+        if (resumption_ex_index < 0)
+        {
+            printSSLErrorAndAbort();
+        }
+    }
+    SSL_CTX_set_ex_data(ctx, resumption_ex_index, data);
+}
+
+static void *getSslResumptionData(const SSL *ssl)
+{
+    return SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), resumption_ex_index);
+}
+
+/*
+    Ticket keys
+*/
+
+static void generateTicketKey(ssl_ticket_key_t *key)
+{
+    if (RAND_bytes(key->name, sizeof(key->name)) != 1 || RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1 ||
+        RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1)
+    {
+        printSSLErrorAndAbort();
+    }
+    key->created = time(NULL);
+}
+
+// copies the key that new tickets are encrypted with, rotates it when it is too old
+static void getCurrentTicketKey(ssl_server_resumption_t *res, ssl_ticket_key_t *out)
+{
+    hhybridmutex_lock(&(res->ticket_mutex));
+    if (time(NULL) - res->current_key.created >= kSslTicketKeyLifetime)
+    {
+        res->previous_key     = res->current_key;
+        res->has_previous_key = true;
+        generateTicketKey(&(res->current_key));
+    }
+    *out = res->current_key;
+    hhybridmutex_unlock(&(res->ticket_mutex));
+}
+
+// 1: found the current key, 2: found the previous key (ticket should be renewed), 0: unknown or expired
+static int findTicketKey(ssl_server_resumption_t *res, const unsigned char name[16], ssl_ticket_key_t *out)
+{
+    int result = 0;
+    hhybridmutex_lock(&(res->ticket_mutex));
+    if (CRYPTO_memcmp(name, res->current_key.name, sizeof(res->current_key.name)) == 0)
+    {
+        *out   = res->current_key;
+        result = 1;
+    }
+    else if (res->has_previous_key &&
+             CRYPTO_memcmp(name, res->previous_key.name, sizeof(res->previous_key.name)) == 0 &&
+             time(NULL) - res->previous_key.created < 2 * kSslTicketKeyLifetime)
+    {
+        *out   = res->previous_key;
+        result = 2;
+    }
+    hhybridmutex_unlock(&(res->ticket_mutex));
+    return result;
+}
+
+#if OPENSSL_VERSION_MAJOR >= 3
+
+static bool setTicketHmacKey(EVP_MAC_CTX *hctx, unsigned char *hmac_key)
+{
+    char       digest[] = "sha256";
+    OSSL_PARAM params[] = {OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, hmac_key, 32),
+                           OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+                           OSSL_PARAM_construct_end()};
+    return EVP_MAC_CTX_set_params(hctx, params) == 1;
+}
+
+static int onTicketKey(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cctx,
+                       EVP_MAC_CTX *hctx, int enc)
+#else
+
+static bool setTicketHmacKey(HMAC_CTX *hctx, unsigned char *hmac_key)
+{
+    return HMAC_Init_ex(hctx, hmac_key, 32, EVP_sha256(), NULL) == 1;
+}
+
+static int onTicketKey(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cctx,
+                       HMAC_CTX *hctx, int enc)
+#endif
+{
+    ssl_server_resumption_t *res = getSslResumptionData(ssl);
+    ssl_ticket_key_t         key;
+    int                      result = 1;
+
+    if (enc)
+    {
+        getCurrentTicketKey(res, &key);
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+        {
+            result = -1;
+            goto done;
+        }
+        memcpy(key_name, key.name, sizeof(key.name));
+        if (EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1 ||
+            ! setTicketHmacKey(hctx, key.hmac_key))
+        {
+            result = -1;
+        }
+        goto done;
+    }
+
+    result = findTicketKey(res, key_name, &key);
+    if (result == 0)
+    {
+        // unknown key, a full handshake is done
+        goto done;
+    }
+    if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1 ||
+        ! setTicketHmacKey(hctx, key.hmac_key))
+    {
+        result = -1;
+    }
+
+done:
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
+
+/*
+    Server session store, for clients that do not use tickets
+*/
+
+static stored_session_t *lockSessionBucket(ssl_server_resumption_t *res, const unsigned char *id,
+                                           unsigned int id_len, session_shard_t **shard_out)
+{
+    hash_t           h     = CALC_HASH_BYTES(id, id_len);
+    session_shard_t *shard = &(res->store[h % kSessionStoreShards]);
+    hhybridmutex_lock(&(shard->mutex));
+    *shard_out = shard;
+    return shard->buckets[(h / kSessionStoreShards) % kSessionStoreBuckets];
+}
+
+static void clearStoredSession(stored_session_t *slot)
+{
+    if (slot->der != NULL)
+    {
+        globalFree(slot->der);
+    }
+    memset(slot, 0, sizeof(*slot));
+}
+
+static int onServerNewSession(SSL *ssl, SSL_SESSION *sess)
+{
+    unsigned int         id_len;
+    const unsigned char *id      = SSL_SESSION_get_id(sess, &id_len);
+    int                  der_len = i2d_SSL_SESSION(sess, NULL);
+    if (id_len == 0 || der_len <= 0)
+    {
+        return 0;
+    }
+
+    unsigned char *der = globalMalloc(der_len);
+    unsigned char *p   = der;
+    i2d_SSL_SESSION(sess, &p);
+
+    session_shard_t  *shard;
+    stored_session_t *bucket = lockSessionBucket(getSslResumptionData(ssl), id, id_len, &shard);
+
+    // take a free or expired way, otherwise the one that expires first
+    stored_session_t *victim = &bucket[0];
+    const time_t      now    = time(NULL);
+    for (int i = 0; i < kSessionStoreWays; i++)
+    {
+        if (bucket[i].der == NULL || bucket[i].expire <= now)
+        {
+            victim = &bucket[i];
+            break;
+        }
+        if (bucket[i].expire < victim->expire)
+        {
+            victim = &bucket[i];
+        }
+    }
+    clearStoredSession(victim);
+    memcpy(victim->id, id, id_len);
+    victim->id_len  = id_len;
+    victim->expire  = now + (time_t) SSL_SESSION_get_timeout(sess);
+    victim->der     = der;
+    victim->der_len = der_len;
+
+    hhybridmutex_unlock(&(shard->mutex));
+
+    // we did not keep a reference to sess
+    return 0;
+}
+
+static SSL_SESSION *onServerGetSession(SSL *ssl, const unsigned char *id, int id_len, int *copy)
+{
+    *copy = 0;
+    if (id_len <= 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    {
+        return NULL;
+    }
+
+    SSL_SESSION      *sess = NULL;
+    session_shard_t  *shard;
+    stored_session_t *bucket = lockSessionBucket(getSslResumptionData(ssl), id, (unsigned int) id_len, &shard);
+
+    for (int i = 0; i < kSessionStoreWays; i++)
+    {
+        if (bucket[i].der != NULL && bucket[i].id_len == (unsigned int) id_len &&
+            memcmp(bucket[i].id, id, id_len) == 0)
+        {
+            if (bucket[i].expire > time(NULL))
+            {
+                const unsigned char *p = bucket[i].der;
+                sess                   = d2i_SSL_SESSION(NULL, &p, bucket[i].der_len);
+            }
+            else
+            {
+                clearStoredSession(&bucket[i]);
+            }
+            break;
+        }
+    }
+    hhybridmutex_unlock(&(shard->mutex));
+    return sess;
+}
+
+static void onServerRemoveSession(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+    unsigned int         id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    if (id_len == 0)
+    {
+        return;
+    }
+    session_shard_t  *shard;
+    stored_session_t *bucket =
+        lockSessionBucket(SSL_CTX_get_ex_data(ctx, resumption_ex_index), id, id_len, &shard);
+    for (int i = 0; i < kSessionStoreWays; i++)
+    {
+        if (bucket[i].der != NULL && bucket[i].id_len == id_len && memcmp(bucket[i].id, id, id_len) == 0)
+        {
+            clearStoredSession(&bucket[i]);
+            break;
+        }
+    }
+    hhybridmutex_unlock(&(shard->mutex));
+}
+
+ssl_server_resumption_t *newSslServerResumption(void)
+{
+    ssl_server_resumption_t *res = globalMalloc(sizeof(ssl_server_resumption_t));
+    memset(res, 0, sizeof(ssl_server_resumption_t));
+    hhybridmutex_init(&(res->ticket_mutex));
+    generateTicketKey(&(res->current_key));
+
+    // random per node, a session of one server node is never accepted by another one
+    if (RAND_bytes(res->session_id_context, sizeof(res->session_id_context)) != 1)
+    {
+        printSSLErrorAndAbort();
+    }
+
+    res->store = globalMallocAligned(kCpuLineCacheSize, sizeof(session_shard_t) * kSessionStoreShards);
+    memset(res->store, 0, sizeof(session_shard_t) * kSessionStoreShards);
+    for (int i = 0; i < kSessionStoreShards; i++)
+    {
+        hhybridmutex_init(&(res->store[i].mutex));
+    }
+    return res;
+}
+
+void sslCtxEnableServerSessionResumption(ssl_ctx_t ctx, ssl_server_resumption_t *res)
+{
+    setCtxResumptionData(ctx, res);
+
+    // the same id context on every worker of the node is what lets a session move between workers
+    SSL_CTX_set_session_id_context(ctx, res->session_id_context, sizeof(res->session_id_context));
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, onServerNewSession);
+    SSL_CTX_sess_set_get_cb(ctx, onServerGetSession);
+    SSL_CTX_sess_set_remove_cb(ctx, onServerRemoveSession);
+
+#if OPENSSL_VERSION_MAJOR >= 3
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, onTicketKey);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, onTicketKey);
+#endif
+}
+
+/*
+    Client session cache
+*/
+
+// a session made without peer verification must never be offered by a connection that verifies
+static hash_t clientSessionKey(const SSL *ssl, const char *destination)
+{
+    return CALC_HASH_BYTES_WITH_SEED(destination, strlen(destination), (uint64_t) SSL_get_verify_mode(ssl));
+}
+
+static int onClientNewSession(SSL *ssl, SSL_SESSION *sess)
+{
+    const char *destination = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (destination == NULL || ! SSL_SESSION_is_resumable(sess))
+    {
+        return 0;
+    }
+    ssl_client_session_cache_t *cache = getSslResumptionData(ssl);
+    hash_t                      h     = clientSessionKey(ssl, destination);
+    client_session_slot_t      *slot  = &(cache->slots[h % kClientSessionBuckets]);
+
+    hhybridmutex_lock(&(cache->mutex));
+    if (slot->destination != h)
+    {
+        for (unsigned int i = 0; i < slot->count; i++)
+        {
+            SSL_SESSION_free(slot->sessions[i]);
+        }
+        slot->count       = 0;
+        slot->destination = h;
+    }
+    if (slot->count == kClientSessionsPerDest)
+    {
+        SSL_SESSION_free(slot->sessions[0]);
+        memmove(&(slot->sessions[0]), &(slot->sessions[1]), sizeof(SSL_SESSION *) * (kClientSessionsPerDest - 1));
+        slot->count -= 1;
+    }
+    slot->sessions[slot->count++] = sess;
+    hhybridmutex_unlock(&(cache->mutex));
+
+    // the reference is kept by the cache
+    return 1;
+}
+
+ssl_client_session_cache_t *newSslClientSessionCache(void)
+{
+    ssl_client_session_cache_t *cache = globalMalloc(sizeof(ssl_client_session_cache_t));
+    memset(cache, 0, sizeof(ssl_client_session_cache_t));
+    hhybridmutex_init(&(cache->mutex));
+    return cache;
+}
+
+void sslCtxEnableClientSessionCache(ssl_ctx_t ctx, ssl_client_session_cache_t *cache)
+{
+    setCtxResumptionData(ctx, cache);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, onClientNewSession);
+}
+
+bool sslResumeCachedSession(SSL *ssl, const char *destination)
+{
+    ssl_client_session_cache_t *cache = getSslResumptionData(ssl);
+    hash_t                      h     = clientSessionKey(ssl, destination);
+    client_session_slot_t      *slot  = &(cache->slots[h % kClientSessionBuckets]);
+    SSL_SESSION                *sess  = NULL;
+
+    hhybridmutex_lock(&(cache->mutex));
+    if (slot->destination == h && slot->count > 0)
+    {
+        sess = slot->sessions[slot->count - 1];
+        // tls 1.3 tickets are meant to be used once, older sessions can be reused
+        if (SSL_SESSION_get_protocol_version(sess) >= TLS1_3_VERSION)
+        {
+            slot->count -= 1;
+        }
+        else
+        {
+            SSL_SESSION_up_ref(sess);
+        }
+    }
+    hhybridmutex_unlock(&(cache->mutex));
+
+    if (sess == NULL)
+    {
+        return false;
+    }
+    bool result = SSL_set_session(ssl, sess) == 1;
+    SSL_SESSION_free(sess);
+    return result;
+}
+
 void printSSLState(const SSL *ssl) // NOLINT (ssl in unused problem)
 {
     const char *current_state = SSL_state_string_long(ssl);
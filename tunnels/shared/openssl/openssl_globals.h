@@ -35,4 +35,30 @@ void printSSLState(const SSL *ssl);
 // if you get compile error at this function , include the propper logger before this file
 void printSSLError(void);
 
+/*
+    Session resumption, each node creates its own state and shares it between the contexts of its workers
+
+    server: tls 1.3 / 1.2 tickets are encrypted with keys of the node that rotate every kSslTicketKeyLifetime
+    seconds (the previous key is still accepted and its tickets are renewed), stateful sessions go to a bounded
+    store that is sharded by session id, the session id context is random per node
+
+    client: new sessions are kept per destination (the sni) and verify mode, a new connection to the same
+    destination takes one
+*/
+enum
+{
+    kSslTicketKeyLifetime = 12 * 60 * 60
+};
+
+typedef struct ssl_server_resumption_s    ssl_server_resumption_t;
+typedef struct ssl_client_session_cache_s ssl_client_session_cache_t;
+
+ssl_server_resumption_t    *newSslServerResumption(void);
+ssl_client_session_cache_t *newSslClientSessionCache(void);
+
+void sslCtxEnableServerSessionResumption(ssl_ctx_t ctx, ssl_server_resumption_t *res);
+void sslCtxEnableClientSessionCache(ssl_ctx_t ctx, ssl_client_session_cache_t *cache);
+// ssl must come from a context that sslCtxEnableClientSessionCache was called on
+bool sslResumeCachedSession(SSL *ssl, const char *destination);
+
 _Noreturn void printSSLErrorAndAbort(void);
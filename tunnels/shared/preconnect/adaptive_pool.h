@@ -0,0 +1,146 @@
+#pragma once
+#include "utils/mathutils.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    Sizes the warm (pre connected) connection pool of one worker
+
+    the arrival rate of new lines and the time an upstream connection needs to become ready are tracked as ewma,
+    their product is the number of connections that get consumed while a replacement is being made (little's law)
+
+    that estimate is scaled by a headroom factor which grows quickly while the hit ratio is below the target and
+    shrinks slowly while it is above, the result is clamped to [min_size, max_size]
+
+    only the owner worker touches it, so there is no locking
+*/
+
+#define ADAPTIVE_POOL_EWMA_ALPHA    0.125
+#define ADAPTIVE_POOL_HEADROOM_UP   1.25
+#define ADAPTIVE_POOL_HEADROOM_DOWN 0.99
+#define ADAPTIVE_POOL_HEADROOM_MAX  8.0
+
+typedef struct adaptive_pool_s
+{
+    unsigned int min_size;
+    unsigned int max_size;
+    double       target_hit_ratio;
+    bool         enabled;
+
+    double   arrival_rate; // lines per second
+    double   handshake_ms;
+    double   hit_ratio;
+    double   headroom;
+    uint64_t last_arrival_ms;
+    unsigned int target;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t handshakes;
+
+} adaptive_pool_t;
+
+static inline void adaptivePoolInit(adaptive_pool_t *ap, unsigned int min_size, unsigned int max_size,
+                                    unsigned int target_hit_percent, bool enabled)
+{
+    *ap = (adaptive_pool_t){.min_size         = min_size,
+                            .max_size         = max(min_size, max_size),
+                            .target_hit_ratio = (double) min(target_hit_percent, 100U) / 100.0,
+                            .enabled          = enabled,
+                            .hit_ratio        = 1.0,
+                            .headroom         = 1.0,
+                            .target           = min_size};
+}
+
+static inline void adaptivePoolUpdateTarget(adaptive_pool_t *ap, uint64_t now_ms)
+{
+    if (! ap->enabled)
+    {
+        ap->target = ap->min_size;
+        return;
+    }
+
+    double rate = ap->arrival_rate;
+
+    // a quiet period must lower the estimate even though there is no arrival to update the ewma
+    if (ap->last_arrival_ms != 0 && now_ms > ap->last_arrival_ms)
+    {
+        rate = min(rate, 1000.0 / (double) (now_ms - ap->last_arrival_ms));
+    }
+
+    const double wanted = ceil(rate * (ap->handshake_ms / 1000.0) * ap->headroom);
+
+    if (wanted <= (double) ap->min_size)
+    {
+        ap->target = ap->min_size;
+    }
+    else if (wanted >= (double) ap->max_size)
+    {
+        ap->target = ap->max_size;
+    }
+    else
+    {
+        ap->target = (unsigned int) wanted;
+    }
+}
+
+// a line arrived, hit means it was served from the warm pool
+static inline void adaptivePoolOnArrival(adaptive_pool_t *ap, bool hit, uint64_t now_ms)
+{
+    if (ap->last_arrival_ms != 0)
+    {
+        const uint64_t gap = now_ms > ap->last_arrival_ms ? now_ms - ap->last_arrival_ms : 1;
+        ap->arrival_rate += ((1000.0 / (double) gap) - ap->arrival_rate) * ADAPTIVE_POOL_EWMA_ALPHA;
+    }
+    ap->last_arrival_ms = now_ms;
+
+    if (hit)
+    {
+        ap->hits += 1;
+    }
+    else
+    {
+        ap->misses += 1;
+    }
+    ap->hit_ratio += ((hit ? 1.0 : 0.0) - ap->hit_ratio) * ADAPTIVE_POOL_EWMA_ALPHA;
+
+    if (ap->hit_ratio < ap->target_hit_ratio)
+    {
+        if (! hit)
+        {
+            ap->headroom = min(ap->headroom * ADAPTIVE_POOL_HEADROOM_UP, ADAPTIVE_POOL_HEADROOM_MAX);
+        }
+    }
+    else
+    {
+        ap->headroom = max(ap->headroom * ADAPTIVE_POOL_HEADROOM_DOWN, 1.0);
+    }
+
+    adaptivePoolUpdateTarget(ap, now_ms);
+}
+
+// an upstream connection became ready after elapsed_ms
+static inline void adaptivePoolOnHandshake(adaptive_pool_t *ap, uint64_t elapsed_ms, uint64_t now_ms)
+{
+    ap->handshakes += 1;
+    if (ap->handshakes == 1)
+    {
+        ap->handshake_ms = (double) elapsed_ms;
+    }
+    else
+    {
+        ap->handshake_ms += ((double) elapsed_ms - ap->handshake_ms) * ADAPTIVE_POOL_EWMA_ALPHA;
+    }
+    adaptivePoolUpdateTarget(ap, now_ms);
+}
+
+static inline int adaptivePoolPrintStats(const adaptive_pool_t *ap, char *buf, size_t len, unsigned int tid,
+                                         unsigned int idle)
+{
+    return snprintf(buf, len,
+                    "worker %u: idle %u target %u (min %u max %u) rate %.2f/s handshake %.1fms hit-ratio %.3f "
+                    "hits %llu misses %llu\n",
+                    tid, idle, ap->target, ap->min_size, ap->max_size, ap->arrival_rate, ap->handshake_ms,
+                    ap->hit_ratio, (unsigned long long) ap->hits, (unsigned long long) ap->misses);
+}
@@ -1,10 +1,15 @@
 #pragma once
 #include "buffer_pool.h"
+#include "buffer_stream.h"
 #include "frand.h"
 #include "openssl_globals.h" /* These helpers depened on openssl */
 #include "shiftbuffer.h"
+#include "utils/mathutils.h"
 #include <assert.h>
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
+#include <openssl/params.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -22,143 +27,302 @@ enum reality_consts
     kTLSHeaderlen         = 1 + 2 + 2,
 };
 
-static bool verifyMessage(shift_buffer_t *buf, EVP_MD *msg_digest, EVP_MD_CTX *sign_context, EVP_PKEY *sign_key)
+/*
+    Record layout after the tls header: hmac-sha256 tag, iv, aes-128-cbc ciphertext (pkcs#7 padded),
+    the tag covers iv and ciphertext
+
+    key material is set up once per worker: the hmac context keeps its key and every record only re-initialises
+    it, the cipher contexts keep their aes key schedule and a record only sets its iv
+
+    a record is processed in one pass, each block range is encrypted (or authenticated) and then fed to the other
+    primitive while it is still in cache, both directions work in place in the record buffer
+*/
+
+enum
 {
-    if (bufLen(buf) < kSignLen)
-    {
-        return false;
-    }
-    int     rc = EVP_DigestSignInit(sign_context, NULL, msg_digest, NULL, sign_key);
-    uint8_t expect[EVP_MAX_MD_SIZE];
-    memcpy(expect, rawBuf(buf), kSignLen);
-    shiftr(buf, kSignLen);
-    if (rc != 1)
+    kRealityCryptoStep = 4096 // must stay a multiple of kEncryptionBlockSize
+};
+
+typedef struct reality_crypto_s
+{
+    EVP_MAC_CTX    *hmac;
+    EVP_CIPHER_CTX *encryption;
+    EVP_CIPHER_CTX *decryption;
+
+} reality_crypto_t;
+
+static inline void realityCryptoInit(reality_crypto_t *rc, const uint8_t *mac_key, const char *password)
+{
+    EVP_MAC *mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (mac == NULL)
     {
         printSSLErrorAndAbort();
     }
-    rc = EVP_DigestSignUpdate(sign_context, rawBuf(buf), bufLen(buf));
-    if (rc != 1)
+    rc->hmac = EVP_MAC_CTX_new(mac);
+    EVP_MAC_free(mac);
+
+    OSSL_PARAM params[] = {OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *) "SHA256", 0),
+                           OSSL_PARAM_construct_end()};
+    if (rc->hmac == NULL || 1 != EVP_MAC_init(rc->hmac, mac_key, kSignLen, params))
     {
         printSSLErrorAndAbort();
     }
-    uint8_t buff[EVP_MAX_MD_SIZE];
-    size_t  size = sizeof(buff);
-    rc           = EVP_DigestSignFinal(sign_context, buff, &size);
-    if (rc != 1)
+
+    EVP_CIPHER *cipher = EVP_CIPHER_fetch(NULL, "AES-128-CBC", NULL);
+    rc->encryption     = EVP_CIPHER_CTX_new();
+    rc->decryption     = EVP_CIPHER_CTX_new();
+    if (cipher == NULL ||
+        1 != EVP_EncryptInit_ex2(rc->encryption, cipher, (const uint8_t *) password, NULL, NULL) ||
+        1 != EVP_DecryptInit_ex2(rc->decryption, cipher, (const uint8_t *) password, NULL, NULL))
     {
         printSSLErrorAndAbort();
     }
-    assert(size == kSignLen);
+    EVP_CIPHER_free(cipher);
 
-    return 0 == CRYPTO_memcmp(expect, buff, size);
+    // padding is done by hand, so the last block is written in place like every other block
+    EVP_CIPHER_CTX_set_padding(rc->encryption, 0);
+    EVP_CIPHER_CTX_set_padding(rc->decryption, 0);
 }
 
-static void signMessage(shift_buffer_t *buf, EVP_MD *msg_digest, EVP_MD_CTX *sign_context, EVP_PKEY *sign_key)
+static inline void realityCipherUpdate(EVP_CIPHER_CTX *ctx, uint8_t *out, const uint8_t *in, int len)
 {
-    int rc = EVP_DigestSignInit(sign_context, NULL, msg_digest, NULL, sign_key);
-    if (rc != 1)
+    int out_len = 0;
+    if (1 != EVP_CipherUpdate(ctx, out, &out_len, in, len))
     {
         printSSLErrorAndAbort();
     }
-    rc = EVP_DigestSignUpdate(sign_context, rawBuf(buf), bufLen(buf));
-    if (rc != 1)
+    assert(out_len == len);
+}
+
+static inline void realityMacUpdate(reality_crypto_t *rc, const uint8_t *data, size_t len)
+{
+    if (1 != EVP_MAC_update(rc->hmac, data, len))
     {
         printSSLErrorAndAbort();
     }
-    size_t req = 0;
-    rc         = EVP_DigestSignFinal(sign_context, NULL, &req);
-    if (rc != 1)
+}
+
+static inline void realityMacFinal(reality_crypto_t *rc, uint8_t tag[kSignLen])
+{
+    size_t tag_len = 0;
+    if (1 != EVP_MAC_final(rc->hmac, tag, &tag_len, kSignLen))
     {
         printSSLErrorAndAbort();
     }
-    shiftl(buf, req);
-    size_t slen = req;
-    rc          = EVP_DigestSignFinal(sign_context, rawBufMut(buf), &slen);
-    if (rc != 1)
+    assert(tag_len == kSignLen);
+}
+
+static inline void realityMacInit(reality_crypto_t *rc)
+{
+    // no key means the key given at setup is reused
+    if (1 != EVP_MAC_init(rc->hmac, NULL, 0, NULL))
     {
         printSSLErrorAndAbort();
     }
-    assert((req == slen) && (req == kSignLen));
 }
 
-static shift_buffer_t *genericDecrypt(shift_buffer_t *in, EVP_CIPHER_CTX *decryption_context, char *password,
-                                      buffer_pool_t *pool)
+// encrypts and signs the payload, the result is "tag iv ciphertext", in place when the buffer has room
+static inline shift_buffer_t *realitySeal(reality_crypto_t *rc, shift_buffer_t *in, buffer_pool_t *pool)
 {
-    shift_buffer_t *out = popBuffer(pool);
+    const unsigned int len      = bufLen(in);
+    const unsigned int tail_len = len % kEncryptionBlockSize;
+    const unsigned int body_len = len - tail_len;
+    const uint8_t      pad      = (uint8_t) (kEncryptionBlockSize - tail_len);
 
-    EVP_DecryptInit_ex(decryption_context, EVP_aes_128_cbc(), NULL, (const uint8_t *) password,
-                       (const uint8_t *) rawBuf(in));
-    shiftr(in, kIVlen);
-    uint16_t input_length = bufLen(in);
-    reserveBufSpace(out, input_length);
-    int out_len = 0;
+    shift_buffer_t *out = in;
+    if (isShallow(in) || rCap(in) < len + pad)
+    {
+        // a slice of a larger payload has no room for the padding, it is encrypted into a new buffer in the same pass
+        out = popBuffer(pool);
+    }
+    setLen(out, len + pad);
 
-    /*
-     * Provide the message to be decrypted, and obtain the plaintext output.
-     * EVP_DecryptUpdate can be called multiple times if necessary.
-     */
-    if (1 != EVP_DecryptUpdate(decryption_context, rawBufMut(out), &out_len, rawBuf(in), input_length))
+    uint32_t iv[kIVlen / sizeof(uint32_t)]; // uint32_t because we need 32 mem alignment
+    for (int i = 0; i < (int) (kIVlen / sizeof(uint32_t)); i++)
     {
-        printSSLErrorAndAbort();
+        iv[i] = fastRand32();
     }
-    setLen(out, out_len);
 
-    /*
-     * Finalise the decryption. Further plaintext bytes may be written at
-     * this stage.
-     */
-    if (1 != EVP_DecryptFinal_ex(decryption_context, rawBufMut(out) + out_len, &out_len))
+    if (1 != EVP_EncryptInit_ex2(rc->encryption, NULL, NULL, (const uint8_t *) iv, NULL))
     {
         printSSLErrorAndAbort();
     }
-    reuseBuffer(pool, in);
+    realityMacInit(rc);
+    realityMacUpdate(rc, (const uint8_t *) iv, kIVlen);
 
-    setLen(out, bufLen(out) + out_len);
+    const uint8_t *src = rawBuf(in);
+    uint8_t       *dst = rawBufMut(out);
+    for (unsigned int pos = 0; pos < body_len; pos += kRealityCryptoStep)
+    {
+        const int step = (int) min(body_len - pos, (unsigned int) kRealityCryptoStep);
+        realityCipherUpdate(rc->encryption, dst + pos, src + pos, step);
+        realityMacUpdate(rc, dst + pos, step);
+    }
+
+    uint8_t last[kEncryptionBlockSize];
+    memcpy(last, src + body_len, tail_len);
+    memset(last + tail_len, pad, pad);
+    realityCipherUpdate(rc->encryption, dst + body_len, last, kEncryptionBlockSize);
+    realityMacUpdate(rc, dst + body_len, kEncryptionBlockSize);
+
+    if (out != in)
+    {
+        reuseBuffer(pool, in);
+    }
+
+    shiftl(out, kIVlen);
+    memcpy(rawBufMut(out), iv, kIVlen);
+    shiftl(out, kSignLen);
+    realityMacFinal(rc, rawBufMut(out));
     return out;
 }
-static shift_buffer_t *genericEncrypt(shift_buffer_t *in, EVP_CIPHER_CTX *encryption_context, char *password,
-                                      buffer_pool_t *pool)
+
+// checks the tag of a record body (tag iv ciphertext) without touching it
+static inline bool realityVerify(reality_crypto_t *rc, const uint8_t *body, size_t len)
 {
-    shift_buffer_t *out          = popBuffer(pool);
-    int             input_length = (int) bufLen(in);
+    if (len < kSignLen + kIVlen)
+    {
+        return false;
+    }
+    uint8_t tag[kSignLen];
+    realityMacInit(rc);
+    realityMacUpdate(rc, body + kSignLen, len - kSignLen);
+    realityMacFinal(rc, tag);
+    return 0 == CRYPTO_memcmp(tag, body, kSignLen);
+}
 
-    uint32_t iv[kIVlen / sizeof(uint32_t)]; // uint32_t because we need 32 mem alignment
+// verifies and decrypts a record body in place, the plaintext is left right after the iv
+static inline bool realityOpen(reality_crypto_t *rc, uint8_t *body, size_t len, size_t *plain_len)
+{
+    if (len < kSignLen + kIVlen + kEncryptionBlockSize || (len - kSignLen - kIVlen) % kEncryptionBlockSize != 0)
+    {
+        return false;
+    }
+    const uint8_t *iv       = body + kSignLen;
+    uint8_t       *data     = body + kSignLen + kIVlen;
+    const size_t   data_len = len - kSignLen - kIVlen;
 
-    for (int i = 0; i < (int) (kIVlen / sizeof(uint32_t)); i++)
+    if (1 != EVP_DecryptInit_ex2(rc->decryption, NULL, NULL, iv, NULL))
     {
-        ((uint32_t *) iv)[i] = fastRand32();
+        printSSLErrorAndAbort();
     }
+    realityMacInit(rc);
+    realityMacUpdate(rc, iv, kIVlen);
 
-    EVP_EncryptInit_ex(encryption_context, EVP_aes_128_cbc(), NULL, (const uint8_t *) password, (const uint8_t *) iv);
+    for (size_t pos = 0; pos < data_len; pos += kRealityCryptoStep)
+    {
+        const int step = (int) min(data_len - pos, (size_t) kRealityCryptoStep);
+        realityMacUpdate(rc, data + pos, step);
+        realityCipherUpdate(rc->decryption, data + pos, data + pos, step);
+    }
 
-    reserveBufSpace(out, input_length + kEncryptionBlockSize + (input_length % kEncryptionBlockSize));
-    int out_len = 0;
+    uint8_t tag[kSignLen];
+    realityMacFinal(rc, tag);
+    if (0 != CRYPTO_memcmp(tag, body, kSignLen))
+    {
+        return false;
+    }
 
-    /*
-     * Provide the message to be encrypted, and obtain the encrypted output.
-     * EVP_EncryptUpdate can be called multiple times if necessary
-     */
-    if (1 != EVP_EncryptUpdate(encryption_context, rawBufMut(out), &out_len, rawBuf(in), input_length))
+    const uint8_t pad = data[data_len - 1];
+    if (pad == 0 || pad > kEncryptionBlockSize)
     {
-        printSSLErrorAndAbort();
+        return false;
     }
+    *plain_len = data_len - pad;
+    return true;
+}
+
+static inline uint16_t realityRecordLength(const uint8_t *tls_header)
+{
+    uint16_t length;
+    memcpy(&length, tls_header + 3, sizeof(uint16_t));
+    return ntohs(length);
+}
 
-    setLen(out, bufLen(out) + out_len);
+/*
+    opens every complete record at the front of the stream, the records that arrived in one buffer are taken as
+    a shallow slice of it and their plaintexts are packed together in that same memory, so one read that carried
+    many records goes to the next node as one payload
 
-    /*
-     * Finalise the encryption. Further ciphertext bytes may be written at
-     * this stage.
-     */
-    if (1 != EVP_EncryptFinal_ex(encryption_context, rawBufMut(out) + out_len, &out_len))
+    returns NULL when no complete record is queued, sets failed when a record is not a valid one
+*/
+static inline shift_buffer_t *realityOpenRecords(reality_crypto_t *rc, buffer_stream_t *stream,
+                                                 buffer_pool_t *pool, generic_pool_t *sb_pool, bool *failed)
+{
+    *failed = false;
+    if (bufferStreamLen(stream) < kTLSHeaderlen)
     {
-        printSSLErrorAndAbort();
+        return NULL;
     }
-    reuseBuffer(pool, in);
-    setLen(out, bufLen(out) + out_len);
 
-    shiftl(out, kIVlen);
-    memcpy(rawBufMut(out), iv, kIVlen);
-    return out;
+    shift_buffer_t    *front     = bufferStreamFront(stream);
+    const uint8_t     *front_ptr = rawBuf(front);
+    const unsigned int front_len = bufLen(front);
+    unsigned int       span      = 0;
+
+    while (span + kTLSHeaderlen <= front_len &&
+           span + kTLSHeaderlen + realityRecordLength(front_ptr + span) <= front_len)
+    {
+        span += kTLSHeaderlen + realityRecordLength(front_ptr + span);
+    }
+
+    shift_buffer_t *chunk;
+    if (span > 0)
+    {
+        chunk = bufferStreamShallowRead(stream, sb_pool, span);
+    }
+    else
+    {
+        // the first record is split over several buffers, they are merged
+        uint8_t tls_header[kTLSHeaderlen];
+        bufferStreamViewBytesAt(stream, 0, tls_header, kTLSHeaderlen);
+        span = kTLSHeaderlen + realityRecordLength(tls_header);
+        if (bufferStreamLen(stream) < span)
+        {
+            return NULL;
+        }
+        chunk = bufferStreamRead(stream, span);
+    }
+
+    uint8_t     *base      = rawBufMut(chunk);
+    unsigned int read_pos  = 0;
+    unsigned int start     = 0;
+    unsigned int write_pos = 0;
+
+    while (read_pos < span)
+    {
+        uint8_t       *record = base + read_pos;
+        const uint16_t length = realityRecordLength(record);
+        uint16_t       tls_ver_b;
+        memcpy(&tls_ver_b, record + 1, sizeof(uint16_t));
+        size_t plain_len = 0;
+
+        if (record[0] != kTLS12ApplicationData || tls_ver_b != kTLSVersion12 ||
+            ! realityOpen(rc, record + kTLSHeaderlen, length, &plain_len))
+        {
+            reuseBuffer(pool, chunk);
+            *failed = true;
+            return NULL;
+        }
+
+        uint8_t *plain = record + kTLSHeaderlen + kSignLen + kIVlen;
+        if (read_pos == 0)
+        {
+            // the first plaintext stays where it is, the others are moved behind it
+            start     = (unsigned int) (plain - base);
+            write_pos = start;
+        }
+        else
+        {
+            memmove(base + write_pos, plain, plain_len);
+        }
+        write_pos += (unsigned int) plain_len;
+        read_pos += kTLSHeaderlen + length;
+    }
+
+    shiftr(chunk, start);
+    setLen(chunk, write_pos - start);
+    return chunk;
 }
 
 static void appendTlsHeader(shift_buffer_t *buf)
@@ -10,7 +10,5 @@ typedef struct trojan_user_s
 {
     struct user_s user;
     sha224_t      sha224_of_user_uid;
-    sha224_hex_t  hexed_sha224_of_user_uid;
-    hash_t        hash_of_hexed_sha224_of_user_uid;
 
 } trojan_user_t;
@@ -0,0 +1,357 @@
+#include "trojan_user_index.h"
+#include "loggers/network_logger.h"
+#include "managers/memory_manager.h"
+#include "utils/hashutils.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum
+{
+    kMinIndexCap = 16
+};
+
+static uint32_t slotOf(const uint8_t *digest)
+{
+    // the stored keys are sha224 outputs, their bytes are already uniform
+    uint32_t h;
+    memcpy(&h, digest, sizeof(h));
+    return h;
+}
+
+// no early exit, the compare takes the same time wherever the first different byte is
+static bool digestEqual(const uint8_t *a, const uint8_t *b)
+{
+    uint32_t diff = 0;
+    for (unsigned int i = 0; i < SHA224_DIGEST_SIZE; i += sizeof(uint32_t))
+    {
+        uint32_t wa;
+        uint32_t wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        diff |= wa ^ wb;
+    }
+    return diff == 0;
+}
+
+trojan_user_index_t *newTrojanUserIndex(uint32_t expected_users)
+{
+    uint32_t cap = kMinIndexCap;
+    while (cap < expected_users * 2)
+    {
+        cap <<= 1;
+    }
+
+    trojan_user_index_t *index = globalMalloc(sizeof(trojan_user_index_t));
+    *index                     = (trojan_user_index_t) {
+                            .slots = globalMalloc(sizeof(trojan_user_index_slot_t) * cap),
+                            .users = globalMalloc(sizeof(trojan_user_t *) * (cap / 2)),
+                            .mask  = cap - 1,
+                            .count = 0,
+                            .cap   = cap / 2};
+    memset(index->slots, 0, sizeof(trojan_user_index_slot_t) * cap);
+    return index;
+}
+
+void destroyTrojanUserIndex(trojan_user_index_t *index)
+{
+    for (uint32_t i = 0; i < index->count; i++)
+    {
+        trojan_user_t *tuser = index->users[i];
+        globalFree(tuser->user.name);
+        globalFree(tuser->user.email);
+        globalFree(tuser->user.notes);
+        globalFree(tuser->user.uid);
+        globalFree(tuser);
+    }
+    globalFree(index->users);
+    globalFree(index->slots);
+    globalFree(index);
+}
+
+static void growIndex(trojan_user_index_t *index)
+{
+    const uint32_t old_slots_count = index->mask + 1;
+    const uint32_t cap             = old_slots_count * 2;
+
+    trojan_user_index_slot_t *old_slots = index->slots;
+    index->slots                        = globalMalloc(sizeof(trojan_user_index_slot_t) * cap);
+    memset(index->slots, 0, sizeof(trojan_user_index_slot_t) * cap);
+    index->users = globalRealloc(index->users, sizeof(trojan_user_t *) * (cap / 2));
+    index->mask  = cap - 1;
+    index->cap   = cap / 2;
+
+    for (uint32_t i = 0; i < old_slots_count; i++)
+    {
+        if (old_slots[i].user == 0)
+        {
+            continue;
+        }
+        uint32_t pos = slotOf(old_slots[i].digest) & index->mask;
+        while (index->slots[pos].user != 0)
+        {
+            pos = (pos + 1) & index->mask;
+        }
+        index->slots[pos] = old_slots[i];
+    }
+    globalFree(old_slots);
+}
+
+bool trojanUserIndexInsert(trojan_user_index_t *index, trojan_user_t *tuser)
+{
+    if (index->count == index->cap)
+    {
+        growIndex(index);
+    }
+
+    uint32_t pos = slotOf(tuser->sha224_of_user_uid) & index->mask;
+    while (index->slots[pos].user != 0)
+    {
+        if (digestEqual(index->slots[pos].digest, tuser->sha224_of_user_uid))
+        {
+            return false;
+        }
+        pos = (pos + 1) & index->mask;
+    }
+
+    index->users[index->count++] = tuser;
+    memcpy(index->slots[pos].digest, tuser->sha224_of_user_uid, sizeof(sha224_t));
+    index->slots[pos].user = index->count;
+    return true;
+}
+
+trojan_user_t *trojanUserIndexFind(const trojan_user_index_t *index, const sha224_t digest)
+{
+    uint32_t pos = slotOf(digest) & index->mask;
+    while (index->slots[pos].user != 0)
+    {
+        if (digestEqual(index->slots[pos].digest, digest))
+        {
+            return index->users[index->slots[pos].user - 1];
+        }
+        pos = (pos + 1) & index->mask;
+    }
+    return NULL;
+}
+
+static uint32_t readLE32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+trojan_user_index_t *loadTrojanUserIndexData(const uint8_t *data, size_t len, const char *source)
+{
+    if (len < kTrojanUserFileHeaderLen)
+    {
+        LOGE("TrojanUserIndex: user data of \"%s\" is too short", source);
+        return NULL;
+    }
+
+    const uint32_t count = readLE32(data + 8);
+
+    if (memcmp(data, "WWTU", 4) != 0 || readLE32(data + 4) != kTrojanUserFileVersion ||
+        count > (len - kTrojanUserFileHeaderLen) / kTrojanUserFileMinRecord)
+    {
+        LOGE("TrojanUserIndex: \"%s\" is not valid user data", source);
+        return NULL;
+    }
+
+    trojan_user_index_t *index = newTrojanUserIndex(count);
+    size_t               pos   = kTrojanUserFileHeaderLen;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (len - pos < kTrojanUserFileMinRecord ||
+            len - pos - kTrojanUserFileMinRecord < data[pos + SHA224_DIGEST_SIZE + 1])
+        {
+            LOGE("TrojanUserIndex: user data of \"%s\" is truncated at user %u", source, i);
+            destroyTrojanUserIndex(index);
+            return NULL;
+        }
+        const uint8_t name_len = data[pos + SHA224_DIGEST_SIZE + 1];
+
+        trojan_user_t *tuser = globalMalloc(sizeof(trojan_user_t));
+        memset(tuser, 0, sizeof(trojan_user_t));
+        memcpy(tuser->sha224_of_user_uid, data + pos, sizeof(sha224_t));
+        tuser->user.hash_uid = CALC_HASH_BYTES(tuser->sha224_of_user_uid, sizeof(sha224_t));
+        tuser->user.enable = data[pos + SHA224_DIGEST_SIZE] != 0;
+        tuser->user.name   = globalMalloc((size_t) name_len + 1);
+        memcpy(tuser->user.name, data + pos + kTrojanUserFileMinRecord, name_len);
+        tuser->user.name[name_len] = '\0';
+
+        if (! trojanUserIndexInsert(index, tuser))
+        {
+            LOGW("TrojanUserIndex: duplicate passwords in \"%s\", user \"%s\" ignored", source, tuser->user.name);
+            globalFree(tuser->user.name);
+            globalFree(tuser);
+        }
+        pos += kTrojanUserFileMinRecord + name_len;
+    }
+
+    return index;
+}
+
+trojan_user_index_t *loadTrojanUserIndexFile(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (! f)
+    {
+        LOGE("TrojanUserIndex: could not open user file \"%s\"", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (fsize < kTrojanUserFileHeaderLen)
+    {
+        LOGE("TrojanUserIndex: user file \"%s\" is too short", path);
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t *data = globalMalloc((size_t) fsize);
+    if (fread(data, (size_t) fsize, 1, f) != 1)
+    {
+        LOGE("TrojanUserIndex: could not read user file \"%s\"", path);
+        globalFree(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    trojan_user_index_t *index = loadTrojanUserIndexData(data, (size_t) fsize, path);
+    globalFree(data);
+    return index;
+}
+
+static void writeLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static uint8_t recordNameLen(const char *name)
+{
+    if (name == NULL)
+    {
+        return 0;
+    }
+    const size_t len = strlen(name);
+    return (uint8_t) (len > UINT8_MAX ? UINT8_MAX : len);
+}
+
+void *serializeTrojanUserIndex(const trojan_user_index_t *index, size_t *len)
+{
+    size_t size = kTrojanUserFileHeaderLen;
+    for (uint32_t i = 0; i < index->count; i++)
+    {
+        size += kTrojanUserFileMinRecord + recordNameLen(index->users[i]->user.name);
+    }
+
+    uint8_t *data = globalMalloc(size);
+    memcpy(data, "WWTU", 4);
+    writeLE32(data + 4, kTrojanUserFileVersion);
+    writeLE32(data + 8, index->count);
+
+    size_t pos = kTrojanUserFileHeaderLen;
+    for (uint32_t i = 0; i < index->count; i++)
+    {
+        const trojan_user_t *tuser    = index->users[i];
+        const uint8_t        name_len = recordNameLen(tuser->user.name);
+
+        memcpy(data + pos, tuser->sha224_of_user_uid, sizeof(sha224_t));
+        data[pos + SHA224_DIGEST_SIZE]     = tuser->user.enable ? 1 : 0;
+        data[pos + SHA224_DIGEST_SIZE + 1] = name_len;
+        if (name_len > 0)
+        {
+            memcpy(data + pos + kTrojanUserFileMinRecord, tuser->user.name, name_len);
+        }
+        pos += kTrojanUserFileMinRecord + name_len;
+    }
+
+    *len = size;
+    return data;
+}
+
+#if defined(__SSE2__)
+
+// 16 characters to 8 bytes, returns the mask of valid characters
+static int decodeHex16(__m128i v, uint8_t *out)
+{
+    const __m128i l     = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                        _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1)));
+
+    // '0'..'9' -> 0..9 and 'a'..'f' / 'A'..'F' -> 1..6 + 9
+    const __m128i nibbles =
+        _mm_add_epi8(_mm_and_si128(v, _mm_set1_epi8(0x0F)), _mm_and_si128(alpha, _mm_set1_epi8(9)));
+
+    // each 16 bit lane holds (high nibble, low nibble), join them in the low byte and pack
+    const __m128i joined = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8)),
+                                         _mm_set1_epi16(0x00FF));
+    _mm_storel_epi64((__m128i *) out, _mm_packus_epi16(joined, joined));
+
+    return _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+}
+
+bool trojanDecodeHexPassword(const uint8_t *hex, sha224_t out)
+{
+    int valid = 0xFFFF;
+    valid &= decodeHex16(_mm_loadu_si128((const __m128i *) (hex + 0)), out + 0);
+    valid &= decodeHex16(_mm_loadu_si128((const __m128i *) (hex + 16)), out + 8);
+    valid &= decodeHex16(_mm_loadu_si128((const __m128i *) (hex + 32)), out + 16);
+
+    // the last 8 characters, the tail of the 16 byte store lands in a scratch buffer
+    uint8_t tail[8];
+    valid &= decodeHex16(_mm_loadl_epi64((const __m128i *) (hex + 48)), tail) | 0xFF00;
+    memcpy(out + 24, tail, 4);
+
+    return valid == 0xFFFF;
+}
+
+#else
+
+static bool decodeHexScalar(const uint8_t *hex, uint8_t *out, size_t out_len)
+{
+    unsigned int invalid = 0;
+    for (size_t i = 0; i < out_len; i++)
+    {
+        uint8_t nibbles[2];
+        for (unsigned int k = 0; k < 2; k++)
+        {
+            const uint8_t c     = hex[i * 2 + k];
+            const uint8_t l     = c | 0x20;
+            const bool    digit = c >= '0' && c <= '9';
+            const bool    alpha = l >= 'a' && l <= 'f';
+            invalid |= ! (digit | alpha);
+            nibbles[k] = (uint8_t) ((c & 0x0F) + (alpha ? 9 : 0));
+        }
+        out[i] = (uint8_t) ((nibbles[0] << 4) | nibbles[1]);
+    }
+    return invalid == 0;
+}
+
+bool trojanDecodeHexPassword(const uint8_t *hex, sha224_t out)
+{
+    return decodeHexScalar(hex, out, sizeof(sha224_t));
+}
+
+#endif
+
+void trojanEncodeHex(const uint8_t *in, size_t len, char *out)
+{
+    static const char kHexDigits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++)
+    {
+        out[i * 2]     = kHexDigits[in[i] >> 4];
+        out[i * 2 + 1] = kHexDigits[in[i] & 0x0F];
+    }
+}
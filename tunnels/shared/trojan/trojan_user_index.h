@@ -0,0 +1,67 @@
+#pragma once
+#include "trojan_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Read only user index of TrojanAuthServer
+
+    an open addressing table (linear probing, load factor <= 0.5) keyed by the raw 28 byte sha224 of the
+    user password, the slots are compact (digest + user number) so a lookup usually touches one cache line,
+    every probed digest is compared in constant time, so the time of a lookup does not tell how much of a
+    guessed password matched
+
+    the index is never changed after it is built, a new user list is a new index that replaces the old one
+    with a pointer swap, see TrojanAuthServer
+
+    binary user file (little endian), lets a panel push 100k+ users without json parsing or hashing:
+
+        magic "WWTU" | u32 version (1) | u32 count | count * { sha224[28] | u8 enable | u8 name_len | name }
+*/
+
+enum
+{
+    kTrojanUserFileVersion   = 1,
+    kTrojanUserFileHeaderLen = 12,
+    kTrojanUserFileMinRecord = SHA224_DIGEST_SIZE + 2
+};
+
+typedef struct trojan_user_index_slot_s
+{
+    sha224_t digest;
+    uint32_t user; // user number + 1, 0 means an empty slot
+
+} trojan_user_index_slot_t;
+
+typedef struct trojan_user_index_s
+{
+    trojan_user_index_slot_t *slots;
+    trojan_user_t           **users;
+    uint32_t                  mask;
+    uint32_t                  count;
+    uint32_t                  cap;
+
+} trojan_user_index_t;
+
+trojan_user_index_t *newTrojanUserIndex(uint32_t expected_users);
+void                 destroyTrojanUserIndex(trojan_user_index_t *index);
+
+// the index owns the user after this call, false means a duplicate password (the user is not added)
+bool trojanUserIndexInsert(trojan_user_index_t *index, trojan_user_t *tuser);
+
+trojan_user_t *trojanUserIndexFind(const trojan_user_index_t *index, const sha224_t digest);
+
+// returns NULL if the file can not be read or is malformed
+trojan_user_index_t *loadTrojanUserIndexFile(const char *path);
+
+// same as the file loader for data already in memory (a config image), source only names it in the logs
+trojan_user_index_t *loadTrojanUserIndexData(const uint8_t *data, size_t len, const char *source);
+
+// writes the index in the user file format, names longer than 255 bytes are cut, the result is globalMalloc'ed
+void *serializeTrojanUserIndex(const trojan_user_index_t *index, size_t *len);
+
+// decodes the 56 hex characters of a trojan request, false if any of them is not a hex digit
+bool trojanDecodeHexPassword(const uint8_t *hex, sha224_t out);
+
+void trojanEncodeHex(const uint8_t *in, size_t len, char *out);
@@ -62,10 +62,10 @@ typedef struct wireguard_keypair_s
     uint32_t remote_index;
     uint32_t last_tx;
     uint32_t last_rx;
-    uint32_t kepair_ms;
-    uint32_t replay_mitmap;
+    uint32_t keypair_millis;
+    uint32_t replay_bitmap;
     bool     valid;
-    bool     is_client_side;
+    bool     initiator;
     bool     sending_valid;
     bool     receiving_valid;
     uint8_t  sending_key[kWgSessionKeyLen];
@@ -77,7 +77,7 @@ typedef struct wireguard_handshake_s
 {
     bool     valid;
     bool     initiator;
-    uint32_t local_port;
+    uint32_t local_index;
     uint32_t remote_index;
     uint8_t  ephemeral_private[kWgPrivateKeyLen];
     uint8_t  remote_ephemeral[kWgPublicKeyLen];
@@ -94,7 +94,7 @@ typedef struct wireguard_allowed_ip_s
 
 } wireguard_allowed_ip_t;
 
-struct wireguard_peer_s
+typedef struct wireguard_peer_s
 {
     bool valid;  // Is this peer initialised?
     bool active; // Should we be actively trying to connect?
@@ -150,14 +150,11 @@ struct wireguard_peer_s
 
     // We set this flag on RX/TX of packets if we think that we should initiate a new handshake
     bool send_handshake;
-};
 
-struct wireguard_device
-{
-    // Maybe have a "Device private" member to abstract these?
-    struct netif   *netif;
-    struct udp_pcb *udp_pcb;
+} wireguard_peer_t;
 
+typedef struct wireguard_device_s
+{
     uint8_t public_key[kWgPublicKeyLen];
     uint8_t private_key[kWgPrivateKeyLen];
 
@@ -172,7 +169,8 @@ struct wireguard_device
     struct wireguard_peer_s peers[kWgMaxPeers];
 
     bool valid;
-};
+
+} wireguard_device_t;
 
 enum wireguard_message_constants
 {
@@ -15,7 +15,7 @@
 #include <string.h>
 #include <limits.h>
 
-// #include "crypto.h"
+#include "wireguard_crypto.h"
 
 // For HMAC calculation
 #define WIREGUARD_BLAKE2S_BLOCK_SIZE (64)
@@ -36,24 +36,24 @@ static uint8_t construction_hash[kWgHashLen];
 static uint8_t identifier_hash[kWgHashLen];
 
 
-void wireguard_init() {
+void wireguard_init(void) {
 	wireguard_blake2s_ctx ctx;
 	// Pre-calculate chaining key hash
-	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0);
+	wireguard_blake2s_init(&ctx, kWgHashLen, NULL, 0);
 	wireguard_blake2s_update(&ctx, CONSTRUCTION, sizeof(CONSTRUCTION));
 	wireguard_blake2s_final(&ctx, construction_hash);
 	// Pre-calculate initial handshake hash - uses construction_hash calculated above
-	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0);
+	wireguard_blake2s_init(&ctx, kWgHashLen, NULL, 0);
 	wireguard_blake2s_update(&ctx, construction_hash, sizeof(construction_hash));
 	wireguard_blake2s_update(&ctx, IDENTIFIER, sizeof(IDENTIFIER));
 	wireguard_blake2s_final(&ctx, identifier_hash);
 }
 
-struct wireguard_peer *peer_alloc(struct wireguard_device *device) {
-	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
+wireguard_peer_t *peer_alloc(wireguard_device_t *device) {
+	wireguard_peer_t *result = NULL;
+	wireguard_peer_t *tmp;
 	int x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+	for (x=0; x < kWgMaxPeers; x++) {
 		tmp = &device->peers[x];
 		if (!tmp->valid) {
 			result = tmp;
@@ -63,14 +63,14 @@ struct wireguard_peer *peer_alloc(struct wireguard_device *device) {
 	return result;
 }
 
-struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, uint8_t *public_key) {
-	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
+wireguard_peer_t *peer_lookup_by_pubkey(wireguard_device_t *device, uint8_t *public_key) {
+	wireguard_peer_t *result = NULL;
+	wireguard_peer_t *tmp;
 	int x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+	for (x=0; x < kWgMaxPeers; x++) {
 		tmp = &device->peers[x];
 		if (tmp->valid) {
-			if (memcmp(tmp->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0) {
+			if (memcmp(tmp->public_key, public_key, kWgPublicKeyLen) == 0) {
 				result = tmp;
 				break;
 			}
@@ -79,10 +79,10 @@ struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, ui
 	return result;
 }
 
-uint8_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer) {
+uint8_t wireguard_peer_index(wireguard_device_t *device, wireguard_peer_t *peer) {
 	uint8_t result = 0xFF;
 	uint8_t x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+	for (x=0; x < kWgMaxPeers; x++) {
 		if (peer == &device->peers[x]) {
 			result = x;
 			break;
@@ -91,9 +91,9 @@ uint8_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_p
 	return result;
 }
 
-struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device, uint8_t peer_index) {
-	struct wireguard_peer *result = NULL;
-	if (peer_index < WIREGUARD_MAX_PEERS) {
+wireguard_peer_t *peer_lookup_by_peer_index(wireguard_device_t *device, uint8_t peer_index) {
+	wireguard_peer_t *result = NULL;
+	if (peer_index < kWgMaxPeers) {
 		if (device->peers[peer_index].valid) {
 			result = &device->peers[peer_index];
 		}
@@ -101,11 +101,11 @@ struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device
 	return result;
 }
 
-struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device, uint32_t receiver) {
-	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
+wireguard_peer_t *peer_lookup_by_receiver(wireguard_device_t *device, uint32_t receiver) {
+	wireguard_peer_t *result = NULL;
+	wireguard_peer_t *tmp;
 	int x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+	for (x=0; x < kWgMaxPeers; x++) {
 		tmp = &device->peers[x];
 		if (tmp->valid) {
 			if ((tmp->curr_keypair.valid && (tmp->curr_keypair.local_index == receiver)) ||
@@ -120,11 +120,11 @@ struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device,
 	return result;
 }
 
-struct wireguard_peer *peer_lookup_by_handshake(struct wireguard_device *device, uint32_t receiver) {
-	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
+wireguard_peer_t *peer_lookup_by_handshake(wireguard_device_t *device, uint32_t receiver) {
+	wireguard_peer_t *result = NULL;
+	wireguard_peer_t *tmp;
 	int x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+	for (x=0; x < kWgMaxPeers; x++) {
 		tmp = &device->peers[x];
 		if (tmp->valid) {
 			if (tmp->handshake.valid && tmp->handshake.initiator && (tmp->handshake.local_index == receiver)) {
@@ -142,21 +142,21 @@ bool wireguard_expired(uint32_t created_millis, uint32_t valid_seconds) {
 }
 
 
-static void generate_cookie_secret(struct wireguard_device *device) {
-	wireguard_random_bytes(device->cookie_secret, WIREGUARD_HASH_LEN);
+static void generate_cookie_secret(wireguard_device_t *device) {
+	wireguard_random_bytes(device->cookie_secret, kWgHashLen);
 	device->cookie_secret_millis = wireguard_sys_now();
 }
 
-static void generate_peer_cookie(struct wireguard_device *device, uint8_t *cookie, uint8_t *source_addr_port, size_t source_length) {
+static void generate_peer_cookie(wireguard_device_t *device, uint8_t *cookie, uint8_t *source_addr_port, size_t source_length) {
 	wireguard_blake2s_ctx ctx;
 
-	if (wireguard_expired(device->cookie_secret_millis, COOKIE_SECRET_MAX_AGE)) {
+	if (wireguard_expired(device->cookie_secret_millis, kWgCookieSecretMaxDuration)) {
 		// Generate new random bytes
 		generate_cookie_secret(device);
 	}
 
 	// Mac(key, input) Keyed-Blake2s(key, input, 16), the keyed MAC variant of the BLAKE2s hash function, returning 16 bytes of output
-	wireguard_blake2s_init(&ctx, WIREGUARD_COOKIE_LEN, device->cookie_secret, WIREGUARD_HASH_LEN);
+	wireguard_blake2s_init(&ctx, kWgCookieLen, device->cookie_secret, kWgHashLen);
 	// 5.4.7 Under Load: Cookie Reply Message
 	// Mix in the IP address and port - have the IP layer pass this in as byte array to avoid using Lwip specific APIs in this module
 	if ((source_addr_port) && (source_length > 0)) {
@@ -166,21 +166,21 @@ static void generate_peer_cookie(struct wireguard_device *device, uint8_t *cooki
 }
 
 static void wireguard_mac(uint8_t *dst, const void *message, size_t len, const uint8_t *key, size_t keylen) {
-	wireguard_blake2s(dst, WIREGUARD_COOKIE_LEN, key, keylen, message, len);
+	wireguard_blake2s(dst, kWgCookieLen, key, keylen, message, len);
 }
 
 static void wireguard_mac_key(uint8_t *key, const uint8_t *public_key, const uint8_t *label, size_t label_len) {
-	blake2s_ctx ctx;
-	blake2s_init(&ctx, WIREGUARD_SESSION_KEY_LEN, NULL, 0);
-	blake2s_update(&ctx, label, label_len);
-	blake2s_update(&ctx, public_key, WIREGUARD_PUBLIC_KEY_LEN);
-	blake2s_final(&ctx, key);
+	wireguard_blake2s_ctx ctx;
+	wireguard_blake2s_init(&ctx, kWgSessionKeyLen, NULL, 0);
+	wireguard_blake2s_update(&ctx, label, label_len);
+	wireguard_blake2s_update(&ctx, public_key, kWgPublicKeyLen);
+	wireguard_blake2s_final(&ctx, key);
 }
 
 static void wireguard_mix_hash(uint8_t *hash, const uint8_t *src, size_t src_len) {
 	wireguard_blake2s_ctx ctx;
-	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0);
-	wireguard_blake2s_update(&ctx, hash, WIREGUARD_HASH_LEN);
+	wireguard_blake2s_init(&ctx, kWgHashLen, NULL, 0);
+	wireguard_blake2s_update(&ctx, hash, kWgHashLen);
 	wireguard_blake2s_update(&ctx, src, src_len);
 	wireguard_blake2s_final(&ctx, hash);
 }
@@ -191,16 +191,16 @@ static void wireguard_hmac(uint8_t *digest, const uint8_t *key, size_t key_len,
 	uint8_t k_ipad[WIREGUARD_BLAKE2S_BLOCK_SIZE]; // inner padding - key XORd with ipad
 	uint8_t k_opad[WIREGUARD_BLAKE2S_BLOCK_SIZE]; // outer padding - key XORd with opad
 
-	uint8_t tk[WIREGUARD_HASH_LEN];
+	uint8_t tk[kWgHashLen];
 	int i;
 	// if key is longer than BLAKE2S_BLOCK_SIZE bytes reset it to key=BLAKE2S(key)
 	if (key_len > WIREGUARD_BLAKE2S_BLOCK_SIZE) {
 		wireguard_blake2s_ctx tctx;
-		wireguard_blake2s_init(&tctx, WIREGUARD_HASH_LEN, NULL, 0);
+		wireguard_blake2s_init(&tctx, kWgHashLen, NULL, 0);
 		wireguard_blake2s_update(&tctx, key, key_len);
 		wireguard_blake2s_final(&tctx, tk);
 		key = tk;
-		key_len = WIREGUARD_HASH_LEN;
+		key_len = kWgHashLen;
 	}
 
 	// the HMAC transform looks like:
@@ -220,28 +220,28 @@ static void wireguard_hmac(uint8_t *digest, const uint8_t *key, size_t key_len,
 		k_opad[i] ^= 0x5c;
 	}
 	// perform inner HASH
-	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0); // init context for 1st pass
+	wireguard_blake2s_init(&ctx, kWgHashLen, NULL, 0); // init context for 1st pass
 	wireguard_blake2s_update(&ctx, k_ipad, WIREGUARD_BLAKE2S_BLOCK_SIZE); // start with inner pad
 	wireguard_blake2s_update(&ctx, text, text_len); // then text of datagram
 	wireguard_blake2s_final(&ctx, digest); // finish up 1st pass
 
 	// perform outer HASH
-	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0); // init context for 2nd pass
+	wireguard_blake2s_init(&ctx, kWgHashLen, NULL, 0); // init context for 2nd pass
 	wireguard_blake2s_update(&ctx, k_opad, WIREGUARD_BLAKE2S_BLOCK_SIZE); // start with outer pad
-	wireguard_blake2s_update(&ctx, digest, WIREGUARD_HASH_LEN); // then results of 1st hash
+	wireguard_blake2s_update(&ctx, digest, kWgHashLen); // then results of 1st hash
 	wireguard_blake2s_final(&ctx, digest); // finish up 2nd pass
 }
 
 static void wireguard_kdf1(uint8_t *tau1, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
-	uint8_t tau0[WIREGUARD_HASH_LEN];
-	uint8_t output[WIREGUARD_HASH_LEN + 1];
+	uint8_t tau0[kWgHashLen];
+	uint8_t output[kWgHashLen + 1];
 
 	// tau0 = Hmac(key, input)
-	wireguard_hmac(tau0, chaining_key, WIREGUARD_HASH_LEN, data, data_len);
+	wireguard_hmac(tau0, chaining_key, kWgHashLen, data, data_len);
 	// tau1 := Hmac(tau0, 0x1)
 	output[0] = 1;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, 1);
-	memcpy(tau1, output, WIREGUARD_HASH_LEN);
+	wireguard_hmac(output, tau0, kWgHashLen, output, 1);
+	memcpy(tau1, output, kWgHashLen);
 
 	// Wipe intermediates
 	crypto_zero(tau0, sizeof(tau0));
@@ -249,20 +249,20 @@ static void wireguard_kdf1(uint8_t *tau1, const uint8_t *chaining_key, const uin
 }
 
 static void wireguard_kdf2(uint8_t *tau1, uint8_t *tau2, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
-	uint8_t tau0[WIREGUARD_HASH_LEN];
-	uint8_t output[WIREGUARD_HASH_LEN + 1];
+	uint8_t tau0[kWgHashLen];
+	uint8_t output[kWgHashLen + 1];
 
 	// tau0 = Hmac(key, input)
-	wireguard_hmac(tau0, chaining_key, WIREGUARD_HASH_LEN, data, data_len);
+	wireguard_hmac(tau0, chaining_key, kWgHashLen, data, data_len);
 	// tau1 := Hmac(tau0, 0x1)
 	output[0] = 1;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, 1);
-	memcpy(tau1, output, WIREGUARD_HASH_LEN);
+	wireguard_hmac(output, tau0, kWgHashLen, output, 1);
+	memcpy(tau1, output, kWgHashLen);
 
 	// tau2 := Hmac(tau0,tau1 || 0x2)
-	output[WIREGUARD_HASH_LEN] = 2;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, WIREGUARD_HASH_LEN + 1);
-	memcpy(tau2, output, WIREGUARD_HASH_LEN);
+	output[kWgHashLen] = 2;
+	wireguard_hmac(output, tau0, kWgHashLen, output, kWgHashLen + 1);
+	memcpy(tau2, output, kWgHashLen);
 
 	// Wipe intermediates
 	crypto_zero(tau0, sizeof(tau0));
@@ -270,32 +270,32 @@ static void wireguard_kdf2(uint8_t *tau1, uint8_t *tau2, const uint8_t *chaining
 }
 
 static void wireguard_kdf3(uint8_t *tau1, uint8_t *tau2, uint8_t *tau3, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
-	uint8_t tau0[WIREGUARD_HASH_LEN];
-	uint8_t output[WIREGUARD_HASH_LEN + 1];
+	uint8_t tau0[kWgHashLen];
+	uint8_t output[kWgHashLen + 1];
 
 	// tau0 = Hmac(key, input)
-	wireguard_hmac(tau0, chaining_key, WIREGUARD_HASH_LEN, data, data_len);
+	wireguard_hmac(tau0, chaining_key, kWgHashLen, data, data_len);
 	// tau1 := Hmac(tau0, 0x1)
 	output[0] = 1;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, 1);
-	memcpy(tau1, output, WIREGUARD_HASH_LEN);
+	wireguard_hmac(output, tau0, kWgHashLen, output, 1);
+	memcpy(tau1, output, kWgHashLen);
 
 	// tau2 := Hmac(tau0,tau1 || 0x2)
-	output[WIREGUARD_HASH_LEN] = 2;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, WIREGUARD_HASH_LEN + 1);
-	memcpy(tau2, output, WIREGUARD_HASH_LEN);
+	output[kWgHashLen] = 2;
+	wireguard_hmac(output, tau0, kWgHashLen, output, kWgHashLen + 1);
+	memcpy(tau2, output, kWgHashLen);
 
 	// tau3 := Hmac(tau0,tau1,tau2 || 0x3)
-	output[WIREGUARD_HASH_LEN] = 3;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, WIREGUARD_HASH_LEN + 1);
-	memcpy(tau3, output, WIREGUARD_HASH_LEN);
+	output[kWgHashLen] = 3;
+	wireguard_hmac(output, tau0, kWgHashLen, output, kWgHashLen + 1);
+	memcpy(tau3, output, kWgHashLen);
 
 	// Wipe intermediates
 	crypto_zero(tau0, sizeof(tau0));
 	crypto_zero(output, sizeof(output));
 }
 
-bool wireguard_check_replay(struct wireguard_keypair *keypair, uint64_t seq) {
+bool wireguard_check_replay(wireguard_keypair_t *keypair, uint64_t seq) {
 	// Implementation of packet replay window - as per RFC2401
 	// Adapted from code in Appendix C at https://tools.ietf.org/html/rfc2401
 	uint32_t diff;
@@ -342,7 +342,7 @@ bool wireguard_check_replay(struct wireguard_keypair *keypair, uint64_t seq) {
 	return result;
 }
 
-struct wireguard_keypair *get_peer_keypair_for_idx(struct wireguard_peer *peer, uint32_t idx) {
+wireguard_keypair_t *get_peer_keypair_for_idx(wireguard_peer_t *peer, uint32_t idx) {
 	if (peer->curr_keypair.valid && peer->curr_keypair.local_index == idx) {
 		return &peer->curr_keypair;
 	} else if (peer->next_keypair.valid && peer->next_keypair.local_index == idx) {
@@ -353,12 +353,12 @@ struct wireguard_keypair *get_peer_keypair_for_idx(struct wireguard_peer *peer,
 	return NULL;
 }
 
-static uint32_t wireguard_generate_unique_index(struct wireguard_device *device) {
+static uint32_t wireguard_generate_unique_index(wireguard_device_t *device) {
 	// We need a random 32-bit number but make sure it's not already been used in the context of this device
 	uint32_t result;
 	uint8_t buf[4];
 	int x;
-	struct wireguard_peer *peer;
+	wireguard_peer_t *peer;
 	bool existing;
 	do {
 		do {
@@ -367,7 +367,7 @@ static uint32_t wireguard_generate_unique_index(struct wireguard_device *device)
 		} while ((result == 0) || (result == 0xFFFFFFFF)); // Don't allow 0 or 0xFFFFFFFF as valid values
 
 		existing = false;
-		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+		for (x=0; x < kWgMaxPeers; x++) {
 			peer = &device->peers[x];
 			existing = (result == peer->curr_keypair.local_index) ||
 					(result == peer->prev_keypair.local_index) ||
@@ -386,49 +386,49 @@ static void wireguard_clamp_private_key(uint8_t *key) {
 }
 
 static void wireguard_generate_private_key(uint8_t *key) {
-	wireguard_random_bytes(key, WIREGUARD_PRIVATE_KEY_LEN);
+	wireguard_random_bytes(key, kWgPrivateKeyLen);
 	wireguard_clamp_private_key(key);
 }
 
 static bool wireguard_generate_public_key(uint8_t *public_key, const uint8_t *private_key) {
-	static const uint8_t basepoint[WIREGUARD_PUBLIC_KEY_LEN] = { 9 };
+	static const uint8_t basepoint[kWgPublicKeyLen] = { 9 };
 	bool result = false;
-	if (memcmp(private_key, zero_key, WIREGUARD_PUBLIC_KEY_LEN) != 0) {
+	if (memcmp(private_key, zero_key, kWgPublicKeyLen) != 0) {
 		result = (wireguard_x25519(public_key, private_key, basepoint) == 0);
 	}
 	return result;
 }
 
-bool wireguard_check_mac1(struct wireguard_device *device, const uint8_t *data, size_t len, const uint8_t *mac1) {
+bool wireguard_check_mac1(wireguard_device_t *device, const uint8_t *data, size_t len, const uint8_t *mac1) {
 	bool result = false;
-	uint8_t calculated[WIREGUARD_COOKIE_LEN];
-	wireguard_mac(calculated, data, len, device->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
-	if (crypto_equal(calculated, mac1, WIREGUARD_COOKIE_LEN)) {
+	uint8_t calculated[kWgCookieLen];
+	wireguard_mac(calculated, data, len, device->label_mac1_key, kWgSessionKeyLen);
+	if (crypto_equal(calculated, mac1, kWgCookieLen)) {
 		result = true;
 	}
 	return result;
 }
 
-bool wireguard_check_mac2(struct wireguard_device *device, const uint8_t *data, size_t len, uint8_t *source_addr_port, size_t source_length, const uint8_t *mac2) {
+bool wireguard_check_mac2(wireguard_device_t *device, const uint8_t *data, size_t len, uint8_t *source_addr_port, size_t source_length, const uint8_t *mac2) {
 	bool result = false;
-	uint8_t cookie[WIREGUARD_COOKIE_LEN];
-	uint8_t calculated[WIREGUARD_COOKIE_LEN];
+	uint8_t cookie[kWgCookieLen];
+	uint8_t calculated[kWgCookieLen];
 
 	generate_peer_cookie(device, cookie, source_addr_port, source_length);
 
-	wireguard_mac(calculated, data, len, cookie, WIREGUARD_COOKIE_LEN);
-	if (crypto_equal(calculated, mac2, WIREGUARD_COOKIE_LEN)) {
+	wireguard_mac(calculated, data, len, cookie, kWgCookieLen);
+	if (crypto_equal(calculated, mac2, kWgCookieLen)) {
 		result = true;
 	}
 	return result;
 }
 
-void keypair_destroy(struct wireguard_keypair *keypair) {
-	crypto_zero(keypair, sizeof(struct wireguard_keypair));
+void keypair_destroy(wireguard_keypair_t *keypair) {
+	crypto_zero(keypair, sizeof(wireguard_keypair_t));
 	keypair->valid = false;
 }
 
-void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *received_keypair) {
+void keypair_update(wireguard_peer_t *peer, wireguard_keypair_t *received_keypair) {
 	bool key_is_next = (received_keypair == &peer->next_keypair);
 	if (key_is_next) {
 		peer->prev_keypair = peer->curr_keypair;
@@ -437,7 +437,7 @@ void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *recei
 	}
 }
 
-static void add_new_keypair(struct wireguard_peer *peer, struct wireguard_keypair new_keypair) {
+static void add_new_keypair(wireguard_peer_t *peer, wireguard_keypair_t new_keypair) {
 	if (new_keypair.initiator) {
 		if (peer->next_keypair.valid) {
 			peer->prev_keypair = peer->next_keypair;
@@ -452,11 +452,11 @@ static void add_new_keypair(struct wireguard_peer *peer, struct wireguard_keypai
 	}
 }
 
-void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
-	struct wireguard_handshake *handshake = &peer->handshake;
-	struct wireguard_keypair new_keypair;
+void wireguard_start_session(wireguard_peer_t *peer, bool initiator) {
+	wireguard_handshake_t *handshake = &peer->handshake;
+	wireguard_keypair_t new_keypair;
 
-	crypto_zero(&new_keypair, sizeof(struct wireguard_keypair));
+	crypto_zero(&new_keypair, sizeof(wireguard_keypair_t));
 	new_keypair.initiator = initiator;
 	new_keypair.local_index = handshake->local_index;
 	new_keypair.remote_index = handshake->remote_index;
@@ -482,10 +482,10 @@ void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
 	new_keypair.valid = true;
 
 	// Eprivi = Epubi = Eprivr = Epubr = Ci = Cr := E
-	crypto_zero(handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
-	crypto_zero(handshake->remote_ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
-	crypto_zero(handshake->hash, WIREGUARD_HASH_LEN);
-	crypto_zero(handshake->chaining_key, WIREGUARD_HASH_LEN);
+	crypto_zero(handshake->ephemeral_private, kWgPublicKeyLen);
+	crypto_zero(handshake->remote_ephemeral, kWgPublicKeyLen);
+	crypto_zero(handshake->hash, kWgHashLen);
+	crypto_zero(handshake->chaining_key, kWgHashLen);
 	handshake->remote_index = 0;
 	handshake->local_index = 0;
 	handshake->valid = false;
@@ -494,28 +494,28 @@ void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
 }
 
 uint8_t wireguard_get_message_type(const uint8_t *data, size_t len) {
-	uint8_t result = MESSAGE_INVALID;
+	uint8_t result = kMessageInvalid;
 	if (len >= 4) {
 		if ((data[1] == 0) && (data[2] == 0) && (data[3] == 0)) {
 			switch (data[0]) {
-				case MESSAGE_HANDSHAKE_INITIATION:
+				case kMessageHandshakeInitiation:
 					if (len == sizeof(struct message_handshake_initiation)) {
-						result = MESSAGE_HANDSHAKE_INITIATION;
+						result = kMessageHandshakeInitiation;
 					}
 					break;
-				case MESSAGE_HANDSHAKE_RESPONSE:
+				case kMessageHandshakeResponse:
 					if (len == sizeof(struct message_handshake_response)) {
-						result = MESSAGE_HANDSHAKE_RESPONSE;
+						result = kMessageHandshakeResponse;
 					}
 					break;
-				case MESSAGE_COOKIE_REPLY:
+				case kMessageCookieReply:
 					if (len == sizeof(struct message_cookie_reply)) {
-						result = MESSAGE_COOKIE_REPLY;
+						result = kMessageCookieReply;
 					}
 					break;
-				case MESSAGE_TRANSPORT_DATA:
-					if (len >= sizeof(struct message_transport_data) + WIREGUARD_AUTHTAG_LEN) {
-						result = MESSAGE_TRANSPORT_DATA;
+				case kMessageTransportData:
+					if (len >= sizeof(struct message_transport_data) + kWgAuthTagLen) {
+						result = kMessageTransportData;
 					}
 					break;
 				default:
@@ -526,17 +526,17 @@ uint8_t wireguard_get_message_type(const uint8_t *data, size_t len) {
 	return result;
 }
 
-struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_device *device, struct message_handshake_initiation *msg) {
-	struct wireguard_peer *ret_peer = NULL;
-	struct wireguard_peer *peer = NULL;
-	struct wireguard_handshake *handshake;
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t chaining_key[WIREGUARD_HASH_LEN];
-	uint8_t hash[WIREGUARD_HASH_LEN];
-	uint8_t s[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t e[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t t[WIREGUARD_TAI64N_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
+wireguard_peer_t *wireguard_process_initiation_message(wireguard_device_t *device, struct message_handshake_initiation *msg) {
+	wireguard_peer_t *ret_peer = NULL;
+	wireguard_peer_t *peer = NULL;
+	wireguard_handshake_t *handshake;
+	uint8_t key[kWgSessionKeyLen];
+	uint8_t chaining_key[kWgHashLen];
+	uint8_t hash[kWgHashLen];
+	uint8_t s[kWgPublicKeyLen];
+	uint8_t e[kWgPublicKeyLen];
+	uint8_t t[kWgTai64Len];
+	uint8_t dh_calculation[kWgPublicKeyLen];
 	uint32_t now;
 	bool rate_limit;
 	bool replay;
@@ -544,32 +544,32 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 	// We are the responder, other end is the initiator
 
 	// Ci := Hash(Construction) (precalculated hash)
-	memcpy(chaining_key, construction_hash, WIREGUARD_HASH_LEN);
+	memcpy(chaining_key, construction_hash, kWgHashLen);
 
 	// Hi := Hash(Ci || Identifier
-	memcpy(hash, identifier_hash, WIREGUARD_HASH_LEN);
+	memcpy(hash, identifier_hash, kWgHashLen);
 
 	// Hi := Hash(Hi || Spubr)
-	wireguard_mix_hash(hash, device->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(hash, device->public_key, kWgPublicKeyLen);
 
 	 // Ci := Kdf1(Ci, Epubi)
-	wireguard_kdf1(chaining_key, chaining_key, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_kdf1(chaining_key, chaining_key, msg->ephemeral, kWgPublicKeyLen);
 
 	// msg.ephemeral := Epubi
-	memcpy(e, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+	memcpy(e, msg->ephemeral, kWgPublicKeyLen);
 
 	// Hi := Hash(Hi || msg.ephemeral)
-	wireguard_mix_hash(hash, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(hash, msg->ephemeral, kWgPublicKeyLen);
 
 	// Calculate DH(Eprivi,Spubr)
 	wireguard_x25519(dh_calculation, device->private_key, e);
-	if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+	if (!crypto_equal(dh_calculation, zero_key, kWgPublicKeyLen)) {
 
 		// (Ci,k) := Kdf2(Ci,DH(Eprivi,Spubr))
-		wireguard_kdf2(chaining_key, key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_kdf2(chaining_key, key, chaining_key, dh_calculation, kWgPublicKeyLen);
 
 		// msg.static := AEAD(k, 0, Spubi, Hi)
-		if (wireguard_aead_decrypt(s, msg->enc_static, sizeof(msg->enc_static), hash, WIREGUARD_HASH_LEN, 0, key)) {
+		if (wireguard_aead_decrypt(s, msg->enc_static, sizeof(msg->enc_static), hash, kWgHashLen, 0, key)) {
 			// Hi := Hash(Hi || msg.static)
 			wireguard_mix_hash(hash, msg->enc_static, sizeof(msg->enc_static));
 
@@ -578,29 +578,29 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 				handshake = &peer->handshake;
 
 				// (Ci,k) := Kdf2(Ci,DH(Sprivi,Spubr))
-				wireguard_kdf2(chaining_key, key, chaining_key, peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+				wireguard_kdf2(chaining_key, key, chaining_key, peer->public_key_dh, kWgPublicKeyLen);
 
 				// msg.timestamp := AEAD(k, 0, Timestamp(), Hi)
-				if (wireguard_aead_decrypt(t, msg->enc_timestamp, sizeof(msg->enc_timestamp), hash, WIREGUARD_HASH_LEN, 0, key)) {
+				if (wireguard_aead_decrypt(t, msg->enc_timestamp, sizeof(msg->enc_timestamp), hash, kWgHashLen, 0, key)) {
 					// Hi := Hash(Hi || msg.timestamp)
 					wireguard_mix_hash(hash, msg->enc_timestamp, sizeof(msg->enc_timestamp));
 
 					now = wireguard_sys_now();
 
 					// Check that timestamp is increasing and we haven't had too many initiations (should only get one per peer every 5 seconds max?)
-					replay = (memcmp(t, peer->greatest_timestamp, WIREGUARD_TAI64N_LEN) <= 0); // tai64n is big endian so we can use memcmp to compare
-					rate_limit = (peer->last_initiation_rx - now) < (1000 / MAX_INITIATIONS_PER_SECOND);
+					replay = (memcmp(t, peer->greatest_timestamp, kWgTai64Len) <= 0); // tai64n is big endian so we can use memcmp to compare
+					rate_limit = (peer->last_initiation_rx - now) < (1000 / kMaxInitiationPerSecond);
 
 					if (!replay && !rate_limit) {
 						// Success! Copy everything to peer
 						peer->last_initiation_rx = now;
-						if (memcmp(t, peer->greatest_timestamp, WIREGUARD_TAI64N_LEN) > 0) {
-							memcpy(peer->greatest_timestamp, t, WIREGUARD_TAI64N_LEN);
+						if (memcmp(t, peer->greatest_timestamp, kWgTai64Len) > 0) {
+							memcpy(peer->greatest_timestamp, t, kWgTai64Len);
 							// TODO: Need to notify if the higher layers want to persist latest timestamp/nonce somewhere
 						}
-						memcpy(handshake->remote_ephemeral, e, WIREGUARD_PUBLIC_KEY_LEN);
-						memcpy(handshake->hash, hash, WIREGUARD_HASH_LEN);
-						memcpy(handshake->chaining_key, chaining_key, WIREGUARD_HASH_LEN);
+						memcpy(handshake->remote_ephemeral, e, kWgPublicKeyLen);
+						memcpy(handshake->hash, hash, kWgHashLen);
+						memcpy(handshake->chaining_key, chaining_key, kWgHashLen);
 						handshake->remote_index = msg->sender;
 						handshake->valid = true;
 						handshake->initiator = false;
@@ -630,66 +630,66 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 	return ret_peer;
 }
 
-bool wireguard_process_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *src) {
-	struct wireguard_handshake *handshake = &peer->handshake;
+bool wireguard_process_handshake_response(wireguard_device_t *device, wireguard_peer_t *peer, struct message_handshake_response *src) {
+	wireguard_handshake_t *handshake = &peer->handshake;
 
 	bool result = false;
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t hash[WIREGUARD_HASH_LEN];
-	uint8_t chaining_key[WIREGUARD_HASH_LEN];
-	uint8_t e[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t ephemeral_private[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t static_private[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t preshared_key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t tau[WIREGUARD_PUBLIC_KEY_LEN];
+	uint8_t key[kWgSessionKeyLen];
+	uint8_t hash[kWgHashLen];
+	uint8_t chaining_key[kWgHashLen];
+	uint8_t e[kWgPublicKeyLen];
+	uint8_t ephemeral_private[kWgPublicKeyLen];
+	uint8_t static_private[kWgPublicKeyLen];
+	uint8_t preshared_key[kWgSessionKeyLen];
+	uint8_t dh_calculation[kWgPublicKeyLen];
+	uint8_t tau[kWgPublicKeyLen];
 
 	if (handshake->valid && handshake->initiator) {
 
-		memcpy(hash, handshake->hash, WIREGUARD_HASH_LEN);
-		memcpy(chaining_key, handshake->chaining_key, WIREGUARD_HASH_LEN);
-		memcpy(ephemeral_private, handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
-		memcpy(preshared_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+		memcpy(hash, handshake->hash, kWgHashLen);
+		memcpy(chaining_key, handshake->chaining_key, kWgHashLen);
+		memcpy(ephemeral_private, handshake->ephemeral_private, kWgPublicKeyLen);
+		memcpy(preshared_key, peer->preshared_key, kWgSessionKeyLen);
 
 		// (Eprivr, Epubr) := DH-Generate()
 		// Not required
 
 		// Cr := Kdf1(Cr,Epubr)
-		wireguard_kdf1(chaining_key, chaining_key, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_kdf1(chaining_key, chaining_key, src->ephemeral, kWgPublicKeyLen);
 
 		// msg.ephemeral := Epubr
-		memcpy(e, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		memcpy(e, src->ephemeral, kWgPublicKeyLen);
 
 		// Hr := Hash(Hr || msg.ephemeral)
-		wireguard_mix_hash(hash, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_mix_hash(hash, src->ephemeral, kWgPublicKeyLen);
 
 		// Cr := Kdf1(Cr, DH(Eprivr, Epubi))
 		// Calculate DH(Eprivr, Epubi)
 		wireguard_x25519(dh_calculation, ephemeral_private, e);
-		if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-			wireguard_kdf1(chaining_key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+		if (!crypto_equal(dh_calculation, zero_key, kWgPublicKeyLen)) {
+			wireguard_kdf1(chaining_key, chaining_key, dh_calculation, kWgPublicKeyLen);
 
 			// Cr := Kdf1(Cr, DH(Eprivr, Spubi))
 			// CalculateDH(Eprivr, Spubi)
 			wireguard_x25519(dh_calculation, device->private_key, e);
-			if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-				wireguard_kdf1(chaining_key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+			if (!crypto_equal(dh_calculation, zero_key, kWgPublicKeyLen)) {
+				wireguard_kdf1(chaining_key, chaining_key, dh_calculation, kWgPublicKeyLen);
 
 				// (Cr, t, k) := Kdf3(Cr, Q)
-				wireguard_kdf3(chaining_key, tau, key, chaining_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+				wireguard_kdf3(chaining_key, tau, key, chaining_key, peer->preshared_key, kWgSessionKeyLen);
 
 				// Hr := Hash(Hr | t)
-				wireguard_mix_hash(hash, tau, WIREGUARD_HASH_LEN);
+				wireguard_mix_hash(hash, tau, kWgHashLen);
 
 				// msg.empty := AEAD(k, 0, E, Hr)
-				if (wireguard_aead_decrypt(NULL, src->enc_empty, sizeof(src->enc_empty), hash, WIREGUARD_HASH_LEN, 0, key)) {
+				if (wireguard_aead_decrypt(NULL, src->enc_empty, sizeof(src->enc_empty), hash, kWgHashLen, 0, key)) {
 					// Hr := Hash(Hr | msg.empty)
 					// Not required as discarded
 
 					//Copy details to handshake
-					memcpy(handshake->remote_ephemeral, e, WIREGUARD_HASH_LEN);
-					memcpy(handshake->hash, hash, WIREGUARD_HASH_LEN);
-					memcpy(handshake->chaining_key, chaining_key, WIREGUARD_HASH_LEN);
+					memcpy(handshake->remote_ephemeral, e, kWgHashLen);
+					memcpy(handshake->hash, hash, kWgHashLen);
+					memcpy(handshake->chaining_key, chaining_key, kWgHashLen);
 					handshake->remote_index = src->sender;
 
 					result = true;
@@ -717,18 +717,19 @@ bool wireguard_process_handshake_response(struct wireguard_device *device, struc
 	return result;
 }
 
-bool wireguard_process_cookie_message(struct wireguard_device *device, struct wireguard_peer *peer, struct message_cookie_reply *src) {
-	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+bool wireguard_process_cookie_message(wireguard_device_t *device, wireguard_peer_t *peer, struct message_cookie_reply *src) {
+	uint8_t cookie[kWgCookieLen];
 	bool result = false;
+	(void) device;
 
 	if (peer->handshake_mac1_valid) {
 
-		result = wireguard_xaead_decrypt(cookie, src->enc_cookie, sizeof(src->enc_cookie), peer->handshake_mac1, WIREGUARD_COOKIE_LEN, src->nonce, peer->label_cookie_key);
+		result = wireguard_xaead_decrypt(cookie, src->enc_cookie, sizeof(src->enc_cookie), peer->handshake_mac1, kWgCookieLen, src->nonce, peer->label_cookie_key);
 
 		if (result) {
 			// 5.4.7 Under Load: Cookie Reply Message
 			// Upon receiving this message, if it is valid, the only thing the recipient of this message should do is store the cookie along with the time at which it was received
-			memcpy(peer->cookie, cookie, WIREGUARD_COOKIE_LEN);
+			memcpy(peer->cookie, cookie, kWgCookieLen);
 			peer->cookie_millis = wireguard_sys_now();
 			peer->handshake_mac1_valid = false;
 		}
@@ -738,63 +739,63 @@ bool wireguard_process_cookie_message(struct wireguard_device *device, struct wi
 	return result;
 }
 
-bool wireguard_create_handshake_initiation(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_initiation *dst) {
-	uint8_t timestamp[WIREGUARD_TAI64N_LEN];
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
+bool wireguard_create_handshake_initiation(wireguard_device_t *device, wireguard_peer_t *peer, struct message_handshake_initiation *dst) {
+	uint8_t timestamp[kWgTai64Len];
+	uint8_t key[kWgSessionKeyLen];
+	uint8_t dh_calculation[kWgPublicKeyLen];
 	bool result = false;
 
-	struct wireguard_handshake *handshake = &peer->handshake;
+	wireguard_handshake_t *handshake = &peer->handshake;
 
 	memset(dst, 0, sizeof(struct message_handshake_initiation));
 
 	// Ci := Hash(Construction) (precalculated hash)
-	memcpy(handshake->chaining_key, construction_hash, WIREGUARD_HASH_LEN);
+	memcpy(handshake->chaining_key, construction_hash, kWgHashLen);
 
 	// Hi := Hash(Ci || Identifier)
-	memcpy(handshake->hash, identifier_hash, WIREGUARD_HASH_LEN);
+	memcpy(handshake->hash, identifier_hash, kWgHashLen);
 
 	// Hi := Hash(Hi || Spubr)
-	wireguard_mix_hash(handshake->hash, peer->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(handshake->hash, peer->public_key, kWgPublicKeyLen);
 
 	// (Eprivi, Epubi) := DH-Generate()
 	wireguard_generate_private_key(handshake->ephemeral_private);
 	if (wireguard_generate_public_key(dst->ephemeral, handshake->ephemeral_private)) {
 
 		// Ci := Kdf1(Ci, Epubi)
-		wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dst->ephemeral, kWgPublicKeyLen);
 
 		// msg.ephemeral := Epubi
 		// Done above - public keys is calculated into dst->ephemeral
 
 		// Hi := Hash(Hi || msg.ephemeral)
-		wireguard_mix_hash(handshake->hash, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_mix_hash(handshake->hash, dst->ephemeral, kWgPublicKeyLen);
 
 		// Calculate DH(Eprivi,Spubr)
 		wireguard_x25519(dh_calculation, handshake->ephemeral_private, peer->public_key);
-		if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+		if (!crypto_equal(dh_calculation, zero_key, kWgPublicKeyLen)) {
 
 			// (Ci,k) := Kdf2(Ci,DH(Eprivi,Spubr))
-			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, dh_calculation, kWgPublicKeyLen);
 
 			// msg.static := AEAD(k,0,Spubi, Hi)
-			wireguard_aead_encrypt(dst->enc_static, device->public_key, WIREGUARD_PUBLIC_KEY_LEN, handshake->hash, WIREGUARD_HASH_LEN, 0, key);
+			wireguard_aead_encrypt(dst->enc_static, device->public_key, kWgPublicKeyLen, handshake->hash, kWgHashLen, 0, key);
 
 			// Hi := Hash(Hi || msg.static)
 			wireguard_mix_hash(handshake->hash, dst->enc_static, sizeof(dst->enc_static));
 
 			// (Ci,k) := Kdf2(Ci,DH(Sprivi,Spubr))
 			// note DH(Sprivi,Spubr) is precomputed per peer
-			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, peer->public_key_dh, kWgPublicKeyLen);
 
 			// msg.timestamp := AEAD(k, 0, Timestamp(), Hi)
 			wireguard_tai64n_now(timestamp);
-			wireguard_aead_encrypt(dst->enc_timestamp, timestamp, WIREGUARD_TAI64N_LEN, handshake->hash, WIREGUARD_HASH_LEN, 0, key);
+			wireguard_aead_encrypt(dst->enc_timestamp, timestamp, kWgTai64Len, handshake->hash, kWgHashLen, 0, key);
 
 			// Hi := Hash(Hi || msg.timestamp)
 			wireguard_mix_hash(handshake->hash, dst->enc_timestamp, sizeof(dst->enc_timestamp));
 
-			dst->type = MESSAGE_HANDSHAKE_INITIATION;
+			dst->type = kMessageHandshakeInitiation;
 			dst->sender = wireguard_generate_unique_index(device);
 
 			handshake->valid = true;
@@ -809,15 +810,15 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 		// 5.4.4 Cookie MACs
 		// msg.mac1 := Mac(Hash(Label-Mac1 || Spubm' ), msgA)
 		// The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed
-		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_initiation)-(2*WIREGUARD_COOKIE_LEN)), peer->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_initiation)-(2*kWgCookieLen)), peer->label_mac1_key, kWgSessionKeyLen);
 
 		// if Lm = E or Lm ≥ 120:
-		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
+		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, kWgCookieSecretMaxDuration)) {
 			// msg.mac2 := 0
-			crypto_zero(dst->mac2, WIREGUARD_COOKIE_LEN);
+			crypto_zero(dst->mac2, kWgCookieLen);
 		} else {
 			// msg.mac2 := Mac(Lm, msgB)
-			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_initiation)-(WIREGUARD_COOKIE_LEN)), peer->cookie, WIREGUARD_COOKIE_LEN);
+			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_initiation)-(kWgCookieLen)), peer->cookie, kWgCookieLen);
 
 		}
 	}
@@ -827,11 +828,11 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 	return result;
 }
 
-bool wireguard_create_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *dst) {
-	struct wireguard_handshake *handshake = &peer->handshake;
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t tau[WIREGUARD_HASH_LEN];
+bool wireguard_create_handshake_response(wireguard_device_t *device, wireguard_peer_t *peer, struct message_handshake_response *dst) {
+	wireguard_handshake_t *handshake = &peer->handshake;
+	uint8_t key[kWgSessionKeyLen];
+	uint8_t dh_calculation[kWgPublicKeyLen];
+	uint8_t tau[kWgHashLen];
 	bool result = false;
 
 	memset(dst, 0, sizeof(struct message_handshake_response));
@@ -843,39 +844,39 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 		if (wireguard_generate_public_key(dst->ephemeral, handshake->ephemeral_private)) {
 
 			// Cr := Kdf1(Cr,Epubr)
-			wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dst->ephemeral, kWgPublicKeyLen);
 
 			// msg.ephemeral := Epubr
 			// Copied above when generated
 
 			// Hr := Hash(Hr || msg.ephemeral)
-			wireguard_mix_hash(handshake->hash, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_mix_hash(handshake->hash, dst->ephemeral, kWgPublicKeyLen);
 
 			// Cr := Kdf1(Cr, DH(Eprivr, Epubi))
 			// Calculate DH(Eprivi,Spubr)
 			wireguard_x25519(dh_calculation, handshake->ephemeral_private, handshake->remote_ephemeral);
-			if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-				wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+			if (!crypto_equal(dh_calculation, zero_key, kWgPublicKeyLen)) {
+				wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, kWgPublicKeyLen);
 
 				// Cr := Kdf1(Cr, DH(Eprivr, Spubi))
 				// Calculate DH(Eprivi,Spubr)
 				wireguard_x25519(dh_calculation, handshake->ephemeral_private, peer->public_key);
-				if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-					wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+				if (!crypto_equal(dh_calculation, zero_key, kWgPublicKeyLen)) {
+					wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, kWgPublicKeyLen);
 
 					// (Cr, t, k) := Kdf3(Cr, Q)
-					wireguard_kdf3(handshake->chaining_key, tau, key, handshake->chaining_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+					wireguard_kdf3(handshake->chaining_key, tau, key, handshake->chaining_key, peer->preshared_key, kWgSessionKeyLen);
 
 					// Hr := Hash(Hr | t)
-					wireguard_mix_hash(handshake->hash, tau, WIREGUARD_HASH_LEN);
+					wireguard_mix_hash(handshake->hash, tau, kWgHashLen);
 
 					// msg.empty := AEAD(k, 0, E, Hr)
-					wireguard_aead_encrypt(dst->enc_empty, NULL, 0, handshake->hash, WIREGUARD_HASH_LEN, 0, key);
+					wireguard_aead_encrypt(dst->enc_empty, NULL, 0, handshake->hash, kWgHashLen, 0, key);
 
 					// Hr := Hash(Hr | msg.empty)
 					wireguard_mix_hash(handshake->hash, dst->enc_empty, sizeof(dst->enc_empty));
 
-					dst->type = MESSAGE_HANDSHAKE_RESPONSE;
+					dst->type = kMessageHandshakeResponse;
 					dst->receiver = handshake->remote_index;
 					dst->sender = wireguard_generate_unique_index(device);
 					// Update handshake object too
@@ -898,15 +899,15 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 		// 5.4.4 Cookie MACs
 		// msg.mac1 := Mac(Hash(Label-Mac1 || Spubm' ), msgA)
 		// The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed
-		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_response)-(2*WIREGUARD_COOKIE_LEN)), peer->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_response)-(2*kWgCookieLen)), peer->label_mac1_key, kWgSessionKeyLen);
 
 		// if Lm = E or Lm ≥ 120:
-		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
+		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, kWgCookieSecretMaxDuration)) {
 			// msg.mac2 := 0
-			crypto_zero(dst->mac2, WIREGUARD_COOKIE_LEN);
+			crypto_zero(dst->mac2, kWgCookieLen);
 		} else {
 			// msg.mac2 := Mac(Lm, msgB)
-			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_response)-(WIREGUARD_COOKIE_LEN)), peer->cookie, WIREGUARD_COOKIE_LEN);
+			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_response)-(kWgCookieLen)), peer->cookie, kWgCookieLen);
 		}
 	}
 
@@ -916,37 +917,37 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 	return result;
 }
 
-void wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length) {
-	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+void wireguard_create_cookie_reply(wireguard_device_t *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length) {
+	uint8_t cookie[kWgCookieLen];
 	crypto_zero(dst, sizeof(struct message_cookie_reply));
-	dst->type = MESSAGE_COOKIE_REPLY;
+	dst->type = kMessageCookieReply;
 	dst->receiver = index;
-	wireguard_random_bytes(dst->nonce, COOKIE_NONCE_LEN);
+	wireguard_random_bytes(dst->nonce, kWgCookieNonceLen);
 	generate_peer_cookie(device, cookie, source_addr_port, source_length);
-	wireguard_xaead_encrypt(dst->enc_cookie, cookie, WIREGUARD_COOKIE_LEN, mac1, WIREGUARD_COOKIE_LEN, dst->nonce, device->label_cookie_key);
+	wireguard_xaead_encrypt(dst->enc_cookie, cookie, kWgCookieLen, mac1, kWgCookieLen, dst->nonce, device->label_cookie_key);
 }
 
-bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key) {
+bool wireguard_peer_init(wireguard_device_t *device, wireguard_peer_t *peer, const uint8_t *public_key, const uint8_t *preshared_key) {
 	// Clear out structure
-	memset(peer, 0, sizeof(struct wireguard_peer));
+	memset(peer, 0, sizeof(wireguard_peer_t));
 
 	if (device->valid) {
 		// Copy across the public key into our peer structure
-		memcpy(peer->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN);
+		memcpy(peer->public_key, public_key, kWgPublicKeyLen);
 		if (preshared_key) {
-			memcpy(peer->preshared_key, preshared_key, WIREGUARD_SESSION_KEY_LEN);
+			memcpy(peer->preshared_key, preshared_key, kWgSessionKeyLen);
 		} else {
-			crypto_zero(peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+			crypto_zero(peer->preshared_key, kWgSessionKeyLen);
 		}
 
 		if (wireguard_x25519(peer->public_key_dh, device->private_key, peer->public_key) == 0) {
 			// Zero out handshake
-			memset(&peer->handshake, 0, sizeof(struct wireguard_handshake));
+			memset(&peer->handshake, 0, sizeof(wireguard_handshake_t));
 			peer->handshake.valid = false;
 
 			// Zero out any cookie info - we haven't received one yet
 			peer->cookie_millis = 0;
-			memset(&peer->cookie, 0, WIREGUARD_COOKIE_LEN);
+			memset(&peer->cookie, 0, kWgCookieLen);
 
 			// Precompute keys to deal with mac1/2 calculation
 			wireguard_mac_key(peer->label_mac1_key, peer->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
@@ -954,15 +955,15 @@ bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer
 
 			peer->valid = true;
 		} else {
-			crypto_zero(peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			crypto_zero(peer->public_key_dh, kWgPublicKeyLen);
 		}
 	}
 	return peer->valid;
 }
 
-bool wireguard_device_init(struct wireguard_device *device, const uint8_t *private_key) {
+bool wireguard_device_init(wireguard_device_t *device, const uint8_t *private_key) {
 	// Set the private key and calculate public key from it
-	memcpy(device->private_key, private_key, WIREGUARD_PRIVATE_KEY_LEN);
+	memcpy(device->private_key, private_key, kWgPrivateKeyLen);
 	// Ensure private key is correctly "clamped"
 	wireguard_clamp_private_key(device->private_key);
 	device->valid = wireguard_generate_public_key(device->public_key, private_key);
@@ -974,17 +975,17 @@ bool wireguard_device_init(struct wireguard_device *device, const uint8_t *priva
 		wireguard_mac_key(device->label_cookie_key, device->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
 
 	} else {
-		crypto_zero(device->private_key, WIREGUARD_PRIVATE_KEY_LEN);
+		crypto_zero(device->private_key, kWgPrivateKeyLen);
 	}
 	return device->valid;
 }
 
-void wireguard_encrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, struct wireguard_keypair *keypair) {
+void wireguard_encrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, wireguard_keypair_t *keypair) {
 	wireguard_aead_encrypt(dst, src, src_len, NULL, 0, keypair->sending_counter, keypair->sending_key);
 	keypair->sending_counter++;
 }
 
-bool wireguard_decrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, uint64_t counter, struct wireguard_keypair *keypair) {
+bool wireguard_decrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, uint64_t counter, wireguard_keypair_t *keypair) {
 	return wireguard_aead_decrypt(dst, src, src_len, NULL, 0, counter, keypair->receiving_key);
 }
 
@@ -992,12 +993,12 @@ bool wireguard_base64_decode(const char *str, uint8_t *out, size_t *outlen) {
 	uint32_t accum = 0; // We accumulate upto four blocks of 6 bits into this to form 3 bytes output
 	uint8_t char_count = 0; // How many characters have we processed in this block
 	int byte_count = 3; // How many bytes are we expecting in current 4 char block
-	int len = 0; // result length in bytes
+	size_t len = 0; // result length in bytes
 	bool result = true;
 	uint8_t bits;
 	char c;
 	char *ptr;
-	int x;
+	size_t x;
 	size_t inlen;
 
 	if (!str) {
@@ -1063,13 +1064,13 @@ bool wireguard_base64_decode(const char *str, uint8_t *out, size_t *outlen) {
 
 bool wireguard_base64_encode(const uint8_t *in, size_t inlen, char *out, size_t *outlen) {
 	bool result = false;
-	int read_offset = 0;
-	int write_offset = 0;
+	size_t read_offset = 0;
+	size_t write_offset = 0;
 	uint8_t byte1, byte2, byte3;
 	uint32_t tmp;
 	char c;
 	size_t len = 4 * ((inlen + 2) / 3);
-	int padding = (3 - (inlen % 3));
+	size_t padding = (3 - (inlen % 3));
 	if (padding > 2) padding = 0;
 	if (*outlen > len) {
 
@@ -0,0 +1,447 @@
+#include "wireguard_crypto.h"
+#include "htime.h"
+#include "loggers/network_logger.h"
+#include "managers/memory_manager.h"
+#include <assert.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+enum
+{
+    kAeadTagLen   = 16,
+    kAeadNonceLen = 12,
+    kX25519KeyLen = 32
+};
+
+struct wireguard_aead_ctx_s
+{
+    EVP_CIPHER_CTX *ctx;
+    bool            seal;
+};
+
+/*  blake2s (rfc 7693)  */
+
+static const uint32_t kBlake2sIV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                       0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+static const uint8_t kBlake2sSigma[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}, {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4}, {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13}, {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11}, {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5}, {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+static inline uint32_t rotr32(uint32_t x, unsigned int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t rotl32(uint32_t x, unsigned int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+#define BLAKE2S_G(a, b, c, d, x, y)                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        v[a] = v[a] + v[b] + (x);                                                                                      \
+        v[d] = rotr32(v[d] ^ v[a], 16);                                                                                \
+        v[c] = v[c] + v[d];                                                                                            \
+        v[b] = rotr32(v[b] ^ v[c], 12);                                                                                \
+        v[a] = v[a] + v[b] + (y);                                                                                      \
+        v[d] = rotr32(v[d] ^ v[a], 8);                                                                                 \
+        v[c] = v[c] + v[d];                                                                                            \
+        v[b] = rotr32(v[b] ^ v[c], 7);                                                                                 \
+    } while (0)
+
+static void blake2sCompress(wireguard_blake2s_ctx *ctx, bool last)
+{
+    uint32_t v[16];
+    uint32_t m[16];
+
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        v[i]     = ctx->h[i];
+        v[i + 8] = kBlake2sIV[i];
+    }
+    v[12] ^= ctx->t[0];
+    v[13] ^= ctx->t[1];
+    if (last)
+    {
+        v[14] = ~v[14];
+    }
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        m[i] = U8TO32_LITTLE(&ctx->b[4 * i]);
+    }
+
+    for (unsigned int r = 0; r < 10; r++)
+    {
+        const uint8_t *s = kBlake2sSigma[r];
+        BLAKE2S_G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        BLAKE2S_G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        BLAKE2S_G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        BLAKE2S_G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        BLAKE2S_G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        BLAKE2S_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        BLAKE2S_G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        BLAKE2S_G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        ctx->h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+void wireguard_blake2s_init(wireguard_blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen)
+{
+    memcpy(ctx->h, kBlake2sIV, sizeof(ctx->h));
+    ctx->h[0] ^= 0x01010000 ^ ((uint32_t) keylen << 8) ^ (uint32_t) outlen;
+    ctx->t[0]   = 0;
+    ctx->t[1]   = 0;
+    ctx->c      = 0;
+    ctx->outlen = outlen;
+    memset(ctx->b, 0, sizeof(ctx->b));
+
+    if (keylen > 0)
+    {
+        // the key is the first block, zero padded
+        wireguard_blake2s_update(ctx, key, keylen);
+        ctx->c = sizeof(ctx->b);
+    }
+}
+
+void wireguard_blake2s_update(wireguard_blake2s_ctx *ctx, const void *in, size_t inlen)
+{
+    const uint8_t *p = in;
+    for (size_t i = 0; i < inlen; i++)
+    {
+        if (ctx->c == sizeof(ctx->b))
+        {
+            ctx->t[0] += (uint32_t) ctx->c;
+            if (ctx->t[0] < ctx->c)
+            {
+                ctx->t[1]++;
+            }
+            blake2sCompress(ctx, false);
+            ctx->c = 0;
+        }
+        ctx->b[ctx->c++] = p[i];
+    }
+}
+
+void wireguard_blake2s_final(wireguard_blake2s_ctx *ctx, void *out)
+{
+    uint8_t *o = out;
+
+    ctx->t[0] += (uint32_t) ctx->c;
+    if (ctx->t[0] < ctx->c)
+    {
+        ctx->t[1]++;
+    }
+    memset(ctx->b + ctx->c, 0, sizeof(ctx->b) - ctx->c);
+    blake2sCompress(ctx, true);
+
+    for (size_t i = 0; i < ctx->outlen; i++)
+    {
+        o[i] = (uint8_t) (ctx->h[i >> 2] >> (8 * (i & 3)));
+    }
+    crypto_zero(ctx, sizeof(*ctx));
+}
+
+void wireguard_blake2s(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen)
+{
+    wireguard_blake2s_ctx ctx;
+    wireguard_blake2s_init(&ctx, outlen, key, keylen);
+    wireguard_blake2s_update(&ctx, in, inlen);
+    wireguard_blake2s_final(&ctx, out);
+}
+
+/*  x25519  */
+
+int wireguard_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point)
+{
+    EVP_PKEY     *priv   = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, scalar, kX25519KeyLen);
+    EVP_PKEY     *peer   = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, point, kX25519KeyLen);
+    EVP_PKEY_CTX *ctx    = priv ? EVP_PKEY_CTX_new(priv, NULL) : NULL;
+    size_t        outlen = kX25519KeyLen;
+    int           result = -1;
+
+    if (ctx && peer && EVP_PKEY_derive_init(ctx) > 0 && EVP_PKEY_derive_set_peer(ctx, peer) > 0 &&
+        EVP_PKEY_derive(ctx, out, &outlen) > 0)
+    {
+        result = 0;
+    }
+    else
+    {
+        // openssl refuses an all zero shared secret, the callers check for that value
+        memset(out, 0, kX25519KeyLen);
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer);
+    EVP_PKEY_free(priv);
+    return result;
+}
+
+/*  chacha20-poly1305  */
+
+static void makeNonce(uint8_t nonce[kAeadNonceLen], uint64_t counter)
+{
+    memset(nonce, 0, 4);
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        nonce[4 + i] = (uint8_t) (counter >> (8 * i));
+    }
+}
+
+static void aeadSeal(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                     const uint8_t *nonce, const uint8_t *key)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int             outl;
+
+    EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key, nonce);
+    if (ad_len > 0)
+    {
+        EVP_EncryptUpdate(ctx, NULL, &outl, ad, (int) ad_len);
+    }
+    if (src_len > 0)
+    {
+        EVP_EncryptUpdate(ctx, dst, &outl, src, (int) src_len);
+    }
+    EVP_EncryptFinal_ex(ctx, dst + src_len, &outl);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, kAeadTagLen, dst + src_len);
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+static bool aeadOpen(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                     const uint8_t *nonce, const uint8_t *key)
+{
+    if (src_len < kAeadTagLen)
+    {
+        return false;
+    }
+    const size_t    len = src_len - kAeadTagLen;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    uint8_t         scratch[kAeadTagLen];
+    int             outl;
+
+    EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key, nonce);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, kAeadTagLen, (void *) (src + len));
+    if (ad_len > 0)
+    {
+        EVP_DecryptUpdate(ctx, NULL, &outl, ad, (int) ad_len);
+    }
+    if (len > 0)
+    {
+        EVP_DecryptUpdate(ctx, dst, &outl, src, (int) len);
+    }
+    const bool result = EVP_DecryptFinal_ex(ctx, dst ? dst + len : scratch, &outl) > 0;
+    EVP_CIPHER_CTX_free(ctx);
+    return result;
+}
+
+void wireguard_aead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key)
+{
+    uint8_t iv[kAeadNonceLen];
+    makeNonce(iv, nonce);
+    aeadSeal(dst, src, src_len, ad, ad_len, iv, key);
+}
+
+bool wireguard_aead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key)
+{
+    uint8_t iv[kAeadNonceLen];
+    makeNonce(iv, nonce);
+    return aeadOpen(dst, src, src_len, ad, ad_len, iv, key);
+}
+
+/*  xchacha20-poly1305, the cookie reply is the only user  */
+
+#define CHACHA_QR(a, b, c, d)                                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        x[a] += x[b];                                                                                                  \
+        x[d] = rotl32(x[d] ^ x[a], 16);                                                                                \
+        x[c] += x[d];                                                                                                  \
+        x[b] = rotl32(x[b] ^ x[c], 12);                                                                                \
+        x[a] += x[b];                                                                                                  \
+        x[d] = rotl32(x[d] ^ x[a], 8);                                                                                 \
+        x[c] += x[d];                                                                                                  \
+        x[b] = rotl32(x[b] ^ x[c], 7);                                                                                 \
+    } while (0)
+
+static void hchacha20(uint8_t out[32], const uint8_t nonce[16], const uint8_t key[32])
+{
+    uint32_t x[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        x[4 + i] = U8TO32_LITTLE(key + 4 * i);
+    }
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        x[12 + i] = U8TO32_LITTLE(nonce + 4 * i);
+    }
+
+    for (unsigned int i = 0; i < 10; i++)
+    {
+        CHACHA_QR(0, 4, 8, 12);
+        CHACHA_QR(1, 5, 9, 13);
+        CHACHA_QR(2, 6, 10, 14);
+        CHACHA_QR(3, 7, 11, 15);
+        CHACHA_QR(0, 5, 10, 15);
+        CHACHA_QR(1, 6, 11, 12);
+        CHACHA_QR(2, 7, 8, 13);
+        CHACHA_QR(3, 4, 9, 14);
+    }
+
+    static const unsigned int kOutWords[8] = {0, 1, 2, 3, 12, 13, 14, 15};
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        const uint32_t w = x[kOutWords[i]];
+        out[4 * i + 0]   = (uint8_t) w;
+        out[4 * i + 1]   = (uint8_t) (w >> 8);
+        out[4 * i + 2]   = (uint8_t) (w >> 16);
+        out[4 * i + 3]   = (uint8_t) (w >> 24);
+    }
+    crypto_zero(x, sizeof(x));
+}
+
+void wireguard_xaead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key)
+{
+    uint8_t subkey[32];
+    uint8_t iv[kAeadNonceLen] = {0};
+
+    hchacha20(subkey, nonce, key);
+    memcpy(iv + 4, nonce + 16, 8);
+    aeadSeal(dst, src, src_len, ad, ad_len, iv, subkey);
+    crypto_zero(subkey, sizeof(subkey));
+}
+
+bool wireguard_xaead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key)
+{
+    uint8_t subkey[32];
+    uint8_t iv[kAeadNonceLen] = {0};
+
+    hchacha20(subkey, nonce, key);
+    memcpy(iv + 4, nonce + 16, 8);
+    const bool result = aeadOpen(dst, src, src_len, ad, ad_len, iv, subkey);
+    crypto_zero(subkey, sizeof(subkey));
+    return result;
+}
+
+/*  platform  */
+
+void wireguard_random_bytes(void *bytes, size_t size)
+{
+    if (RAND_bytes(bytes, (int) size) != 1)
+    {
+        LOGF("WireGuard: openssl could not generate random bytes");
+        exit(1);
+    }
+}
+
+uint32_t wireguard_sys_now(void)
+{
+    return gettick_ms();
+}
+
+void wireguard_tai64n_now(uint8_t *output)
+{
+    // 64 bit seconds from 1970 (plus 2^62 and the 10 leap seconds of tai64), 32 bit nano seconds, big endian
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    const uint64_t seconds = 0x400000000000000aULL + (uint64_t) tv.tv_sec;
+    const uint32_t nanos   = (uint32_t) tv.tv_usec * 1000;
+
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        output[i] = (uint8_t) (seconds >> (56 - 8 * i));
+    }
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        output[8 + i] = (uint8_t) (nanos >> (24 - 8 * i));
+    }
+}
+
+void crypto_zero(void *dest, size_t len)
+{
+    OPENSSL_cleanse(dest, len);
+}
+
+bool crypto_equal(const void *a, const void *b, size_t size)
+{
+    return CRYPTO_memcmp(a, b, size) == 0;
+}
+
+/*  data path  */
+
+wireguard_aead_ctx_t *newWireguardAeadCtx(void)
+{
+    wireguard_aead_ctx_t *ctx = globalMalloc(sizeof(wireguard_aead_ctx_t));
+    ctx->ctx                  = EVP_CIPHER_CTX_new();
+    ctx->seal                 = true;
+    return ctx;
+}
+
+void destroyWireguardAeadCtx(wireguard_aead_ctx_t *ctx)
+{
+    EVP_CIPHER_CTX_free(ctx->ctx);
+    globalFree(ctx);
+}
+
+void wireguardAeadSetKey(wireguard_aead_ctx_t *ctx, const uint8_t *key, bool seal)
+{
+    ctx->seal = seal;
+    EVP_CipherInit_ex(ctx->ctx, EVP_chacha20_poly1305(), NULL, key, NULL, seal ? 1 : 0);
+}
+
+void wireguardAeadSeal(wireguard_aead_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len, uint64_t counter)
+{
+    uint8_t iv[kAeadNonceLen];
+    int     outl;
+
+    assert(ctx->seal);
+    makeNonce(iv, counter);
+    EVP_CipherInit_ex(ctx->ctx, NULL, NULL, NULL, iv, -1);
+    if (len > 0)
+    {
+        EVP_CipherUpdate(ctx->ctx, dst, &outl, src, (int) len);
+    }
+    EVP_CipherFinal_ex(ctx->ctx, dst + len, &outl);
+    EVP_CIPHER_CTX_ctrl(ctx->ctx, EVP_CTRL_AEAD_GET_TAG, kAeadTagLen, dst + len);
+}
+
+bool wireguardAeadOpen(wireguard_aead_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len, uint64_t counter)
+{
+    uint8_t iv[kAeadNonceLen];
+    uint8_t scratch[kAeadTagLen];
+    int     outl;
+
+    assert(! ctx->seal);
+    if (len < kAeadTagLen)
+    {
+        return false;
+    }
+    len -= kAeadTagLen;
+
+    makeNonce(iv, counter);
+    EVP_CipherInit_ex(ctx->ctx, NULL, NULL, NULL, iv, -1);
+    EVP_CIPHER_CTX_ctrl(ctx->ctx, EVP_CTRL_AEAD_SET_TAG, kAeadTagLen, (void *) (src + len));
+    if (len > 0)
+    {
+        EVP_CipherUpdate(ctx->ctx, dst, &outl, src, (int) len);
+    }
+    return EVP_CipherFinal_ex(ctx->ctx, scratch, &outl) > 0;
+}
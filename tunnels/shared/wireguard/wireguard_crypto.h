@@ -0,0 +1,65 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Crypto primitives of WireGuard
+
+    the first part is what the ported protocol code (wireguard.c) expects from the crypto.h of wireguard-lwip,
+    x25519 and chacha20-poly1305 come from openssl (which picks its avx2 / avx512 / neon code at runtime),
+    blake2s and hchacha20 are small and only used by the handshake, they are plain c here
+
+    the second part is the data path, an aead context that is keyed once and then seals / opens a batch of
+    transport packets in place, only the nonce changes between the packets of a batch
+*/
+
+#define U8TO32_LITTLE(p)                                                                                               \
+    (((uint32_t) ((p)[0])) | ((uint32_t) ((p)[1]) << 8) | ((uint32_t) ((p)[2]) << 16) | ((uint32_t) ((p)[3]) << 24))
+
+typedef struct wireguard_blake2s_ctx_s
+{
+    uint8_t  b[64];
+    uint32_t h[8];
+    uint32_t t[2];
+    size_t   c;
+    size_t   outlen;
+
+} wireguard_blake2s_ctx;
+
+void wireguard_blake2s_init(wireguard_blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen);
+void wireguard_blake2s_update(wireguard_blake2s_ctx *ctx, const void *in, size_t inlen);
+void wireguard_blake2s_final(wireguard_blake2s_ctx *ctx, void *out);
+void wireguard_blake2s(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+
+// returns 0 on success
+int wireguard_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point);
+
+void wireguard_aead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key);
+bool wireguard_aead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key);
+void wireguard_xaead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key);
+bool wireguard_xaead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key);
+
+void     wireguard_random_bytes(void *bytes, size_t size);
+uint32_t wireguard_sys_now(void);
+void     wireguard_tai64n_now(uint8_t *output);
+void     crypto_zero(void *dest, size_t len);
+bool     crypto_equal(const void *a, const void *b, size_t size);
+
+typedef struct wireguard_aead_ctx_s wireguard_aead_ctx_t;
+
+wireguard_aead_ctx_t *newWireguardAeadCtx(void);
+void                  destroyWireguardAeadCtx(wireguard_aead_ctx_t *ctx);
+
+// the key stays set until the next call, seal and open must not be mixed on one key
+void wireguardAeadSetKey(wireguard_aead_ctx_t *ctx, const uint8_t *key, bool seal);
+
+// writes len bytes of cipher text and the 16 byte tag to dst, dst may be src
+void wireguardAeadSeal(wireguard_aead_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len, uint64_t counter);
+
+// len includes the tag, writes len - 16 bytes of plain text, dst may be src
+bool wireguardAeadOpen(wireguard_aead_ctx_t *ctx, uint8_t *dst, const uint8_t *src, size_t len, uint64_t counter);
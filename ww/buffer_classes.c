@@ -0,0 +1,218 @@
+#include "buffer_classes.h"
+#include "buffer_slab.h"
+#include "hmutex.h"
+#include "managers/memory_manager.h"
+#include "master_pool.h"
+#include "utils/mathutils.h"
+#include <assert.h>
+
+enum
+{
+    kRechargeBatch   = 8,
+    kMinCacheLen     = 4,
+    kCacheBudgetUnit = 8192, // bytes cached per class and thread, for each step of the ram profile
+    kMaxThreadCaches = 256 + 8 // workers and the few other threads that touch buffers
+};
+
+typedef struct size_class_s
+{
+    master_pool_t *mp;
+    size_t         block_size;
+    unsigned int   cache_cap;
+
+} size_class_t;
+
+typedef struct class_cache_s
+{
+    void       **items;
+    unsigned int len;
+    uint64_t     hits;
+    uint64_t     misses;
+
+} class_cache_t;
+
+static size_class_t   size_classes[kBufferSizeClassCount];
+static size_t         class_padding = 0;
+static hhybridmutex_t caches_mutex;
+static class_cache_t *thread_caches[kMaxThreadCaches];
+static unsigned int   thread_caches_len = 0;
+
+static _Thread_local class_cache_t *local_caches = NULL;
+
+// the class of a block size, -1 when the size is not exactly the size of a class
+static int classIndex(size_t size)
+{
+    if (class_padding == 0 || size < class_padding + kBufferSizeClassMin)
+    {
+        return -1;
+    }
+    const size_t cap = size - class_padding;
+    if ((cap & (cap - 1)) != 0 || cap > ((size_t) kBufferSizeClassMin << (kBufferSizeClassCount - 1)))
+    {
+        return -1;
+    }
+    return __builtin_ctzll(cap) - __builtin_ctzll(kBufferSizeClassMin);
+}
+
+static master_pool_item_t *createBlockHandle(struct master_pool_s *pool, void *userdata)
+{
+    (void) pool;
+    size_class_t *sc    = userdata;
+    void         *block = allocSlabSlot(sc->block_size);
+    return block != NULL ? block : globalMalloc(sc->block_size);
+}
+
+static void destroyBlockHandle(struct master_pool_s *pool, master_pool_item_t *item, void *userdata)
+{
+    (void) pool;
+    (void) userdata;
+    if (! freeSlabSlot(item))
+    {
+        globalFree(item);
+    }
+}
+
+static class_cache_t *createThreadCaches(void)
+{
+    class_cache_t *caches = globalMalloc(sizeof(class_cache_t) * kBufferSizeClassCount);
+
+    for (unsigned int i = 0; i < kBufferSizeClassCount; i++)
+    {
+        caches[i] = (class_cache_t) {.items = globalMalloc(sizeof(void *) * size_classes[i].cache_cap)};
+    }
+
+    hhybridmutex_lock(&caches_mutex);
+    if (thread_caches_len < kMaxThreadCaches)
+    {
+        thread_caches[thread_caches_len++] = caches;
+    }
+    hhybridmutex_unlock(&caches_mutex);
+
+    return caches;
+}
+
+void initBufferSizeClasses(size_t padding, unsigned int ram_profile, unsigned int workers_count)
+{
+    assert(class_padding == 0 && padding > 0);
+
+    const size_t       budget  = (size_t) ram_profile * kCacheBudgetUnit;
+    const unsigned int max_len = max(kMinCacheLen, 2 * ram_profile);
+
+    hhybridmutex_init(&caches_mutex);
+    for (unsigned int i = 0; i < kBufferSizeClassCount; i++)
+    {
+        size_class_t *sc = &(size_classes[i]);
+        sc->block_size   = ((size_t) kBufferSizeClassMin << i) + padding;
+        sc->cache_cap    = (unsigned int) min(max_len, max(kMinCacheLen, budget / sc->block_size));
+        sc->mp           = newMasterPoolWithCap(sc->cache_cap * max(workers_count, 1U));
+        installMasterPoolAllocCallbacks(sc->mp, createBlockHandle, destroyBlockHandle);
+    }
+    class_padding = padding;
+}
+
+size_t fitBufferSizeClass(size_t size)
+{
+    if (class_padding == 0)
+    {
+        return (size + 15) & ~((size_t) 15);
+    }
+    if (size <= class_padding + kBufferSizeClassMin)
+    {
+        return class_padding + kBufferSizeClassMin;
+    }
+    const size_t cap = size - class_padding;
+    if (cap > ((size_t) kBufferSizeClassMin << (kBufferSizeClassCount - 1)))
+    {
+        return (size + 15) & ~((size_t) 15);
+    }
+    return ((size_t) 1 << (64 - __builtin_clzll((unsigned long long) cap - 1))) + class_padding;
+}
+
+void *allocBufferMemory(size_t size)
+{
+    const int index = classIndex(size);
+    if (index < 0)
+    {
+        return globalMalloc(size);
+    }
+
+    if (WW_UNLIKELY(local_caches == NULL))
+    {
+        local_caches = createThreadCaches();
+    }
+    size_class_t  *sc    = &(size_classes[index]);
+    class_cache_t *cache = &(local_caches[index]);
+
+    if (WW_LIKELY(cache->len > 0))
+    {
+        cache->hits += 1;
+        return cache->items[--(cache->len)];
+    }
+
+    cache->misses += 1;
+    const unsigned int count = min(kRechargeBatch, sc->cache_cap / 2);
+    popMasterPoolItems(sc->mp, (void const **) cache->items, count, sc);
+    cache->len = count - 1;
+    return cache->items[count - 1];
+}
+
+void freeBufferMemory(void *ptr, size_t size)
+{
+    const int index = classIndex(size);
+    if (index < 0)
+    {
+        globalFree(ptr);
+        return;
+    }
+
+    if (WW_UNLIKELY(local_caches == NULL))
+    {
+        local_caches = createThreadCaches();
+    }
+    size_class_t  *sc    = &(size_classes[index]);
+    class_cache_t *cache = &(local_caches[index]);
+
+    if (WW_UNLIKELY(cache->len == sc->cache_cap))
+    {
+        const unsigned int spill = sc->cache_cap / 2;
+        reuseMasterPoolItems(sc->mp, &(cache->items[cache->len - spill]), spill, sc);
+        cache->len -= spill;
+    }
+    cache->items[(cache->len)++] = ptr;
+}
+
+void shrinkBufferSizeClasses(void)
+{
+    if (class_padding == 0)
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < kBufferSizeClassCount; i++)
+    {
+        size_class_t *sc = &(size_classes[i]);
+        if (local_caches != NULL && local_caches[i].len > 0)
+        {
+            reuseMasterPoolItems(sc->mp, local_caches[i].items, local_caches[i].len, sc);
+            local_caches[i].len = 0;
+        }
+        drainMasterPool(sc->mp, sc);
+    }
+}
+
+// counters of other threads are read without a lock, they are only for reporting
+buffer_size_class_stats_t getBufferSizeClassStats(unsigned int class_index)
+{
+    assert(class_index < kBufferSizeClassCount);
+
+    buffer_size_class_stats_t stats = {.block_size = size_classes[class_index].block_size};
+
+    hhybridmutex_lock(&caches_mutex);
+    for (unsigned int i = 0; i < thread_caches_len; i++)
+    {
+        stats.hits += thread_caches[i][class_index].hits;
+        stats.misses += thread_caches[i][class_index].misses;
+    }
+    hhybridmutex_unlock(&caches_mutex);
+
+    return stats;
+}
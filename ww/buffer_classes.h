@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Size classes for the memory of buffers
+
+    the memory block of every shift buffer is taken from here, blocks are grouped in power of two classes
+    by capacity (256B up to 256KB, plus the fixed left and right padding of a shift buffer)
+
+    each thread keeps a small free list per class, a list that runs empty is refilled from the master pool
+    of its class and a list that runs full spills half of it there, so a buffer that is freed on another
+    worker is not lost; the master pool of a class is sized for the spills of every worker, not for one list;
+    blocks of the large and small buffer pool sizes come from the slabs (buffer_slab.h)
+
+    shift buffers round their size up with fitBufferSizeClass, so expand() moves a buffer to the next class
+    and the old block goes back to its list instead of the allocator
+
+    blocks bigger than the largest class are allocated and freed one by one, their size is still rounded up
+    to 16 bytes so the reference counter at the end of a shift buffer stays aligned
+
+    hits are the blocks served from the thread's own list, misses are the ones that went to the master pool,
+    they tell which classes are used and help to pick the right sizes for a node, the memory budget logs them
+*/
+
+enum
+{
+    kBufferSizeClassMin   = 1U << 8,
+    kBufferSizeClassCount = 11 // up to 256KB
+};
+
+typedef struct buffer_size_class_stats_s
+{
+    size_t   block_size;
+    uint64_t hits;
+    uint64_t misses;
+
+} buffer_size_class_stats_t;
+
+// padding is the memory a shift buffer needs on top of its capacity, called once before any buffer is created
+void   initBufferSizeClasses(size_t padding, unsigned int ram_profile, unsigned int workers_count);
+size_t fitBufferSizeClass(size_t size);
+void  *allocBufferMemory(size_t size);
+void   freeBufferMemory(void *ptr, size_t size);
+
+// gives the blocks cached by the calling thread back, and frees the ones kept by the master pools
+void                      shrinkBufferSizeClasses(void);
+buffer_size_class_stats_t getBufferSizeClassStats(unsigned int class_index);
@@ -1,4 +1,6 @@
 #include "buffer_pool.h"
+#include "buffer_classes.h"
+#include "buffer_slab.h"
 #include "hplatform.h"
 #ifdef DEBUG
 #include "loggers/network_logger.h"
@@ -32,9 +34,7 @@ struct buffer_pool_s
     unsigned int    large_buffers_default_size;
     unsigned int    small_buffers_default_size;
     generic_pool_t *shift_buffer_pool;
-#if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    atomic_size_t in_use;
-#endif
+    long            in_use; // popped minus reused on this worker, buffers move between workers so it can go below 0
     master_pool_t   *large_buffers_mp;
     shift_buffer_t **large_buffers;
     master_pool_t   *small_buffers_mp;
@@ -97,7 +97,7 @@ static void reChargeLargeBuffers(buffer_pool_t *pool)
 
     pool->large_buffers_container_len += increase;
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    LOGD("BufferPool: allocated %d new large buffers, %zu are in use", increase, pool->in_use);
+    LOGD("BufferPool: allocated %d new large buffers, %ld are in use", increase, pool->in_use);
 #endif
 }
 
@@ -110,7 +110,7 @@ static void reChargeSmallBuffers(buffer_pool_t *pool)
 
     pool->small_buffers_container_len += increase;
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    LOGD("BufferPool: allocated %d new small buffers, %zu are in use", increase, pool->in_use);
+    LOGD("BufferPool: allocated %d new small buffers, %ld are in use", increase, pool->in_use);
 #endif
 }
 
@@ -137,7 +137,7 @@ static void shrinkLargeBuffers(buffer_pool_t *pool)
     pool->large_buffers_container_len -= decrease;
 
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    LOGD("BufferPool: freed %d large buffers, %zu are in use", decrease, pool->in_use);
+    LOGD("BufferPool: freed %d large buffers, %ld are in use", decrease, pool->in_use);
 #endif
 }
 
@@ -152,7 +152,7 @@ static void shrinkSmallBuffers(buffer_pool_t *pool)
     pool->small_buffers_container_len -= decrease;
 
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    LOGD("BufferPool: freed %d small buffers, %zu are in use", decrease, pool->in_use);
+    LOGD("BufferPool: freed %d small buffers, %ld are in use", decrease, pool->in_use);
 #endif
 }
 
@@ -161,9 +161,7 @@ shift_buffer_t *popBuffer(buffer_pool_t *pool)
 #if defined(DEBUG) && defined(BYPASS_BUFFERPOOL)
     return newShiftBuffer(pool->shift_buffer_pool,pool->large_buffers_default_size);
 #endif
-#if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
     pool->in_use += 1;
-#endif
 
     if (WW_LIKELY(pool->large_buffers_container_len > 0))
     {
@@ -181,9 +179,7 @@ shift_buffer_t *popSmallBuffer(buffer_pool_t *pool)
 #if defined(DEBUG) && defined(BYPASS_BUFFERPOOL)
     return newShiftBuffer(pool->shift_buffer_pool,pool->small_buffers_default_size);
 #endif
-#if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
     pool->in_use += 1;
-#endif
 
     if (WW_LIKELY(pool->small_buffers_container_len > 0))
     {
@@ -196,6 +192,21 @@ shift_buffer_t *popSmallBuffer(buffer_pool_t *pool)
     return pool->small_buffers[pool->small_buffers_container_len];
 }
 
+// for nodes that know how big their records are (tls, http2, mux), the buffer holds size bytes without expanding
+shift_buffer_t *popSizedBuffer(buffer_pool_t *pool, unsigned int size)
+{
+    if (size <= pool->small_buffers_default_size)
+    {
+        return popSmallBuffer(pool);
+    }
+    if (size <= pool->large_buffers_default_size)
+    {
+        return popBuffer(pool);
+    }
+    pool->in_use += 1;
+    return newShiftBuffer(pool->shift_buffer_pool, size);
+}
+
 void reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b)
 {
     
@@ -209,9 +220,7 @@ void reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b)
         destroyShiftBuffer(pool->shift_buffer_pool, b);
         return;
     }
-#if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
     pool->in_use -= 1;
-#endif
     if (isLargeBuffer(b))
     {
         if (WW_UNLIKELY(pool->large_buffers_container_len > pool->free_threshold))
@@ -232,6 +241,54 @@ void reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b)
     }
 }
 
+// gives every cached buffer back to the allocator, the pool recharges when it is used again
+void shrinkBufferPool(buffer_pool_t *pool)
+{
+    if (pool->large_buffers_container_len > 0)
+    {
+        reuseMasterPoolItems(pool->large_buffers_mp, (void **) pool->large_buffers, pool->large_buffers_container_len,
+                             pool);
+        pool->large_buffers_container_len = 0;
+    }
+    if (pool->small_buffers_container_len > 0)
+    {
+        reuseMasterPoolItems(pool->small_buffers_mp, (void **) pool->small_buffers, pool->small_buffers_container_len,
+                             pool);
+        pool->small_buffers_container_len = 0;
+    }
+    drainMasterPool(pool->large_buffers_mp, pool);
+    drainMasterPool(pool->small_buffers_mp, pool);
+    shrinkBufferSizeClasses();
+}
+
+// the cached buffers go back to the master pools, buffers still in use must not be reused to this pool anymore
+void destroyBufferPool(buffer_pool_t *pool)
+{
+    if (pool->large_buffers_container_len > 0)
+    {
+        reuseMasterPoolItems(pool->large_buffers_mp, (void **) pool->large_buffers, pool->large_buffers_container_len,
+                             pool);
+    }
+    if (pool->small_buffers_container_len > 0)
+    {
+        reuseMasterPoolItems(pool->small_buffers_mp, (void **) pool->small_buffers, pool->small_buffers_container_len,
+                             pool);
+    }
+    globalFree(pool->large_buffers);
+    globalFree(pool->small_buffers);
+    globalFree(pool);
+}
+
+long getBufferPoolInUse(buffer_pool_t *pool)
+{
+    return pool->in_use;
+}
+
+unsigned int getBufferPoolCachedCount(buffer_pool_t *pool)
+{
+    return pool->large_buffers_container_len + pool->small_buffers_container_len;
+}
+
 shift_buffer_t *appendBufferMerge(buffer_pool_t *pool, shift_buffer_t *restrict b1, shift_buffer_t *restrict b2)
 {
     unsigned int b1_length = bufLen(b1);
@@ -268,9 +325,7 @@ static buffer_pool_t *allocBufferPool(struct master_pool_s *mp_large, struct mas
         .small_buffers_default_size = small_buffer_size,
         .free_threshold             = max(bufcount / 2, (bufcount * 2) / 3),
         .shift_buffer_pool          = sb_pool,
-#if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-        .in_use = 0,
-#endif
+        .in_use                     = 0,
         .large_buffers_mp = mp_large,
         .large_buffers    = globalMalloc(container_len),
         .small_buffers_mp = mp_small,
@@ -289,6 +344,14 @@ static buffer_pool_t *allocBufferPool(struct master_pool_s *mp_large, struct mas
     return ptr_pool;
 }
 
+// sets up the size classes of buffer memory and the slab region that backs the large and small buffers
+void initBufferPoolMemory(unsigned int slots_per_class, size_t slab_limit)
+{
+    initBufferSizeClasses(getShiftBufferPaddingSize(), RAM_PROFILE, WORKERS_COUNT);
+    initBufferSlabs(calcShiftBufferAllocSize(LARGE_BUFFER_SIZE), calcShiftBufferAllocSize(SMALL_BUFFER_SIZE),
+                    slots_per_class, slab_limit);
+}
+
 buffer_pool_t *createBufferPool(struct master_pool_s *mp_large, struct master_pool_s *mp_small, generic_pool_t *sb_pool,
                                 unsigned int pool_width)
 {
@@ -16,6 +16,9 @@
 
     - appendBufferMerge: concats 2 buffers to 1 in a efficient way, and the loser buffer is reused
 
+    - popSizedBuffer: a buffer that already has room for a known size, sizes above the large buffer size take
+      their memory from the size classes (buffer_classes.h) instead of growing a large buffer with expand
+
 
     This is the most memory consuming part of the program, and also the preallocation length really
     depends on where you want to use this program, on a mobile phone or on a 16 core server?
@@ -29,13 +32,19 @@
 
 typedef struct buffer_pool_s buffer_pool_t;
 
+void            initBufferPoolMemory(unsigned int slots_per_class, size_t slab_limit);
 buffer_pool_t *createBufferPool(struct master_pool_s *mp_large, struct master_pool_s *mp_small, generic_pool_t *sb_pool,
                                 unsigned int pool_width);
 shift_buffer_t *popBuffer(buffer_pool_t *pool);
 shift_buffer_t *popSmallBuffer(buffer_pool_t *pool);
+shift_buffer_t *popSizedBuffer(buffer_pool_t *pool, unsigned int size);
 shift_buffer_t *appendBufferMerge(buffer_pool_t *pool, shift_buffer_t *restrict b1, shift_buffer_t *restrict b2);
 void            reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b);
 // void            reuseBufferThreadSafe(shift_buffer_t *buf);
+void            shrinkBufferPool(buffer_pool_t *pool);
+void            destroyBufferPool(buffer_pool_t *pool);
+long            getBufferPoolInUse(buffer_pool_t *pool);
+unsigned int    getBufferPoolCachedCount(buffer_pool_t *pool);
 unsigned int getBufferPoolLargeBufferDefaultSize(void);
 unsigned int getBufferPoolSmallBufferDefaultSize(void);
 bool         isLargeBuffer(shift_buffer_t *buf);
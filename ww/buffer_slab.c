@@ -0,0 +1,264 @@
+#include "buffer_slab.h"
+#include "hmutex.h"
+#include "hplatform.h"
+#include "loggers/core_logger.h"
+#include "managers/memory_manager.h"
+#include <stdbool.h>
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(OS_LINUX)
+#include <sys/mman.h>
+#endif
+
+enum
+{
+    kSlabAlign     = 1U << 21, // 2MB, size of a huge page on x86-64 and arm64
+    kSlotAlign     = 64,
+    kPageSize      = 4096,
+    kSlabClasses   = 2,
+    kPrefaultBatch = 1U << 18, // bytes of free slots faulted in together when a released slot is taken
+    kReleaseBatch  = 256       // slots given back to the kernel per call, the class is locked meanwhile
+};
+
+typedef struct slab_class_s
+{
+    hhybridmutex_t mutex;
+    uint8_t       *base;
+    size_t         slot_size;
+    size_t         alloc_size; // the size that is served from this class
+    uint32_t      *free_slots;   // stack of free slot indexes
+    unsigned int   free_len;
+    unsigned int   released_len; // free_slots below this are not faulted in (never used or released)
+    unsigned int   slots;
+
+} slab_class_t;
+
+static slab_class_t slab_classes[kSlabClasses];
+static uint8_t     *region_begin   = NULL;
+static uint8_t     *region_end     = NULL;
+static bool         region_hugetlb = false;
+
+#if defined(OS_LINUX)
+
+static uint8_t *reserveRegion(size_t size)
+{
+#ifdef MAP_HUGETLB
+    // no MAP_NORESERVE here, it would let the mapping succeed without enough reserved pages and fault later
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+    {
+        LOGD("BufferSlab: reserved %zu MB of hugetlb pages", size >> 20);
+        region_hugetlb = true;
+        return ptr;
+    }
+#endif
+
+    // no reserved huge pages, over reserve to align it ourselves and ask for transparent huge pages
+    uint8_t *raw =
+        mmap(NULL, size + kSlabAlign, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return NULL;
+    }
+    uint8_t *aligned = (uint8_t *) (((uintptr_t) raw + kSlabAlign - 1) & ~((uintptr_t) kSlabAlign - 1));
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    LOGD("BufferSlab: reserved %zu MB, transparent huge pages requested", size >> 20);
+    return aligned;
+}
+
+// faults the pages of a free slot in, the caller holds the class lock so the slot can be written
+static void faultSlot(slab_class_t *c, uint32_t slot)
+{
+    uint8_t *p = c->base + ((size_t) slot * c->slot_size);
+
+#ifdef MADV_POPULATE_WRITE
+    uint8_t *begin = (uint8_t *) ((uintptr_t) p & ~((uintptr_t) kPageSize - 1));
+    if (madvise(begin, (size_t) (p + c->slot_size - begin), MADV_POPULATE_WRITE) == 0)
+    {
+        return;
+    }
+#endif
+    for (size_t offset = 0; offset < c->slot_size; offset += kPageSize)
+    {
+        p[offset] = 0;
+    }
+    p[c->slot_size - 1] = 0;
+}
+
+// drops the pages that lie fully inside a free slot, hugetlb pages can only be dropped whole so they are kept
+static void releaseSlot(slab_class_t *c, uint32_t slot)
+{
+    uint8_t  *p     = c->base + ((size_t) slot * c->slot_size);
+    uintptr_t begin = ((uintptr_t) p + kPageSize - 1) & ~((uintptr_t) kPageSize - 1);
+    uintptr_t end   = ((uintptr_t) p + c->slot_size) & ~((uintptr_t) kPageSize - 1);
+
+    if (end > begin)
+    {
+        madvise((void *) begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+#else
+
+static uint8_t *reserveRegion(size_t size)
+{
+    (void) size;
+    return NULL;
+}
+
+static void faultSlot(slab_class_t *c, uint32_t slot)
+{
+    (void) c;
+    (void) slot;
+}
+
+static void releaseSlot(slab_class_t *c, uint32_t slot)
+{
+    (void) c;
+    (void) slot;
+}
+
+#endif
+
+static size_t slabSize(size_t slot_size, unsigned int slots)
+{
+    return ((slot_size * slots) + kSlabAlign - 1) & ~((size_t) kSlabAlign - 1);
+}
+
+static void initClass(slab_class_t *c, uint8_t *base, size_t alloc_size, unsigned int slots)
+{
+    c->base       = base;
+    c->alloc_size = alloc_size;
+    c->slot_size  = (alloc_size + kSlotAlign - 1) & ~((size_t) kSlotAlign - 1);
+    c->slots        = slots;
+    c->free_len     = slots;
+    c->released_len = slots;
+    c->free_slots   = globalMalloc(sizeof(uint32_t) * slots);
+    hhybridmutex_init(&(c->mutex));
+
+    // lower slots are handed out first, so the pages in use stay together
+    for (unsigned int i = 0; i < slots; i++)
+    {
+        c->free_slots[i] = slots - 1 - i;
+    }
+}
+
+void initBufferSlabs(size_t large_size, size_t small_size, unsigned int slots_per_class, size_t max_bytes)
+{
+    assert(region_begin == NULL);
+
+    const size_t sizes[kSlabClasses] = {large_size, small_size};
+    size_t       slot_sizes          = 0;
+    size_t       total               = 0;
+
+    for (unsigned int i = 0; i < kSlabClasses; i++)
+    {
+        slot_sizes += (sizes[i] + kSlotAlign - 1) & ~((size_t) kSlotAlign - 1);
+    }
+    if (max_bytes / slot_sizes < slots_per_class)
+    {
+        slots_per_class = (unsigned int) (max_bytes / slot_sizes);
+    }
+    if (slots_per_class == 0)
+    {
+        LOGD("BufferSlab: disabled, buffers are allocated one by one");
+        return;
+    }
+
+    for (unsigned int i = 0; i < kSlabClasses; i++)
+    {
+        total += slabSize((sizes[i] + kSlotAlign - 1) & ~((size_t) kSlotAlign - 1), slots_per_class);
+    }
+
+    uint8_t *region = reserveRegion(total);
+    if (region == NULL)
+    {
+        LOGW("BufferSlab: could not reserve %zu MB for buffers, they are allocated one by one", total >> 20);
+        return;
+    }
+
+    uint8_t *base = region;
+    for (unsigned int i = 0; i < kSlabClasses; i++)
+    {
+        initClass(&(slab_classes[i]), base, sizes[i], slots_per_class);
+        base += slabSize(slab_classes[i].slot_size, slots_per_class);
+    }
+    region_begin = region;
+    region_end   = region + total;
+}
+
+void *allocSlabSlot(size_t size)
+{
+    for (unsigned int i = 0; i < kSlabClasses; i++)
+    {
+        slab_class_t *c = &(slab_classes[i]);
+        if (c->alloc_size != size)
+        {
+            continue;
+        }
+        void *ptr = NULL;
+        hhybridmutex_lock(&(c->mutex));
+        if (c->free_len > 0)
+        {
+            const unsigned int index = --(c->free_len);
+            ptr                      = c->base + ((size_t) c->free_slots[index] * c->slot_size);
+
+            // the slot and the next released ones are faulted in together, instead of a fault per page later
+            if (index < c->released_len)
+            {
+                unsigned int low = index + 1;
+                for (size_t bytes = 0; low > 0 && bytes < kPrefaultBatch; bytes += c->slot_size)
+                {
+                    faultSlot(c, c->free_slots[--low]);
+                }
+                c->released_len = low;
+            }
+        }
+        hhybridmutex_unlock(&(c->mutex));
+        return ptr;
+    }
+    return NULL;
+}
+
+bool freeSlabSlot(void *ptr)
+{
+    uint8_t *p = ptr;
+    if (p < region_begin || p >= region_end)
+    {
+        return false;
+    }
+
+    slab_class_t *c = &(slab_classes[0]);
+    if (p >= slab_classes[1].base)
+    {
+        c = &(slab_classes[1]);
+    }
+    hhybridmutex_lock(&(c->mutex));
+    c->free_slots[(c->free_len)++] = (uint32_t) ((size_t) (p - c->base) / c->slot_size);
+    hhybridmutex_unlock(&(c->mutex));
+    return true;
+}
+
+void releaseFreeSlabSlots(void)
+{
+    if (region_begin == NULL || region_hugetlb)
+    {
+        return;
+    }
+
+    for (unsigned int i = 0; i < kSlabClasses; i++)
+    {
+        slab_class_t *c = &(slab_classes[i]);
+        hhybridmutex_lock(&(c->mutex));
+        unsigned int count = 0;
+        while (c->released_len < c->free_len && count++ < kReleaseBatch)
+        {
+            releaseSlot(c, c->free_slots[(c->released_len)++]);
+        }
+        hhybridmutex_unlock(&(c->mutex));
+    }
+}
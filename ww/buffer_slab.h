@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Slab regions for the memory of pooled buffers
+
+    buffer pools keep recycling buffers of 2 fixed sizes (large and small), the memory of those buffers is
+    carved out of one region that is reserved at startup, aligned to 2MB and backed by huge pages when the
+    system has them (explicit hugetlb pages first, transparent huge pages otherwise)
+
+    the region is capped by max_bytes (core.json "buffer-slab-limit", 64MB by default, 0 disables it), slots
+    past the cap come from the allocator as before
+
+    nothing is faulted in at startup, when a slot that is not faulted in is taken, it is faulted in together
+    with the next free slots (one madvise or a write per page), instead of page faults while the buffer is filled
+
+    releaseFreeSlabSlots gives the pages of free slots back to the kernel (MADV_DONTNEED), the memory budget
+    calls it under pressure, hugetlb pages are kept since they can only be dropped whole; faulted in slots of
+    a transparent huge page region are resident memory and count toward the budget watermarks, hugetlb pages
+    are not part of rss and do not
+
+    a slab only holds the bytes of the buffers, the free slot lists live in normal memory
+
+    the size classes (buffer_classes.h) take their blocks from here first, allocSlabSlot returns NULL for
+    other sizes or once a slab is out of slots, freeSlabSlot returns false for pointers outside the region
+
+    regions are only used on linux, other platforms always get NULL
+*/
+
+// called once before the workers are created
+void  initBufferSlabs(size_t large_size, size_t small_size, unsigned int slots_per_class, size_t max_bytes);
+void *allocSlabSlot(size_t size);
+bool  freeSlabSlot(void *ptr);
+void  releaseFreeSlabSlots(void);
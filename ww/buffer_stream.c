@@ -81,6 +81,43 @@ shift_buffer_t *bufferStreamIdealRead(buffer_stream_t *self)
     return container;
 }
 
+// drops bytes from the front without allocating a buffer for them
+void bufferStreamSkip(buffer_stream_t *self, size_t bytes)
+{
+    assert(self->size >= bytes);
+    self->size -= bytes;
+
+    while (bytes > 0)
+    {
+        shift_buffer_t *front = *queue_front(&self->q);
+        size_t          blen  = bufLen(front);
+        if (blen > bytes)
+        {
+            shiftr(front, bytes);
+            return;
+        }
+        queue_pop_front(&self->q);
+        reuseBuffer(self->pool, front);
+        bytes -= blen;
+    }
+}
+
+// the bytes must lie in the first buffer, they are returned as a shallow slice of it instead of a copy
+shift_buffer_t *bufferStreamShallowRead(buffer_stream_t *self, generic_pool_t *sb_pool, size_t bytes)
+{
+    assert(self->size >= bytes && bytes > 0);
+    shift_buffer_t *front = *queue_front(&self->q);
+    assert(bufLen(front) >= bytes);
+    self->size -= bytes;
+
+    if (bufLen(front) == bytes)
+    {
+        queue_pop_front(&self->q);
+        return front;
+    }
+    return shallowSliceBuffer(sb_pool, front, (unsigned int) bytes);
+}
+
 uint8_t bufferStreamViewByteAt(buffer_stream_t *self, size_t at)
 {
     assert(self->size > at && self->size != 0);
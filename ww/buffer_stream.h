@@ -33,6 +33,8 @@ void             destroyBufferStream(buffer_stream_t *self);
 void             bufferStreamPush(buffer_stream_t *self, shift_buffer_t *buf);
 shift_buffer_t  *bufferStreamRead(buffer_stream_t *self, size_t bytes);
 shift_buffer_t  *bufferStreamIdealRead(buffer_stream_t *self);
+void             bufferStreamSkip(buffer_stream_t *self, size_t bytes);
+shift_buffer_t  *bufferStreamShallowRead(buffer_stream_t *self, generic_pool_t *sb_pool, size_t bytes);
 uint8_t          bufferStreamViewByteAt(buffer_stream_t *self, size_t at);
 void             bufferStreamViewBytesAt(buffer_stream_t *self, size_t at, uint8_t *buf, size_t len);
 
@@ -41,6 +43,13 @@ static inline size_t bufferStreamLen(buffer_stream_t *self)
     return self->size;
 }
 
+// the first buffer in the stream, it stays in the stream
+static inline shift_buffer_t *bufferStreamFront(buffer_stream_t *self)
+{
+    assert(self->size > 0);
+    return *queue_front(&self->q);
+}
+
 static inline shift_buffer_t *bufferStreamFullRead(buffer_stream_t *self)
 {
     return bufferStreamRead(self, bufferStreamLen(self));
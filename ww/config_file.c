@@ -1,5 +1,6 @@
 #include "config_file.h"
 #include "cJSON.h"
+#include "config_image.h"
 #include "ww.h"
 #include "loggers/core_logger.h" //NOLINT
 #include "utils/fileutils.h"
@@ -25,6 +26,10 @@ void destroyConfigFile(config_file_t *state)
     {
         globalFree(state->author);
     }
+    if (state->image != NULL)
+    {
+        destroyConfigImage(state->image);
+    }
     hmutex_destroy(&(state->guard));
 
     globalFree(state);
@@ -43,6 +48,11 @@ void releaseUpdateLock(config_file_t *state)
 // only use if you acquired lock before
 void unsafeCommitChanges(config_file_t *state)
 {
+    if (state->compiled)
+    {
+        LOGW("WriteFile Error: config \"%s\" is a compiled image, changes are kept in memory only", state->file_path);
+        return;
+    }
     char     *string      = cJSON_PrintBuffered(state->root, (int) ((state->file_prebuffer_size) * 2), true);
     size_t    len         = strlen(string);
     const int max_retries = 3;
@@ -11,10 +11,13 @@ typedef struct config_file_s
     int           config_version;
     int           core_minimum_version;
     bool          encrypted;
+    bool          compiled; // loaded from a config image, see config_image.h
     struct cJSON *root;
     struct cJSON *nodes;
     size_t        file_prebuffer_size;
     hmutex_t      guard;
+
+    struct config_image_s *image; // the mapped image of a compiled config, NULL for json
 } config_file_t;
 
 // a config is loaded in ram and can be updated continously by other threads forexample when a user
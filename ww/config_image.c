@@ -0,0 +1,670 @@
+#include "config_image.h"
+#include "cJSON.h"
+#include "library_loader.h"
+#include "loggers/core_logger.h" //NOLINT
+#include "utils/hashutils.h"
+#include "utils/jsonutils.h"
+#include "ww.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+    layout:   [header] [nodes] [values] [strings] [data]
+
+    every section starts 8 byte aligned, strings are referenced by their offset in the string section and
+    values by their index in the value section, children of a value are always stored after their parent,
+    the data section holds the pre-parsed blocks of the nodes, each one 8 byte aligned
+*/
+
+enum
+{
+    kImageFormatVersion = 2,
+    kImageByteOrderMark = 0x01020304,
+    kImageNone          = 0xFFFFFFFF,
+    kImageMaxDepth      = 64,
+    kImageSectionAlign  = 8
+};
+
+static const uint8_t kImageMagic[8] = {'W', 'W', 'C', 'O', 'N', 'F', 'I', 'G'};
+
+enum config_image_value_type
+{
+    kImageValueNull,
+    kImageValueFalse,
+    kImageValueTrue,
+    kImageValueNumber,
+    kImageValueString,
+    kImageValueArray,
+    kImageValueObject
+};
+
+typedef struct config_image_header_s
+{
+    uint8_t  magic[8];
+    uint32_t format_version;
+    uint32_t byte_order;
+    uint32_t total_size;
+    uint32_t name;
+    uint32_t author;
+    int32_t  config_version;
+    int32_t  core_minimum_version;
+    uint32_t encrypted;
+    uint32_t nodes_offset;
+    uint32_t nodes_count;
+    uint32_t values_offset;
+    uint32_t values_count;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    uint32_t data_offset;
+    uint32_t data_size;
+
+} config_image_header_t;
+
+typedef struct config_image_node_s
+{
+    hash_t   hash_name;
+    hash_t   hash_type;
+    hash_t   hash_next;
+    uint32_t name;
+    uint32_t type;
+    uint32_t next;
+    uint32_t next_index; // kImageNone for the last node of a chain
+    uint32_t version;
+    uint32_t settings;
+    uint32_t data; // offset in the data section, kImageNone if the library pre-parsed nothing
+    uint32_t data_len;
+
+} config_image_node_t;
+
+typedef struct config_image_value_s
+{
+    uint32_t type;
+    uint32_t key;
+    uint32_t string;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t reserved;
+    double   number;
+
+} config_image_value_t;
+
+typedef struct image_section_s
+{
+    uint8_t *data;
+    size_t   len;
+    size_t   cap;
+
+} image_section_t;
+
+/*
+    Compile side
+*/
+
+static size_t alignSize(size_t len)
+{
+    return (len + (kImageSectionAlign - 1)) & ~((size_t) kImageSectionAlign - 1);
+}
+
+static size_t sectionReserve(image_section_t *section, size_t len)
+{
+    if (section->len + len > section->cap)
+    {
+        size_t new_cap = section->cap == 0 ? 4096 : section->cap;
+        while (new_cap < section->len + len)
+        {
+            new_cap *= 2;
+        }
+        section->data = globalRealloc(section->data, new_cap);
+        section->cap  = new_cap;
+    }
+    size_t offset = section->len;
+    memset(section->data + offset, 0, len);
+    section->len += len;
+    return offset;
+}
+
+static uint32_t sectionAddString(image_section_t *strings, const char *str)
+{
+    if (str == NULL)
+    {
+        return kImageNone;
+    }
+    const uint32_t len    = (uint32_t) strlen(str);
+    const size_t   offset = sectionReserve(strings, sizeof(uint32_t) + len + 1);
+    memcpy(strings->data + offset, &len, sizeof(len));
+    memcpy(strings->data + offset + sizeof(uint32_t), str, len + 1);
+    return (uint32_t) offset;
+}
+
+static config_image_value_t *sectionValueAt(image_section_t *values, uint32_t index)
+{
+    return (config_image_value_t *) (values->data + ((size_t) index * sizeof(config_image_value_t)));
+}
+
+static uint32_t compileValue(image_section_t *values, image_section_t *strings, const cJSON *item)
+{
+    const uint32_t index = (uint32_t) (sectionReserve(values, sizeof(config_image_value_t)) /
+                                       sizeof(config_image_value_t));
+
+    config_image_value_t value = {.key          = sectionAddString(strings, item->string),
+                                  .string       = kImageNone,
+                                  .first_child  = kImageNone,
+                                  .next_sibling = kImageNone};
+
+    if (cJSON_IsNull(item))
+    {
+        value.type = kImageValueNull;
+    }
+    else if (cJSON_IsFalse(item))
+    {
+        value.type = kImageValueFalse;
+    }
+    else if (cJSON_IsTrue(item))
+    {
+        value.type = kImageValueTrue;
+    }
+    else if (cJSON_IsNumber(item))
+    {
+        value.type   = kImageValueNumber;
+        value.number = item->valuedouble;
+    }
+    else if (cJSON_IsString(item))
+    {
+        value.type   = kImageValueString;
+        value.string = sectionAddString(strings, item->valuestring);
+    }
+    else
+    {
+        value.type = cJSON_IsArray(item) ? kImageValueArray : kImageValueObject;
+
+        uint32_t     prev  = kImageNone;
+        const cJSON *child = NULL;
+        cJSON_ArrayForEach(child, item)
+        {
+            uint32_t child_index = compileValue(values, strings, child);
+            if (prev == kImageNone)
+            {
+                value.first_child = child_index;
+            }
+            else
+            {
+                sectionValueAt(values, prev)->next_sibling = child_index;
+            }
+            prev = child_index;
+        }
+    }
+    // the section may have moved while children were added, the parent links next_sibling after this returns
+    *sectionValueAt(values, index) = value;
+    return index;
+}
+
+// the pre-parsed block of the node library, it is taken out of the settings before they are stored
+static uint32_t compileNodeData(image_section_t *data, const config_image_node_t *node, cJSON *settings,
+                                uint32_t *len)
+{
+    const tunnel_lib_t lib = loadTunnelLibByHash(node->hash_type);
+    if (lib.compileHandle == NULL || settings == NULL)
+    {
+        return kImageNone;
+    }
+    size_t block_len = 0;
+    void  *block     = lib.compileHandle(settings, &block_len);
+    if (block == NULL)
+    {
+        return kImageNone;
+    }
+    const size_t offset = sectionReserve(data, alignSize(block_len));
+    memcpy(data->data + offset, block, block_len);
+    globalFree(block);
+    *len = (uint32_t) block_len;
+    return (uint32_t) offset;
+}
+
+bool compileConfigFile(const config_file_t *cfile, const char *out_path)
+{
+    const unsigned int count   = (unsigned int) cJSON_GetArraySize(cfile->nodes);
+    image_section_t    nodes   = {0};
+    image_section_t    values  = {0};
+    image_section_t    strings = {0};
+    image_section_t    data    = {0};
+
+    config_image_header_t header = {.format_version       = kImageFormatVersion,
+                                    .byte_order           = kImageByteOrderMark,
+                                    .name                 = sectionAddString(&strings, cfile->name),
+                                    .author               = sectionAddString(&strings, cfile->author),
+                                    .config_version       = cfile->config_version,
+                                    .core_minimum_version = cfile->core_minimum_version,
+                                    .encrypted            = cfile->encrypted,
+                                    .nodes_count          = count};
+    memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+
+    sectionReserve(&nodes, sizeof(config_image_node_t) * count);
+    config_image_node_t *image_nodes = (config_image_node_t *) nodes.data;
+
+    unsigned int i         = 0;
+    cJSON       *node_json = NULL;
+    cJSON_ArrayForEach(node_json, cfile->nodes)
+    {
+        const char  *name     = cJSON_GetObjectItemCaseSensitive(node_json, "name")->valuestring;
+        const char  *type     = cJSON_GetObjectItemCaseSensitive(node_json, "type")->valuestring;
+        const cJSON *next     = cJSON_GetObjectItemCaseSensitive(node_json, "next");
+        cJSON       *settings = cJSON_GetObjectItemCaseSensitive(node_json, "settings");
+        int          version  = 0;
+        getIntFromJsonObjectOrDefault(&version, node_json, "version", 0);
+
+        config_image_node_t node = {.hash_name  = CALC_HASH_BYTES(name, strlen(name)),
+                                    .hash_type  = CALC_HASH_BYTES(type, strlen(type)),
+                                    .hash_next  = next != NULL ? CALC_HASH_BYTES(next->valuestring,
+                                                                                 strlen(next->valuestring))
+                                                               : 0,
+                                    .name       = sectionAddString(&strings, name),
+                                    .type       = sectionAddString(&strings, type),
+                                    .next       = next != NULL ? sectionAddString(&strings, next->valuestring)
+                                                               : kImageNone,
+                                    .next_index = kImageNone,
+                                    .version    = (uint32_t) version};
+
+        node.data     = compileNodeData(&data, &node, settings, &node.data_len);
+        node.settings = settings != NULL ? compileValue(&values, &strings, settings) : kImageNone;
+
+        image_nodes[i++] = node;
+    }
+
+    // checkConfigFile made sure every next exists and is referenced once
+    for (i = 0; i < count; i++)
+    {
+        for (unsigned int j = 0; j < count && image_nodes[i].hash_next != 0; j++)
+        {
+            if (image_nodes[j].hash_name == image_nodes[i].hash_next)
+            {
+                image_nodes[i].next_index = j;
+                break;
+            }
+        }
+    }
+
+    const size_t header_len = alignSize(sizeof(header));
+    header.nodes_offset     = (uint32_t) header_len;
+    header.values_offset    = (uint32_t) (header.nodes_offset + alignSize(nodes.len));
+    header.values_count     = (uint32_t) (values.len / sizeof(config_image_value_t));
+    header.strings_offset   = (uint32_t) (header.values_offset + alignSize(values.len));
+    header.strings_size     = (uint32_t) strings.len;
+    header.data_offset      = (uint32_t) (header.strings_offset + alignSize(strings.len));
+    header.data_size        = (uint32_t) data.len;
+    header.total_size       = (uint32_t) (header.data_offset + data.len);
+
+    uint8_t *image = globalMalloc(header.total_size);
+    memset(image, 0, header.total_size);
+    memcpy(image, &header, sizeof(header));
+    if (nodes.len > 0)
+    {
+        memcpy(image + header.nodes_offset, nodes.data, nodes.len);
+    }
+    if (values.len > 0)
+    {
+        memcpy(image + header.values_offset, values.data, values.len);
+    }
+    memcpy(image + header.strings_offset, strings.data, strings.len);
+    if (data.len > 0)
+    {
+        memcpy(image + header.data_offset, data.data, data.len);
+    }
+
+    globalFree(nodes.data);
+    globalFree(values.data);
+    globalFree(strings.data);
+    globalFree(data.data);
+
+    bool  result = false;
+    FILE *f      = fopen(out_path, "wb");
+    if (f != NULL)
+    {
+        result = fwrite(image, header.total_size, 1, f) == 1;
+        result = (fclose(f) == 0) && result;
+    }
+    globalFree(image);
+
+    if (! result)
+    {
+        LOGF("ConfigImage: could not write \"%s\"", out_path);
+    }
+    return result;
+}
+
+/*
+    Load side
+*/
+
+typedef struct image_view_s
+{
+    const uint8_t               *base;
+    const config_image_header_t *header;
+
+} image_view_t;
+
+static const char *imageString(const image_view_t *view, uint32_t offset)
+{
+    if (offset == kImageNone)
+    {
+        return NULL;
+    }
+    uint32_t len;
+    if ((size_t) offset + sizeof(len) > view->header->strings_size)
+    {
+        return NULL;
+    }
+    const uint8_t *at = view->base + view->header->strings_offset + offset;
+    memcpy(&len, at, sizeof(len));
+    if ((size_t) offset + sizeof(len) + len + 1 > view->header->strings_size || at[sizeof(len) + len] != '\0')
+    {
+        return NULL;
+    }
+    return (const char *) (at + sizeof(len));
+}
+
+static const config_image_value_t *imageValue(const image_view_t *view, uint32_t index)
+{
+    if (index >= view->header->values_count)
+    {
+        return NULL;
+    }
+    return (const config_image_value_t *) (view->base + view->header->values_offset +
+                                           ((size_t) index * sizeof(config_image_value_t)));
+}
+
+static cJSON *loadValue(const image_view_t *view, uint32_t index, unsigned int depth)
+{
+    const config_image_value_t *value = imageValue(view, index);
+    if (value == NULL || depth > kImageMaxDepth)
+    {
+        return NULL;
+    }
+
+    switch (value->type)
+    {
+    case kImageValueNull:
+        return cJSON_CreateNull();
+    case kImageValueFalse:
+        return cJSON_CreateFalse();
+    case kImageValueTrue:
+        return cJSON_CreateTrue();
+    case kImageValueNumber:
+        return cJSON_CreateNumber(value->number);
+    case kImageValueString: {
+        const char *str = imageString(view, value->string);
+        return str != NULL ? cJSON_CreateString(str) : NULL;
+    }
+    case kImageValueArray:
+    case kImageValueObject: {
+        cJSON *container = value->type == kImageValueArray ? cJSON_CreateArray() : cJSON_CreateObject();
+
+        // indexes only grow along the tree, which rules out loops in a damaged image
+        uint32_t prev  = index;
+        uint32_t child = value->first_child;
+        while (child != kImageNone)
+        {
+            const config_image_value_t *child_value = imageValue(view, child);
+            cJSON                      *item        = child > prev ? loadValue(view, child, depth + 1) : NULL;
+            if (item == NULL)
+            {
+                cJSON_Delete(container);
+                return NULL;
+            }
+            if (value->type == kImageValueArray)
+            {
+                cJSON_AddItemToArray(container, item);
+            }
+            else
+            {
+                const char *key = imageString(view, child_value->key);
+                if (key == NULL)
+                {
+                    cJSON_Delete(item);
+                    cJSON_Delete(container);
+                    return NULL;
+                }
+                cJSON_AddItemToObject(container, key, item);
+            }
+            prev  = child;
+            child = child_value->next_sibling;
+        }
+        return container;
+    }
+    default:
+        return NULL;
+    }
+}
+
+static bool checkImageHeader(const config_image_header_t *header, size_t file_size)
+{
+    return memcmp(header->magic, kImageMagic, sizeof(kImageMagic)) == 0 &&
+           header->format_version == kImageFormatVersion && header->byte_order == kImageByteOrderMark &&
+           header->total_size == file_size &&
+           (size_t) header->nodes_offset + ((size_t) header->nodes_count * sizeof(config_image_node_t)) <=
+               header->values_offset &&
+           (size_t) header->values_offset + ((size_t) header->values_count * sizeof(config_image_value_t)) <=
+               header->strings_offset &&
+           (size_t) header->strings_offset + header->strings_size <= header->data_offset &&
+           (size_t) header->data_offset + header->data_size <= file_size &&
+           header->nodes_offset % kImageSectionAlign == 0 && header->values_offset % kImageSectionAlign == 0 &&
+           header->data_offset % kImageSectionAlign == 0;
+}
+
+/*
+    the compiler resolved next of every node to an index, a node that is referenced twice or a ring of nodes
+    (which the node manager would walk forever) can only come from a damaged image
+
+    with at most one reference per node the graph is made of chains and rings, every chain starts at a node
+    that nobody references, so whatever the chains do not reach is a ring
+*/
+static bool checkImageGraph(const config_image_node_t *image_nodes, uint32_t count)
+{
+    enum
+    {
+        kUnreferenced,
+        kReferenced,
+        kReached
+    };
+
+    uint8_t *marks = globalMalloc(count > 0 ? count : 1);
+    memset(marks, kUnreferenced, count);
+    bool result = true;
+
+    for (uint32_t i = 0; i < count && result; i++)
+    {
+        const uint32_t next = image_nodes[i].next_index;
+        if (next == kImageNone)
+        {
+            result = image_nodes[i].hash_next == 0;
+            continue;
+        }
+        result = next < count && marks[next] == kUnreferenced &&
+                 image_nodes[i].hash_next == image_nodes[next].hash_name;
+        if (result)
+        {
+            marks[next] = kReferenced;
+        }
+    }
+
+    for (uint32_t i = 0; i < count && result; i++)
+    {
+        if (marks[i] != kUnreferenced)
+        {
+            continue;
+        }
+        for (uint32_t at = i; at != kImageNone; at = image_nodes[at].next_index)
+        {
+            marks[at] = kReached;
+        }
+    }
+
+    for (uint32_t i = 0; i < count && result; i++)
+    {
+        result = marks[i] == kReached;
+    }
+
+    globalFree(marks);
+    return result;
+}
+
+bool isConfigImageFile(const char *path)
+{
+    uint8_t magic[sizeof(kImageMagic)];
+    FILE   *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return false;
+    }
+    bool result = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, kImageMagic, sizeof(magic)) == 0;
+    fclose(f);
+    return result;
+}
+
+static cJSON *loadImageNodes(const image_view_t *view, compiled_node_t *compiled_nodes)
+{
+    cJSON                     *nodes       = cJSON_CreateArray();
+    const config_image_node_t *image_nodes = (const config_image_node_t *) (view->base + view->header->nodes_offset);
+
+    for (uint32_t i = 0; i < view->header->nodes_count; i++)
+    {
+        const config_image_node_t *image_node = &image_nodes[i];
+
+        const char *name = imageString(view, image_node->name);
+        const char *type = imageString(view, image_node->type);
+        const char *next = imageString(view, image_node->next);
+
+        const bool has_data = image_node->data != kImageNone;
+        if (name == NULL || type == NULL || (image_node->next != kImageNone && next == NULL) ||
+            (has_data && ((size_t) image_node->data + image_node->data_len > view->header->data_size ||
+                          image_node->data % kImageSectionAlign != 0)))
+        {
+            cJSON_Delete(nodes);
+            return NULL;
+        }
+
+        compiled_nodes[i] = (compiled_node_t) {
+            .hash_name = image_node->hash_name,
+            .hash_type = image_node->hash_type,
+            .hash_next = image_node->hash_next,
+            .data      = has_data ? view->base + view->header->data_offset + image_node->data : NULL,
+            .data_len  = has_data ? image_node->data_len : 0};
+
+        cJSON *node = cJSON_CreateObject();
+        cJSON_AddItemToArray(nodes, node);
+        cJSON_AddStringToObject(node, "name", name);
+        cJSON_AddStringToObject(node, "type", type);
+        if (next != NULL)
+        {
+            cJSON_AddStringToObject(node, "next", next);
+        }
+        cJSON_AddNumberToObject(node, "version", image_node->version);
+
+        if (image_node->settings != kImageNone)
+        {
+            cJSON *settings = loadValue(view, image_node->settings, 0);
+            if (settings == NULL)
+            {
+                cJSON_Delete(nodes);
+                return NULL;
+            }
+            cJSON_AddItemToObject(node, "settings", settings);
+        }
+    }
+    return nodes;
+}
+
+config_file_t *loadConfigImage(const char *const path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        LOGF("File Error: config image \"%s\" could not be read", path);
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(config_image_header_t))
+    {
+        LOGF("ConfigImage: \"%s\" is not a valid config image", path);
+        exit(1);
+    }
+
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        LOGF("ConfigImage: could not map \"%s\"", path);
+        exit(1);
+    }
+
+    image_view_t view = {.base = map, .header = map};
+
+    if (! checkImageHeader(view.header, (size_t) st.st_size))
+    {
+        LOGF("ConfigImage: \"%s\" is not a valid config image or was compiled by another version, compile it again",
+             path);
+        exit(1);
+    }
+
+    config_image_t *image = globalMalloc(sizeof(config_image_t));
+    image->map            = map;
+    image->map_size       = (size_t) st.st_size;
+    image->nodes          = globalMalloc(sizeof(compiled_node_t) * (view.header->nodes_count + 1));
+    image->nodes_count    = view.header->nodes_count;
+
+    cJSON *nodes = checkImageGraph((const config_image_node_t *) (view.base + view.header->nodes_offset),
+                                   view.header->nodes_count)
+                       ? loadImageNodes(&view, image->nodes)
+                       : NULL;
+    if (nodes == NULL)
+    {
+        LOGF("ConfigImage: \"%s\" is damaged, compile it again", path);
+        exit(1);
+    }
+
+    config_file_t *state = globalMalloc(sizeof(config_file_t));
+    memset(state, 0, sizeof(config_file_t));
+    hmutex_init(&(state->guard));
+
+    state->file_path = globalMalloc(strlen(path) + 1);
+    strcpy(state->file_path, path);
+
+    const char *name   = imageString(&view, view.header->name);
+    const char *author = imageString(&view, view.header->author);
+    state->name        = globalMalloc(strlen(name != NULL ? name : "") + 1);
+    strcpy(state->name, name != NULL ? name : "");
+    state->author = globalMalloc(strlen(author != NULL ? author : "EMPTY_AUTHOR") + 1);
+    strcpy(state->author, author != NULL ? author : "EMPTY_AUTHOR");
+
+    state->config_version       = view.header->config_version;
+    state->core_minimum_version = view.header->core_minimum_version;
+    state->encrypted            = view.header->encrypted != 0;
+    state->file_prebuffer_size  = (size_t) st.st_size;
+    state->compiled             = true;
+    state->image                = image;
+
+    state->root = cJSON_CreateObject();
+    cJSON_AddStringToObject(state->root, "name", state->name);
+    cJSON_AddStringToObject(state->root, "author", state->author);
+    cJSON_AddNumberToObject(state->root, "config-version", state->config_version);
+    cJSON_AddNumberToObject(state->root, "core-minimum-version", state->core_minimum_version);
+    cJSON_AddBoolToObject(state->root, "encrypted", state->encrypted);
+    cJSON_AddItemToObject(state->root, "nodes", nodes);
+    state->nodes = nodes;
+
+    // the pre-parsed blocks of the nodes are read in place, the image stays mapped while the config lives
+    return state;
+}
+
+void destroyConfigImage(config_image_t *image)
+{
+    munmap(image->map, image->map_size);
+    globalFree(image->nodes);
+    globalFree(image);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "basic_types.h"
+#include "config_file.h"
+#include <stdbool.h>
+
+/*
+    Compiled config image
+
+    "Waterwall --compile config.json [out]" validates a config file with the checks of the node manager
+    (required fields, node types and the node graph) and writes a binary image of it, the image can be listed
+    in core.json in place of the json file
+
+    the node graph is resolved by the compiler, every node carries the hashes of its name, type and next and the
+    index of its next node, the loader checks those indexes in one pass (in range, referenced once, no rings)
+    and the node manager takes them as they are, only the libraries are looked up again since an image can be
+    older than the tunnel libraries of the running binary
+
+    a library with a compileHandle pre-parses its heavy settings into a block of its own format (the whitelist
+    prefixes of the listeners, the user index of TrojanAuthServer), the image stays mapped read-only while the
+    config lives and the node reads the block in place, the remaining settings are stored as a flat value tree
+    that is rebuilt without any text parsing
+
+    the image is tied to the byte order of the machine that compiled it
+*/
+
+typedef struct compiled_node_s
+{
+    hash_t      hash_name;
+    hash_t      hash_type;
+    hash_t      hash_next;
+    const void *data; // the block of the compileHandle, inside the mapping
+    size_t      data_len;
+
+} compiled_node_t;
+
+typedef struct config_image_s
+{
+    void            *map;
+    size_t           map_size;
+    compiled_node_t *nodes; // in the order of config_file_t->nodes
+    unsigned int     nodes_count;
+
+} config_image_t;
+
+// cfile must have passed checkConfigFile (node_manager.h), the compileHandle of a library may change its settings
+bool           compileConfigFile(const config_file_t *cfile, const char *out_path);
+bool           isConfigImageFile(const char *path);
+config_file_t *loadConfigImage(const char *path);
+void           destroyConfigImage(config_image_t *image);
@@ -51,6 +51,11 @@ context_t *contextQueuePop(context_queue_t *self)
     return context;
 }
 
+context_t *contextQueuePeek(context_queue_t *self)
+{
+    return *queue_front(&self->q);
+}
+
 size_t contextQueueLen(context_queue_t *self)
 {
     return queue_size(&self->q);
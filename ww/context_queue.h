@@ -14,4 +14,5 @@ context_queue_t *newContextQueue(void);
 void             destroyContextQueue(context_queue_t *self);
 void             contextQueuePush(context_queue_t *self, context_t *context);
 context_t       *contextQueuePop(context_queue_t *self);
+context_t       *contextQueuePeek(context_queue_t *self);
 size_t           contextQueueLen(context_queue_t *self);
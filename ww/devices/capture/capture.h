@@ -10,22 +10,37 @@ struct capture_device_s;
 
 typedef void (*CaptureReadEventHandle)(struct capture_device_s *cdev, void *userdata, shift_buffer_t *buf, tid_t tid);
 
+/*
+    Each netfilter queue of the device has its own netlink socket, reader thread and reader buffer pool, so
+    the kernel can balance flows over a queue range (NFQUEUE --queue-balance) and each queue is drained in parallel
+*/
+typedef struct capture_queue_s
+{
+    struct capture_device_s *cdev;
+    int                      socket;
+    uint32_t                 queue_number;
+    unsigned int             queue_index;
+    hthread_t                read_thread;
+    generic_pool_t          *reader_shift_buffer_pool;
+    buffer_pool_t           *reader_buffer_pool;
+
+} capture_queue_t;
+
 typedef struct capture_device_s
 {
-    char     *name;
-    int       socket;
-    uint32_t  queue_number;
-    bool      drop_captured_packet;
-    void     *userdata;
-    hthread_t read_thread;
-    hthread_t write_thread;
+    char            *name;
+    int              socket;
+    uint32_t         queue_number;
+    uint32_t         queue_count;
+    capture_queue_t *queues;
+    bool             drop_captured_packet;
+    void            *userdata;
+    hthread_t        write_thread;
 
     hthread_routine routine_reader;
     hthread_routine routine_writer;
 
     master_pool_t  *reader_message_pool;
-    generic_pool_t *reader_shift_buffer_pool;
-    buffer_pool_t  *reader_buffer_pool;
     generic_pool_t *writer_shift_buffer_pool;
     buffer_pool_t  *writer_buffer_pool;
 
@@ -40,6 +55,9 @@ typedef struct capture_device_s
 bool bringCaptureDeviceUP(capture_device_t *cdev);
 bool bringCaptureDeviceDown(capture_device_t *cdev);
 
-capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, void *userdata,
+/*
+    captures queues [queue_number, queue_number + queue_count), queue_count must be at least 1
+*/
+capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, uint32_t queue_count, void *userdata,
                                       CaptureReadEventHandle cb);
 bool              writeToCaptureDevce(capture_device_t *cdev, shift_buffer_t *buf);
@@ -15,22 +15,36 @@
 #include <netinet/ip.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 enum
 {
     kReadPacketSize              = 1500,
     kEthDataLen                  = 1500,
+    kNetlinkMessageOverhead      = 512,
+    kReadBufferSize              = kReadPacketSize + kNetlinkMessageOverhead,
+    kReadBatchSize               = 32,
     kMasterMessagePoolCap        = 64,
     kQueueLen                    = 512,
     kCaptureWriteChannelQueueMax = 128
 };
 
+// a batch of packets that are read from one queue, they are all delivered to the same worker
 struct msg_event
 {
     capture_device_t *cdev;
-    shift_buffer_t   *buf;
+    unsigned int      count;
+    shift_buffer_t   *bufs[kReadBatchSize];
 };
 
+typedef struct netfilter_attr_s
+{
+    uint16_t    type;
+    const void *data;
+    size_t      size;
+} netfilter_attr_t;
+
 static pool_item_t *allocCaptureMsgPoolHandle(struct master_pool_s *pool, void *userdata)
 {
     (void) userdata;
@@ -50,17 +64,23 @@ static void localThreadEventReceived(hevent_t *ev)
     struct msg_event *msg = hevent_userdata(ev);
     tid_t             tid = (tid_t) (hloop_tid(hevent_loop(ev)));
 
-    msg->cdev->read_event_callback(msg->cdev, msg->cdev->userdata, msg->buf, tid);
+    for (unsigned int i = 0; i < msg->count; i++)
+    {
+        msg->cdev->read_event_callback(msg->cdev, msg->cdev->userdata, msg->bufs[i], tid);
+    }
 
     reuseMasterPoolItems(msg->cdev->reader_message_pool, (void **) &msg, 1, msg->cdev);
 }
 
-static void distributePacketPayload(capture_device_t *cdev, tid_t target_tid, shift_buffer_t *buf)
+static void distributePacketPayloads(capture_device_t *cdev, tid_t target_tid, shift_buffer_t **bufs,
+                                     unsigned int count)
 {
     struct msg_event *msg;
     popMasterPoolItems(cdev->reader_message_pool, (const void **) &(msg), 1, cdev);
 
-    *msg = (struct msg_event) {.cdev = cdev, .buf = buf};
+    msg->cdev  = cdev;
+    msg->count = count;
+    memcpy(msg->bufs, bufs, sizeof(shift_buffer_t *) * count);
 
     hevent_t ev;
     memset(&ev, 0, sizeof(ev));
@@ -71,12 +91,16 @@ static void distributePacketPayload(capture_device_t *cdev, tid_t target_tid, sh
 }
 
 /*
- * Send a message to the netfilter system and wait for an acknowledgement.
+ * Send a message carrying one or more attributes to the netfilter system and wait for an acknowledgement.
  */
-static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa_type, uint16_t res_id, bool ack,
-                                 void *msg, size_t size)
+static bool netfilterSendMessageAttrs(int netfilter_socket, uint16_t nl_type, uint16_t res_id, bool ack,
+                                      const netfilter_attr_t *attrs, unsigned int attrs_count)
 {
-    size_t  nl_size = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg))) + NFA_ALIGN(NFA_LENGTH(size));
+    size_t nl_size = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+    for (unsigned int i = 0; i < attrs_count; i++)
+    {
+        nl_size += NFA_ALIGN(NFA_LENGTH(attrs[i].size));
+    }
     uint8_t buff[nl_size];
     memset(buff, 0, nl_size);
     struct nlmsghdr *nl_hdr = (struct nlmsghdr *) buff;
@@ -92,13 +116,15 @@ static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa
     nl_gen_msg->nfgen_family    = AF_UNSPEC;
     nl_gen_msg->res_id          = htons(res_id);
 
-    struct nfattr *nl_attr     = (struct nfattr *) (buff + NLMSG_ALIGN(nl_hdr->nlmsg_len));
-    size_t         nl_attr_len = NFA_LENGTH(size);
-    nl_hdr->nlmsg_len          = NLMSG_ALIGN(nl_hdr->nlmsg_len) + NFA_ALIGN(nl_attr_len);
-    nl_attr->nfa_type          = nfa_type;
-    nl_attr->nfa_len           = NFA_LENGTH(size);
-
-    memmove(NFA_DATA(nl_attr), msg, size);
+    nl_hdr->nlmsg_len = NLMSG_ALIGN(nl_hdr->nlmsg_len);
+    for (unsigned int i = 0; i < attrs_count; i++)
+    {
+        struct nfattr *nl_attr = (struct nfattr *) (buff + nl_hdr->nlmsg_len);
+        nl_attr->nfa_type      = attrs[i].type;
+        nl_attr->nfa_len       = NFA_LENGTH(attrs[i].size);
+        memmove(NFA_DATA(nl_attr), attrs[i].data, attrs[i].size);
+        nl_hdr->nlmsg_len += NFA_ALIGN(NFA_LENGTH(attrs[i].size));
+    }
 
     struct sockaddr_nl nl_addr;
     memset(&nl_addr, 0x0, sizeof(nl_addr));
@@ -142,6 +168,16 @@ static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa
     return false;
 }
 
+/*
+ * Send a message with a single attribute to the netfilter system.
+ */
+static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa_type, uint16_t res_id, bool ack,
+                                 void *msg, size_t size)
+{
+    netfilter_attr_t attr = {.type = (uint16_t) nfa_type, .data = msg, .size = size};
+    return netfilterSendMessageAttrs(netfilter_socket, nl_type, res_id, ack, &attr, 1);
+}
+
 /*
  * Set a netfilter configuration option.
  */
@@ -171,154 +207,223 @@ static bool netfilterSetQueueLength(int netfilter_socket, uint16_t qnumber, uint
 }
 
 /*
- * Get a packet from netfilter.
+ * Make the kernel accept packets instead of dropping them when the queue is full, so a slow reader
+ * never blackholes the captured traffic.
  */
-static int netfilterGetPacket(int netfilter_socket, uint16_t qnumber, shift_buffer_t *buff)
+static bool netfilterSetFailOpen(int netfilter_socket, uint16_t qnumber)
 {
-    // Read a message from netlink
-    char               nl_buff[512 + kEthDataLen + sizeof(struct ethhdr) + sizeof(struct nfqnl_msg_packet_hdr)];
-    struct sockaddr_nl nl_addr;
-    socklen_t          nl_addr_len = sizeof(nl_addr);
-    ssize_t            result =
-        recvfrom(netfilter_socket, nl_buff, sizeof(nl_buff), 0, (struct sockaddr *) &nl_addr, &nl_addr_len);
+    uint32_t               flags    = htonl(NFQA_CFG_F_FAIL_OPEN);
+    uint32_t               mask     = htonl(NFQA_CFG_F_FAIL_OPEN);
+    const netfilter_attr_t attrs[2] = {{.type = NFQA_CFG_FLAGS, .data = &flags, .size = sizeof(flags)},
+                                       {.type = NFQA_CFG_MASK, .data = &mask, .size = sizeof(mask)}};
 
-    if (result <= (int) sizeof(struct nlmsghdr))
-    {
-        errno = EINVAL;
-        return -1;
-    }
-    if (nl_addr_len != sizeof(nl_addr) || nl_addr.nl_pid != 0)
+    return netfilterSendMessageAttrs(netfilter_socket, NFQNL_MSG_CONFIG, qnumber, true, attrs, 2);
+}
+
+/*
+ * Drop every queued packet with an id less than or equal to packet_id (network order) in a single message.
+ */
+static bool netfilterSendBatchVerdict(int netfilter_socket, uint16_t qnumber, uint32_t packet_id)
+{
+    struct nfqnl_msg_verdict_hdr nl_verdict;
+    nl_verdict.verdict = htonl(NF_DROP);
+    nl_verdict.id      = packet_id;
+    return netfilterSendMessage(netfilter_socket, NFQNL_MSG_VERDICT_BATCH, NFQA_VERDICT_HDR, qnumber, false,
+                                &nl_verdict, sizeof(nl_verdict));
+}
+
+/*
+ * Parse a packet message received from netfilter, the message is not modified or copied.
+ */
+static bool netfilterParsePacket(uint8_t *nl_buff, size_t nl_buff_len, uint8_t **data, size_t *data_size,
+                                 uint32_t *packet_id)
+{
+    if (nl_buff_len <= sizeof(struct nlmsghdr))
     {
-        errno = EINVAL;
         return false;
     }
 
     struct nlmsghdr *nl_hdr = (struct nlmsghdr *) nl_buff;
     if (NFNL_SUBSYS_ID(nl_hdr->nlmsg_type) != NFNL_SUBSYS_QUEUE)
     {
-        errno = EINVAL;
-        return -1;
+        return false;
     }
     if (NFNL_MSG_TYPE(nl_hdr->nlmsg_type) != NFQNL_MSG_PACKET)
     {
-        errno = EINVAL;
-        return -1;
+        return false;
     }
-    if (nl_hdr->nlmsg_len < sizeof(struct nfgenmsg))
+    if (nl_hdr->nlmsg_len > nl_buff_len)
     {
-        errno = EINVAL;
-        return -1;
+        return false;
     }
 
-    // Get the packet data
     int nl_size0 = NLMSG_SPACE(sizeof(struct nfgenmsg));
     if ((int) nl_hdr->nlmsg_len < nl_size0)
     {
-        errno = EINVAL;
-        return -1;
+        return false;
     }
     struct nfattr               *nl_attr      = NFM_NFA(NLMSG_DATA(nl_hdr));
     int                          nl_attr_size = (int) (nl_hdr->nlmsg_len - NLMSG_ALIGN(nl_size0));
-    bool                         found_data = false, found_pkt_hdr = false;
     uint8_t                     *nl_data      = NULL;
     size_t                       nl_data_size = 0;
     struct nfqnl_msg_packet_hdr *nl_pkt_hdr   = NULL;
     while (NFA_OK(nl_attr, nl_attr_size))
     {
-        int nl_attr_type = NFA_TYPE(nl_attr);
-        switch (nl_attr_type)
+        switch (NFA_TYPE(nl_attr))
         {
         case NFQA_PAYLOAD:
-            if (found_data)
+            if (nl_data != NULL)
             {
-                errno = EINVAL;
-                return -1;
+                return false;
             }
-            found_data   = true;
             nl_data      = (uint8_t *) NFA_DATA(nl_attr);
             nl_data_size = (size_t) NFA_PAYLOAD(nl_attr);
             break;
         case NFQA_PACKET_HDR:
-            if (found_pkt_hdr)
+            if (nl_pkt_hdr != NULL)
             {
-                errno = EINVAL;
-                return -1;
+                return false;
             }
-            found_pkt_hdr = true;
-            nl_pkt_hdr    = (struct nfqnl_msg_packet_hdr *) NFA_DATA(nl_attr);
+            nl_pkt_hdr = (struct nfqnl_msg_packet_hdr *) NFA_DATA(nl_attr);
             break;
         }
         nl_attr = NFA_NEXT(nl_attr, nl_attr_size);
     }
-    if (! found_data || ! found_pkt_hdr)
+    if (nl_data == NULL || nl_pkt_hdr == NULL)
     {
-        errno = EINVAL;
-        return -1;
+        return false;
     }
 
-    // Tell netlink to drop the packet
-    struct nfqnl_msg_verdict_hdr nl_verdict;
-    nl_verdict.verdict = htonl(NF_DROP);
-    nl_verdict.id      = nl_pkt_hdr->packet_id;
-    if (! netfilterSendMessage(netfilter_socket, NFQNL_MSG_VERDICT, NFQA_VERDICT_HDR, qnumber, false, &nl_verdict,
-                               sizeof(nl_verdict)))
+    *data      = nl_data;
+    *data_size = nl_data_size;
+    memcpy(packet_id, &nl_pkt_hdr->packet_id, sizeof(*packet_id));
+    return true;
+}
+
+/*
+ * Get a batch of packets from netfilter.
+ *
+ * The netlink messages are received straight into the pool buffers, each buffer that holds a valid packet is
+ * then shifted so it starts at the ip header (no copy), moved into `out` and replaced with a fresh one.
+ * Returns the number of packets in `out`, or -1 on a socket error
+ */
+static int netfilterGetPackets(capture_queue_t *queue, shift_buffer_t **bufs, shift_buffer_t **out)
+{
+    struct mmsghdr     msgs[kReadBatchSize];
+    struct iovec       iovecs[kReadBatchSize];
+    struct sockaddr_nl nl_addrs[kReadBatchSize];
+
+    for (unsigned int i = 0; i < kReadBatchSize; i++)
+    {
+        // the small pool buffer is read to its full right capacity, its size class already leaves room for the
+        // netlink headers, so only a pool with smaller buffers than that ever expands here
+        if (WW_UNLIKELY(rCap(bufs[i]) < kReadBufferSize))
+        {
+            reserveBufSpace(bufs[i], kReadBufferSize);
+        }
+        iovecs[i] = (struct iovec) {.iov_base = rawBufMut(bufs[i]), .iov_len = rCap(bufs[i])};
+        msgs[i]   = (struct mmsghdr) {.msg_hdr = {.msg_name    = &nl_addrs[i],
+                                                  .msg_namelen = sizeof(nl_addrs[i]),
+                                                  .msg_iov     = &iovecs[i],
+                                                  .msg_iovlen  = 1}};
+    }
+
+    int received = recvmmsg(queue->socket, msgs, kReadBatchSize, MSG_WAITFORONE, NULL);
+    if (received <= 0)
     {
-        return -1;
+        return received == 0 ? 0 : -1;
     }
 
-    // Copy the packet's contents to the output buffer.
-    // Also add a phony ethernet header.
-    setLen(buff, nl_data_size);
-    // struct ethhdr *eth_header = (struct ethhdr *) buff;
-    // memset(&eth_header->h_dest, 0x0, ETH_ALEN);
-    // memset(&eth_header->h_source, 0x0, ETH_ALEN);
-    // eth_header->h_proto = htons(ETH_P_IP);
+    int      count        = 0;
+    uint32_t last_id      = 0;
+    bool     has_verdicts = false;
 
-    struct iphdr *ip_header = (struct iphdr *) rawBufMut(buff);
-    memmove(ip_header, nl_data, nl_data_size);
+    for (int i = 0; i < received; i++)
+    {
+        uint8_t *nl_data;
+        size_t   nl_data_size;
+        uint32_t packet_id;
 
-    return (int) (nl_data_size);
+        if (msgs[i].msg_hdr.msg_namelen != sizeof(struct sockaddr_nl) || nl_addrs[i].nl_pid != 0 ||
+            (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+            ! netfilterParsePacket(rawBufMut(bufs[i]), msgs[i].msg_len, &nl_data, &nl_data_size, &packet_id))
+        {
+            // buffer is kept for the next read
+            continue;
+        }
+
+        // packet ids of a queue are increasing, the last one covers the whole batch
+        last_id      = packet_id;
+        has_verdicts = true;
+
+        shift_buffer_t    *buf    = bufs[i];
+        const unsigned int offset = (unsigned int) (nl_data - rawBufMut(buf));
+        setLen(buf, offset + nl_data_size);
+        shiftr(buf, offset);
+
+        out[count++] = buf;
+        bufs[i]      = popSmallBuffer(queue->reader_buffer_pool);
+    }
+
+    // Tell netlink to drop the packets
+    if (has_verdicts && ! netfilterSendBatchVerdict(queue->socket, queue->queue_number, last_id))
+    {
+        LOGW("CaptureDevice: failed to send verdict for queue %u", queue->queue_number);
+    }
+
+    return count;
 }
 
 static HTHREAD_ROUTINE(routineReadFromCapture) // NOLINT
 {
-    capture_device_t *cdev           = userdata;
-    tid_t             distribute_tid = 0;
-    shift_buffer_t   *buf;
-    ssize_t           nread;
+    capture_queue_t  *queue = userdata;
+    capture_device_t *cdev  = queue->cdev;
+    shift_buffer_t   *bufs[kReadBatchSize];
+    shift_buffer_t   *packets[kReadBatchSize];
+    int               nread;
+
+    // when there are enough queues, each queue feeds one worker so the flows that the kernel balanced onto a queue
+    // stay on the same worker, otherwise batches are spread round robin
+    const bool pinned         = cdev->queue_count >= WORKERS_COUNT;
+    tid_t      distribute_tid = (tid_t) (queue->queue_index % WORKERS_COUNT);
+
+    for (unsigned int i = 0; i < kReadBatchSize; i++)
+    {
+        bufs[i] = popSmallBuffer(queue->reader_buffer_pool);
+    }
 
     while (atomic_load_explicit(&(cdev->running), memory_order_relaxed))
     {
-        buf = popSmallBuffer(cdev->reader_buffer_pool);
-
-        reserveBufSpace(buf, kReadPacketSize);
+        nread = netfilterGetPackets(queue, bufs, packets);
 
-        nread = netfilterGetPacket(cdev->socket, cdev->queue_number, buf);
-
-        if (nread == 0)
+        if (nread < 0)
         {
-            reuseBuffer(cdev->reader_buffer_pool, buf);
-            LOGW("CaptureDevice: Exit read routine due to End Of File");
-            return 0;
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            {
+                continue;
+            }
+            LOGE("CaptureDevice: Exit read routine due to critical error, errno: %d", errno);
+            break;
         }
 
-        if (nread < 0)
+        if (nread == 0)
         {
-            reuseBuffer(cdev->reader_buffer_pool, buf);
-            LOGW("CaptureDevice: failed to read a packet from netfilter socket, retrying...");
             continue;
         }
 
-        setLen(buf, nread);
+        distributePacketPayloads(cdev, distribute_tid, packets, (unsigned int) nread);
 
-        distributePacketPayload(cdev, distribute_tid++, buf);
-
-        if (distribute_tid >= WORKERS_COUNT)
+        if (! pinned && ++distribute_tid >= WORKERS_COUNT)
         {
             distribute_tid = 0;
         }
     }
 
+    for (unsigned int i = 0; i < kReadBatchSize; i++)
+    {
+        reuseBuffer(queue->reader_buffer_pool, bufs[i]);
+    }
+
     return 0;
 }
 
@@ -391,7 +496,10 @@ bool bringCaptureDeviceUP(capture_device_t *cdev)
 
     LOGD("CaptureDevice: device %s is now up", cdev->name);
 
-    cdev->read_thread  = hthread_create(cdev->routine_reader, cdev);
+    for (unsigned int i = 0; i < cdev->queue_count; i++)
+    {
+        cdev->queues[i].read_thread = hthread_create(cdev->routine_reader, &(cdev->queues[i]));
+    }
     cdev->write_thread = hthread_create(cdev->routine_writer, cdev);
     return true;
 }
@@ -407,49 +515,61 @@ bool bringCaptureDeviceDown(capture_device_t *cdev)
 
     LOGD("CaptureDevice: device %s is now down", cdev->name);
 
-    hthread_join(cdev->read_thread);
+    for (unsigned int i = 0; i < cdev->queue_count; i++)
+    {
+        hthread_join(cdev->queues[i].read_thread);
+    }
     hthread_join(cdev->write_thread);
 
     shift_buffer_t *buf;
     while (hchanRecv(cdev->writer_buffer_channel, &buf))
     {
-        reuseBuffer(cdev->reader_buffer_pool, buf);
+        reuseBuffer(cdev->writer_buffer_pool, buf);
     }
 
     return true;
 }
 
-capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, void *userdata,
-                                      CaptureReadEventHandle cb)
+static bool openCaptureQueue(capture_queue_t *queue)
 {
-
     int socket_netfilter = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
     if (socket_netfilter < 0)
     {
         LOGE("CaptureDevice: unable to create a netfilter socket");
+        return false;
     }
 
+    // the kernel assigns a unique port id for each queue socket
     struct sockaddr_nl nl_addr;
     memset(&nl_addr, 0x0, sizeof(nl_addr));
     nl_addr.nl_family = AF_NETLINK;
-    nl_addr.nl_pid    = getpid();
+    nl_addr.nl_pid    = 0;
 
     if (bind(socket_netfilter, (struct sockaddr *) &nl_addr, sizeof(nl_addr)) != 0)
     {
         LOGE("CaptureDevice: unable to bind netfilter socket to current process");
+        close(socket_netfilter);
+        return false;
     }
 
-    if (! netfilterSetConfig(socket_netfilter, NFQNL_CFG_CMD_PF_UNBIND, 0, PF_INET))
-    {
-        LOGE("CaptureDevice: unable to unbind netfilter from PF_INET");
-    }
-    if (! netfilterSetConfig(socket_netfilter, NFQNL_CFG_CMD_PF_BIND, 0, PF_INET))
+    const uint32_t queue_number = queue->queue_number;
+
+    if (queue->queue_index == 0)
     {
-        LOGE("CaptureDevice: unable to bind netfilter to PF_INET");
+        if (! netfilterSetConfig(socket_netfilter, NFQNL_CFG_CMD_PF_UNBIND, 0, PF_INET))
+        {
+            LOGE("CaptureDevice: unable to unbind netfilter from PF_INET");
+        }
+        if (! netfilterSetConfig(socket_netfilter, NFQNL_CFG_CMD_PF_BIND, 0, PF_INET))
+        {
+            LOGE("CaptureDevice: unable to bind netfilter to PF_INET");
+        }
     }
     if (! netfilterSetConfig(socket_netfilter, NFQNL_CFG_CMD_BIND, queue_number, 0))
     {
         LOGE("CaptureDevice: unable to bind netfilter to queue number %u", queue_number);
+        close(socket_netfilter);
+        return false;
     }
     uint32_t range = kEthDataLen + sizeof(struct ethhdr) + sizeof(struct nfqnl_msg_packet_hdr);
     if (! netfilterSetParams(socket_netfilter, queue_number, NFQNL_COPY_PACKET, range))
@@ -462,33 +582,74 @@ capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, v
     {
         LOGE("CaptureDevice: unable to set netfilter queue maximum length to %u", kQueueLen);
     }
+    if (! netfilterSetFailOpen(socket_netfilter, queue_number))
+    {
+        LOGW("CaptureDevice: unable to set fail-open on netfilter queue %u, packets will be dropped when the queue is "
+             "full",
+             queue_number);
+    }
+
+    queue->socket = socket_netfilter;
 
-    generic_pool_t *reader_sb_pool =
+    queue->reader_shift_buffer_pool =
         newGenericPoolWithCap(GSTATE.masterpool_shift_buffer_pools, (64) + GSTATE.ram_profile,
                               allocShiftBufferPoolHandle, destroyShiftBufferPoolHandle);
-    buffer_pool_t *reader_bpool = createBufferPool(
-        GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small, reader_sb_pool, GSTATE.ram_profile);
+    queue->reader_buffer_pool =
+        createBufferPool(GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small,
+                         queue->reader_shift_buffer_pool, GSTATE.ram_profile);
+    return true;
+}
+
+capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, uint32_t queue_count, void *userdata,
+                                      CaptureReadEventHandle cb)
+{
+    assert(queue_count >= 1);
+
+    capture_queue_t *queues = globalMalloc(sizeof(capture_queue_t) * queue_count);
+    memset(queues, 0, sizeof(capture_queue_t) * queue_count);
+
+    capture_device_t *cdev = globalMalloc(sizeof(capture_device_t));
+
+    for (unsigned int i = 0; i < queue_count; i++)
+    {
+        queues[i].cdev         = cdev;
+        queues[i].queue_index  = i;
+        queues[i].queue_number = queue_number + i;
+
+        if (! openCaptureQueue(&queues[i]))
+        {
+            LOGE("CaptureDevice: unable to open netfilter queue %u", queue_number + i);
+            // the queues that were opened before this one are closed again
+            for (unsigned int j = 0; j < i; j++)
+            {
+                close(queues[j].socket);
+                destroyBufferPool(queues[j].reader_buffer_pool);
+                destroyGenericPool(queues[j].reader_shift_buffer_pool);
+            }
+            globalFree(queues);
+            globalFree(cdev);
+            return NULL;
+        }
+    }
 
     generic_pool_t *writer_sb_pool = newGenericPoolWithCap(GSTATE.masterpool_shift_buffer_pools, 1,
                                                            allocShiftBufferPoolHandle, destroyShiftBufferPoolHandle);
     buffer_pool_t  *writer_bpool =
         createBufferPool(GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small, writer_sb_pool, 1);
 
-    capture_device_t *cdev = globalMalloc(sizeof(capture_device_t));
-
     *cdev = (capture_device_t) {.name                     = strdup(name),
                                 .running                  = false,
                                 .up                       = false,
                                 .routine_reader           = routineReadFromCapture,
                                 .routine_writer           = routineWriteToCapture,
-                                .socket                   = socket_netfilter,
+                                .socket                   = queues[0].socket,
                                 .queue_number             = queue_number,
-                                .reader_shift_buffer_pool = reader_sb_pool,
+                                .queue_count              = queue_count,
+                                .queues                   = queues,
                                 .read_event_callback      = cb,
                                 .userdata                 = userdata,
                                 .writer_buffer_channel    = hchanOpen(sizeof(void *), kCaptureWriteChannelQueueMax),
                                 .reader_message_pool      = newMasterPoolWithCap(kMasterMessagePoolCap),
-                                .reader_buffer_pool       = reader_bpool,
                                 .writer_shift_buffer_pool = writer_sb_pool,
                                 .writer_buffer_pool       = writer_bpool};
 
@@ -10,6 +10,12 @@ struct raw_device_s;
 
 typedef void (*RawReadEventHandle)(struct raw_device_s *rdev, void *userdata, shift_buffer_t *buf, tid_t tid);
 
+/*
+    Writes are not handed to a writer thread, each worker queues its own packets and sends them from its own loop
+    with a single sendmmsg() per batch
+*/
+struct raw_device_write_queue_s;
+
 typedef struct raw_device_s
 {
     char     *name;
@@ -17,22 +23,18 @@ typedef struct raw_device_s
     uint32_t  mark;
     void     *userdata;
     hthread_t read_thread;
-    hthread_t write_thread;
 
     hthread_routine routine_reader;
-    hthread_routine routine_writer;
 
     master_pool_t  *reader_message_pool;
     generic_pool_t *reader_shift_buffer_pool;
     buffer_pool_t  *reader_buffer_pool;
-    generic_pool_t *writer_shift_buffer_pool;
-    buffer_pool_t  *writer_buffer_pool;
 
     RawReadEventHandle read_event_callback;
 
-    struct hchan_s *writer_buffer_channel;
-    atomic_bool     running;
-    atomic_bool     up;
+    struct raw_device_write_queue_s *write_queues;
+    atomic_bool                      running;
+    atomic_bool                      up;
 
 } raw_device_t;
 
@@ -41,4 +43,5 @@ bool bringRawDeviceDown(raw_device_t *rdev);
 
 raw_device_t *createRawDevice(const char *name, uint32_t mark, void *userdata, RawReadEventHandle cb);
 
-bool writeToRawDevce(raw_device_t *rdev, shift_buffer_t *buf);
+// must be called on the worker that owns the buffer, the buffer is taken in any case
+bool writeToRawDevce(raw_device_t *rdev, shift_buffer_t *buf, tid_t tid);
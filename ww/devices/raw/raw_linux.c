@@ -1,5 +1,4 @@
 #include "generic_pool.h"
-#include "hchan.h"
 #include "loggers/network_logger.h"
 #include "raw.h"
 #include "ww.h"
@@ -10,15 +9,24 @@
 #include <netinet/ip.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 enum
 {
-    kReadPacketSize          = 1500,
-    kMasterMessagePoolCap    = 64,
-    kRawWriteChannelQueueMax = 256
+    kReadPacketSize       = 1500,
+    kMasterMessagePoolCap = 64,
+    kRawWriteBatchSize    = 64
 };
 
+typedef struct raw_device_write_queue_s
+{
+    shift_buffer_t *bufs[kRawWriteBatchSize];
+    unsigned int    len;
+    bool            flush_scheduled;
+
+} ATTR_ALIGNED_LINE_CACHE raw_device_write_queue_t;
+
 struct msg_event
 {
     raw_device_t   *rdev;
@@ -114,67 +122,109 @@ static HTHREAD_ROUTINE(routineReadFromRaw) // NOLINT
     return 0;
 }
 
-static HTHREAD_ROUTINE(routineWriteToRaw) // NOLINT
+/*
+    Sends every queued packet of the worker with as few sendmmsg() calls as possible, the socket is used in non
+    blocking mode so a full send buffer drops the rest of the batch instead of stalling the worker loop
+*/
+static void flushRawWriteQueue(raw_device_t *rdev, tid_t tid)
 {
-    raw_device_t   *rdev = userdata;
-    shift_buffer_t *buf;
-    ssize_t         nwrite;
+    raw_device_write_queue_t *wqueue = &(rdev->write_queues[tid]);
+    struct mmsghdr            msgs[kRawWriteBatchSize];
+    struct iovec              iovecs[kRawWriteBatchSize];
+    struct sockaddr_in        to_addrs[kRawWriteBatchSize];
 
-    while (atomic_load_explicit(&(rdev->running), memory_order_relaxed))
+    if (atomic_load_explicit(&(rdev->running), memory_order_relaxed))
     {
-        if (! hchanRecv(rdev->writer_buffer_channel, &buf))
-        {
-            LOGD("RawDevice: routine write will exit due to channel closed");
-            return 0;
-        }
-
-        assert(bufLen(buf) > sizeof(struct iphdr));
-
-        struct iphdr *ip_header = (struct iphdr *) rawBuf(buf);
-
-        struct sockaddr_in to_addr = {.sin_family = AF_INET, .sin_addr.s_addr = ip_header->daddr};
-
-        nwrite = sendto(rdev->socket, ip_header, bufLen(buf), 0, (struct sockaddr *) (&to_addr), sizeof(to_addr));
-
-        reuseBuffer(rdev->writer_buffer_pool, buf);
-
-        if (nwrite == 0)
+        for (unsigned int i = 0; i < wqueue->len; i++)
         {
-            LOGW("RawDevice: Exit write routine due to End Of File");
-            return 0;
+            shift_buffer_t     *buf       = wqueue->bufs[i];
+            const struct iphdr *ip_header = (const struct iphdr *) rawBuf(buf);
+
+            to_addrs[i] = (struct sockaddr_in) {.sin_family = AF_INET, .sin_addr.s_addr = ip_header->daddr};
+            iovecs[i]   = (struct iovec) {.iov_base = rawBufMut(buf), .iov_len = bufLen(buf)};
+            msgs[i]     = (struct mmsghdr) {.msg_hdr = {.msg_name    = &to_addrs[i],
+                                                        .msg_namelen = sizeof(to_addrs[i]),
+                                                        .msg_iov     = &iovecs[i],
+                                                        .msg_iovlen  = 1}};
         }
 
-        if (nwrite < 0)
+        unsigned int sent = 0;
+        while (sent < wqueue->len)
         {
-            LOGW("RawDevice: writing a packet to RAW  device failed, code: %d", (int) nwrite);
-            if (errno == EINVAL || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            int nwrite = sendmmsg(rdev->socket, &msgs[sent], wqueue->len - sent, MSG_DONTWAIT);
+            if (nwrite > 0)
             {
+                sent += (unsigned int) nwrite;
                 continue;
             }
-            LOGE("RawDevice: Exit write routine due to critical error");
-            return 0;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            {
+                LOGW("RawDevice: socket buffer is full, dropped %u packets", wqueue->len - sent);
+                break;
+            }
+            // only the first packet of the remaining batch has failed, skip it
+            LOGW("RawDevice: writing a packet to RAW  device failed, errno: %d", errno);
+            sent += 1;
         }
     }
-    return 0;
+
+    buffer_pool_t *pool = getWorkerBufferPool(tid);
+    for (unsigned int i = 0; i < wqueue->len; i++)
+    {
+        reuseBuffer(pool, wqueue->bufs[i]);
+    }
+    wqueue->len = 0;
+}
+
+static void onRawWriteQueueFlushEvent(hevent_t *ev)
+{
+    raw_device_t *rdev = hevent_userdata(ev);
+    tid_t         tid  = (tid_t) (hloop_tid(hevent_loop(ev)));
+
+    rdev->write_queues[tid].flush_scheduled = false;
+    if (rdev->write_queues[tid].len > 0)
+    {
+        flushRawWriteQueue(rdev, tid);
+    }
 }
 
-bool writeToRawDevce(raw_device_t *rdev, shift_buffer_t *buf)
+bool writeToRawDevce(raw_device_t *rdev, shift_buffer_t *buf, tid_t tid)
 {
     assert(bufLen(buf) > sizeof(struct iphdr));
 
-    bool closed = false;
-    if (! hchanTrySend(rdev->writer_buffer_channel, &buf, &closed))
+    if (WW_UNLIKELY(! atomic_load_explicit(&(rdev->running), memory_order_relaxed)))
     {
-        if (closed)
-        {
-            LOGE("RawDevice: write failed, channel was closed");
-        }
-        else
-        {
-            LOGE("RawDevice: write failed, ring is full");
-        }
+        LOGE("RawDevice: write failed, device is down");
+        reuseBuffer(getWorkerBufferPool(tid), buf);
         return false;
     }
+
+    raw_device_write_queue_t *wqueue = &(rdev->write_queues[tid]);
+
+    wqueue->bufs[wqueue->len++] = buf;
+
+    if (wqueue->len >= kRawWriteBatchSize)
+    {
+        flushRawWriteQueue(rdev, tid);
+        return true;
+    }
+
+    // the rest of packets that are written in this loop iteration are coalesced into the same batch
+    if (! wqueue->flush_scheduled)
+    {
+        wqueue->flush_scheduled = true;
+
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop = getWorkerLoop(tid);
+        ev.cb   = onRawWriteQueueFlushEvent;
+        hevent_set_userdata(&ev, rdev);
+        hloop_post_event(getWorkerLoop(tid), &ev);
+    }
     return true;
 }
 
@@ -191,7 +241,6 @@ bool bringRawDeviceUP(raw_device_t *rdev)
     {
         rdev->read_thread = hthread_create(rdev->routine_reader, rdev);
     }
-    rdev->write_thread = hthread_create(rdev->routine_writer, rdev);
     return true;
 }
 
@@ -202,21 +251,14 @@ bool bringRawDeviceDown(raw_device_t *rdev)
     rdev->running = false;
     rdev->up      = false;
 
-    hchanClose(rdev->writer_buffer_channel);
-
     LOGD("RawDevice: device %s is now down", rdev->name);
 
     if (rdev->read_event_callback != NULL)
     {
         hthread_join(rdev->read_thread);
     }
-    hthread_join(rdev->write_thread);
 
-    shift_buffer_t *buf;
-    while (hchanRecv(rdev->writer_buffer_channel, &buf))
-    {
-        reuseBuffer(rdev->reader_buffer_pool, buf);
-    }
+    // packets that are still queued are released by the scheduled flush events of their workers
 
     return true;
 }
@@ -257,26 +299,22 @@ raw_device_t *createRawDevice(const char *name, uint32_t mark, void *userdata, R
         installMasterPoolAllocCallbacks(reader_message_pool, allocRawMsgPoolHandle, destroyRawMsgPoolHandle);
     }
 
-    generic_pool_t *writer_sb_pool = newGenericPoolWithCap(GSTATE.masterpool_shift_buffer_pools, GSTATE.ram_profile,
-                                                           allocShiftBufferPoolHandle, destroyShiftBufferPoolHandle);
-    buffer_pool_t  *writer_bpool   = createBufferPool(
-        GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small, writer_sb_pool, GSTATE.ram_profile);
+    raw_device_write_queue_t *write_queues =
+        globalMallocAligned(kCpuLineCacheSize, sizeof(raw_device_write_queue_t) * WORKERS_COUNT);
+    memset(write_queues, 0, sizeof(raw_device_write_queue_t) * WORKERS_COUNT);
 
     *rdev = (raw_device_t) {.name                     = strdup(name),
                             .running                  = false,
                             .up                       = false,
                             .routine_reader           = routineReadFromRaw,
-                            .routine_writer           = routineWriteToRaw,
                             .socket                   = rsocket,
                             .mark                     = mark,
                             .reader_shift_buffer_pool = reader_sb_pool,
                             .read_event_callback      = cb,
                             .userdata                 = userdata,
-                            .writer_buffer_channel    = hchanOpen(sizeof(void *), kRawWriteChannelQueueMax),
                             .reader_message_pool      = reader_message_pool,
                             .reader_buffer_pool       = reader_bpool,
-                            .writer_shift_buffer_pool = writer_sb_pool,
-                            .writer_buffer_pool       = writer_bpool};
+                            .write_queues             = write_queues};
 
     return rdev;
 }
@@ -16,7 +16,14 @@ typedef void *tun_handle_t; // Windows handle (void* can hold HANDLE)
 
 struct tun_device_s;
 
-typedef void (*TunReadEventHandle)(struct tun_device_s *tdev, void *userdata, shift_buffer_t *buf, tid_t tid);
+enum
+{
+    kTunReadBatchMax = 32 // packets handed to a worker in one event
+};
+
+// bufs holds 1 to kTunReadBatchMax packets that were read back to back, the callee takes the buffers
+typedef void (*TunReadEventHandle)(struct tun_device_s *tdev, void *userdata, shift_buffer_t **bufs,
+                                   unsigned int count, tid_t tid);
 
 typedef struct tun_device_s
 {
@@ -10,6 +10,7 @@
 #include <linux/if_tun.h>
 #include <linux/ipv6.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,13 +21,15 @@ enum
 {
     kReadPacketSize          = 1500,
     kMasterMessagePoolCap    = 64,
-    kTunWriteChannelQueueMax = 256
+    kTunWriteChannelQueueMax = 256,
+    kTunReadWaitMs           = 100 // the reader checks if it should stop at least this often
 };
 
 struct msg_event
 {
     tun_device_t   *tdev;
-    shift_buffer_t *buf;
+    unsigned int    count;
+    shift_buffer_t *bufs[kTunReadBatchMax];
 };
 
 static void printIPPacketInfo(const char *devname, const unsigned char *buffer)
@@ -96,18 +99,13 @@ static void localThreadEventReceived(hevent_t *ev)
     struct msg_event *msg = hevent_userdata(ev);
     tid_t             tid = (tid_t) (hloop_tid(hevent_loop(ev)));
 
-    msg->tdev->read_event_callback(msg->tdev, msg->tdev->userdata, msg->buf, tid);
+    msg->tdev->read_event_callback(msg->tdev, msg->tdev->userdata, msg->bufs, msg->count, tid);
 
     reuseMasterPoolItems(msg->tdev->reader_message_pool, (void **) &msg, 1, msg->tdev);
 }
 
-static void distributePacketPayload(tun_device_t *tdev, tid_t target_tid, shift_buffer_t *buf)
+static void distributePacketPayload(tid_t target_tid, struct msg_event *msg)
 {
-    struct msg_event *msg;
-    popMasterPoolItems(tdev->reader_message_pool, (const void **) &(msg), 1, tdev);
-
-    *msg = (struct msg_event) {.tdev = tdev, .buf = buf};
-
     hevent_t ev;
     memset(&ev, 0, sizeof(ev));
     ev.loop = getWorkerLoop(target_tid);
@@ -116,15 +114,28 @@ static void distributePacketPayload(tun_device_t *tdev, tid_t target_tid, shift_
     hloop_post_event(getWorkerLoop(target_tid), &ev);
 }
 
+/*
+    the device is non blocking, packets that are already queued on it are read until it reports EAGAIN and go to one
+    worker in one event, a burst costs one wakeup of the worker per batch instead of one per packet and the layer3
+    chain gets them as one packet vector; the reader only polls once the queue is drained, so a single packet is
+    still sent right away and nothing waits for a batch to fill
+*/
 static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
 {
-    tun_device_t   *tdev           = userdata;
-    tid_t           distribute_tid = 0;
-    shift_buffer_t *buf;
-    ssize_t         nread;
+    tun_device_t     *tdev           = userdata;
+    tid_t             distribute_tid = 0;
+    struct msg_event *msg            = NULL;
+    shift_buffer_t   *buf;
+    ssize_t           nread;
 
     while (atomic_load_explicit(&(tdev->running), memory_order_relaxed))
     {
+        if (msg == NULL)
+        {
+            popMasterPoolItems(tdev->reader_message_pool, (const void **) &(msg), 1, tdev);
+            *msg = (struct msg_event) {.tdev = tdev, .count = 0};
+        }
+
         buf = popSmallBuffer(tdev->reader_buffer_pool);
 
         reserveBufSpace(buf, kReadPacketSize);
@@ -135,7 +146,21 @@ static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
         {
             reuseBuffer(tdev->reader_buffer_pool, buf);
             LOGW("TunDevice: Exit read routine due to End Of File");
-            return 0;
+            break;
+        }
+
+        if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            reuseBuffer(tdev->reader_buffer_pool, buf);
+            if (msg->count > 0)
+            {
+                distributePacketPayload(distribute_tid, msg);
+                distribute_tid = (tid_t) ((distribute_tid + 1) % WORKERS_COUNT);
+                msg            = NULL;
+            }
+            struct pollfd pfd = {.fd = tdev->handle, .events = POLLIN};
+            poll(&pfd, 1, kTunReadWaitMs);
+            continue;
         }
 
         if (nread < 0)
@@ -143,12 +168,12 @@ static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
             reuseBuffer(tdev->reader_buffer_pool, buf);
 
             LOGE("TunDevice: reading a packet from TUN device failed, code: %d", (int) nread);
-            if (errno == EINVAL || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            if (errno == EINVAL || errno == EINTR)
             {
                 continue;
             }
             LOGE("TunDevice: Exit read routine due to critical error");
-            return 0;
+            break;
         }
 
         setLen(buf, nread);
@@ -158,14 +183,25 @@ static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
             LOGD("TunDevice: read %zd bytes from device %s", nread, tdev->name);
         }
 
-        distributePacketPayload(tdev, distribute_tid++, buf);
+        msg->bufs[msg->count++] = buf;
 
-        if (distribute_tid >= WORKERS_COUNT)
+        if (msg->count == kTunReadBatchMax)
         {
-            distribute_tid = 0;
+            distributePacketPayload(distribute_tid, msg);
+            distribute_tid = (tid_t) ((distribute_tid + 1) % WORKERS_COUNT);
+            msg            = NULL;
         }
     }
 
+    if (msg != NULL)
+    {
+        for (unsigned int i = 0; i < msg->count; i++)
+        {
+            reuseBuffer(tdev->reader_buffer_pool, msg->bufs[i]);
+        }
+        reuseMasterPoolItems(tdev->reader_message_pool, (void **) &msg, 1, tdev);
+    }
+
     return 0;
 }
 
@@ -345,6 +381,14 @@ tun_device_t *createTunDevice(const char *name, bool offload, void *userdata, Tu
         return NULL;
     }
 
+    // the reader drains the device until EAGAIN, writes to a tun device never wait anyway
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+    {
+        LOGE("TunDevice: setting the device non blocking failed");
+        close(fd);
+        return NULL;
+    }
+
     generic_pool_t *reader_sb_pool =
         newGenericPoolWithCap(GSTATE.masterpool_shift_buffer_pools, (64) + GSTATE.ram_profile,
                               allocShiftBufferPoolHandle, destroyShiftBufferPoolHandle);
@@ -0,0 +1,116 @@
+#pragma once
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hmutex.h"
+#include "hplatform.h"
+#include "hthread.h"
+#include "master_pool.h"
+#include <stdint.h>
+
+/*
+    AF_XDP device, packets are taken from the nic driver before the kernel network stack sees them
+
+    a tiny xdp program is attached to the interface, it redirects ipv4/ipv6 frames of each rx queue to the
+    xdp socket of that queue and passes everything else (arp, ...) to the kernel
+
+    each queue has its own umem, rings and reader thread, zero-copy mode is used when the driver supports it
+    and copy mode otherwise
+
+    the device works on ip packets, the ethernet header is removed on receive and added on send
+
+    local test with a veth pair:
+
+        ip link add xdp0 type veth peer name xdp1
+        ip link set xdp0 up && ip link set xdp1 up
+        ip addr add 10.10.0.2/24 dev xdp1
+
+    then use "xdp0" as the interface of the device and ping 10.10.0.1 from xdp1
+*/
+
+struct xdp_device_s;
+
+typedef void (*XdpReadEventHandle)(struct xdp_device_s *xdev, void *userdata, shift_buffer_t *buf, tid_t tid);
+
+typedef struct xdp_ring_s
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void     *descs;
+    void     *map;
+    size_t    map_len;
+    uint32_t  size;
+    uint32_t  mask;
+    uint32_t  cached_prod;
+    uint32_t  cached_cons;
+
+} xdp_ring_t;
+
+typedef struct xdp_queue_s
+{
+    struct xdp_device_s *xdev;
+    int                  socket;
+    uint32_t             queue_id;
+    bool                 zero_copy;
+    hthread_t            read_thread;
+
+    uint8_t   *umem_area;
+    size_t     umem_len;
+    xdp_ring_t fill_ring;
+    xdp_ring_t comp_ring;
+    xdp_ring_t rx_ring;
+    xdp_ring_t tx_ring;
+
+    // tx side is shared by the workers that are mapped to this queue
+    hhybridmutex_t tx_mutex;
+    uint64_t      *tx_free_frames;
+    uint32_t       tx_free_frames_len;
+
+    generic_pool_t *reader_shift_buffer_pool;
+    buffer_pool_t  *reader_buffer_pool;
+
+} xdp_queue_t;
+
+struct xdp_device_worker_state_s;
+
+typedef struct xdp_device_s
+{
+    char        *name;
+    unsigned int ifindex;
+    uint8_t      src_mac[6];
+    uint8_t      dst_mac[6];
+    void        *userdata;
+
+    uint32_t     queue_count;
+    xdp_queue_t *queues;
+    int          xsks_map_fd;
+    int          prog_fd;
+    int          link_fd;
+
+    hthread_routine routine_reader;
+
+    master_pool_t *reader_message_pool;
+
+    XdpReadEventHandle read_event_callback;
+
+    struct xdp_device_worker_state_s *worker_states;
+    atomic_bool                       running;
+    atomic_bool                       up;
+
+} xdp_device_t;
+
+bool bringXdpDeviceUP(xdp_device_t *xdev);
+bool bringXdpDeviceDown(xdp_device_t *xdev);
+
+/*
+    queues [0, queue_count) of the interface are captured, dst_mac is used as the destination of sent frames
+    (NULL means broadcast)
+*/
+xdp_device_t *createXdpDevice(const char *name, uint32_t queue_count, bool zero_copy, const uint8_t *dst_mac,
+                              void *userdata, XdpReadEventHandle cb);
+
+// brings the device down if it is up, detaches the xdp program and frees the queues, umems and the device
+void closeXdpDevice(xdp_device_t *xdev);
+
+// must be called on the worker that owns the buffer, the buffer is taken in any case
+bool writeToXdpDevice(xdp_device_t *xdev, shift_buffer_t *buf, tid_t tid);
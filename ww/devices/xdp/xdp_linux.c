@@ -0,0 +1,775 @@
+#include "generic_pool.h"
+#include "loggers/network_logger.h"
+#include "ww.h"
+#include "xdp.h"
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+enum
+{
+    kXdpFrameSize         = 2048,
+    kXdpFrameCount        = 4096,
+    kXdpRxFrameCount      = kXdpFrameCount / 2,
+    kXdpTxFrameCount      = kXdpFrameCount - kXdpRxFrameCount,
+    kXdpRingSize          = 2048,
+    kXdpReadBatchSize     = 64,
+    kXdpPollTimeoutMs     = 100,
+    kEthHeaderLen         = 14,
+    kMasterMessagePoolCap = 64
+};
+
+typedef struct xdp_device_worker_state_s
+{
+    bool kick_scheduled;
+
+} ATTR_ALIGNED_LINE_CACHE xdp_device_worker_state_t;
+
+// a batch of packets that are read from one queue, they are all delivered to the same worker
+struct msg_event
+{
+    xdp_device_t   *xdev;
+    unsigned int    count;
+    shift_buffer_t *bufs[kXdpReadBatchSize];
+};
+
+static pool_item_t *allocXdpMsgPoolHandle(struct master_pool_s *pool, void *userdata)
+{
+    (void) userdata;
+    (void) pool;
+    return globalMalloc(sizeof(struct msg_event));
+}
+
+static void destroyXdpMsgPoolHandle(struct master_pool_s *pool, master_pool_item_t *item, void *userdata)
+{
+    (void) pool;
+    (void) userdata;
+    globalFree(item);
+}
+
+static void localThreadEventReceived(hevent_t *ev)
+{
+    struct msg_event *msg = hevent_userdata(ev);
+    tid_t             tid = (tid_t) (hloop_tid(hevent_loop(ev)));
+
+    for (unsigned int i = 0; i < msg->count; i++)
+    {
+        msg->xdev->read_event_callback(msg->xdev, msg->xdev->userdata, msg->bufs[i], tid);
+    }
+
+    reuseMasterPoolItems(msg->xdev->reader_message_pool, (void **) &msg, 1, msg->xdev);
+}
+
+static void distributePacketPayloads(xdp_device_t *xdev, tid_t target_tid, shift_buffer_t **bufs, unsigned int count)
+{
+    struct msg_event *msg;
+    popMasterPoolItems(xdev->reader_message_pool, (const void **) &(msg), 1, xdev);
+
+    msg->xdev  = xdev;
+    msg->count = count;
+    memcpy(msg->bufs, bufs, sizeof(shift_buffer_t *) * count);
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop = getWorkerLoop(target_tid);
+    ev.cb   = localThreadEventReceived;
+    hevent_set_userdata(&ev, msg);
+    hloop_post_event(getWorkerLoop(target_tid), &ev);
+}
+
+/*
+    Ring helpers, producer/consumer indexes are shared with the kernel
+*/
+
+static uint32_t xdpRingConsumable(xdp_ring_t *ring, uint32_t max)
+{
+    uint32_t avail = ring->cached_prod - ring->cached_cons;
+    if (avail == 0)
+    {
+        ring->cached_prod = __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE);
+        avail             = ring->cached_prod - ring->cached_cons;
+    }
+    return avail > max ? max : avail;
+}
+
+static void xdpRingRelease(xdp_ring_t *ring, uint32_t count)
+{
+    ring->cached_cons += count;
+    __atomic_store_n(ring->consumer, ring->cached_cons, __ATOMIC_RELEASE);
+}
+
+static uint32_t xdpRingReservable(xdp_ring_t *ring, uint32_t wanted)
+{
+    uint32_t free_entries = ring->size - (ring->cached_prod - ring->cached_cons);
+    if (free_entries < wanted)
+    {
+        ring->cached_cons = __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE);
+        free_entries      = ring->size - (ring->cached_prod - ring->cached_cons);
+    }
+    return free_entries;
+}
+
+static void xdpRingSubmit(xdp_ring_t *ring, uint32_t count)
+{
+    ring->cached_prod += count;
+    __atomic_store_n(ring->producer, ring->cached_prod, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t *xdpRingAddr(xdp_ring_t *ring, uint32_t index)
+{
+    return &(((uint64_t *) ring->descs)[index & ring->mask]);
+}
+
+static inline struct xdp_desc *xdpRingDesc(xdp_ring_t *ring, uint32_t index)
+{
+    return &(((struct xdp_desc *) ring->descs)[index & ring->mask]);
+}
+
+static bool mapXdpRing(int fd, xdp_ring_t *ring, const struct xdp_ring_offset *off, size_t desc_size, off_t pgoff)
+{
+    ring->map_len = off->desc + (kXdpRingSize * desc_size);
+    ring->map     = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->map == MAP_FAILED)
+    {
+        ring->map = NULL;
+        return false;
+    }
+    ring->producer    = (uint32_t *) ((uint8_t *) ring->map + off->producer);
+    ring->consumer    = (uint32_t *) ((uint8_t *) ring->map + off->consumer);
+    ring->flags       = (uint32_t *) ((uint8_t *) ring->map + off->flags);
+    ring->descs       = (uint8_t *) ring->map + off->desc;
+    ring->size        = kXdpRingSize;
+    ring->mask        = kXdpRingSize - 1;
+    ring->cached_prod = *(ring->producer);
+    ring->cached_cons = *(ring->consumer);
+    return true;
+}
+
+/*
+    Bpf part, the program is built by hand so there is no libbpf / clang dependency
+*/
+
+static int sysBpf(int cmd, union bpf_attr *attr)
+{
+    return (int) syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int createXsksMap(uint32_t entries)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size    = sizeof(uint32_t);
+    attr.value_size  = sizeof(uint32_t);
+    attr.max_entries = entries;
+    return sysBpf(BPF_MAP_CREATE, &attr);
+}
+
+static bool updateXsksMap(int map_fd, uint32_t queue_id, int xsk_fd)
+{
+    uint32_t       value = (uint32_t) xsk_fd;
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key    = (uint64_t) (uintptr_t) &queue_id;
+    attr.value  = (uint64_t) (uintptr_t) &value;
+    attr.flags  = BPF_ANY;
+    return sysBpf(BPF_MAP_UPDATE_ELEM, &attr) == 0;
+}
+
+/*
+    if (data + sizeof(ethhdr) > data_end) return XDP_PASS;
+    if (eth->h_proto == ETH_P_IP || eth->h_proto == ETH_P_IPV6)
+        return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+    return XDP_PASS;
+*/
+static int loadXdpRedirectProgram(int xsks_map_fd)
+{
+    const struct bpf_insn insns[] = {
+        {.code    = BPF_LDX | BPF_MEM | BPF_W,
+         .dst_reg = BPF_REG_2,
+         .src_reg = BPF_REG_1,
+         .off     = offsetof(struct xdp_md, data)},
+        {.code    = BPF_LDX | BPF_MEM | BPF_W,
+         .dst_reg = BPF_REG_3,
+         .src_reg = BPF_REG_1,
+         .off     = offsetof(struct xdp_md, data_end)},
+        {.code = BPF_ALU64 | BPF_MOV | BPF_X, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_2},
+        {.code = BPF_ALU64 | BPF_ADD | BPF_K, .dst_reg = BPF_REG_4, .imm = kEthHeaderLen},
+        {.code = BPF_JMP | BPF_JGT | BPF_X, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_3, .off = 10},
+        {.code    = BPF_LDX | BPF_MEM | BPF_H,
+         .dst_reg = BPF_REG_4,
+         .src_reg = BPF_REG_2,
+         .off     = offsetof(struct ethhdr, h_proto)},
+        {.code = BPF_JMP | BPF_JEQ | BPF_K, .dst_reg = BPF_REG_4, .off = 2, .imm = htons(ETH_P_IP)},
+        {.code = BPF_JMP | BPF_JEQ | BPF_K, .dst_reg = BPF_REG_4, .off = 1, .imm = htons(ETH_P_IPV6)},
+        {.code = BPF_JMP | BPF_JA, .off = 6},
+        {.code    = BPF_LDX | BPF_MEM | BPF_W,
+         .dst_reg = BPF_REG_2,
+         .src_reg = BPF_REG_1,
+         .off     = offsetof(struct xdp_md, rx_queue_index)},
+        {.code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD, .imm = xsks_map_fd},
+        {.code = 0},
+        {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS},
+        {.code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map},
+        {.code = BPF_JMP | BPF_EXIT},
+        {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = XDP_PASS},
+        {.code = BPF_JMP | BPF_EXIT},
+    };
+
+    static const char kLicense[] = "GPL";
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt  = sizeof(insns) / sizeof(insns[0]);
+    attr.insns     = (uint64_t) (uintptr_t) insns;
+    attr.license   = (uint64_t) (uintptr_t) kLicense;
+    return sysBpf(BPF_PROG_LOAD, &attr);
+}
+
+static int attachXdpProgram(int prog_fd, unsigned int ifindex)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd     = prog_fd;
+    attr.link_create.target_fd   = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    return sysBpf(BPF_LINK_CREATE, &attr);
+}
+
+/*
+    Read side
+*/
+
+static HTHREAD_ROUTINE(routineReadFromXdp) // NOLINT
+{
+    xdp_queue_t    *queue = userdata;
+    xdp_device_t   *xdev  = queue->xdev;
+    shift_buffer_t *packets[kXdpReadBatchSize];
+    struct pollfd   pfd = {.fd = queue->socket, .events = POLLIN};
+
+    // when there are enough queues, each queue feeds one worker so the flows that the nic balanced onto a queue
+    // stay on the same worker, otherwise batches are spread round robin
+    const bool pinned         = xdev->queue_count >= WORKERS_COUNT;
+    tid_t      distribute_tid = (tid_t) (queue->queue_id % WORKERS_COUNT);
+
+    while (atomic_load_explicit(&(xdev->running), memory_order_relaxed))
+    {
+        const uint32_t avail = xdpRingConsumable(&queue->rx_ring, kXdpReadBatchSize);
+
+        if (avail == 0)
+        {
+            // poll also wakes up the driver when the fill ring needs it
+            poll(&pfd, 1, kXdpPollTimeoutMs);
+            continue;
+        }
+
+        unsigned int count = 0;
+        for (uint32_t i = 0; i < avail; i++)
+        {
+            const struct xdp_desc *desc = xdpRingDesc(&queue->rx_ring, queue->rx_ring.cached_cons + i);
+
+            if (WW_UNLIKELY(desc->len <= kEthHeaderLen))
+            {
+                continue;
+            }
+
+            const unsigned int ip_len = desc->len - kEthHeaderLen;
+            shift_buffer_t    *buf    = popSmallBuffer(queue->reader_buffer_pool);
+            setLen(buf, ip_len);
+            writeRaw(buf, queue->umem_area + desc->addr + kEthHeaderLen, ip_len);
+            packets[count++] = buf;
+        }
+
+        // give the frames back to the driver, the fill ring has room for every rx frame so this never waits
+        const uint32_t reserved = xdpRingReservable(&queue->fill_ring, avail);
+        assert(reserved >= avail);
+        (void) reserved;
+        for (uint32_t i = 0; i < avail; i++)
+        {
+            const struct xdp_desc *desc = xdpRingDesc(&queue->rx_ring, queue->rx_ring.cached_cons + i);
+            *xdpRingAddr(&queue->fill_ring, queue->fill_ring.cached_prod + i) =
+                desc->addr & ~((uint64_t) kXdpFrameSize - 1);
+        }
+        xdpRingRelease(&queue->rx_ring, avail);
+        xdpRingSubmit(&queue->fill_ring, avail);
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        distributePacketPayloads(xdev, distribute_tid, packets, count);
+
+        if (! pinned && ++distribute_tid >= WORKERS_COUNT)
+        {
+            distribute_tid = 0;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Write side, workers fill the tx ring of their queue and kick the kernel once per loop iteration
+*/
+
+static void reclaimXdpTxFrames(xdp_queue_t *queue)
+{
+    const uint32_t done = xdpRingConsumable(&queue->comp_ring, kXdpTxFrameCount);
+    for (uint32_t i = 0; i < done; i++)
+    {
+        queue->tx_free_frames[queue->tx_free_frames_len++] =
+            *xdpRingAddr(&queue->comp_ring, queue->comp_ring.cached_cons + i);
+    }
+    xdpRingRelease(&queue->comp_ring, done);
+}
+
+static xdp_queue_t *getWorkerXdpQueue(xdp_device_t *xdev, tid_t tid)
+{
+    return &(xdev->queues[tid % xdev->queue_count]);
+}
+
+static void onXdpKickEvent(hevent_t *ev)
+{
+    xdp_device_t *xdev  = hevent_userdata(ev);
+    tid_t         tid   = (tid_t) (hloop_tid(hevent_loop(ev)));
+    xdp_queue_t  *queue = getWorkerXdpQueue(xdev, tid);
+
+    xdev->worker_states[tid].kick_scheduled = false;
+
+    // copy mode transmits only inside sendto(), zero-copy drivers only need it when they asked for it
+    if (! queue->zero_copy || (__atomic_load_n(queue->tx_ring.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP))
+    {
+        if (sendto(queue->socket, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN && errno != EBUSY &&
+            errno != ENOBUFS && errno != ENETDOWN)
+        {
+            LOGW("XdpDevice: kicking tx of queue %u failed, errno: %d", queue->queue_id, errno);
+        }
+    }
+}
+
+bool writeToXdpDevice(xdp_device_t *xdev, shift_buffer_t *buf, tid_t tid)
+{
+    const unsigned int ip_len = bufLen(buf);
+
+    if (WW_UNLIKELY(! atomic_load_explicit(&(xdev->running), memory_order_relaxed)))
+    {
+        LOGE("XdpDevice: write failed, device is down");
+        reuseBuffer(getWorkerBufferPool(tid), buf);
+        return false;
+    }
+
+    if (WW_UNLIKELY(ip_len == 0 || ip_len + kEthHeaderLen > kXdpFrameSize))
+    {
+        LOGW("XdpDevice: dropped a packet with invalid size %u", ip_len);
+        reuseBuffer(getWorkerBufferPool(tid), buf);
+        return false;
+    }
+
+    xdp_queue_t *queue = getWorkerXdpQueue(xdev, tid);
+
+    hhybridmutex_lock(&(queue->tx_mutex));
+
+    reclaimXdpTxFrames(queue);
+
+    if (queue->tx_free_frames_len == 0 || xdpRingReservable(&queue->tx_ring, 1) == 0)
+    {
+        hhybridmutex_unlock(&(queue->tx_mutex));
+        LOGW("XdpDevice: tx ring of queue %u is full, dropped a packet", queue->queue_id);
+        reuseBuffer(getWorkerBufferPool(tid), buf);
+        return false;
+    }
+
+    const uint64_t addr  = queue->tx_free_frames[--(queue->tx_free_frames_len)];
+    uint8_t       *frame = queue->umem_area + addr;
+
+    const uint8_t  ip_version = ((const uint8_t *) rawBuf(buf))[0] >> 4;
+    const uint16_t h_proto    = htons(ip_version == 6 ? ETH_P_IPV6 : ETH_P_IP);
+
+    memcpy(frame, xdev->dst_mac, sizeof(xdev->dst_mac));
+    memcpy(frame + sizeof(xdev->dst_mac), xdev->src_mac, sizeof(xdev->src_mac));
+    memcpy(frame + offsetof(struct ethhdr, h_proto), &h_proto, sizeof(h_proto));
+    memcpy(frame + kEthHeaderLen, rawBuf(buf), ip_len);
+
+    struct xdp_desc *desc = xdpRingDesc(&queue->tx_ring, queue->tx_ring.cached_prod);
+    desc->addr            = addr;
+    desc->len             = ip_len + kEthHeaderLen;
+    desc->options         = 0;
+    xdpRingSubmit(&queue->tx_ring, 1);
+
+    hhybridmutex_unlock(&(queue->tx_mutex));
+
+    reuseBuffer(getWorkerBufferPool(tid), buf);
+
+    // the rest of packets that are written in this loop iteration share the same kick
+    if (! xdev->worker_states[tid].kick_scheduled)
+    {
+        xdev->worker_states[tid].kick_scheduled = true;
+
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop = getWorkerLoop(tid);
+        ev.cb   = onXdpKickEvent;
+        hevent_set_userdata(&ev, xdev);
+        hloop_post_event(getWorkerLoop(tid), &ev);
+    }
+    return true;
+}
+
+bool bringXdpDeviceUP(xdp_device_t *xdev)
+{
+    assert(! xdev->up);
+
+    xdev->up      = true;
+    xdev->running = true;
+
+    LOGD("XdpDevice: device %s is now up", xdev->name);
+
+    if (xdev->read_event_callback != NULL)
+    {
+        for (unsigned int i = 0; i < xdev->queue_count; i++)
+        {
+            xdev->queues[i].read_thread = hthread_create(xdev->routine_reader, &(xdev->queues[i]));
+        }
+    }
+    return true;
+}
+
+bool bringXdpDeviceDown(xdp_device_t *xdev)
+{
+    assert(xdev->up);
+
+    xdev->running = false;
+    xdev->up      = false;
+
+    LOGD("XdpDevice: device %s is now down", xdev->name);
+
+    if (xdev->read_event_callback != NULL)
+    {
+        for (unsigned int i = 0; i < xdev->queue_count; i++)
+        {
+            hthread_join(xdev->queues[i].read_thread);
+        }
+    }
+
+    return true;
+}
+
+static void unMapXdpRing(xdp_ring_t *ring)
+{
+    if (ring->map != NULL)
+    {
+        munmap(ring->map, ring->map_len);
+        ring->map = NULL;
+    }
+}
+
+// releases what openXdpQueue managed to set up, in reverse order, so it is also used on its error paths
+static void closeXdpQueue(xdp_queue_t *queue)
+{
+    if (queue->reader_buffer_pool != NULL)
+    {
+        destroyBufferPool(queue->reader_buffer_pool);
+        destroyGenericPool(queue->reader_shift_buffer_pool);
+        hhybridmutex_destroy(&(queue->tx_mutex));
+        queue->reader_buffer_pool       = NULL;
+        queue->reader_shift_buffer_pool = NULL;
+    }
+    if (queue->tx_free_frames != NULL)
+    {
+        globalFree(queue->tx_free_frames);
+        queue->tx_free_frames = NULL;
+    }
+    unMapXdpRing(&queue->tx_ring);
+    unMapXdpRing(&queue->rx_ring);
+    unMapXdpRing(&queue->comp_ring);
+    unMapXdpRing(&queue->fill_ring);
+    if (queue->socket >= 0)
+    {
+        // closing the socket also drops its entry from the xsks map
+        close(queue->socket);
+        queue->socket = -1;
+    }
+    if (queue->umem_area != NULL)
+    {
+        munmap(queue->umem_area, queue->umem_len);
+        queue->umem_area = NULL;
+    }
+}
+
+static bool openXdpQueue(xdp_device_t *xdev, xdp_queue_t *queue, bool zero_copy)
+{
+    queue->socket    = -1;
+    queue->umem_len  = (size_t) kXdpFrameSize * kXdpFrameCount;
+    queue->umem_area = mmap(NULL, queue->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                            -1, 0);
+    if (queue->umem_area == MAP_FAILED)
+    {
+        queue->umem_area = NULL;
+        LOGE("XdpDevice: unable to allocate umem for queue %u", queue->queue_id);
+        return false;
+    }
+
+    queue->socket = socket(AF_XDP, SOCK_RAW, 0);
+    if (queue->socket < 0)
+    {
+        LOGE("XdpDevice: unable to open an AF_XDP socket");
+        goto fail;
+    }
+
+    struct xdp_umem_reg umem_reg = {.addr       = (uint64_t) (uintptr_t) queue->umem_area,
+                                    .len        = queue->umem_len,
+                                    .chunk_size = kXdpFrameSize,
+                                    .headroom   = 0,
+                                    .flags      = 0};
+    if (setsockopt(queue->socket, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) != 0)
+    {
+        LOGE("XdpDevice: unable to register umem, errno: %d", errno);
+        goto fail;
+    }
+
+    const int ring_size = kXdpRingSize;
+    if (setsockopt(queue->socket, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) != 0 ||
+        setsockopt(queue->socket, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) != 0 ||
+        setsockopt(queue->socket, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) != 0 ||
+        setsockopt(queue->socket, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) != 0)
+    {
+        LOGE("XdpDevice: unable to set ring sizes, errno: %d", errno);
+        goto fail;
+    }
+
+    struct xdp_mmap_offsets offsets;
+    socklen_t               offsets_len = sizeof(offsets);
+    if (getsockopt(queue->socket, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_len) != 0)
+    {
+        LOGE("XdpDevice: unable to get ring offsets, errno: %d", errno);
+        goto fail;
+    }
+
+    if (! mapXdpRing(queue->socket, &queue->fill_ring, &offsets.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+        ! mapXdpRing(queue->socket, &queue->comp_ring, &offsets.cr, sizeof(uint64_t),
+                     XDP_UMEM_PGOFF_COMPLETION_RING) ||
+        ! mapXdpRing(queue->socket, &queue->rx_ring, &offsets.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+        ! mapXdpRing(queue->socket, &queue->tx_ring, &offsets.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+    {
+        LOGE("XdpDevice: unable to map rings, errno: %d", errno);
+        goto fail;
+    }
+
+    // first half of the umem is owned by the rx side, the other half by tx
+    for (uint32_t i = 0; i < kXdpRxFrameCount; i++)
+    {
+        *xdpRingAddr(&queue->fill_ring, queue->fill_ring.cached_prod + i) = (uint64_t) i * kXdpFrameSize;
+    }
+    xdpRingSubmit(&queue->fill_ring, kXdpRxFrameCount);
+
+    queue->tx_free_frames     = globalMalloc(sizeof(uint64_t) * kXdpTxFrameCount);
+    queue->tx_free_frames_len = 0;
+    for (uint32_t i = 0; i < kXdpTxFrameCount; i++)
+    {
+        queue->tx_free_frames[queue->tx_free_frames_len++] = (uint64_t) (kXdpRxFrameCount + i) * kXdpFrameSize;
+    }
+
+    struct sockaddr_xdp sxdp = {.sxdp_family   = AF_XDP,
+                                .sxdp_ifindex  = xdev->ifindex,
+                                .sxdp_queue_id = queue->queue_id,
+                                .sxdp_flags    = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP};
+
+    queue->zero_copy = zero_copy;
+    if (! zero_copy || bind(queue->socket, (struct sockaddr *) &sxdp, sizeof(sxdp)) != 0)
+    {
+        queue->zero_copy = false;
+        sxdp.sxdp_flags  = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(queue->socket, (struct sockaddr *) &sxdp, sizeof(sxdp)) != 0)
+        {
+            LOGE("XdpDevice: unable to bind AF_XDP socket to %s queue %u, errno: %d", xdev->name, queue->queue_id,
+                 errno);
+            goto fail;
+        }
+    }
+    LOGD("XdpDevice: queue %u of %s is bound in %s mode", queue->queue_id, xdev->name,
+         queue->zero_copy ? "zero-copy" : "copy");
+
+    if (! updateXsksMap(xdev->xsks_map_fd, queue->queue_id, queue->socket))
+    {
+        LOGE("XdpDevice: unable to register AF_XDP socket in the xsks map, errno: %d", errno);
+        goto fail;
+    }
+
+    hhybridmutex_init(&(queue->tx_mutex));
+
+    queue->reader_shift_buffer_pool =
+        newGenericPoolWithCap(GSTATE.masterpool_shift_buffer_pools, (64) + GSTATE.ram_profile,
+                              allocShiftBufferPoolHandle, destroyShiftBufferPoolHandle);
+    queue->reader_buffer_pool =
+        createBufferPool(GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small,
+                         queue->reader_shift_buffer_pool, GSTATE.ram_profile);
+    return true;
+
+fail:
+    closeXdpQueue(queue);
+    return false;
+}
+
+static bool readInterfaceMac(const char *name, uint8_t *mac)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+    bool result = ioctl(fd, SIOCGIFHWADDR, &ifr) == 0;
+    if (result)
+    {
+        memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+    }
+    close(fd);
+    return result;
+}
+
+xdp_device_t *createXdpDevice(const char *name, uint32_t queue_count, bool zero_copy, const uint8_t *dst_mac,
+                              void *userdata, XdpReadEventHandle cb)
+{
+    assert(queue_count >= 1);
+
+    unsigned int ifindex = if_nametoindex(name);
+    if (ifindex == 0)
+    {
+        LOGE("XdpDevice: interface %s was not found", name);
+        return NULL;
+    }
+
+    unsigned int  opened_queues = 0;
+    xdp_device_t *xdev          = globalMalloc(sizeof(xdp_device_t));
+    memset(xdev, 0, sizeof(xdp_device_t));
+
+    xdev->name                = strdup(name);
+    xdev->ifindex             = ifindex;
+    xdev->queue_count         = queue_count;
+    xdev->userdata            = userdata;
+    xdev->read_event_callback = cb;
+    xdev->routine_reader      = routineReadFromXdp;
+    xdev->running             = false;
+    xdev->up                  = false;
+
+    if (! readInterfaceMac(name, xdev->src_mac))
+    {
+        LOGE("XdpDevice: unable to read the mac address of %s", name);
+        goto fail_device;
+    }
+    if (dst_mac != NULL)
+    {
+        memcpy(xdev->dst_mac, dst_mac, sizeof(xdev->dst_mac));
+    }
+    else
+    {
+        memset(xdev->dst_mac, 0xFF, sizeof(xdev->dst_mac));
+    }
+
+    xdev->xsks_map_fd = createXsksMap(queue_count);
+    if (xdev->xsks_map_fd < 0)
+    {
+        LOGE("XdpDevice: unable to create xsks map, errno: %d", errno);
+        goto fail_device;
+    }
+
+    xdev->queues = globalMalloc(sizeof(xdp_queue_t) * queue_count);
+    memset(xdev->queues, 0, sizeof(xdp_queue_t) * queue_count);
+
+    for (opened_queues = 0; opened_queues < queue_count; opened_queues++)
+    {
+        xdev->queues[opened_queues].xdev     = xdev;
+        xdev->queues[opened_queues].queue_id = opened_queues;
+        if (! openXdpQueue(xdev, &(xdev->queues[opened_queues]), zero_copy))
+        {
+            goto fail_queues;
+        }
+    }
+
+    xdev->prog_fd = loadXdpRedirectProgram(xdev->xsks_map_fd);
+    if (xdev->prog_fd < 0)
+    {
+        LOGE("XdpDevice: unable to load xdp program, errno: %d", errno);
+        goto fail_queues;
+    }
+
+    // the link is detached by the kernel when the process exits
+    xdev->link_fd = attachXdpProgram(xdev->prog_fd, ifindex);
+    if (xdev->link_fd < 0)
+    {
+        LOGE("XdpDevice: unable to attach xdp program to %s, errno: %d", name, errno);
+        goto fail_program;
+    }
+
+    xdev->worker_states = globalMallocAligned(kCpuLineCacheSize, sizeof(xdp_device_worker_state_t) * WORKERS_COUNT);
+    memset(xdev->worker_states, 0, sizeof(xdp_device_worker_state_t) * WORKERS_COUNT);
+
+    xdev->reader_message_pool = newMasterPoolWithCap(kMasterMessagePoolCap);
+    installMasterPoolAllocCallbacks(xdev->reader_message_pool, allocXdpMsgPoolHandle, destroyXdpMsgPoolHandle);
+
+    return xdev;
+
+    // unwinding in reverse order of the setup above
+fail_program:
+    close(xdev->prog_fd);
+fail_queues:
+    while (opened_queues > 0)
+    {
+        closeXdpQueue(&(xdev->queues[--opened_queues]));
+    }
+    globalFree(xdev->queues);
+    close(xdev->xsks_map_fd);
+fail_device:
+    free(xdev->name);
+    globalFree(xdev);
+    return NULL;
+}
+
+void closeXdpDevice(xdp_device_t *xdev)
+{
+    if (xdev->up)
+    {
+        bringXdpDeviceDown(xdev);
+    }
+
+    // closing the only fd of the bpf link detaches the program from the interface
+    close(xdev->link_fd);
+    close(xdev->prog_fd);
+    for (unsigned int i = 0; i < xdev->queue_count; i++)
+    {
+        closeXdpQueue(&(xdev->queues[i]));
+    }
+    globalFree(xdev->queues);
+    close(xdev->xsks_map_fd);
+
+    // the struct of the master pool stays, messages that are still posted to workers give their items back to it
+    drainMasterPool(xdev->reader_message_pool, NULL);
+    globalFreeAligned(xdev->worker_states);
+    free(xdev->name);
+    globalFree(xdev);
+}
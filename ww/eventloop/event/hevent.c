@@ -95,6 +95,7 @@ void hio_ready(hio_t* io) {
     io->recv = io->send = 0;
     io->recvfrom = io->sendto = 0;
     io->close = 0;
+    io->pressure_paused = 0;
     // public:
     io->id = hio_next_id();
     io->io_type = HIO_TYPE_UNKNOWN;
@@ -103,6 +104,7 @@ void hio_ready(hio_t* io) {
     io->last_read_hrtime = io->last_write_hrtime = io->loop->cur_hrtime;
 
     io->read_flags = 0;
+    io->read_avg = 0;
     // write_queue
     io->write_bufsize = 0;
     io->max_write_bufsize = MAX_WRITE_BUFSIZE;
@@ -57,6 +57,10 @@ struct hloop_s {
     uint32_t                    nios;
     // one loop per thread, so one readbuf per loop is OK.
     buffer_pool_t*              bufpool;
+    // memory pressure level this loop last saw, bulk stream reads wait while it is hard
+    int                         memory_pressure;
+    // ios whose reading was stopped by memory pressure, resumed when it is over
+    struct list_head            pressure_paused_ios;
     void*                       iowatcher;
     // custom_events
     int                         eventfds[2];
@@ -114,6 +118,7 @@ struct hio_s {
     unsigned    recvfrom    :1;
     unsigned    sendto      :1;
     unsigned    close       :1;
+    unsigned    pressure_paused :1; // reading stopped by memory pressure, resumed when it is over
 // public:
     hio_type_e  io_type;
     uint32_t    id; // fd cannot be used as unique identifier, so we provide an id
@@ -139,6 +144,7 @@ struct hio_s {
     uint64_t            last_write_hrtime;
     // read
     unsigned int        read_flags;
+    uint32_t            read_avg; // moving average of stream read sizes (x8), picks the read buffer size
     // write
     struct write_queue  write_queue;
     // hrecursive_mutex_t  write_mutex; // lock write and write_queue
@@ -169,6 +175,7 @@ struct hio_s {
 #if defined(EVENT_POLL) || defined(EVENT_KQUEUE)
     int         event_index[2]; // for poll,kqueue
 #endif
+    struct list_node pressure_node; // in loop->pressure_paused_ios while pressure_paused is set
 
 #ifdef EVENT_IOCP
     void*       hovlp;          // for iocp/overlapio
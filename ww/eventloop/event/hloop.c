@@ -325,6 +325,8 @@ static void hloop_init(hloop_t* loop) {
     // idles
     list_init(&loop->idles);
 
+    list_init(&loop->pressure_paused_ios);
+
     // timers
     heap_init(&loop->timers, timers_compare);
     heap_init(&loop->realtimers, timers_compare);
@@ -407,6 +409,7 @@ hloop_t* hloop_new(int flags, buffer_pool_t* swimmingpool, long tid) {
     hloop_init(loop);
     loop->flags |= flags;
     loop->bufpool = swimmingpool;
+    loop->memory_pressure = 0;
     loop->tid = tid;
     // hlogd("hloop_new tid=%ld", loop->tid);
     return loop;
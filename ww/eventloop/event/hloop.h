@@ -333,11 +333,16 @@ HV_EXPORT int hio_accept(hio_t* io);
 
 // connect => hio_add(io, HV_WRITE) => hconnect_cb
 HV_EXPORT int hio_connect(hio_t* io);
+// connect and send the start of buf with the SYN (tcp fast open) => hconnect_cb
+// returns the bytes that went out with it (0 when the kernel has no cookie yet) or -1, buf stays with the caller
+HV_EXPORT int hio_connect_fastopen(hio_t* io, shift_buffer_t* buf);
 
 // hio_add(io, HV_READ) => read => hread_cb
 HV_EXPORT int hio_read(hio_t* io);
 #define hio_read_start(io) hio_read(io)
-#define hio_read_stop(io) hio_del(io, HV_READ)
+HV_EXPORT int hio_read_stop(hio_t* io);
+// reads that memory pressure stopped start again
+HV_EXPORT void hio_resume_pressure_paused(hloop_t* loop);
 
 // hio_read_start => hread_cb => hio_read_stop
 HV_EXPORT int hio_read_once(hio_t* io);
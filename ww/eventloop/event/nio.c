@@ -1,5 +1,6 @@
 #include "iowatcher.h"
 #include "ww.h"
+#include "memory_budget.h"
 #ifndef EVENT_IOCP
 #include "hevent.h"
 #include "hsocket.h"
@@ -61,6 +62,13 @@ static void __close_cb(hio_t* io) {
     hio_close_cb(io);
 }
 
+static void hio_unlink_pressure_paused(hio_t* io) {
+    if (io->pressure_paused) {
+        io->pressure_paused = 0;
+        list_del(&io->pressure_node);
+    }
+}
+
 static void nio_accept(hio_t* io) {
     // printd("nio_accept listenfd=%d\n", io->fd);
     int connfd = 0, err = 0, accept_cnt = 0;
@@ -194,10 +202,23 @@ static void nio_read(hio_t* io) {
     //     }else
     // #endif
     shift_buffer_t* buf;
+    const unsigned int small_size = getBufferPoolSmallBufferDefaultSize();
+
+    // under hard memory pressure bulk streams stop reading, what they send waits in the kernel
+    if (WW_UNLIKELY(io->loop->memory_pressure >= kMemoryPressureHard) && (io->io_type & HIO_TYPE_SOCK_STREAM) &&
+        (io->read_avg / 8) >= small_size) {
+        hio_del(io, HV_READ);
+        io->pressure_paused = 1;
+        list_add(&io->pressure_node, &io->loop->pressure_paused_ios);
+        return;
+    }
 
     switch (io->io_type) {
     default:
-    case HIO_TYPE_TCP: buf = popBuffer(io->loop->bufpool); break;
+    case HIO_TYPE_TCP:
+        // connections that recently read little (interactive, mostly idle) read into small buffers
+        buf = (io->read_avg / 8) < small_size ? popSmallBuffer(io->loop->bufpool) : popBuffer(io->loop->bufpool);
+        break;
     case HIO_TYPE_UDP:
     case HIO_TYPE_IP: buf = popSmallBuffer(io->loop->bufpool); break;
     }
@@ -249,6 +270,21 @@ static void nio_read(hio_t* io) {
     // }
     // #endif
 
+    if (io->io_type & HIO_TYPE_SOCK_STREAM) {
+        // a read that filled the buffer means there is more, the next one goes to a large buffer
+        const uint32_t sample = (unsigned int)nread == available ? (1U << 15) : (uint32_t)nread;
+        io->read_avg = io->read_avg - (io->read_avg / 8) + sample;
+
+        // a small read must not pin a large buffer while it travels the chain and waits in queues
+        if ((unsigned int)nread <= small_size && isLargeBuffer(buf)) {
+            shift_buffer_t* small = popSmallBuffer(io->loop->bufpool);
+            setLen(small, nread);
+            memcpy(rawBufMut(small), rawBuf(buf), nread);
+            reuseBuffer(io->loop->bufpool, buf);
+            buf = small;
+        }
+    }
+
     setLen(buf, nread);
     __read_cb(io, buf);
     // user consumed buffer
@@ -386,16 +422,66 @@ int hio_connect(hio_t* io) {
     return hio_add(io, hio_handle_events, HV_WRITE);
 }
 
+int hio_connect_fastopen(hio_t* io, shift_buffer_t* buf) {
+#if defined(OS_LINUX) && defined(MSG_FASTOPEN)
+    // with a cached cookie the data goes out in the SYN, without one the kernel sends a cookie request and
+    // reports EINPROGRESS, then nothing was consumed and the caller writes it after connect
+    int ret = sendto(io->fd, rawBuf(buf), bufLen(buf), MSG_FASTOPEN | MSG_NOSIGNAL, io->peeraddr,
+                     SOCKADDR_LEN(io->peeraddr));
+    if (ret < 0) {
+        int err = socket_errno();
+        if (err == EOPNOTSUPP) {
+            // client side fast open is disabled (net.ipv4.tcp_fastopen)
+            return hio_connect(io) < 0 ? -1 : 0;
+        }
+        if (err != EINPROGRESS) {
+            perror("sendto");
+            io->error = err;
+            hio_close_async(io);
+            return -1;
+        }
+        ret = 0;
+    }
+    int timeout = io->connect_timeout ? io->connect_timeout : HIO_DEFAULT_CONNECT_TIMEOUT;
+    io->connect_timer = htimer_add(io->loop, __connect_timeout_cb, timeout, 1);
+    io->connect_timer->privdata = io;
+    io->connect = 1;
+    if (hio_add(io, hio_handle_events, HV_WRITE) < 0) {
+        hio_close_async(io);
+        return -1;
+    }
+    return ret;
+#else
+    (void)buf;
+    return hio_connect(io) < 0 ? -1 : 0;
+#endif
+}
+
 int hio_read(hio_t* io) {
     if (io->closed) {
         hloge("hio_read called but fd[%d] already closed!", io->fd);
         return -1;
     }
+    hio_unlink_pressure_paused(io);
     hio_add(io, hio_handle_events, HV_READ);
 
     return 0;
 }
 
+int hio_read_stop(hio_t* io) {
+    hio_unlink_pressure_paused(io);
+    return hio_del(io, HV_READ);
+}
+
+void hio_resume_pressure_paused(hloop_t* loop) {
+    // only the paused ios are visited, the loop may hold many more
+    while (!list_empty(&loop->pressure_paused_ios)) {
+        hio_t* io = list_entry(loop->pressure_paused_ios.next, hio_t, pressure_node);
+        hio_unlink_pressure_paused(io);
+        hio_add(io, hio_handle_events, HV_READ);
+    }
+}
+
 int hio_write(hio_t* io, shift_buffer_t* buf) {
     if (io->closed) {
         hloge("hio_write called but fd[%d] already closed!", io->fd);
@@ -513,6 +599,7 @@ int hio_close(hio_t* io) {
         return 0;
     }
     io->closed = 1;
+    hio_unlink_pressure_paused(io);
 
     hio_done(io);
     __close_cb(io);
@@ -248,6 +248,11 @@ int hio_accept (hio_t* io) {
     return hio_add(io, hio_handle_events, HV_READ);
 }
 
+int hio_connect_fastopen(hio_t* io, shift_buffer_t* buf) {
+    (void)buf;
+    return hio_connect(io) < 0 ? -1 : 0;
+}
+
 int hio_connect (hio_t* io) {
     // NOTE: ConnectEx must call bind
     struct sockaddr_in localaddr;
@@ -0,0 +1,414 @@
+#include "flow_table.h"
+#include "basic_types.h"
+#include "hdef.h"
+#include "hloop.h"
+#include "utils/hashutils.h"
+#include "ww.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum
+{
+    kGroupWidth      = 16,
+    kMinCapacity     = 64,
+    kWheelSlots      = 64,
+    kWheelTickMs     = 1000,
+    kCtrlEmpty       = 0x80,
+    kCtrlDeleted     = 0xFE,
+    kIpv4SrcOffset   = 12,
+    kIpv6SrcOffset   = 8,
+    kIpProtocolTcp   = 6,
+    kIpProtocolUdp   = 17,
+    kIpProtocolSctp  = 132
+};
+
+struct flow_table_s
+{
+    hloop_t           *loop;
+    htimer_t          *wheel_handle;
+    FlowExpireCallBack expire_cb;
+    uint8_t           *ctrl;
+    flow_entry_t     **slots;
+    size_t             capacity; // power of 2, multiple of kGroupWidth
+    size_t             size;
+    size_t             max_size;
+    size_t             growth_left; // inserts into empty slots before the table is rebuilt
+    uint64_t           timeout_ms;
+    uint64_t           wheel_tick; // next tick the wheel processes
+    flow_entry_t      *wheel[kWheelSlots];
+};
+
+static void wheelCallBack(htimer_t *timer);
+
+static inline uint8_t ctrlTag(hash_t hash)
+{
+    return (uint8_t) (hash & 0x7F);
+}
+
+static inline size_t firstGroup(const flow_table_t *self, hash_t hash)
+{
+    return (size_t) (hash >> 7) & ((self->capacity / kGroupWidth) - 1);
+}
+
+// bit i is set when ctrl[i] of the group equals the value
+static inline uint32_t matchGroup(const uint8_t *group, uint8_t value)
+{
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) value)));
+#else
+    uint32_t mask = 0;
+    for (unsigned int i = 0; i < kGroupWidth; i++)
+    {
+        mask |= (uint32_t) (group[i] == value) << i;
+    }
+    return mask;
+#endif
+}
+
+// bit i is set when slot i of the group is empty or deleted
+static inline uint32_t matchGroupFree(const uint8_t *group)
+{
+#if defined(__SSE2__)
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    uint32_t mask = 0;
+    for (unsigned int i = 0; i < kGroupWidth; i++)
+    {
+        mask |= (uint32_t) (group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline unsigned int lowestBit(uint32_t mask)
+{
+    return (unsigned int) __builtin_ctz(mask);
+}
+
+static void allocSlots(flow_table_t *self, size_t capacity)
+{
+    self->capacity    = capacity;
+    self->ctrl        = globalMalloc(capacity);
+    self->slots       = globalMalloc(capacity * sizeof(flow_entry_t *));
+    self->growth_left = capacity - (capacity / 8); // max load 7/8
+    memset(self->ctrl, kCtrlEmpty, capacity);
+}
+
+// places an entry that is known not to be in the table, returns the slot
+static size_t placeEntry(flow_table_t *self, flow_entry_t *flow)
+{
+    const size_t groups = self->capacity / kGroupWidth;
+    size_t       g      = firstGroup(self, flow->hash);
+
+    for (size_t step = 1;; step++)
+    {
+        const uint32_t free_mask = matchGroupFree(self->ctrl + (g * kGroupWidth));
+        if (free_mask != 0)
+        {
+            const size_t index = (g * kGroupWidth) + lowestBit(free_mask);
+            if (self->ctrl[index] == kCtrlEmpty)
+            {
+                self->growth_left -= 1;
+            }
+            self->ctrl[index]  = ctrlTag(flow->hash);
+            self->slots[index] = flow;
+            return index;
+        }
+        // triangular probing visits every group when the group count is a power of 2
+        g = (g + step) & (groups - 1);
+    }
+}
+
+static void rehash(flow_table_t *self)
+{
+    uint8_t       *old_ctrl     = self->ctrl;
+    flow_entry_t **old_slots    = self->slots;
+    const size_t   old_capacity = self->capacity;
+
+    // tombstones alone are cleared in place, a table that is really full doubles
+    const size_t capacity = (self->size * 2 > old_capacity - (old_capacity / 8)) ? old_capacity * 2 : old_capacity;
+
+    allocSlots(self, capacity);
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if ((old_ctrl[i] & 0x80) == 0)
+        {
+            placeEntry(self, old_slots[i]);
+        }
+    }
+    globalFree(old_ctrl);
+    globalFree(old_slots);
+}
+
+static size_t findSlot(const flow_table_t *self, const flow_key_t *key, hash_t hash)
+{
+    const size_t  groups = self->capacity / kGroupWidth;
+    const uint8_t tag    = ctrlTag(hash);
+    size_t        g      = firstGroup(self, hash);
+
+    for (size_t step = 1; step <= groups; step++)
+    {
+        const uint8_t *group = self->ctrl + (g * kGroupWidth);
+
+        for (uint32_t mask = matchGroup(group, tag); mask != 0; mask &= mask - 1)
+        {
+            const size_t  index = (g * kGroupWidth) + lowestBit(mask);
+            flow_entry_t *flow  = self->slots[index];
+            if (flow->hash == hash && memcmp(&(flow->key), key, sizeof(flow_key_t)) == 0)
+            {
+                return index;
+            }
+        }
+        if (matchGroup(group, kCtrlEmpty) != 0)
+        {
+            break;
+        }
+        g = (g + step) & (groups - 1);
+    }
+    return self->capacity;
+}
+
+static void wheelLink(flow_table_t *self, flow_entry_t *flow)
+{
+    uint64_t tick = (flow->last_seen_ms + self->timeout_ms) / kWheelTickMs;
+
+    // the slot that is being processed is not visited again for a full turn
+    if (tick < self->wheel_tick)
+    {
+        tick = self->wheel_tick;
+    }
+    if (tick >= self->wheel_tick + kWheelSlots)
+    {
+        tick = self->wheel_tick + kWheelSlots - 1;
+    }
+
+    const uint32_t slot = (uint32_t) (tick % kWheelSlots);
+    flow->wheel_slot    = slot;
+    flow->wheel_prev    = NULL;
+    flow->wheel_next    = self->wheel[slot];
+    if (self->wheel[slot] != NULL)
+    {
+        self->wheel[slot]->wheel_prev = flow;
+    }
+    self->wheel[slot] = flow;
+}
+
+static void wheelUnlink(flow_table_t *self, flow_entry_t *flow)
+{
+    if (flow->wheel_prev != NULL)
+    {
+        flow->wheel_prev->wheel_next = flow->wheel_next;
+    }
+    else
+    {
+        self->wheel[flow->wheel_slot] = flow->wheel_next;
+    }
+    if (flow->wheel_next != NULL)
+    {
+        flow->wheel_next->wheel_prev = flow->wheel_prev;
+    }
+}
+
+// the entry must already be out of the wheel
+static void eraseSlot(flow_table_t *self, size_t index)
+{
+    flow_entry_t *flow = self->slots[index];
+    self->ctrl[index]  = kCtrlDeleted;
+    self->size -= 1;
+    globalFree(flow);
+}
+
+// removes an entry of the first wheel slot that is not empty, those are the flows that expire first
+static void evictOldest(flow_table_t *self)
+{
+    for (uint64_t tick = self->wheel_tick; tick < self->wheel_tick + kWheelSlots; tick++)
+    {
+        flow_entry_t *flow = self->wheel[tick % kWheelSlots];
+        if (flow != NULL)
+        {
+            wheelUnlink(self, flow);
+            if (self->expire_cb != NULL)
+            {
+                self->expire_cb(self, flow);
+            }
+            eraseSlot(self, findSlot(self, &(flow->key), flow->hash));
+            return;
+        }
+    }
+}
+
+flow_table_t *newFlowTable(hloop_t *loop, uint64_t timeout_ms, size_t max_size, FlowExpireCallBack cb)
+{
+    flow_table_t *self = globalMalloc(sizeof(flow_table_t));
+    memset(self, 0, sizeof(flow_table_t));
+
+    self->loop         = loop;
+    self->expire_cb    = cb;
+    self->timeout_ms   = timeout_ms;
+    self->max_size     = max_size;
+    self->wheel_tick   = hloop_now_ms(loop) / kWheelTickMs;
+    self->wheel_handle = htimer_add(loop, wheelCallBack, kWheelTickMs, INFINITE);
+    hevent_set_userdata(self->wheel_handle, self);
+
+    allocSlots(self, kMinCapacity);
+    return self;
+}
+
+void destroyFlowTable(flow_table_t *self)
+{
+    htimer_del(self->wheel_handle);
+    for (size_t i = 0; i < self->capacity; i++)
+    {
+        if ((self->ctrl[i] & 0x80) == 0)
+        {
+            if (self->expire_cb != NULL)
+            {
+                self->expire_cb(self, self->slots[i]);
+            }
+            globalFree(self->slots[i]);
+        }
+    }
+    globalFree(self->ctrl);
+    globalFree(self->slots);
+    globalFree(self);
+}
+
+bool makeFlowKey(flow_key_t *key, const uint8_t *packet, unsigned int len, uint8_t ip_version,
+                 unsigned int l4_offset, uint8_t l4_protocol)
+{
+    memset(key, 0, sizeof(flow_key_t));
+    key->ip_version = ip_version;
+    key->protocol   = l4_protocol;
+
+    if (ip_version == 4)
+    {
+        if (len < kIpv4SrcOffset + 8)
+        {
+            return false;
+        }
+        memcpy(key->src, packet + kIpv4SrcOffset, 4);
+        memcpy(key->dst, packet + kIpv4SrcOffset + 4, 4);
+
+        // only the first fragment carries the ports
+        if (((((unsigned int) packet[6] << 8) | packet[7]) & 0x1FFF) != 0)
+        {
+            return true;
+        }
+    }
+    else if (ip_version == 6)
+    {
+        if (len < kIpv6SrcOffset + 32)
+        {
+            return false;
+        }
+        memcpy(key->src, packet + kIpv6SrcOffset, 16);
+        memcpy(key->dst, packet + kIpv6SrcOffset + 16, 16);
+    }
+    else
+    {
+        return false;
+    }
+
+    if ((l4_protocol == kIpProtocolTcp || l4_protocol == kIpProtocolUdp || l4_protocol == kIpProtocolSctp) &&
+        len >= l4_offset + 4)
+    {
+        memcpy(&(key->src_port), packet + l4_offset, 2);
+        memcpy(&(key->dst_port), packet + l4_offset + 2, 2);
+    }
+    return true;
+}
+
+flow_entry_t *findFlow(flow_table_t *self, const flow_key_t *key)
+{
+    const size_t index = findSlot(self, key, CALC_HASH_BYTES(key, sizeof(flow_key_t)));
+    return index == self->capacity ? NULL : self->slots[index];
+}
+
+flow_entry_t *trackFlow(flow_table_t *self, const flow_key_t *key, unsigned int packet_len, bool *created)
+{
+    const hash_t   hash  = CALC_HASH_BYTES(key, sizeof(flow_key_t));
+    const size_t   index = findSlot(self, key, hash);
+    const uint64_t now   = hloop_now_ms(self->loop);
+    flow_entry_t  *flow;
+
+    if (WW_LIKELY(index != self->capacity))
+    {
+        flow     = self->slots[index];
+        *created = false;
+    }
+    else
+    {
+        if (self->size >= self->max_size)
+        {
+            evictOldest(self);
+        }
+        if (self->growth_left == 0)
+        {
+            rehash(self);
+        }
+        flow = globalMalloc(sizeof(flow_entry_t));
+        memset(flow, 0, sizeof(flow_entry_t));
+        flow->key          = *key;
+        flow->hash         = hash;
+        flow->last_seen_ms = now;
+        placeEntry(self, flow);
+        wheelLink(self, flow);
+        self->size += 1;
+        *created = true;
+    }
+
+    flow->packets += 1;
+    flow->bytes += packet_len;
+    flow->last_seen_ms = now;
+    return flow;
+}
+
+void removeFlow(flow_table_t *self, flow_entry_t *flow)
+{
+    const size_t index = findSlot(self, &(flow->key), flow->hash);
+    assert(index != self->capacity);
+    wheelUnlink(self, flow);
+    eraseSlot(self, index);
+}
+
+size_t getFlowTableSize(flow_table_t *self)
+{
+    return self->size;
+}
+
+static void wheelCallBack(htimer_t *timer)
+{
+    flow_table_t  *self     = hevent_userdata(timer);
+    const uint64_t now      = hloop_now_ms(self->loop);
+    const uint64_t now_tick = now / kWheelTickMs;
+
+    while (self->wheel_tick <= now_tick)
+    {
+        const uint32_t slot = (uint32_t) (self->wheel_tick % kWheelSlots);
+        flow_entry_t  *flow = self->wheel[slot];
+        self->wheel[slot]   = NULL;
+        self->wheel_tick += 1;
+
+        while (flow != NULL)
+        {
+            flow_entry_t *next = flow->wheel_next;
+
+            if (flow->last_seen_ms + self->timeout_ms <= now)
+            {
+                if (self->expire_cb != NULL)
+                {
+                    self->expire_cb(self, flow);
+                }
+                eraseSlot(self, findSlot(self, &(flow->key), flow->hash));
+            }
+            else
+            {
+                wheelLink(self, flow);
+            }
+            flow = next;
+        }
+    }
+}
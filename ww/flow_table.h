@@ -0,0 +1,67 @@
+#pragma once
+
+#include "hloop.h"
+#include "ww.h"
+#include <stdint.h>
+
+/*
+    Per worker flow table (connection tracking) for layer3 nodes
+
+    a flow is identified by its 5-tuple (addresses, ports, protocol), the first packet of a flow creates an entry
+    and the node stores its decision (and any per flow state) in it, the rest of the packets of that flow find
+    the entry with one hash and one or two probes and reuse the decision instead of walking rules again
+
+    the table is a swiss table, a control byte per slot keeps 7 bits of the hash so a group of 16 slots is
+    matched with a single compare, entries are allocated one by one so their address stays the same while
+    the table grows
+
+    entries expire on a timing wheel with 1 second slots, a packet only updates the last seen time of its
+    entry, the wheel moves an entry forward when its slot comes and it was seen since
+
+    the table holds at most max_size entries, a new flow in a full table evicts an entry of the wheel slot that
+    expires first (the expire callback is called for it), so a flood of new flows can not grow it without bound
+
+    a flow table belongs to one worker and must only be used on it, nodes create one table per worker
+*/
+
+typedef struct flow_table_s flow_table_t;
+
+typedef struct flow_key_s
+{
+    uint8_t  src[16]; // ipv4 addresses use the first 4 bytes
+    uint8_t  dst[16];
+    uint16_t src_port; // network order, 0 for protocols without ports
+    uint16_t dst_port;
+    uint8_t  protocol;
+    uint8_t  ip_version;
+    uint16_t pad;
+
+} flow_key_t;
+
+typedef struct flow_entry_s
+{
+    flow_key_t           key;
+    uint64_t             packets;
+    uint64_t             bytes;
+    uint64_t             last_seen_ms;
+    void                *userdata; // per flow state of the owner node
+    uint32_t             decision; // cached decision of the owner node
+    uint32_t             wheel_slot;
+    hash_t               hash;
+    struct flow_entry_s *wheel_prev;
+    struct flow_entry_s *wheel_next;
+
+} flow_entry_t;
+
+// called right before an idle flow is removed, the owner releases what it keeps in userdata
+typedef void (*FlowExpireCallBack)(flow_table_t *table, flow_entry_t *flow);
+
+flow_table_t *newFlowTable(hloop_t *loop, uint64_t timeout_ms, size_t max_size, FlowExpireCallBack cb);
+void          destroyFlowTable(flow_table_t *self);
+
+bool          makeFlowKey(flow_key_t *key, const uint8_t *packet, unsigned int len, uint8_t ip_version,
+                          unsigned int l4_offset, uint8_t l4_protocol);
+flow_entry_t *findFlow(flow_table_t *self, const flow_key_t *key);
+flow_entry_t *trackFlow(flow_table_t *self, const flow_key_t *key, unsigned int packet_len, bool *created);
+void          removeFlow(flow_table_t *self, flow_entry_t *flow);
+size_t        getFlowTableSize(flow_table_t *self);
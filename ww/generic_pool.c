@@ -56,6 +56,17 @@ void poolShrink(generic_pool_t *pool)
 #endif
 }
 
+// gives the cached items back to the master pool and frees the pool, items still in use are not tracked
+void destroyGenericPool(generic_pool_t *pool)
+{
+    if (pool->len > 0)
+    {
+        reuseMasterPoolItems(pool->mp, pool->available, pool->len, pool);
+        pool->len = 0;
+    }
+    globalFree(pool);
+}
+
 static void poolFirstCharge(generic_pool_t *pool)
 {
     poolReCharge(pool);
@@ -112,6 +112,7 @@ generic_pool_t *newGenericPoolWithCap(struct master_pool_s *mp, unsigned int poo
 generic_pool_t *newGenericPoolDefaultAllocator(struct master_pool_s *mp, unsigned int item_size);
 generic_pool_t *newGenericPoolDefaultAllocatorWithCap(struct master_pool_s *mp, unsigned int item_size,
                                                       unsigned int pool_width);
+void            destroyGenericPool(generic_pool_t *pool);
 
 #undef BYPASS_POOL
 #undef POOL_DEBUG
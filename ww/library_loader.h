@@ -18,6 +18,10 @@ typedef struct tunnel_lib_s
     struct tunnel_s *(*destroyHandle)(struct tunnel_s *instance);
     api_result_t (*apiHandle)(struct tunnel_s *instance, const char *msg);
     tunnel_metadata_t (*getMetadataHandle)(void);
+    // optional, used by --compile: returns the settings pre-parsed into a globalMalloc'd block (NULL if there is
+    // nothing to pre-parse) and may remove what it took from settings, the node gets the block back in place as
+    // instance_info->compiled_data when it starts from the image
+    void *(*compileHandle)(struct cJSON *settings, size_t *len);
     hash_t hash_name;
 
 } tunnel_lib_t;
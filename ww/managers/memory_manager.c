@@ -91,6 +91,18 @@ void globalFree(void *ptr)
 {
     mi_free(ptr);
 }
+/*
+    for types declared with ATTR_ALIGNED_LINE_CACHE and the like, plain malloc only promises alignof(max_align_t)
+    alignment must be a power of 2, memory from here must be released with globalFreeAligned
+*/
+void *globalMallocAligned(size_t alignment, size_t size)
+{
+    return mi_malloc_aligned(size, alignment);
+}
+void globalFreeAligned(void *ptr)
+{
+    mi_free(ptr);
+}
 
 
 /*
@@ -38,6 +38,27 @@ static inline void globalFree(void *ptr)
 {
     free(ptr);
 }
+#ifdef _WIN32
+#include <malloc.h>
+static inline void *globalMallocAligned(size_t alignment, size_t size)
+{
+    return _aligned_malloc(size, alignment);
+}
+static inline void globalFreeAligned(void *ptr)
+{
+    _aligned_free(ptr);
+}
+#else
+static inline void *globalMallocAligned(size_t alignment, size_t size)
+{
+    // aligned_alloc wants the size to be a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+static inline void globalFreeAligned(void *ptr)
+{
+    free(ptr);
+}
+#endif
 
 static inline void *dedicatedMalloc(dedicated_memory_t *dm, size_t size)
 {
@@ -60,6 +81,8 @@ static inline void dedicatedFree(dedicated_memory_t *dm, void *ptr)
 void *globalMalloc(size_t size);
 void *globalRealloc(void *ptr, size_t size);
 void  globalFree(void *ptr);
+void *globalMallocAligned(size_t alignment, size_t size);
+void  globalFreeAligned(void *ptr);
 
 void *dedicatedMalloc(dedicated_memory_t *dm, size_t size);
 void *dedicatedRealloc(dedicated_memory_t *dm, void *ptr, size_t size);
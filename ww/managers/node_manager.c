@@ -2,6 +2,7 @@
 #include "basic_types.h"
 #include "cJSON.h"
 #include "config_file.h"
+#include "config_image.h"
 #include "library_loader.h"
 #include "loggers/core_logger.h"
 #include "node.h"
@@ -179,13 +180,24 @@ static void cycleProcess(node_manager_config_t *cfg)
     }
 }
 
-void registerNode(node_manager_config_t *cfg, node_t *new_node, cJSON *node_settings)
+// compiled is the node as a config image resolved it, NULL for json configs
+static void installNode(node_manager_config_t *cfg, node_t *new_node, cJSON *node_settings,
+                        const compiled_node_t *compiled)
 {
-    new_node->hash_name = CALC_HASH_BYTES(new_node->name, strlen(new_node->name));
-    new_node->hash_type = CALC_HASH_BYTES(new_node->type, strlen(new_node->type));
-    if (new_node->next)
+    if (compiled != NULL)
+    {
+        new_node->hash_name = compiled->hash_name;
+        new_node->hash_type = compiled->hash_type;
+        new_node->hash_next = compiled->hash_next;
+    }
+    else
     {
-        new_node->hash_next = CALC_HASH_BYTES(new_node->next, strlen(new_node->next));
+        new_node->hash_name = CALC_HASH_BYTES(new_node->name, strlen(new_node->name));
+        new_node->hash_type = CALC_HASH_BYTES(new_node->type, strlen(new_node->type));
+        if (new_node->next)
+        {
+            new_node->hash_next = CALC_HASH_BYTES(new_node->next, strlen(new_node->next));
+        }
     }
     // load lib
     tunnel_lib_t lib = loadTunnelLibByHash(new_node->hash_type);
@@ -215,6 +227,11 @@ void registerNode(node_manager_config_t *cfg, node_t *new_node, cJSON *node_sett
     new_node_ctx.node_settings_json  = node_settings;
     new_node_ctx.node                = new_node;
     new_node_ctx.node_manager_config = cfg;
+    if (compiled != NULL)
+    {
+        new_node_ctx.compiled_data     = compiled->data;
+        new_node_ctx.compiled_data_len = compiled->data_len;
+    }
 
     new_node->instance_context = new_node_ctx;
 
@@ -228,6 +245,11 @@ void registerNode(node_manager_config_t *cfg, node_t *new_node, cJSON *node_sett
     map_node_t_insert(map, new_node->hash_name, new_node);
 }
 
+void registerNode(node_manager_config_t *cfg, node_t *new_node, cJSON *node_settings)
+{
+    installNode(cfg, new_node, node_settings, NULL);
+}
+
 node_t *getNode(node_manager_config_t *cfg, hash_t hash_node_name)
 {
     map_node_t_iter iter = map_node_t_find(&(cfg->node_map), hash_node_name);
@@ -245,10 +267,12 @@ node_t *newNode(void)
     return new_node;
 }
 
-static void startInstallingConfigFile(node_manager_config_t *cfg)
+static void registerConfigNodes(node_manager_config_t *cfg)
 {
-    cJSON *nodes_json = cfg->config_file->nodes;
-    cJSON *node_json  = NULL;
+    const config_image_t *image      = cfg->config_file->image;
+    cJSON                *nodes_json = cfg->config_file->nodes;
+    cJSON                *node_json  = NULL;
+    unsigned int          index      = 0;
     cJSON_ArrayForEach(node_json, nodes_json)
     {
         node_t *new_node = newNode();
@@ -267,10 +291,22 @@ static void startInstallingConfigFile(node_manager_config_t *cfg)
         }
         getStringFromJsonObject(&(new_node->next), node_json, "next");
         getIntFromJsonObjectOrDefault((int *) &(new_node->version), node_json, "version", 0);
-        registerNode(cfg, new_node, cJSON_GetObjectItemCaseSensitive(node_json, "settings"));
+        installNode(cfg, new_node, cJSON_GetObjectItemCaseSensitive(node_json, "settings"),
+                    image != NULL ? &(image->nodes[index]) : NULL);
+        index++;
+    }
+
+    // the graph of an image was resolved by the compiler and its indexes checked when it was loaded
+    if (image == NULL)
+    {
+        cycleProcess(cfg);
+        pathWalk(cfg);
     }
-    cycleProcess(cfg);
-    pathWalk(cfg);
+}
+
+static void startInstallingConfigFile(node_manager_config_t *cfg)
+{
+    registerConfigNodes(cfg);
     runNodes(cfg);
 }
 
@@ -292,6 +328,27 @@ void runConfigFile(config_file_t *config_file)
     vec_configs_t_push(&(state->configs), cfg);
 }
 
+void checkConfigFile(config_file_t *config_file)
+{
+    node_manager_config_t cfg = {.config_file = config_file, .node_map = map_node_t_with_capacity(kNodeMapCap)};
+    registerConfigNodes(&cfg);
+
+    // nothing was started, only the nodes themselves are released
+    c_foreach(p1, map_node_t, cfg.node_map)
+    {
+        node_t *n1 = p1.ref->second;
+        globalFree(n1->name);
+        globalFree(n1->type);
+        if (n1->next)
+        {
+            globalFree(n1->next);
+        }
+        globalFree(n1->lib);
+        globalFree(n1);
+    }
+    map_node_t_drop(&cfg.node_map);
+}
+
 node_manager_t *createNodeManager(void)
 {
     assert(state == NULL);
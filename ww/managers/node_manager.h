@@ -31,6 +31,7 @@ node_t                *getNode(node_manager_config_t *cfg, hash_t hash_node_name
 node_t                *newNode(void);
 void                   registerNode(node_manager_config_t *cfg, node_t *new_node, cJSON *node_settings);
 void                   runConfigFile(config_file_t *config_file);
+void                   checkConfigFile(config_file_t *config_file); // graph checks only, exits on failure
 struct node_manager_s *getNodeManager(void);
 void                   setNodeManager(struct node_manager_s *state);
 struct node_manager_s *createNodeManager(void);
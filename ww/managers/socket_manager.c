@@ -44,7 +44,9 @@ enum
     kSoOriginalDest          = 80,
     kFilterLevels            = 4,
     kMaxBalanceSelections    = 64,
-    kDefalultBalanceInterval = 60 * 1000
+    kDefalultBalanceInterval = 60 * 1000,
+    kMaxSteerPeekLen         = 32,
+    kSteerKeyTimeout         = 1000
 };
 
 typedef struct socket_manager_s
@@ -249,25 +251,21 @@ static inline bool needsV4SocketStrategy(sockaddr_u *peer_addr)
     return use_v4_strategy;
 }
 
-static void parseWhiteListOption(socket_filter_option_t *option)
+socket_filter_prefix_t *parseWhiteListPrefixes(char *const *cidrs, unsigned int *count)
 {
-    assert(option->white_list_raddr != NULL);
-
     int   len = 0;
     char *cur = NULL;
 
-    while ((cur = option->white_list_raddr[len]))
+    while ((cur = cidrs[len]))
     {
         len++;
     }
 
-    option->white_list_parsed_length = len;
-    option->white_list_parsed        = globalMalloc(sizeof(option->white_list_parsed[0]) * len);
+    socket_filter_prefix_t *prefixes = globalMalloc(sizeof(socket_filter_prefix_t) * len);
     for (int i = 0; i < len; i++)
     {
-        cur              = option->white_list_raddr[i];
-        int parse_result = parseIPWithSubnetMask(&(option->white_list_parsed[i].ip_bytes_buf), cur,
-                                                 &(option->white_list_parsed[i].mask_bytes_buf));
+        cur              = cidrs[i];
+        int parse_result = parseIPWithSubnetMask(&(prefixes[i].ip_bytes_buf), cur, &(prefixes[i].mask_bytes_buf));
 
         if (parse_result == -1)
         {
@@ -275,6 +273,15 @@ static void parseWhiteListOption(socket_filter_option_t *option)
             exit(1);
         }
     }
+    *count = (unsigned int) len;
+    return prefixes;
+}
+
+static void parseWhiteListOption(socket_filter_option_t *option)
+{
+    assert(option->white_list_raddr != NULL);
+
+    option->white_list_parsed = parseWhiteListPrefixes(option->white_list_raddr, &(option->white_list_parsed_length));
 }
 
 void registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onAccept cb)
@@ -284,6 +291,12 @@ void registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onA
         LOGF("SocketManager: cannot register after accept thread starts");
         exit(1);
     }
+    if ((unsigned int) option.steer_key_offset + option.steer_key_len > kMaxSteerPeekLen)
+    {
+        LOGF("SocketManager: steering keys must end in the first %d bytes of the stream (offset %d + length %d)",
+             kMaxSteerPeekLen, (int) option.steer_key_offset, (int) option.steer_key_len);
+        exit(1);
+    }
     socket_filter_t *filter   = globalMalloc(sizeof(socket_filter_t));
     unsigned int     pirority = 0;
     if (option.multiport_backend == kMultiportBackendNothing)
@@ -292,9 +305,12 @@ void registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onA
     }
     if (option.white_list_raddr != NULL)
     {
-        pirority++;
         parseWhiteListOption(&option);
     }
+    if (option.white_list_parsed != NULL)
+    {
+        pirority++;
+    }
 
     if (option.black_list_raddr != NULL)
     {
@@ -345,11 +361,8 @@ static inline void incrementDistributeTid(void)
     }
 }
 
-static void distributeSocket(void *io, socket_filter_t *filter, uint16_t local_port)
+static void distributeSocketTo(void *io, socket_filter_t *filter, uint16_t local_port, tid_t tid)
 {
-
-    tid_t tid = (uint8_t) getCurrentDistributeTid();
-
     hhybridmutex_lock(&(state->tcp_pools[tid].mutex));
     socket_accept_result_t *result = popPoolItem(state->tcp_pools[tid].pool);
     hhybridmutex_unlock(&(state->tcp_pools[tid].mutex));
@@ -362,11 +375,136 @@ static void distributeSocket(void *io, socket_filter_t *filter, uint16_t local_p
     result->io           = io;
     result->tunnel       = filter->tunnel;
     ev.userdata          = result;
-    incrementDistributeTid();
 
     hloop_post_event(worker_loop, &ev);
 }
 
+static void distributeSocket(void *io, socket_filter_t *filter, uint16_t local_port)
+{
+    tid_t tid = (uint8_t) getCurrentDistributeTid();
+    incrementDistributeTid();
+    distributeSocketTo(io, filter, local_port, tid);
+}
+
+typedef struct steer_wait_s
+{
+    socket_filter_t *filter;
+    htimer_t        *timer;
+    uint16_t         local_port;
+
+} steer_wait_t;
+
+// a tls record or an http request line starts the same way for every connection, steering on it is pointless
+static bool hasFixedPreamble(const uint8_t *head, int len)
+{
+    if (len >= 2 && head[0] == 0x16 && head[1] == 0x03)
+    {
+        return true;
+    }
+    if (len < 3)
+    {
+        return false;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (head[i] < 'A' || head[i] > 'Z')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    peeks the steering key of the socket, returns false if it is not fully received yet, otherwise the socket is
+    distributed to the worker of the key (or closed if the peer is already gone)
+*/
+static bool tryDistributeByKey(hio_t *io, socket_filter_t *filter, uint16_t local_port)
+{
+    const uint8_t key_offset = filter->option.steer_key_offset;
+    const uint8_t key_len    = filter->option.steer_key_len;
+    const int     peek_len   = (int) key_offset + key_len;
+    uint8_t       head[kMaxSteerPeekLen];
+
+    int n = (int) recv(hio_fd(io), (void *) head, (size_t) peek_len, MSG_PEEK);
+    if (n == 0 || (n < 0 && socket_errno() != EAGAIN))
+    {
+        hio_close(io);
+        return true;
+    }
+
+    if (hasFixedPreamble(head, n))
+    {
+        static bool warned = false;
+        if (! warned)
+        {
+            warned = true;
+            LOGW("SocketManager: a steered listener got a tls or http stream, such streams are not steered, turn "
+                 "steering off if nothing on this port starts with a flow id");
+        }
+        hio_del(io, HV_RDWR);
+        hevent_set_userdata(io, NULL);
+        hio_detach(io);
+        distributeSocket(io, filter, local_port);
+        return true;
+    }
+    if (n < peek_len)
+    {
+        return false;
+    }
+
+    uint8_t *key = head + key_offset;
+    key[0] &= filter->option.steer_key_first_byte_mask;
+    const tid_t tid = (tid_t) (CALC_HASH_BYTES(key, key_len) % getWorkersCount());
+
+    hio_del(io, HV_RDWR);
+    hevent_set_userdata(io, NULL);
+    hio_detach(io);
+    distributeSocketTo(io, filter, local_port, tid);
+    return true;
+}
+
+static void onSteerKeyReadable(hio_t *io)
+{
+    steer_wait_t *wait = hevent_userdata(io);
+    htimer_t     *timer = wait->timer;
+
+    if (tryDistributeByKey(io, wait->filter, wait->local_port))
+    {
+        htimer_del(timer);
+        globalFree(wait);
+    }
+}
+
+static void onSteerKeyTimeout(htimer_t *timer)
+{
+    hio_t        *io   = hevent_userdata(timer);
+    steer_wait_t *wait = hevent_userdata(io);
+
+    // the key did not come in time, the pair (if any) will meet on different workers
+    hio_del(io, HV_RDWR);
+    hevent_set_userdata(io, NULL);
+    hio_detach(io);
+    distributeSocket(io, wait->filter, wait->local_port);
+    htimer_del(timer);
+    globalFree(wait);
+}
+
+static void distributeSocketByKey(hio_t *io, socket_filter_t *filter, uint16_t local_port)
+{
+    if (tryDistributeByKey(io, filter, local_port))
+    {
+        return;
+    }
+
+    steer_wait_t *wait = globalMalloc(sizeof(steer_wait_t));
+    *wait              = (steer_wait_t) {.filter = filter, .local_port = local_port};
+    wait->timer        = htimer_add(hevent_loop(io), onSteerKeyTimeout, kSteerKeyTimeout, 1);
+    hevent_set_userdata(wait->timer, io);
+    hevent_set_userdata(io, wait);
+    hio_add(io, onSteerKeyReadable, HV_READ);
+}
+
 static void noTcpSocketConsumerFound(hio_t *io)
 {
     char localaddrstr[SOCKADDR_STRLEN] = {0};
@@ -448,7 +586,7 @@ static void distributeTcpSocket(hio_t *io, uint16_t local_port)
                 continue;
             }
 
-            if (option.white_list_raddr != NULL)
+            if (option.white_list_parsed != NULL)
             {
                 if (! checkIpIsWhiteList(paddr, option))
                 {
@@ -494,6 +632,11 @@ static void distributeTcpSocket(hio_t *io, uint16_t local_port)
             {
                 tcp_nodelay(hio_fd(io), 1);
             }
+            if (option.steer_key_len > 0)
+            {
+                distributeSocketByKey(io, filter, local_port);
+                return;
+            }
             hio_detach(io);
             distributeSocket(io, filter, local_port);
             return;
@@ -755,7 +898,7 @@ static void distributeUdpPayload(const udp_payload_t pl)
             {
                 continue;
             }
-            if (option.white_list_raddr != NULL)
+            if (option.white_list_parsed != NULL)
             {
                 if (! checkIpIsWhiteList(paddr, option))
                 {
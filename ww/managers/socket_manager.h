@@ -20,6 +20,14 @@ typedef enum
 
 struct balance_group_s;
 
+// one whitelist entry, a config image stores these as they are (see the listeners compileHandle)
+typedef struct socket_filter_prefix_s
+{
+    struct in6_addr ip_bytes_buf;
+    struct in6_addr mask_bytes_buf;
+
+} socket_filter_prefix_t;
+
 /*
     socket_filter_option_t provides information about which forxample protocol (tcp ? udp?)
     which ports (single? range?)
@@ -42,13 +50,21 @@ typedef struct socket_filter_option_s
     bool                         no_delay;
     unsigned int                 balance_group_interval;
 
-    // private
-    unsigned int white_list_parsed_length;
-    struct
-    {
-        struct in6_addr ip_bytes_buf;
-        struct in6_addr mask_bytes_buf;
-    } *white_list_parsed;
+    // when set, a tcp connection is handed to the worker picked by the hash of steer_key_len bytes at
+    // steer_key_offset of its stream (the first one masked by steer_key_first_byte_mask), so connections that start
+    // with the same key land on the same worker, the socket manager peeks the key and falls back to round robin if
+    // it does not arrive in time
+    //
+    // only for protocols that open the stream with a per flow id (halfduplex straight on the listener), a stream
+    // that opens with a fixed preamble would put every connection on one worker, tls and http ones are detected
+    // and go round robin, offset + len can not be more than the bytes the manager peeks (32)
+    uint8_t steer_key_offset;
+    uint8_t steer_key_len;
+    uint8_t steer_key_first_byte_mask;
+
+    // filled from white_list_raddr, or set by the acceptor instead of it when the prefixes are already parsed
+    unsigned int                  white_list_parsed_length;
+    const socket_filter_prefix_t *white_list_parsed;
 
     idle_table_t *shared_balance_table;
 
@@ -95,4 +111,6 @@ struct socket_manager_s *createSocketManager(void);
 void                     setSocketManager(struct socket_manager_s *state);
 void                     startSocketManager(void);
 void                     registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onAccept cb);
+// cidrs is NULL terminated, exits on a malformed entry
+socket_filter_prefix_t  *parseWhiteListPrefixes(char *const *cidrs, unsigned int *count);
 void                     postUdpWrite(udpsock_t *socket_io, uint8_t tid_from, shift_buffer_t *buf);
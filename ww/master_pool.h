@@ -146,6 +146,23 @@ static inline void reuseMasterPoolItems(master_pool_t *const pool, master_pool_i
     }
 }
 
+// destroys every item the pool keeps, used to give memory back under pressure
+static inline void drainMasterPool(master_pool_t *const pool, void *userdata)
+{
+    if (atomic_load_explicit(&(pool->len), memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    hhybridmutex_lock(&(pool->mutex));
+    const unsigned int tmp_len = atomic_load_explicit(&(pool->len), memory_order_relaxed);
+    for (unsigned int i = 0; i < tmp_len; i++)
+    {
+        pool->destroy_item_handle(pool, pool->available[i], userdata);
+    }
+    atomic_store_explicit(&(pool->len), 0, memory_order_relaxed);
+    hhybridmutex_unlock(&(pool->mutex));
+}
+
 static void installMasterPoolAllocCallbacks(master_pool_t *pool, MasterPoolItemCreateHandle create_h,
                                             MasterPoolItemDestroyHandle destroy_h)
 {
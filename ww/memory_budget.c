@@ -0,0 +1,172 @@
+#include "memory_budget.h"
+#include "buffer_classes.h"
+#include "buffer_pool.h"
+#include "buffer_slab.h"
+#include "hevent.h"
+#include "hloop.h"
+#include "hplatform.h"
+#include "loggers/core_logger.h"
+#include "mimalloc.h"
+#include "ww.h"
+#include <stdatomic.h>
+
+#if defined(OS_LINUX)
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+enum
+{
+    kMemoryBudgetTickMs = 500
+};
+
+static size_t      soft_watermark = 0;
+static size_t      hard_watermark = 0;
+static atomic_int  pressure_level = kMemoryPressureNone;
+
+/*
+    on linux the resident pages are read from /proc/self/statm, mimalloc only reports its own commit counter
+    as rss there, windows and macos get the real resident size from mimalloc (working set / task info)
+*/
+size_t getMemoryUsage(void)
+{
+#if defined(OS_LINUX)
+    char buf[128];
+    int  fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return 0;
+    }
+    buf[len] = '\0';
+
+    // size resident shared text lib data dt, in pages
+    unsigned long pages_size     = 0;
+    unsigned long pages_resident = 0;
+    if (sscanf(buf, "%lu %lu", &pages_size, &pages_resident) != 2)
+    {
+        return 0;
+    }
+    return (size_t) pages_resident * (size_t) sysconf(_SC_PAGESIZE);
+#else
+    size_t elapsed, user, system, current_rss, peak_rss, current_commit, peak_commit, page_faults;
+    mi_process_info(&elapsed, &user, &system, &current_rss, &peak_rss, &current_commit, &peak_commit, &page_faults);
+    return current_rss;
+#endif
+}
+
+enum memory_pressure getMemoryPressure(void)
+{
+    return (enum memory_pressure) atomic_load_explicit(&pressure_level, memory_order_relaxed);
+}
+
+static bool isOver(size_t usage, size_t watermark, bool was_over)
+{
+    if (watermark == 0)
+    {
+        return false;
+    }
+    return was_over ? usage >= watermark - (watermark / 8) : usage >= watermark;
+}
+
+static void reportUsage(size_t usage, enum memory_pressure level)
+{
+    static const char *const kLevelNames[] = {"normal", "soft limit", "hard limit"};
+
+    LOGW("MemoryBudget: %s, resident memory %zu MB (soft %zu MB, hard %zu MB)", kLevelNames[level], usage >> 20,
+         soft_watermark >> 20, hard_watermark >> 20);
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        buffer_pool_t *pool = getWorkerBufferPool(i);
+        LOGW("MemoryBudget: worker %u holds %ld buffers, %u cached", i, getBufferPoolInUse(pool),
+             getBufferPoolCachedCount(pool));
+    }
+
+    for (unsigned int i = 0; i < kBufferSizeClassCount; i++)
+    {
+        const buffer_size_class_stats_t stats = getBufferSizeClassStats(i);
+        if (stats.hits + stats.misses > 0)
+        {
+            LOGW("MemoryBudget: buffer class of %zu bytes, %llu hits %llu misses", stats.block_size,
+                 (unsigned long long) stats.hits, (unsigned long long) stats.misses);
+        }
+    }
+}
+
+// only worker 0 samples, other workers follow the level it published
+static void sampleUsage(void)
+{
+    const size_t               usage = getMemoryUsage();
+    const enum memory_pressure prev  = getMemoryPressure();
+    enum memory_pressure       level = kMemoryPressureNone;
+
+    if (isOver(usage, hard_watermark, prev >= kMemoryPressureHard))
+    {
+        level = kMemoryPressureHard;
+    }
+    else if (isOver(usage, soft_watermark, prev >= kMemoryPressureSoft))
+    {
+        level = kMemoryPressureSoft;
+    }
+
+    if (level != prev)
+    {
+        atomic_store_explicit(&pressure_level, level, memory_order_relaxed);
+        reportUsage(usage, level);
+    }
+}
+
+static void onMemoryBudgetTick(htimer_t *timer)
+{
+    const tid_t tid  = (tid_t) (uintptr_t) hevent_userdata(timer);
+    hloop_t    *loop = getWorkerLoop(tid);
+
+    if (tid == 0)
+    {
+        sampleUsage();
+    }
+
+    const enum memory_pressure level = getMemoryPressure();
+    const enum memory_pressure prev  = (enum memory_pressure) loop->memory_pressure;
+    loop->memory_pressure            = level;
+
+    if (level >= kMemoryPressureSoft)
+    {
+        shrinkBufferPool(getWorkerBufferPool(tid));
+        releaseFreeSlabSlots();
+        mi_collect(false);
+    }
+
+    if (prev >= kMemoryPressureHard && level < kMemoryPressureHard)
+    {
+        hio_resume_pressure_paused(loop);
+    }
+}
+
+void initMemoryBudget(size_t soft_limit, size_t hard_limit)
+{
+    if (soft_limit == 0 && hard_limit == 0)
+    {
+        return;
+    }
+    if (hard_limit != 0 && soft_limit > hard_limit)
+    {
+        LOGW("MemoryBudget: soft limit is above the hard limit, soft limit is lowered to the hard limit");
+        soft_limit = hard_limit;
+    }
+    soft_watermark = soft_limit;
+    hard_watermark = hard_limit;
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        htimer_t *timer = htimer_add(getWorkerLoop(i), onMemoryBudgetTick, kMemoryBudgetTickMs, INFINITE);
+        hevent_set_userdata(timer, (void *) (uintptr_t) i);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+
+/*
+    Process wide memory budget
+
+    the resident memory of the process is sampled every tick and compared with 2 watermarks
+
+    soft:   every worker gives its cached buffers back (buffer pools and master pools) and asks the allocator
+            to return free pages, usage of each worker is reported
+
+    hard:   on top of that, stream sockets that are moving bulk data (the ones reading into large buffers) stop
+            reading until usage is back under the watermark, their data waits in the kernel and tcp flow control
+            slows the peer down, interactive connections keep working
+
+            the choice is made per socket from its recent read sizes, the sockets are not ranked by the memory
+            their lines hold, so every bulk reader of the process stops, not only the heaviest ones
+
+    a level is left when usage is 1/8 below its watermark, so it does not flap around it
+
+    a limit of 0 disables it, the budget is off unless core.json (misc) sets "memory-soft-limit" or
+    "memory-hard-limit" (megabytes)
+*/
+
+enum memory_pressure
+{
+    kMemoryPressureNone = 0,
+    kMemoryPressureSoft,
+    kMemoryPressureHard
+};
+
+// starts the tick on every worker loop, call it after the workers are created and before they run
+void                 initMemoryBudget(size_t soft_limit, size_t hard_limit);
+enum memory_pressure getMemoryPressure(void);
+size_t               getMemoryUsage(void);
@@ -11,6 +11,9 @@ typedef struct node_instance_context_s
     struct node_manager_config_s *node_manager_config;
     struct node_s                *node;
     size_t                        chain_index;
+    // settings the library pre-parsed into a config image (compileHandle), read in place, NULL for json configs
+    const void                   *compiled_data;
+    size_t                        compiled_data_len;
 } node_instance_context_t;
 
 enum node_flags
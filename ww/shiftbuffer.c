@@ -1,4 +1,5 @@
 #include "shiftbuffer.h"
+#include "buffer_classes.h"
 #include "generic_pool.h"
 #include "utils/mathutils.h"
 #include "ww.h"
@@ -12,6 +13,12 @@
 
 #define REFC_SIZE sizeof(shiftbuffer_refc_t)
 
+// the refcount sits at the end of the block, so it also tells how big the block is
+static inline size_t blockSize(const char *block, const shiftbuffer_refc_t *refc)
+{
+    return (size_t) ((const char *) refc - block) + REFC_SIZE;
+}
+
 pool_item_t *allocShiftBufferPoolHandle(generic_pool_t *pool)
 {
     (void) pool;
@@ -35,7 +42,7 @@ void destroyShiftBuffer(generic_pool_t *pool, shift_buffer_t *self)
 
     if (*(self->refc) <= 0)
     {
-        globalFree(self->pbuf - self->offset);
+        freeBufferMemory(self->pbuf - self->offset, blockSize(self->pbuf - self->offset, self->refc));
         reusePoolItem(pool, self);
     }
     else
@@ -44,15 +51,24 @@ void destroyShiftBuffer(generic_pool_t *pool, shift_buffer_t *self)
     }
 }
 
-shift_buffer_t *newShiftBuffer(generic_pool_t *pool, unsigned int pre_cap) // NOLINT
+size_t getShiftBufferPaddingSize(void)
+{
+    return LEFTPADDING + RIGHTPADDING;
+}
+
+// number of bytes newShiftBuffer allocates for a buffer of this capacity, rounded up to its size class
+size_t calcShiftBufferAllocSize(unsigned int pre_cap)
 {
     if (pre_cap != 0 && pre_cap % 16 != 0)
     {
-        // pre_cap = (unsigned int) pow(2, ceil(log2((double) max(16, pre_cap))));
         pre_cap = (max(16, pre_cap) + 15) & ~0x0F;
     }
+    return fitBufferSizeClass((size_t) pre_cap + LEFTPADDING + RIGHTPADDING);
+}
 
-    unsigned int real_cap = (pre_cap + LEFTPADDING + RIGHTPADDING) - REFC_SIZE;
+shift_buffer_t *newShiftBuffer(generic_pool_t *pool, unsigned int pre_cap) // NOLINT
+{
+    unsigned int real_cap = (unsigned int) calcShiftBufferAllocSize(pre_cap) - REFC_SIZE;
 
     // shift_buffer_t *self = globalMalloc(sizeof(shift_buffer_t));
     shift_buffer_t *self = (shift_buffer_t *) popPoolItem(pool);
@@ -61,7 +77,7 @@ shift_buffer_t *newShiftBuffer(generic_pool_t *pool, unsigned int pre_cap) // NO
     self->offset   = 0;
     self->curpos   = LEFTPADDING;
     self->full_cap = real_cap;
-    self->pbuf     = globalMalloc(real_cap + REFC_SIZE);
+    self->pbuf     = allocBufferMemory(real_cap + REFC_SIZE);
     self->refc     = (shiftbuffer_refc_t *) (self->pbuf + real_cap);
     *(self->refc)  = 1;
 
@@ -83,12 +99,7 @@ void reset(shift_buffer_t *self, unsigned int pre_cap)
 {
     assert(! isShallow(self));
 
-    if (pre_cap != 0 && pre_cap % 16 != 0)
-    {
-        pre_cap = (max(16, pre_cap) + 15) & ~0x0F;
-    }
-
-    unsigned int real_cap = (pre_cap + LEFTPADDING + RIGHTPADDING) - REFC_SIZE;
+    unsigned int real_cap = (unsigned int) calcShiftBufferAllocSize(pre_cap) - REFC_SIZE;
 
     if (self->offset != 0)
     {
@@ -100,8 +111,8 @@ void reset(shift_buffer_t *self, unsigned int pre_cap)
 
     if (self->full_cap != real_cap)
     {
-        globalFree(self->pbuf - self->offset);
-        self->pbuf     = globalMalloc(real_cap + REFC_SIZE);
+        freeBufferMemory(self->pbuf, blockSize(self->pbuf, self->refc));
+        self->pbuf     = allocBufferMemory(real_cap + REFC_SIZE);
         self->refc     = (shiftbuffer_refc_t *) (self->pbuf + real_cap);
         *(self->refc)  = 1;
         self->full_cap = real_cap;
@@ -118,10 +129,11 @@ void unShallow(shift_buffer_t *self)
     char *old_buf = self->pbuf;
 
     *(self->refc) -= 1;
-    self->pbuf    = globalMalloc(self->full_cap + REFC_SIZE);
-    self->refc    = (shiftbuffer_refc_t *) (self->pbuf + self->full_cap);
-    *(self->refc) = 1;
-    self->offset  = 0;
+    self->full_cap = (unsigned int) fitBufferSizeClass(self->full_cap + REFC_SIZE) - REFC_SIZE;
+    self->pbuf     = allocBufferMemory(self->full_cap + REFC_SIZE);
+    self->refc     = (shiftbuffer_refc_t *) (self->pbuf + self->full_cap);
+    *(self->refc)  = 1;
+    self->offset   = 0;
     memcpy(&(self->pbuf[self->curpos]), &(old_buf[self->curpos]), (self->calc_len));
 }
 
@@ -134,13 +146,15 @@ void expand(shift_buffer_t *self, unsigned int increase)
         const unsigned int calculated_increase = increase * 2UL;
         const unsigned int minimum_increase    = old_realcap / 4;
 
+        // moves to the size class that fits, its block can be recycled
         unsigned int new_realcap =
             old_realcap + (minimum_increase > calculated_increase ? minimum_increase : calculated_increase);
+        new_realcap = (unsigned int) fitBufferSizeClass(new_realcap + REFC_SIZE) - REFC_SIZE;
 
         // unShallow
         char *old_buf = self->pbuf;
         *(self->refc) -= 1;
-        self->pbuf       = globalMalloc(new_realcap + REFC_SIZE);
+        self->pbuf       = allocBufferMemory(new_realcap + REFC_SIZE);
         self->refc       = (shiftbuffer_refc_t *) (self->pbuf + new_realcap);
         *(self->refc)    = 1;
         self->offset     = 0;
@@ -156,17 +170,20 @@ void expand(shift_buffer_t *self, unsigned int increase)
         const unsigned int calculated_increase = increase * 2UL;
         const unsigned int minimum_increase    = old_realcap / 4;
 
+        // moves to the size class that fits, its block can be recycled
         unsigned int new_realcap =
             old_realcap + (minimum_increase > calculated_increase ? minimum_increase : calculated_increase);
-        char *old_buf    = self->pbuf;
-        self->pbuf       = globalMalloc(new_realcap + REFC_SIZE);
+        new_realcap = (unsigned int) fitBufferSizeClass(new_realcap + REFC_SIZE) - REFC_SIZE;
+        char                     *old_buf  = self->pbuf;
+        const shiftbuffer_refc_t *old_refc = self->refc;
+        self->pbuf       = allocBufferMemory(new_realcap + REFC_SIZE);
         self->refc       = (shiftbuffer_refc_t *) (self->pbuf + new_realcap);
         *(self->refc)    = 1;
         unsigned int dif = (new_realcap - self->full_cap) / 2;
         memcpy(&(self->pbuf[self->curpos + dif]), &(old_buf[self->curpos]), self->calc_len);
         self->curpos += dif;
         self->full_cap = new_realcap;
-        globalFree(old_buf - self->offset);
+        freeBufferMemory(old_buf - self->offset, blockSize(old_buf - self->offset, old_refc));
         self->offset = 0;
     }
 }
@@ -45,6 +45,8 @@ typedef struct shift_buffer_s shift_buffer_t;
 void           *allocShiftBufferPoolHandle(generic_pool_t *pool);
 void            destroyShiftBufferPoolHandle(generic_pool_t *pool, void *item);
 shift_buffer_t *newShiftBuffer(generic_pool_t *pool, unsigned int pre_cap);
+size_t          calcShiftBufferAllocSize(unsigned int pre_cap);
+size_t          getShiftBufferPaddingSize(void);
 shift_buffer_t *newShallowShiftBuffer(generic_pool_t *pool, shift_buffer_t *owner);
 shift_buffer_t *sliceBuffer(generic_pool_t *pool, shift_buffer_t *self, unsigned int bytes);
 shift_buffer_t *shallowSliceBuffer(generic_pool_t *pool, shift_buffer_t *self, unsigned int bytes);
@@ -2,6 +2,8 @@
 #include "basic_types.h"
 #include "hsocket.h"
 #include "loggers/dns_logger.h"
+#include "utils/mathutils.h"
+#include "utils/sockutils.h"
 
 
 bool resolveContextSync(socket_context_t *sctx)
@@ -37,3 +39,102 @@ bool resolveContextSync(socket_context_t *sctx)
     sctx->domain_resolved = true;
     return true;
 }
+
+enum
+{
+    kMaxResolvedAddresses = 16
+};
+
+unsigned int resolveContextSyncAll(socket_context_t *sctx, enum domain_strategy strategy, sockaddr_u *addrs,
+                                   unsigned int max)
+{
+    assert(sctx->address_type == kSatDomainName && sctx->domain_resolved == false && sctx->domain != NULL);
+    assert(max > 0);
+
+    const uint16_t  port  = sockaddr_port(&(sctx->address));
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *ais  = NULL;
+
+    if (strategy == kDsOnlyIpV4)
+    {
+        hints.ai_family = AF_INET;
+    }
+    else if (strategy == kDsOnlyIpV6)
+    {
+        hints.ai_family = AF_INET6;
+    }
+
+    int ret = getaddrinfo(sctx->domain, NULL, &hints, &ais);
+    if (ret != 0 || ais == NULL)
+    {
+        LOGE("SyncDns: resolve failed  %s", sctx->domain);
+        return 0;
+    }
+
+    // split by family, duplicates (one per socktype/protocol on some systems) are skipped
+    max = min(max, kMaxResolvedAddresses);
+    sockaddr_u   v4[kMaxResolvedAddresses];
+    sockaddr_u   v6[kMaxResolvedAddresses];
+    unsigned int v4_len = 0;
+    unsigned int v6_len = 0;
+
+    for (struct addrinfo *pai = ais; pai != NULL; pai = pai->ai_next)
+    {
+        sockaddr_u   *list = pai->ai_family == AF_INET ? v4 : v6;
+        unsigned int *len  = pai->ai_family == AF_INET ? &v4_len : &v6_len;
+
+        if ((pai->ai_family != AF_INET && pai->ai_family != AF_INET6) || *len == max)
+        {
+            continue;
+        }
+        sockaddr_u addr = {0};
+        memcpy(&addr, pai->ai_addr, min(pai->ai_addrlen, sizeof(sockaddr_u)));
+
+        bool duplicate = false;
+        for (unsigned int i = 0; i < *len; i++)
+        {
+            duplicate = duplicate || sockAddrCmpIP(&list[i], &addr);
+        }
+        if (! duplicate)
+        {
+            sockaddr_set_port(&addr, port);
+            list[(*len)++] = addr;
+        }
+    }
+    freeaddrinfo(ais);
+
+    const bool         v6_first   = strategy == kDsPreferIpV6;
+    const sockaddr_u  *first      = v6_first ? v6 : v4;
+    const sockaddr_u  *second     = v6_first ? v4 : v6;
+    const unsigned int first_len  = v6_first ? v6_len : v4_len;
+    const unsigned int second_len = v6_first ? v4_len : v6_len;
+    unsigned int       count      = 0;
+
+    for (unsigned int i = 0; count < max && (i < first_len || i < second_len); i++)
+    {
+        if (i < first_len)
+        {
+            addrs[count++] = first[i];
+        }
+        if (i < second_len && count < max)
+        {
+            addrs[count++] = second[i];
+        }
+    }
+
+    if (count == 0)
+    {
+        LOGE("SyncDns: resolve failed  %s", sctx->domain);
+        return 0;
+    }
+    if (logger_will_write_level(getDnsLogger(), (log_level_e) LOG_LEVEL_INFO))
+    {
+        char ip[64];
+        sockaddr_str(&(addrs[0]), ip, 64);
+        LOGI("SyncDns: %s resolved to %s and %u more", sctx->domain, ip, count - 1);
+    }
+
+    sctx->address         = addrs[0];
+    sctx->domain_resolved = true;
+    return count;
+}
@@ -4,3 +4,9 @@
 // TODO (internal cache , prefer v4/6)
 bool resolveContextSync(socket_context_t *s_ctx);
 
+// resolves every A/AAAA record (up to max), ordered for connection racing: families alternate, the first one is
+// picked by the strategy (ipv4 unless it prefers ipv6), only-v4/only-v6 drop the other family
+// s_ctx->address becomes the first one, returns the count (0 on failure)
+unsigned int resolveContextSyncAll(socket_context_t *s_ctx, enum domain_strategy strategy, sockaddr_u *addrs,
+                                   unsigned int max);
+
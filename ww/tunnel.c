@@ -34,8 +34,9 @@ tunnel_t *newTunnel(void)
     tunnel_t *ptr = globalMalloc(sizeof(tunnel_t));
 
     tunnel_t tunnel = (tunnel_t) {
-        .upStream   = &defaultUpStream,
-        .downStream = &defaultDownStream,
+        .upStream       = &defaultUpStream,
+        .downStream     = &defaultDownStream,
+        .upStreamVector = &defaultUpStreamVector,
     };
     memcpy(ptr, &tunnel, sizeof(tunnel_t));
 
@@ -82,6 +83,17 @@ void defaultDownStream(tunnel_t *self, context_t *c)
     }
 }
 
+void defaultUpStreamVector(tunnel_t *self, packet_vector_t *v)
+{
+    for (unsigned int i = 0; i < v->count; i++)
+    {
+        context_t *c = newContext(v->line);
+        c->payload   = v->bufs[i];
+        self->upStream(self, c);
+    }
+    v->count = 0;
+}
+
 void pipeUpStream(context_t *c)
 {
     if (! pipeSendToUpStream((pipe_line_t *) c->line->up_state, c))
@@ -114,7 +114,12 @@ typedef struct line_s
     socket_context_t src_ctx;
     socket_context_t dest_ctx;
     void            *chains_state[kMaxChainLen];
+    hash_t           auth_user; // set by the node that authenticated the line, 0 if there is no user
     uint8_t          auth_cur;
+    uint8_t          up_holds; // counted pauses of throttling nodes, see holdLineUpSide
+    uint8_t          dw_holds;
+    bool             up_paused; // paused by backpressure
+    bool             dw_paused;
 
 } line_t;
 
@@ -134,16 +139,47 @@ typedef struct context_s
     bool            fin;
 } context_t;
 
+/*
+    Packet vector carries a batch of ip packets of one line, it is used by layer3 chains instead of one context
+    per packet, so a node does one indirect call per batch and walks the packets in a tight loop
+
+    the receiver of a vector takes the buffers, the vector itself belongs to the caller and is only valid
+    during the call, a node drops a packet by releasing its buffer and leaving it out of the vector it passes on
+
+    meta is filled by Layer3Receiver, nodes that change the ip headers keep it in sync
+
+*/
+enum
+{
+    kPacketVectorCap = 32
+};
+
+typedef struct packet_meta_s
+{
+    uint16_t l4_offset; // length of the ip header
+    uint8_t  ip_version;
+    uint8_t  l4_protocol;
+} packet_meta_t;
+
+typedef struct packet_vector_s
+{
+    line_t         *line;
+    unsigned int    count;
+    shift_buffer_t *bufs[kPacketVectorCap];
+    packet_meta_t   metas[kPacketVectorCap];
+} packet_vector_t;
+
 struct tunnel_s;
 
 typedef void (*TunnelFlowRoutine)(struct tunnel_s *, struct context_s *);
+typedef void (*TunnelVectorRoutine)(struct tunnel_s *, struct packet_vector_s *);
 
 /*
     Tunnel is just a doubly linked list, it has its own state, per connection state is stored in line structure
     which later gets accessed by the chain_index which is fixed
 
 */
-typedef struct tunnel_s // 48
+typedef struct tunnel_s // 56
 {
     void            *state;
     struct tunnel_s *dw, *up;
@@ -151,6 +187,9 @@ typedef struct tunnel_s // 48
     TunnelFlowRoutine upStream;
     TunnelFlowRoutine downStream;
 
+    // nodes that do not handle packet vectors keep the default, it feeds upStream one context per packet
+    TunnelVectorRoutine upStreamVector;
+
     chain_index_t chain_index;
 } tunnel_t;
 
@@ -161,6 +200,7 @@ void      chainDown(tunnel_t *from, tunnel_t *to);
 void      chainUp(tunnel_t *from, tunnel_t *to);
 void      defaultUpStream(tunnel_t *self, context_t *c);
 void      defaultDownStream(tunnel_t *self, context_t *c);
+void      defaultUpStreamVector(tunnel_t *self, packet_vector_t *v);
 void      pipeUpStream(context_t *c);
 void      pipeDownStream(context_t *c);
 void      pipeTo(tunnel_t *self, line_t *l, tid_t tid);
@@ -231,6 +271,7 @@ static inline void doneLineDownSide(line_t *const l)
 
 static inline void pauseLineUpSide(line_t *const l)
 {
+    l->up_paused = true;
     if (l->up_state)
     {
         l->up_pause_cb(l->up_state);
@@ -239,6 +280,7 @@ static inline void pauseLineUpSide(line_t *const l)
 
 static inline void pauseLineDownSide(line_t *const l)
 {
+    l->dw_paused = true;
     if (l->dw_state)
     {
         l->dw_pause_cb(l->dw_state);
@@ -247,7 +289,8 @@ static inline void pauseLineDownSide(line_t *const l)
 
 static inline void resumeLineUpSide(line_t *const l)
 {
-    if (l->up_state)
+    l->up_paused = false;
+    if (l->up_state && l->up_holds == 0)
     {
         l->up_resume_cb(l->up_state);
     }
@@ -255,7 +298,51 @@ static inline void resumeLineUpSide(line_t *const l)
 
 static inline void resumeLineDownSide(line_t *const l)
 {
-    if (l->dw_state)
+    l->dw_paused = false;
+    if (l->dw_state && l->dw_holds == 0)
+    {
+        l->dw_resume_cb(l->dw_state);
+    }
+}
+
+/*
+    Holds are pauses that are owned and counted, they are used by nodes that throttle a line (RateLimiter)
+
+    a side stays paused while it has a hold or a backpressure pause, so releasing a hold does not resume a side
+    that backpressure has paused and a backpressure resume does not resume a side that is still held
+*/
+static inline void holdLineUpSide(line_t *const l)
+{
+    assert(l->up_holds < UINT8_MAX);
+    if (l->up_holds++ == 0 && ! l->up_paused && l->up_state)
+    {
+        l->up_pause_cb(l->up_state);
+    }
+}
+
+static inline void holdLineDownSide(line_t *const l)
+{
+    assert(l->dw_holds < UINT8_MAX);
+    if (l->dw_holds++ == 0 && ! l->dw_paused && l->dw_state)
+    {
+        l->dw_pause_cb(l->dw_state);
+    }
+}
+
+// may run the resumed side right away, which can close the line
+static inline void releaseLineUpSide(line_t *const l)
+{
+    assert(l->up_holds > 0);
+    if (--(l->up_holds) == 0 && ! l->up_paused && l->up_state)
+    {
+        l->up_resume_cb(l->up_state);
+    }
+}
+
+static inline void releaseLineDownSide(line_t *const l)
+{
+    assert(l->dw_holds > 0);
+    if (--(l->dw_holds) == 0 && ! l->dw_paused && l->dw_state)
     {
         l->dw_resume_cb(l->dw_state);
     }
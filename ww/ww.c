@@ -5,6 +5,7 @@
 #include "loggers/dns_logger.h"
 #include "loggers/network_logger.h"
 #include "managers/memory_manager.h"
+#include "memory_budget.h"
 #include "managers/node_manager.h"
 #include "managers/signal_manager.h"
 #include "managers/socket_manager.h"
@@ -173,12 +174,16 @@ void createWW(const ww_construction_data_t init_data)
         WORKERS = (worker_t *) globalMalloc(sizeof(worker_t) * (WORKERS_COUNT));
 
         initializeShortCuts();
+        // every worker pool can cache up to 2 * ram_profile buffers of each size, the slab is capped below that
+        initBufferPoolMemory(2 * WORKERS_COUNT * GSTATE.ram_profile, init_data.buffer_slab_limit);
         initializeMasterPools();
 
         for (unsigned int i = 0; i < WORKERS_COUNT; ++i)
         {
             initalizeWorker(getWorker(i), i);
         }
+
+        initMemoryBudget(init_data.memory_soft_limit, init_data.memory_hard_limit);
     }
 
     // [Section] setup SignalManager
@@ -81,6 +81,9 @@ typedef struct
 {
     unsigned int               workers_count;
     enum ram_profiles          ram_profile;
+    size_t                     memory_soft_limit; // bytes, 0 disables
+    size_t                     memory_hard_limit; // bytes, 0 disables
+    size_t                     buffer_slab_limit; // bytes, 0 disables
     logger_construction_data_t core_logger_data;
     logger_construction_data_t network_logger_data;
     logger_construction_data_t dns_logger_data;